@@ -1,26 +1,14 @@
 #!/bin/bash
 
+# Converts a music library for the card with the host transcoder, see
+# firmware/host/transcode.cpp. Files of all subdirectories are converted in
+# parallel to .LTS streams, a rerun only converts new or changed files.
+# FLAC needs the `flac` command, MP3 / Ogg / AAC need `ffmpeg`.
+
 INPUT_DIR="./in" # change this to your source directory
 OUTPUT_DIR="./out"  # change this to output directory
 
-mkdir -p "$OUTPUT_DIR"
-
-for file in "$INPUT_DIR"/*.flac; do
-    [ -e "$file" ] || continue  # skip if no FLAC files exist
-    filename=$(basename -- "$file")
-    output_file="$OUTPUT_DIR/${filename%.flac}.sbc"
-    
-    echo "Converting: $file -> $output_file"
-    ffmpeg -n -i "$file" -ac 2 -c:a sbc -b:a 328k "$output_file"
-done
-
-for file in "$INPUT_DIR"/*.mp3; do
-    [ -e "$file" ] || continue  # skip if no MP3 files exist
-    filename=$(basename -- "$file")
-    output_file="$OUTPUT_DIR/${filename%.mp3}.sbc"
-    
-    echo "Converting: $file -> $output_file"
-    ffmpeg -n -i "$file" -ac 2 -c:a sbc -b:a 328k "$output_file"
-done
+HOST_DIR="$(dirname -- "$0")/../firmware/host"
 
-echo "All files converted!"
+make -C "$HOST_DIR" -s bin/transcode || exit 1
+"$HOST_DIR/bin/transcode" "$INPUT_DIR" "$OUTPUT_DIR" "$@"
@@ -7,12 +7,26 @@
 
 #include "audio_player.h"
 #include "libsbc/include/sbc.h"
+#include "libsbc/include/lts.h"
 #include "utility.h"
+#include "boot.h"
 #include "file_navigator.h"
+#include "config.h"
+#include "irq_priority.h"
+#include "scheduler.h"
+#include "gpio.h"
+#include "button.h"
+#include "light_sensor.h"
+#include "power.h"
+#include "trace.h"
+
+#include <cstring>
+#include <iterator>
 
 extern "C" {
     #include "py32f0xx.h"
     #include "py32f0xx_hal.h"
+    #include "petitfat/source/diskio.h"
 }
 
 namespace AudioPlayer {
@@ -26,6 +40,33 @@ constexpr uint32_t TIM_PERIOD_48KHZ = (250 - 1)*4;   // 192 kHz PWM frequency
 constexpr uint32_t TIM_PERIOD_441KHZ = (272 - 1)*4;  // 176.4 kHz PWM frequency
 constexpr uint32_t REPEAT_COUNT = 0;              // Update every 4 PWM cycles (RCR + 1 = 4)
 
+// Frames decoded (and discarded) before resume point to fill synthesis filter history (10 blocks)
+constexpr uint32_t WARMUP_FRAMES = 3;
+
+// Optional tasks get no time limit while output is muted
+constexpr Scheduler::Time NO_DEADLINE = 0x40000000;
+
+// Assumed state save time (10 ms at 48 kHz): file open reads directory and FAT sectors,
+// then the block is sent. Playback slack is under a buffer half, so saves wait until output is muted
+constexpr Scheduler::Time STATE_SAVE_ESTIMATE = 480;
+
+// Q15 unity of master and track gain
+constexpr uint32_t GAIN_UNITY = 0x8000;
+
+// Equaliser band gains from -12 to +12 dB in 1 dB steps, Q13 (8192 is 0 dB)
+constexpr int EQ_MIN_DB = -12;
+constexpr int EQ_MAX_DB = 12;
+constexpr uint16_t EQ_DB_GAIN[] = {
+     2058,  2309,  2591,  2907,  3261,  3659,  4106,  4607,  5169,  5799,  6507,  7301,
+     8192,
+     9192, 10313, 11572, 12983, 14568, 16345, 18340, 20577, 23088, 25905, 29066, 32613
+};
+
+// Scanning: first jumps are 2 s, doubled every 4 steps up to 16 s
+constexpr uint32_t SCAN_JUMP_SECONDS = 2;
+constexpr uint32_t SCAN_ACCEL_STEPS = 4;
+constexpr uint32_t SCAN_MAX_DOUBLINGS = 3;
+
 namespace {
     // Audio buffers
     int16_t pcml[CHANNEL_FULL_BUFFER] = {0};
@@ -33,19 +74,95 @@ namespace {
     uint8_t data[SBC_MAX_SAMPLES*sizeof(int16_t)] = {0};
     constexpr auto silence = make_filled_array<int16_t, CHANNEL_FULL_BUFFER, (136*4)>();
 
-    // Synchronization flags
-    volatile bool half_transfer = false;
-    volatile bool transfer_complete = false;
+    // Output clock, buffer halves played (DMA interrupt keeps running while muted, not in Stop mode)
+    volatile uint32_t dma_halves = 0;
+
     volatile PlaybackCommand playback_command = PlaybackCommand::KeepPlaying;
     volatile uint32_t mute_ref = 0;
+
+    // Byte offset of the next frame to decode in current file
+    uint32_t position = 0;
+    volatile bool file_playing = false; // position refers to current track
+
+    // Scan request: 1 forward, -1 backward
+    volatile int8_t scan_direction = 0;
+    volatile uint32_t scan_steps = 0;
+
+    // State of the track being played, lives on play_file stack
+    struct Track {
+        FILINFO* file;
+        sbc_frame frame;
+        sbc_t sbc;
+        lts_header lts;             // .LTS stream layout, frames_per_sector 0 for raw SBC
+        int srate_hz;
+        int pos;                    // write position in output buffers
+        bool filling;               // buffer half started, not complete yet
+        bool restart;               // half started after a gap (track start, unmute), no deadline
+        bool finished;
+        Scheduler::Time deadline;   // DMA enters half being filled
+    };
+
+    Track* track = nullptr;
+
+    // read and advanced by decoder of the track, silent until first fade in
+    sbc_gain output_gain = { 0, 0, SBC_GAIN_RATE_MAX };
+
+    // sub-band gains from config, off until set_equalizer()
+    sbc_eq output_eq = {};
+
+    // Output level is master gain times track gain when faded in
+    uint16_t master_gain = GAIN_UNITY;
+    uint16_t track_gain = GAIN_UNITY;
+    bool faded_in = false;
+    uint32_t output_hz = 44100;     // sample rate fade times are converted with
+
+    // right channel decode buffer, none when both outputs play the left one:
+    // mono downmix or a mono stream
+    int16_t* right_output() {
+        return CFG.mono_output || (track && track->frame.mode == SBC_MODE_MONO) ? nullptr : pcmr;
+    }
+
+    void update_gain_target() {
+        output_gain.target = faded_in ? (master_gain * track_gain >> 15) << 16 : 0;
+    }
+
+    // Raw SBC streams are frames of the first frame's size back to back
+    uint32_t frame_offset(const Track& t, uint32_t index) {
+        return t.lts.frames_per_sector ? lts_frame_offset(&t.lts, index) : index * sbc_get_frame_size(&t.frame);
+    }
+
+    uint32_t frame_index(const Track& t, uint32_t offset) {
+        return t.lts.frames_per_sector ? lts_frame_index(&t.lts, offset) : offset / sbc_get_frame_size(&t.frame);
+    }
+
+    uint32_t frame_count(const Track& t) {
+        const uint32_t frame_size = sbc_get_frame_size(&t.frame);
+        return t.lts.frames_per_sector ? t.lts.frame_count : (t.file->fsize + frame_size - 1) / frame_size;
+    }
 }
 
-void __attribute__ ((noinline)) handle_state_save_during_playback() {
-    // Save PetitFat state to avoid losing track of currently played file
-    FATFS petit_state;
-    pf_save_state(&petit_state);
-    FileNavigator::handle_state_save();
-    pf_restore_state(&petit_state);
+// State save or trace save, both open their own file
+void __attribute__ ((noinline)) write_during_playback(void (*write)()) {
+    // Keep currently played file, write opens another one
+    FSTATE played;
+    if (pf_save_file(&played) != FR_OK) {
+        track->finished = true; // no file to come back to, saved before next track
+        return;
+    }
+    write();
+
+    // restore reads the cluster cache of a long file again, on error the track
+    // is opened again at the same place; a read error failing that too ends it
+    // and the play loop remounts (disk_recovery.failed)
+    if (pf_restore_file(&played) != FR_OK
+            && (pf_open_fileinfo(track->file) != FR_OK || pf_lseek_cached(played.fptr) != FR_OK)) {
+        track->finished = true;
+        return;
+    }
+
+    // card is still programming the block, read stream of played file is
+    // restarted by storage task (disk_poll) once it's done
+    disk_prefetch(played.fptr % 512 ? played.dsect : played.next_sect);
 }
 
 
@@ -81,7 +198,7 @@ void init_dma() {
     // Configure DMA Channel 1 (Left channel)
     DMA1_Channel1->CCR = 0;
     DMA1_Channel1->CNDTR = CHANNEL_FULL_BUFFER;
-    DMA1_Channel1->CPAR = (uint32_t)&TIM1->CCR2;
+    DMA1_Channel1->CPAR = (uint32_t)(uintptr_t)&TIM1->CCR2;
 
     const uint32_t ccr1 = DMA_CCR_MINC |      // Memory increment mode
                             DMA_CCR_DIR |     // Memory-to-peripheral direction
@@ -95,7 +212,7 @@ void init_dma() {
     // Configure DMA Channel 2 (Right channel)
     DMA1_Channel2->CCR &= ~DMA_CCR_EN;
     DMA1_Channel2->CNDTR = CHANNEL_FULL_BUFFER;
-    DMA1_Channel2->CPAR = (uint32_t)&TIM1->CCR3;
+    DMA1_Channel2->CPAR = (uint32_t)(uintptr_t)&TIM1->CCR3;
 
     const uint32_t ccr2 = DMA_CCR_MINC |      // Memory increment mode
                             DMA_CCR_DIR |     // Memory-to-peripheral direction
@@ -105,11 +222,15 @@ void init_dma() {
                             DMA_CCR_EN;       // Enable channel
 
     // Enable DMA channels but not interrupt
-    DMA1_Channel1->CMAR = (uint32_t)silence.data();
-    DMA1_Channel2->CMAR = (uint32_t)silence.data();
+    DMA1_Channel1->CMAR = (uint32_t)(uintptr_t)silence.data();
+    DMA1_Channel2->CMAR = (uint32_t)(uintptr_t)silence.data();
 
     DMA1_Channel1->CCR = ccr1;
     DMA1_Channel2->CCR = ccr2;
+
+    // output clock must not wait for button / light sensor handlers
+    NVIC_SetPriority(DMA1_Channel1_IRQn, IrqPriority::AUDIO);
+    NVIC_EnableIRQ(DMA1_Channel1_IRQn);
 }
 
 void init() {
@@ -122,9 +243,8 @@ void mute() {
     if (mute_ref++ > 0) {
         return; // already muted
     }
-    NVIC_DisableIRQ(DMA1_Channel1_IRQn);
-    DMA1_Channel1->CMAR = (uint32_t)silence.data();
-    DMA1_Channel2->CMAR = (uint32_t)silence.data();
+    DMA1_Channel1->CMAR = (uint32_t)(uintptr_t)silence.data();
+    DMA1_Channel2->CMAR = (uint32_t)(uintptr_t)silence.data();
 }
 
 void reset_mute() {
@@ -137,16 +257,421 @@ void unmute() {
     if (mute_ref == 0 || --mute_ref > 0) {
         return; // still muted
     }
-    NVIC_EnableIRQ(DMA1_Channel1_IRQn);
-    DMA1_Channel1->CMAR = (uint32_t)pcml;
-    DMA1_Channel2->CMAR = (uint32_t)pcmr;
+    DMA1_Channel1->CMAR = (uint32_t)(uintptr_t)pcml;
+    DMA1_Channel2->CMAR = (uint32_t)(uintptr_t)(right_output() ? pcmr : pcml);
+    Boot::mark(Boot::Phase::Sound);
+}
+
+void halt() {
+    NVIC_DisableIRQ(DMA1_Channel1_IRQn);
+    DMA1_Channel1->CCR &= ~DMA_CCR_EN;
+    DMA1_Channel2->CCR &= ~DMA_CCR_EN;
+    TIM1->BDTR &= ~TIM_BDTR_MOE; // outputs off
+    TIM1->CR1 &= ~TIM_CR1_CEN;
+
+    if (file_playing) {
+        FileNavigator::get_state().track_offset = position;
+    }
 }
 
 bool muted() {
     return mute_ref > 0;
 }
 
-bool play_file(FILINFO *file, PlaybackCommand &command) {
+void fade(bool on, uint32_t duration_ms) {
+    faded_in = on;
+    update_gain_target();
+
+    if (duration_ms == 0) {
+        output_gain.level = output_gain.target;
+        return;
+    }
+
+    // rate covers the whole range in given time, so reversed fade takes as long as it ran
+    const uint32_t samples = duration_ms * output_hz / 1000;
+    const uint32_t rate = SBC_GAIN_UNITY / samples;
+    output_gain.rate = rate == 0 ? 1 : rate > SBC_GAIN_RATE_MAX ? SBC_GAIN_RATE_MAX : rate;
+}
+
+bool fade_done() {
+    return output_gain.level == output_gain.target;
+}
+
+void set_master_gain(uint16_t gain) {
+    master_gain = gain > GAIN_UNITY ? GAIN_UNITY : gain;
+    update_gain_target();
+}
+
+void set_track_gain(uint16_t gain) {
+    track_gain = gain > GAIN_UNITY ? GAIN_UNITY : gain;
+    update_gain_target();
+}
+
+void set_equalizer(const int8_t (&db)[Config::EQ_BANDS]) {
+    uint16_t gain8[Config::EQ_BANDS];
+    bool flat = true;
+    uint32_t peak = 0;
+
+    for (int i = 0; i < Config::EQ_BANDS; i++) {
+        const int d = db[i] < EQ_MIN_DB ? EQ_MIN_DB : db[i] > EQ_MAX_DB ? EQ_MAX_DB : db[i];
+        gain8[i] = EQ_DB_GAIN[d - EQ_MIN_DB];
+        flat = flat && d == 0;
+        peak = gain8[i] > peak ? gain8[i] : peak;
+    }
+
+    output_eq.enabled = 0;
+    if (flat) {
+        return;
+    }
+
+    // boosts take 1 bit of sample range per 6 dB, Q13 gains scale to Q15 of 2^headroom
+    const int headroom = peak > 2 * 8192 ? 2 : peak > 8192 ? 1 : 0;
+    output_eq.headroom = headroom;
+    for (int i = 0; i < Config::EQ_BANDS; i++) {
+        output_eq.gain8[i] = gain8[i] << (2 - headroom);
+    }
+    // 4 sub-bands streams: each band spans two of the 8
+    for (int i = 0; i < Config::EQ_BANDS / 2; i++) {
+        output_eq.gain4[i] = ((gain8[2 * i] + gain8[2 * i + 1]) / 2) << (2 - headroom);
+    }
+    output_eq.enabled = 1;
+}
+
+Scheduler::Time now() {
+    uint32_t halves;
+    uint32_t remaining;
+    do {
+        halves = dma_halves;
+        remaining = DMA1_Channel1->CNDTR;
+    } while (halves != dma_halves);
+
+    const uint32_t played = CHANNEL_FULL_BUFFER - remaining;
+    // interrupt of the half DMA is in may still be pending (masked during decode)
+    if ((played >= CHANNEL_HALF_BUFFER) != ((halves & 1) != 0)) {
+        halves++;
+    }
+
+    return halves * CHANNEL_HALF_BUFFER + played % CHANNEL_HALF_BUFFER;
+}
+
+/**
+ * Read next frame of an .LTS stream in place, the pointer into the sector
+ * cache of disk layer is valid until next card access. Frames don't cross
+ * sectors, padding at the end of a sector is skipped.
+ * @return nullptr at the end of the file
+ */
+const uint8_t* read_lts_frame(const lts_header& lts) {
+    const uint32_t left = LTS_SECTOR_SIZE - position % LTS_SECTOR_SIZE;
+    if (left < lts.frame_size) {
+        position += freadwrap(nullptr, left);
+    }
+
+    const void* frame;
+    if (freaddirect(&frame, lts.frame_size) < lts.frame_size) {
+        return nullptr;
+    }
+
+    position += lts.frame_size;
+    return static_cast<const uint8_t*>(frame);
+}
+
+/**
+ * Read header of an .LTS stream, its magic is in data already. Leaves file
+ * pointer at the first frame.
+ */
+bool open_lts(Track &t) {
+    constexpr UINT rest = sizeof(lts_header) - SBC_PROBE_SIZE;
+    if (freadwrap(data + SBC_PROBE_SIZE, rest) < rest) {
+        return false;
+    }
+    std::memcpy(&t.lts, data, sizeof(lts_header));
+
+    if (t.lts.version != LTS_VERSION || t.lts.frames_per_sector == 0
+            || t.lts.frames_per_sector * t.lts.frame_size > LTS_SECTOR_SIZE
+            || sbc_probe(t.lts.sbc_header, &t.frame) < 0
+            || sbc_get_frame_size(&t.frame) != t.lts.frame_size) {
+        return false;
+    }
+
+    position = LTS_HEADER_SIZE;
+    return pf_lseek_cached(position) == FR_OK;
+}
+
+/**
+ * Move read pointer to the frame containing offset. Cluster is located using
+ * cached cluster ranges, then few preceding frames are decoded to silence
+ * to warm up synthesis filter, so resumed playback doesn't click.
+ * On success position holds offset of the frame playback continues from.
+ */
+bool seek_frame(Track &t, uint32_t offset) {
+    const uint32_t frame_size = sbc_get_frame_size(&t.frame);
+    uint32_t index = frame_index(t, offset);
+
+    if (index >= frame_count(t)) {
+        index = 0; // stale offset, start from the beginning
+    }
+
+    uint32_t warmup = index < WARMUP_FRAMES ? index : WARMUP_FRAMES;
+
+    position = frame_offset(t, index - warmup);
+    if (pf_lseek_cached(position) != FR_OK) {
+        return false;
+    }
+
+    while (warmup--) {
+        const uint8_t* frame = data;
+        if (t.lts.frames_per_sector) {
+            frame = read_lts_frame(t.lts);
+            if (!frame) {
+                break;
+            }
+        }
+        else if (freadwrap(data, frame_size) < frame_size) {
+            break;
+        }
+
+        // output is discarded to where the next frame is decoded, samples queued
+        // for DMA before a remount stay; playback mute lock is still held here
+        __disable_irq();
+        int16_t* right = right_output();
+        sbc_decode(&t.sbc, frame, frame_size, &t.frame, &pcml[t.pos], right ? &right[t.pos] : nullptr);
+        __enable_irq();
+    }
+
+    // .LTS position stays where reading stopped, padding before the frame is skipped on read
+    if (!t.lts.frames_per_sector) {
+        position = index * frame_size;
+    }
+    return true;
+}
+
+/**
+ * Jump by scan step. Frames are constant size, so jump target is computed
+ * from the frame duration and the file pointer is moved through cached
+ * cluster ranges, without reading FAT.
+ */
+bool handle_scan(const Track &t) {
+    const bool forward = scan_direction > 0;
+    scan_direction = 0;
+
+    const uint32_t steps = scan_steps++;
+    const uint32_t doublings = steps / SCAN_ACCEL_STEPS < SCAN_MAX_DOUBLINGS
+        ? steps / SCAN_ACCEL_STEPS : SCAN_MAX_DOUBLINGS;
+    const uint32_t frames = (SCAN_JUMP_SECONDS << doublings) * t.srate_hz
+        / (t.frame.nblocks * t.frame.nsubbands);
+    const uint32_t index = frame_index(t, position);
+
+    uint32_t target;
+    if (forward) {
+        // jumping past the end finishes the track
+        target = index + frames < frame_count(t) ? frame_offset(t, index + frames) : t.file->fsize;
+    }
+    else {
+        target = frame_offset(t, index > frames ? index - frames : 0);
+    }
+
+    if (pf_lseek_cached(target) != FR_OK) {
+        return false;
+    }
+
+    position = target;
+    return true;
+}
+
+/**
+ * Disk layer gave up on a read (sector requested again, bus resynced, card
+ * initialized again). Volume is mounted again and the track reopened at the
+ * frame that failed, decoder state and output buffers stay. Mute lock must be
+ * held, like for seek_frame.
+ */
+bool remount(Track &t) {
+    disk_recovery.remounts++;
+
+    if (!FileNavigator::remount() || pf_open_fileinfo(t.file) != FR_OK
+            || !seek_frame(t, position)) {
+        return false;
+    }
+
+    // raw stream: header of the failed frame is read again
+    return t.lts.frames_per_sector
+        || (freadwrap(data, SBC_PROBE_SIZE) >= 1 && sbc_probe(data, &t.frame) == 0);
+}
+
+/* --- Playback tasks --- */
+
+bool half_free() {
+    const bool dma_in_second = DMA1_Channel1->CNDTR <= CHANNEL_HALF_BUFFER;
+    const bool fill_second = track->pos >= CHANNEL_HALF_BUFFER;
+    return dma_in_second != fill_second;
+}
+
+bool decode_pending() {
+    return !track->finished && !muted() && (track->filling || half_free());
+}
+
+/**
+ * Decode one frame, header of it is already in data. Deadline of a buffer
+ * half is the moment DMA enters it.
+ */
+void decode_frame() {
+    Track& t = *track;
+
+    if (!t.filling) {
+        // DMA plays the other half, it gets to this one at next boundary
+        const Scheduler::Time time = now();
+        const Scheduler::Time deadline = time - time % CHANNEL_HALF_BUFFER + CHANNEL_HALF_BUFFER;
+        // previous half was due one half earlier unless output stream was interrupted
+        t.restart = deadline != t.deadline;
+        t.deadline = deadline;
+        t.filling = true;
+    }
+
+    // .LTS frames are decoded from the sector cache, raw ones are copied after their header
+    const uint8_t* frame = data;
+    if (t.lts.frames_per_sector) {
+        frame = read_lts_frame(t.lts);
+    }
+    else if (freadwrap(data + SBC_PROBE_SIZE, sbc_get_frame_size(&t.frame) - SBC_PROBE_SIZE) < 1) {
+        frame = nullptr;
+    }
+    else {
+        position += sbc_get_frame_size(&t.frame);
+    }
+
+    if (!frame) {
+        t.finished = true;
+        return;
+    }
+
+    const int npcm = t.frame.nblocks * t.frame.nsubbands;
+
+    // disable interrupts during decode, too stack intensive
+    __disable_irq();
+
+    int16_t* right = right_output();
+    sbc_decode(&t.sbc, frame, sbc_get_frame_size(&t.frame), &t.frame, &pcml[t.pos], right ? &right[t.pos] : nullptr);
+
+    __enable_irq();
+
+    const bool left_part = t.pos < CHANNEL_HALF_BUFFER;
+
+    t.pos += npcm;
+
+    if ((left_part && t.pos >= CHANNEL_HALF_BUFFER) || t.pos >= CHANNEL_FULL_BUFFER) {
+        if (!t.restart) { // DMA was playing stale samples already
+            const int32_t lateness = static_cast<int32_t>(now() - t.deadline);
+            Scheduler::deadline_done(lateness);
+            if (lateness > 0) {
+                Trace::underrun(lateness);
+            }
+        }
+        t.filling = false;
+        // DMA leaves the next half as it enters this one, next half is due one half later
+        t.deadline += CHANNEL_HALF_BUFFER;
+
+        if (t.pos >= CHANNEL_FULL_BUFFER) {
+            t.pos = 0;
+        }
+    }
+
+    if (scan_direction != 0 && !handle_scan(t)) {
+        t.finished = true;
+        return;
+    }
+
+    // raw stream: next header is read here, end of file or a bad frame ends the track
+    t.finished = playback_command != PlaybackCommand::KeepPlaying
+        || (t.lts.frames_per_sector ? frame_index(t, position) >= t.lts.frame_count
+            : freadwrap(data, SBC_PROBE_SIZE) < 1 || sbc_probe(data, &t.frame) != 0);
+}
+
+void decode_run() {
+    Trace::record(Trace::Event::DecodeStart, static_cast<uint8_t>(track->pos));
+    decode_frame();
+    Trace::record(Trace::Event::DecodeEnd);
+}
+
+bool storage_pending() {
+    return disk_busy();
+}
+
+void storage_run() {
+    disk_poll(); // finish pending write, restart read-ahead
+}
+
+bool state_save_pending() {
+    return FileNavigator::is_state_save_requested() || Trace::save_requested();
+}
+
+void state_save_run() {
+    if (FileNavigator::is_state_save_requested()) {
+        FileNavigator::get_state().track_offset = position;
+        write_during_playback(FileNavigator::handle_state_save);
+    }
+    else {
+        write_during_playback(FileNavigator::handle_trace_save);
+    }
+    // card programming is left to storage task, polled between decodes
+}
+
+// Table order is priority, see PlaybackTask
+const Scheduler::Task tasks[] = {
+    {decode_pending, decode_run, 0, false},
+    {PlaybackEventsPending, PlaybackPollCallback, 0, false},
+    {storage_pending, storage_run, 0, true},
+    {state_save_pending, state_save_run, STATE_SAVE_ESTIMATE, true},
+};
+
+static_assert(std::size(tasks) == static_cast<size_t>(PlaybackTask::Count)
+    && std::size(tasks) <= Scheduler::MAX_TASKS);
+
+/**
+ * Optional tasks must leave time for decoding the next buffer half before
+ * its deadline. Nothing is played while muted, so there is no limit.
+ */
+Scheduler::Time latest_start() {
+    if (muted()) {
+        return now() + NO_DEADLINE;
+    }
+
+    const Track& t = *track;
+    const int npcm = t.frame.nblocks * t.frame.nsubbands;
+    const uint32_t frames = (CHANNEL_HALF_BUFFER + npcm - 1) / npcm;
+    const Scheduler::Time decode = frames
+        * Scheduler::budget(tasks, static_cast<uint32_t>(PlaybackTask::Decode));
+
+    // half being filled is due at deadline, once it's complete deadline is the next half's
+    return t.deadline - decode;
+}
+
+/**
+ * Nothing is decoded while muted, so with the speakers' USB supply off (no
+ * click to hear when output stops) and no press or light reading in progress
+ * the device waits in Stop mode. Track, decoder and file system state stay in
+ * SRAM, playback continues from the next frame once output is unmuted; the
+ * card is checked on its next access.
+ */
+void idle() {
+    // interrupts are masked between the checks and sleep, so no event is left
+    // waiting for the next wake up, pending one still ends the sleep
+    __disable_irq();
+    if (muted() && !GPIO::usb_powered() && !PlaybackEventsPending() && !disk_busy()
+            && !BTN::busy() && !LIGHT::busy()) {
+        TIM1->CR1 &= ~TIM_CR1_CEN; // stops at Stop mode entry anyway, DMA resumes in place
+        disk_suspend();
+        Trace::record(Trace::Event::StopEnter);
+        STOP::enter();
+        Trace::record(Trace::Event::StopExit);
+        TIM1->CR1 |= TIM_CR1_CEN;
+    }
+    else {
+        // DMA interrupt comes every buffer half, card programming end (no interrupt) waits at most that long
+        __WFI();
+    }
+    __enable_irq();
+}
+
+bool play_file(FILINFO *file, uint32_t offset, PlaybackCommand &command) {
     // Open file
     FRESULT res;
     res = pf_open_fileinfo(file);
@@ -155,68 +680,85 @@ bool play_file(FILINFO *file, PlaybackCommand &command) {
     }
 
     /* --- Setup decoding --- */
-    struct sbc_frame frame = {0};
-    sbc_t sbc = {0};
+    Track t = {};
+    t.file = file;
 
-    // reading frame at the beginning to setup frequency
-    if (freadwrap(data, SBC_PROBE_SIZE) < 1
-            || sbc_probe(data, &frame) < 0) {
+    // reading frame at the beginning (or .LTS header) to setup frequency
+    position = 0;
+
+    if (freadwrap(data, SBC_PROBE_SIZE) < 1) {
+        return false;
+    }
+    if (std::memcmp(data, LTS_MAGIC, SBC_PROBE_SIZE) == 0) {
+        if (!open_lts(t)) {
+            return false;
+        }
+    }
+    else if (sbc_probe(data, &t.frame) < 0) {
         return false;
     }
 
-    int srate_hz = sbc_get_freq_hz(frame.freq);
+    t.srate_hz = sbc_get_freq_hz(t.frame.freq);
+    output_hz = t.srate_hz;
 
-    sbc_reset(&sbc);
+    sbc_reset(&t.sbc);
+    sbc_set_gain(&t.sbc, &output_gain);
+    sbc_set_eq(&t.sbc, &output_eq);
+    set_track_gain(t.lts.gain ? t.lts.gain : GAIN_UNITY);
 
-    int pos = 0;
+    if (offset > 0 && t.lts.rewind_s) {
+        const uint32_t rewind = t.lts.rewind_s * t.srate_hz / (t.frame.nblocks * t.frame.nsubbands);
+        const uint32_t index = frame_index(t, offset);
+        offset = frame_offset(t, index > rewind ? index - rewind : 0);
+    }
+
+    if (offset > 0) {
+        if (!seek_frame(t, offset)) {
+            return false;
+        }
+        // raw stream: read header again, at the frame playback continues from
+        if (!t.lts.frames_per_sector
+                && (freadwrap(data, SBC_PROBE_SIZE) < 1 || sbc_probe(data, &t.frame) < 0)) {
+            return false;
+        }
+    }
 
     playback_command = PlaybackCommand::KeepPlaying; // Reset command
+    file_playing = true;
+    track = &t;
 
     unmute();
 
-    do {
-        if (freadwrap(data + SBC_PROBE_SIZE,
-                sbc_get_frame_size(&frame) - SBC_PROBE_SIZE) < 1) {
-            break;
-        }
-
-        int npcm = frame.nblocks * frame.nsubbands;
-
-        // disable interrupts during decode, too stack intensive
-        __disable_irq();
+    disk_recovery.failed = 0;
+    uint32_t failed_frame = UINT32_MAX;
 
-        sbc_decode(&sbc, data, sizeof(data),
-            &frame, &pcml[pos], &pcmr[pos]);
+    for (;;) {
+        while (!t.finished) {
+            if (!Scheduler::run(tasks, std::size(tasks), now, latest_start)) {
+                idle();
+            }
+        }
 
-        __enable_irq();
-        
-        const bool left_part = pos < CHANNEL_HALF_BUFFER;
-
-        pos += npcm;
-
-        if (left_part && pos >= CHANNEL_HALF_BUFFER) {
-            // wait for transfer complete
-            while (!transfer_complete) {
-                if (muted() && FileNavigator::is_state_save_requested()) {
-                    handle_state_save_during_playback();
-                }
-            };
-            transfer_complete = false;
+        // read error ends the track like end of file, unless remount gets past it;
+        // failing again at the same frame skips the track
+        if (!disk_recovery.failed || frame_index(t, position) == failed_frame) {
+            break;
         }
+        failed_frame = frame_index(t, position);
+        disk_recovery.failed = 0;
 
-        if (pos >= CHANNEL_FULL_BUFFER) {
-            // wait for half transfer
-            while (!half_transfer) {
-                if (muted() && FileNavigator::is_state_save_requested()) {
-                    handle_state_save_during_playback();
-                }
-            };
-            half_transfer = false;
-            pos = 0;
+        mute();
+        const bool resumed = remount(t);
+        unmute();
+
+        if (!resumed) {
+            break;
         }
+        t.finished = false;
     }
-    while(playback_command == PlaybackCommand::KeepPlaying && freadwrap(data, SBC_PROBE_SIZE) >= 1 && sbc_probe(data, &frame) == 0);
-    
+
+    track = nullptr;
+    file_playing = false;
     mute();
 
     command = playback_command;
@@ -227,18 +769,28 @@ void set_playback_command(PlaybackCommand command) {
     playback_command = command;
 }
 
+void scan(bool forward) {
+    scan_direction = forward ? 1 : -1;
+}
+
+void end_scan() {
+    scan_steps = 0;
+}
+
 } // namespace AudioPlayer
 
 void DMA1_Channel1_IRQHandler() {
     // Check for DMA1 Channel 1 Transfer Complete Interrupt
     if (DMA1->ISR & DMA_ISR_TCIF1) {
-        AudioPlayer::transfer_complete = true;
-        DMA1->IFCR |= DMA_IFCR_CTCIF1;  // Clear interrupt flag
+        Trace::record(Trace::Event::DmaComplete);
+        AudioPlayer::dma_halves = AudioPlayer::dma_halves + 1;
+        DMA1->IFCR = DMA_IFCR_CTCIF1;  // Clear interrupt flag
     }
     
     // Check for DMA1 Channel 1 Half Transfer Interrupt
     if (DMA1->ISR & DMA_ISR_HTIF1) {
-        AudioPlayer::half_transfer = true;
-        DMA1->IFCR |= DMA_IFCR_CHTIF1;  // Clear interrupt flag
+        Trace::record(Trace::Event::DmaHalf);
+        AudioPlayer::dma_halves = AudioPlayer::dma_halves + 1;
+        DMA1->IFCR = DMA_IFCR_CHTIF1;  // Clear interrupt flag
     }
 }
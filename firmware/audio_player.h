@@ -9,6 +9,7 @@
 
 #include <cstdint>
 #include "petitfat/source/pff.h"
+#include "config.h"
 
 namespace AudioPlayer {
 
@@ -19,6 +20,17 @@ enum class PlaybackCommand : uint8_t {
     NextDirectory = 3,
 };
 
+/**
+ * @brief Tasks of the playback loop in priority order, index into Scheduler::stats
+ */
+enum class PlaybackTask : uint8_t {
+    Decode,     // fills output buffer half before DMA gets to it (deadline task)
+    Events,     // PlaybackPollCallback
+    Storage,    // card write completion, read-ahead restart
+    StateSave,  // requested state save or trace save, runs when it fits before next decode
+    Count
+};
+
 /**
  * @brief Initialize audio hardware (timers and DMA)
  */
@@ -44,18 +56,51 @@ void mute();
  */
 void unmute();
 
+/**
+ * @brief Stop audio output for good (power failure), remember current position in state
+ */
+void halt();
+
 /**
  * @brief Reset mute reference counter (for use after SD card re-initialization)
  */
 void reset_mute();
 
+/**
+ * @brief Ramp output to full level (on) or silence, linearly in decoded samples
+ * @param duration_ms Time of a ramp over the whole range, 0 sets level at once
+ */
+void fade(bool on, uint32_t duration_ms);
+
+/**
+ * @brief Output level got where last fade() sent it
+ */
+bool fade_done();
+
+/**
+ * @brief Set master volume, Q15 (0x8000 is unity and maximum)
+ */
+void set_master_gain(uint16_t gain);
+
+/**
+ * @brief Set gain of current track, Q15 (0x8000 is unity and maximum), reset when track starts
+ */
+void set_track_gain(uint16_t gain);
+
+/**
+ * @brief Set sub-band equaliser, gain in dB (-12 to 12) per band of 8 sub-bands from lowest
+ *        frequency, all 0 disables it. 4 sub-band streams get gain averages of band pairs
+ */
+void set_equalizer(const int8_t (&db)[Config::EQ_BANDS]);
+
 /**
  * @brief Play a single audio file
  * @param file Pointer to FILINFO structure of file to play
+ * @param offset Byte offset to resume playback from (rounded down to frame boundary)
  * @param[out] command Playback command requested during playback
  * @return true if file played successfully, false on error
  */
-bool play_file(FILINFO *file, PlaybackCommand &command);
+bool play_file(FILINFO *file, uint32_t offset, PlaybackCommand &command);
 
 /**
  * @brief Set playback command to interrupt current playback
@@ -63,4 +108,19 @@ bool play_file(FILINFO *file, PlaybackCommand &command);
  */
 void set_playback_command(PlaybackCommand command);
 
+/**
+ * @brief Jump within current track, jumps get longer while scanning continues
+ * @param forward Direction of the jump
+ */
+void scan(bool forward);
+
+/**
+ * @brief Finish scanning, next scan starts with the shortest jump
+ */
+void end_scan();
+
 } // namespace AudioPlayer
+
+// called by playback loop between decodes, handles deferred interrupt work
+bool PlaybackEventsPending();
+void PlaybackPollCallback();
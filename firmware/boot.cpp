@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "boot.h"
+
+extern "C" {
+#include "py32f0xx.h"
+#include "py32f0xx_hal.h"
+}
+
+namespace Boot {
+
+constexpr uint32_t RETAINED_MAGIC = 0x544f4f42; // "BOOT"
+
+// not cleared by startup code, see .noinit in the linker script
+__attribute__((section(".noinit"))) Retained retained;
+
+namespace {
+    bool counting = false;
+
+    void clear(Profile& profile) {
+        for (uint16_t& ticks : profile.ticks) {
+            ticks = NOT_REACHED;
+        }
+    }
+
+    void finish() {
+        counting = false;
+        TIM16->CR1 = 0;
+        __HAL_RCC_TIM16_CLK_DISABLE();
+    }
+}
+
+void start() {
+    if (retained.magic == RETAINED_MAGIC) {
+        retained.boots++;
+        retained.previous = retained.current;
+    }
+    else {
+        // power on, RAM content is random
+        retained.magic = RETAINED_MAGIC;
+        retained.boots = 0;
+        clear(retained.previous);
+    }
+    clear(retained.current);
+
+    __HAL_RCC_TIM16_CLK_ENABLE();
+    TIM16->CR1 = 0;
+    TIM16->PSC = INPUT_FREQUENCY / (1000000 / TICK_US) - 1;
+    TIM16->ARR = 0xffff;
+    TIM16->EGR = TIM_EGR_UG; // load prescaler, counter from 0
+    TIM16->SR = 0;           // UG flags an update too, UIF means wrapped from here on
+    TIM16->CR1 = TIM_CR1_CEN;
+    counting = true;
+}
+
+void mark(Phase phase) {
+    if (!counting) {
+        return;
+    }
+    if (TIM16->SR & TIM_SR_UIF) {
+        finish(); // wrapped, times would be wrong
+        return;
+    }
+
+    retained.current.ticks[static_cast<uint32_t>(phase)] = static_cast<uint16_t>(TIM16->CNT);
+    if (phase == Phase::Sound) {
+        finish();
+    }
+}
+
+} // namespace Boot
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Boot profile: time each boot phase ends at, counted by TIM16 from the
+ * system clock setup in 100 us ticks (6.5 s range). Kept in RAM startup code
+ * doesn't clear, after a reset the profile of the boot before is still there
+ * (a hang shows as the phases never reached).
+ */
+namespace Boot {
+
+constexpr uint32_t TICK_US = 100;
+constexpr uint16_t NOT_REACHED = 0xffff;
+
+enum class Phase : uint8_t {
+    Peripherals,    // GPIO, SPI, timers, DMA, sensor
+    Card,           // SD card initialisation
+    Mount,          // FAT volume
+    Config,         // CONFIG.INI / CONFIG.BIN
+    State,          // STATE.BIN, settings applied
+    Restore,        // directory and track from saved state
+    Sound,          // decoded output starts
+    Count
+};
+
+struct Profile {
+    uint16_t ticks[static_cast<uint32_t>(Phase::Count)];
+};
+
+struct Retained {
+    uint32_t magic;     // RETAINED_MAGIC once written since power on
+    uint32_t boots;     // resets since power on
+    Profile current;
+    Profile previous;
+};
+
+extern Retained retained;
+
+/**
+ * @brief Start counting, first thing after the system clock is set up
+ */
+void start();
+
+/**
+ * @brief Record end of a phase, ignored once boot is over (sound started, card
+ *        re-init) or the counter wrapped (no sound for long, dark room)
+ */
+void mark(Phase phase);
+
+} // namespace Boot
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+/*
+ * Optional features (0: left out, 1: built in), set by the CMake options of
+ * the same name. All of them are built by default and fit the chip's 32 KB
+ * flash / 4 KB RAM with the stack reserve, turning one off frees its flash
+ * and RAM for something else.
+ */
+
+// Event trace saved to TRACE.BIN (trace.h)
+#ifndef LOOTUNES_TRACE
+#define LOOTUNES_TRACE 1
+#endif
+
+// Card read timing measured at mount, kept in CARD.BIN (card_profile.h)
+#ifndef LOOTUNES_CARD_PROFILE
+#define LOOTUNES_CARD_PROFILE 1
+#endif
+
+// Parsed CONFIG.INI kept in CONFIG.BIN (config.h)
+#ifndef LOOTUNES_CONFIG_CACHE
+#define LOOTUNES_CONFIG_CACHE 1
+#endif
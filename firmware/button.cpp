@@ -6,6 +6,7 @@
 */
 
 #include "button.h"
+#include "irq_priority.h"
 
 extern "C" {
 #include "py32f0xx.h"
@@ -13,6 +14,9 @@ extern "C" {
 }
 
 static uint32_t g_btn_pressed = 0;
+static bool g_scan_mode = false;
+static uint32_t g_btn_held = 0; // button held past hold period in scan mode
+static uint32_t g_scan_steps = 0;
 
 void BTN::init()
 {
@@ -39,13 +43,41 @@ void BTN::init()
     TIM3->CR1 |= TIM_CR1_OPM | TIM_CR1_URS; // one pulse mode, only overflow generates interrupt
     TIM3->DIER |= TIM_DIER_CC1IE | TIM_DIER_UIE; // enable capture1 and update interrupts
     // enable interrupt for timer
+    NVIC_SetPriority(TIM3_IRQn, IrqPriority::EVENTS);
     NVIC_EnableIRQ(TIM3_IRQn);
 
     EXTI->IMR |= EXTI_IMR_IM0 | EXTI_IMR_IM1; // unmask interrupts in exti
     //todo: EXTI_EMR ?
+    NVIC_SetPriority(EXTI0_1_IRQn, IrqPriority::EVENTS);
     NVIC_EnableIRQ(EXTI0_1_IRQn);
 }
 
+void BTN::set_scan_mode(bool enabled) {
+    g_scan_mode = enabled;
+}
+
+static void finish_hold() {
+    // in scan mode long press action is taken on release, only if no scan happened
+    if (g_scan_steps > 0) {
+        ButtonPressCallback(BTN::ID::SCAN_END);
+    }
+    else if (g_btn_held & GPIO_IDR_ID0) {
+        ButtonPressCallback(BTN::ID::PREV);
+    }
+    else {
+        ButtonPressCallback(BTN::ID::NEXT_DIR);
+    }
+
+    g_btn_held = 0;
+    g_scan_steps = 0;
+    TIM3->CR1 &= ~TIM_CR1_CEN;
+    TIM3->ARR = BTN::BUTTON_HOLD_PERIOD;
+}
+
+bool BTN::busy() {
+    return (TIM3->CR1 & TIM_CR1_CEN) != 0;
+}
+
 void BTN::on_ext_interrupt() {
 
     // if timer 3 was not enabled
@@ -68,6 +100,12 @@ void BTN::on_ext_interrupt() {
 
     // we're in stable state here so we could check if button was released
     if ((GPIOB->IDR & (GPIO_IDR_ID0 | GPIO_IDR_ID1)) == (GPIO_IDR_ID0 | GPIO_IDR_ID1)) {
+        if (g_btn_held) {
+            // end of hold in scan mode
+            finish_hold();
+            return;
+        }
+
         // button was released, short press
         ButtonPressCallback(g_btn_pressed & GPIO_IDR_ID0 ? BTN::ID::POWER : BTN::ID::NEXT);
 
@@ -82,11 +120,42 @@ void BTN::on_ext_interrupt() {
 void BTN::on_short_timer_interrupt() {
     // if no button is not pressed after bouncing period, stop timer
     if ((GPIOB->IDR & (GPIO_IDR_ID0 | GPIO_IDR_ID1)) == (GPIO_IDR_ID0 | GPIO_IDR_ID1)) {
+        if (g_btn_held) {
+            // released within bouncing period of scan step
+            finish_hold();
+            return;
+        }
         TIM3->CR1 &= ~TIM_CR1_CEN;
     }
 }
 
 void BTN::on_timer_interrupt() {
+    const uint32_t pressed = ~GPIOB->IDR & (GPIO_IDR_ID0 | GPIO_IDR_ID1);
+
+    if (pressed == (GPIO_IDR_ID0 | GPIO_IDR_ID1) && !g_btn_held) {
+        // both buttons held, neither one's long press action is taken
+        ButtonPressCallback(BTN::ID::SAVE_TRACE);
+        return;
+    }
+
+    if (g_scan_mode && pressed) {
+        if (g_btn_held) {
+            // next scan step, longer hold accelerates scanning (handled by player)
+            g_scan_steps++;
+            ButtonPressCallback(g_btn_held & GPIO_IDR_ID0 ? BTN::ID::SCAN_FWD : BTN::ID::SCAN_BACK);
+        }
+        else {
+            // hold period reached, start scanning at next step
+            g_btn_held = pressed;
+            TIM3->ARR = BUTTON_SCAN_PERIOD;
+        }
+
+        // re-arm one pulse timer for the next step
+        TIM3->CNT = 0;
+        TIM3->CR1 |= TIM_CR1_CEN;
+        return;
+    }
+
     // button was held for 1 second
     // check if button is still pressed reading port
     if ((GPIOB->IDR & GPIO_IDR_ID0) == 0) {
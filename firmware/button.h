@@ -16,17 +16,28 @@ public:
         POWER = 0, // left button, short press
         NEXT_DIR, // left button, long press
         NEXT, // right button, short press
-        PREV // right button, long press
+        PREV, // right button, long press
+        SCAN_FWD, // right button, held (scan mode)
+        SCAN_BACK, // left button, held (scan mode)
+        SCAN_END, // held button released after scanning
+        SAVE_TRACE // both buttons, long press
     };
 
     static constexpr uint32_t BUTTON_DEBOUNCE_PERIOD = 50;
     static constexpr uint32_t BUTTON_HOLD_PERIOD = 400;
+    static constexpr uint32_t BUTTON_SCAN_PERIOD = 250;
 
 public:
     static void init();
+    static void set_scan_mode(bool enabled);
     static void on_ext_interrupt();
     static void on_short_timer_interrupt();
     static void on_timer_interrupt();
+
+    /**
+     * @brief Press being debounced or timed, TIM3 has to keep running (no Stop mode)
+     */
+    static bool busy();
 };
 
 void ButtonPressCallback(BTN::ID button_id);
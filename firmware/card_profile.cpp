@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "card_profile.h"
+
+#if LOOTUNES_CARD_PROFILE
+
+#include "file_record.h"
+
+#include <algorithm>
+
+extern "C" {
+    #include "petitfat/source/diskio.h"
+}
+
+namespace CardProfile {
+
+namespace {
+    struct Record {
+        static constexpr uint32_t MAGIC = 0x44524143; // "CARD"
+        static constexpr uint16_t VERSION = 1;
+
+        FileRecord::Header header;
+        DPROFILE profile;
+        uint32_t crc;
+    };
+
+    bool matches(const Record& record) {
+        return FileRecord::valid(record)
+            && std::equal(record.profile.cid, record.profile.cid + sizeof(record.profile.cid),
+                disk_profile.cid);
+    }
+}
+
+bool load(const char* filename, uint32_t sector) {
+    if (disk_profile.single_us) {
+        return true; // same card initialized again, profile is still valid
+    }
+
+    // without the file a measurement would be repeated every boot, streaming read-ahead
+    // set by card init stays
+    if (pf_open(filename) != FR_OK) {
+        return true;
+    }
+
+    Record record;
+    if (FileRecord::read(0, record) && matches(record)) {
+        disk_profile = record.profile;
+        return true;
+    }
+
+    if (disk_calibrate(sector) != RES_OK) {
+        return false;
+    }
+
+    record.profile = disk_profile;
+    FileRecord::seal(record);
+    FileRecord::write(0, record);
+    return true;
+}
+
+} // namespace CardProfile
+
+#endif // LOOTUNES_CARD_PROFILE
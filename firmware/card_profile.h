@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include "build_options.h"
+
+#include <cstdint>
+
+/*
+ * Read timing of the card (see DPROFILE in diskio.h) decides how the disk
+ * layer reads ahead. It's measured the first time a card is mounted and kept
+ * in a file on the card, next boots with the same card (CID) only read it.
+ * Without the file the card isn't measured and streams (CMD18) ahead.
+ */
+namespace CardProfile {
+
+#if LOOTUNES_CARD_PROFILE
+
+/**
+ * @brief Apply profile of the mounted card, measure it if the file holds none for it
+ * @param filename Profile file in the root directory, card isn't measured without it
+ * @param sector Sector the measurement reads, any one on the card
+ * @return true if a profile is in use, false if the card couldn't be measured
+ */
+bool load(const char* filename, uint32_t sector);
+
+#else
+
+// left out of the build (LOOTUNES_CARD_PROFILE), card streams ahead as without the file
+inline bool load(const char*, uint32_t) { return true; }
+
+#endif
+
+} // namespace CardProfile
@@ -6,7 +6,9 @@
 */
 
 #include "config.h"
-#include "petitfat/source/pff.h"
+#include "build_options.h"
+#include "file_record.h"
+#include <array>
 #include <cstring>
 namespace {
     // not including cstdlib because of __sf overhead
@@ -48,6 +50,22 @@ namespace {
         field = 0xfff - static_cast<uint16_t>(atoi(value)); // invert threshold
     }
 
+    // "6,3,0,-2": dB per band from lowest, missing bands stay 0
+    static void set_eq(Config& cfg, const char* value) {
+        for (int i = 0; i < Config::EQ_BANDS && *value; i++) {
+            while (*value == ' ') value++;
+            const bool negative = *value == '-';
+            if (*value == '-' || *value == '+') value++;
+
+            const int v = atoi(value);
+            cfg.eq[i] = static_cast<int8_t>(negative ? -v : v);
+
+            const char* next = strchr(value, ',');
+            if (!next) break;
+            value = next + 1;
+        }
+    }
+
     static void set_light_mode(Config& cfg, const char* value) {
         int v = atoi(value);
         if (v >= 0 && v <= 2)
@@ -73,6 +91,20 @@ namespace {
         }
     }
 
+    static void set_save_position(Config& cfg, const char* value) {
+        if (atoi(value) != 0) {
+            cfg.enable_saving(Config::SaveState::SaveDirectory);
+            cfg.enable_saving(Config::SaveState::SaveTrack);
+            cfg.enable_saving(Config::SaveState::SavePosition);
+        }
+    }
+
+    static void set_save_on_power_fail(Config& cfg, const char* value) {
+        if (atoi(value) != 0) {
+            cfg.enable_saving(Config::SaveState::PowerFail);
+        }
+    }
+
     static void set_save_mode(Config& cfg, const char* value) {
         if (atoi(value) != 0) {
             cfg.enable_saving(Config::SaveState::SaveMode);
@@ -88,13 +120,208 @@ namespace {
         { "usb_mode", set_usb_mode },
         { "fade_in", [](Config& cfg, const char* val) { set_uint8(cfg.fade_in, val); } },
         { "fade_out", [](Config& cfg, const char* val) { set_uint8(cfg.fade_out, val); } },
+        { "volume", [](Config& cfg, const char* val) { set_uint8(cfg.volume, val); } },
+        { "mono_output", [](Config& cfg, const char* val) { set_uint8(cfg.mono_output, val); } },
+        { "eq", set_eq },
         { "save_directory", set_save_directory },
         { "save_track", set_save_track },
+        { "save_position", set_save_position },
         { "save_mode", set_save_mode },
+        { "save_on_power_fail", set_save_on_power_fail },
         { "jump_next_dir", [](Config& cfg, const char* val) { set_uint8(cfg.jump_next_dir, val); } },
         { "instant_mode_change", [](Config& cfg, const char* val) { set_uint8(cfg.instant_mode_change, val); } },
+        { "hold_to_scan", [](Config& cfg, const char* val) { set_uint8(cfg.hold_to_scan, val); } },
     };
 
+    // Keys are found by a perfect hash: FNV-1a from a seed searched at compile time
+    // so that every key has its own slot, one strcmp rejects unknown keys
+    constexpr uint32_t HASH_BITS = 5;
+    constexpr uint32_t HASH_SLOTS = 1 << HASH_BITS;
+
+    // top bits, low ones only depend on low bits of the characters
+    constexpr uint32_t hash_slot(uint32_t hash) {
+        return hash >> (32 - HASH_BITS);
+    }
+
+    constexpr uint32_t hash_step(uint32_t hash, char c) {
+        return (hash ^ static_cast<uint8_t>(c)) * 0x01000193;
+    }
+
+    constexpr uint32_t hash_key(const char* key, uint32_t hash) {
+        while (*key) {
+            hash = hash_step(hash, *key++);
+        }
+        return hash;
+    }
+
+    constexpr uint32_t find_seed() {
+        for (uint32_t seed = 0x811c9dc5;; seed++) {
+            uint32_t used = 0;
+            bool unique = true;
+            for (const auto& handler : key_handlers) {
+                const uint32_t bit = 1u << hash_slot(hash_key(handler.key, seed));
+                unique = unique && !(used & bit);
+                used |= bit;
+            }
+            if (unique) {
+                return seed;
+            }
+        }
+    }
+
+    constexpr uint32_t HASH_SEED = find_seed();
+
+    // handler index + 1 per slot, 0: no key
+    constexpr auto key_slots = [] {
+        std::array<uint8_t, HASH_SLOTS> slots{};
+        for (uint32_t i = 0; i < std::size(key_handlers); i++) {
+            slots[hash_slot(hash_key(key_handlers[i].key, HASH_SEED))] = static_cast<uint8_t>(i + 1);
+        }
+        return slots;
+    }();
+
+    // Streaming tokenizer, fed with file data as it comes from the sector cache.
+    // Comment lines are skipped without copying, key and value are collected in
+    // one buffer: "key\0value".
+    class Parser {
+    public:
+        explicit Parser(Config& cfg) : cfg(cfg) {}
+
+        void feed(const char* data, UINT size) {
+            for (const char* end = data + size; data < end; data++) {
+                const char c = *data;
+                const bool eol = c == '\n' || c == '\r';
+
+                switch (state) {
+                case State::LineStart:
+                    if (c == ';') {
+                        state = State::Skip;
+                    } else if (c != ' ' && c != '\t' && !eol) {
+                        state = State::Key;
+                        append(c);
+                    }
+                    break;
+
+                case State::Key:
+                    if (eol) {
+                        restart(); // no value
+                    } else if (c == '=') {
+                        key_end = length;
+                        state = State::Value;
+                        append('\0');
+                    } else {
+                        append(c);
+                    }
+                    break;
+
+                case State::Value:
+                    if (eol) {
+                        finish();
+                    } else {
+                        append(c);
+                    }
+                    break;
+
+                case State::Skip:
+                    if (eol) {
+                        restart();
+                    }
+                    break;
+                }
+            }
+        }
+
+        // last line may come without line break
+        void finish() {
+            if (state == State::Value) {
+                text[length] = '\0';
+                apply();
+            }
+            restart();
+        }
+
+    private:
+        static constexpr int LINE_MAX_LEN = 128;
+
+        enum class State : uint8_t { LineStart, Key, Value, Skip };
+
+        Config& cfg;
+        State state = State::LineStart;
+        uint32_t hash = HASH_SEED;
+        uint8_t length = 0;
+        uint8_t key_end = 0;
+        char text[LINE_MAX_LEN];
+
+        void append(char c) {
+            if (length >= LINE_MAX_LEN - 1) {
+                state = State::Skip; // line too long, ignored
+                return;
+            }
+            if (state == State::Key) {
+                hash = hash_step(hash, c);
+            }
+            text[length++] = c;
+        }
+
+        void restart() {
+            state = State::LineStart;
+            hash = HASH_SEED;
+            length = 0;
+        }
+
+        void apply() {
+            const uint8_t slot = key_slots[hash_slot(hash)];
+            if (slot && std::strcmp(text, key_handlers[slot - 1].key) == 0) {
+                key_handlers[slot - 1].apply(cfg, text + key_end + 1);
+            }
+        }
+    };
+
+#if LOOTUNES_CONFIG_CACHE
+    // Compiled configuration, parsed fields of the file it was written for
+    struct Compiled {
+        static constexpr uint32_t MAGIC = 0x4643544c; // "LTCF"
+        static constexpr uint16_t VERSION = 1;
+
+        FileRecord::Header header;
+        uint32_t source_size;
+        uint16_t source_date;
+        uint16_t source_time;
+        Config config;
+        uint32_t crc;
+    };
+
+    bool matches(const Compiled& compiled, const FILINFO& source) {
+        return FileRecord::valid(compiled) && compiled.source_size == source.fsize
+            && compiled.source_date == source.fdate && compiled.source_time == source.ftime;
+    }
+#endif
+
+    // both files are found with one pass over the root directory
+    bool find_files(const char* filename, FILINFO& source, const char* compiled_name, FILINFO& compiled) {
+        DIR dir;
+        FILINFO info;
+        if (pf_opendir(&dir, "/") != FR_OK) {
+            return false;
+        }
+
+        source.fname[0] = compiled.fname[0] = '\0';
+        while (pf_readdir(&dir, &info) == FR_OK && info.fname[0]) {
+            if (info.fattrib & AM_DIR) {
+                continue;
+            }
+            if (std::strcmp(info.fname, filename) == 0) {
+                source = info;
+            } else if (std::strcmp(info.fname, compiled_name) == 0) {
+                compiled = info;
+            }
+            if (source.fname[0] && compiled.fname[0]) {
+                break;
+            }
+        }
+        return source.fname[0];
+    }
+
 }
 
 Config::Config()
@@ -108,67 +335,64 @@ Config::Config()
       usb_mode(UsbMode::OnPlayback),
       fade_in(50),
       fade_out(100),
+      volume(100),
+      mono_output(0),
+      eq{},
       save_state(SaveState::Disabled),
       jump_next_dir(0),
-      instant_mode_change(0)
+      instant_mode_change(0),
+      hold_to_scan(0)
 {
 }
 
-__attribute__((noinline)) bool Config::load_from_file(const char* filename) {
-   
-    FRESULT res = pf_open(filename);
-    if (res != FR_OK) {
+__attribute__((noinline)) bool Config::load_from_file(const char* filename, const char* compiled_name) {
+    FILINFO source, compiled_file;
+    if (!find_files(filename, source, compiled_name, compiled_file)) {
         return false;
     }
 
-    constexpr int LINE_MAX_LEN = 128;
-    char line[LINE_MAX_LEN];
-    UINT bytesRead = 0;
-    char* ptr = line;
-    int line_pos = 0;
-
-    while (true) {
-        char c;
-        res = pf_read(&c, 1, &bytesRead);
-        if (res != FR_OK || bytesRead == 0) {
-            break; // EOF or error
-        }
-
-        if (c == '\n' || c == '\r' || line_pos >= LINE_MAX_LEN - 1) {
-            *ptr = '\0';
+#if LOOTUNES_CONFIG_CACHE
+    // --- Compiled copy, one read ---
 
-            // Trim leading space
-            char* trimmed = line;
+    Compiled compiled;
+    const bool has_compiled = compiled_file.fname[0] && compiled_file.fsize >= sizeof(Compiled)
+        && pf_open_fileinfo(&compiled_file) == FR_OK;
 
-            while (*trimmed == ' ' || *trimmed == '\t') trimmed++;
+    if (has_compiled && FileRecord::read(0, compiled) && matches(compiled, source)) {
+        *this = compiled.config;
+        return true;
+    }
+#endif
 
+    // --- Parse, sector by sector in place ---
 
-            if (*trimmed != ';' && *trimmed != '\0') {
-                char* equal_sign = strchr(trimmed, '=');
+    if (pf_open_fileinfo(&source) != FR_OK) {
+        return false;
+    }
 
-                if (equal_sign) {
-                    *equal_sign = '\0';
-                    char* key = trimmed;
-                    char* value = equal_sign + 1;
+    Parser parser(*this);
+    while (true) {
+        const void* data;
+        UINT br;
+        if (pf_read_direct(&data, 512, &br) != FR_OK || br == 0) {
+            break; // EOF or error
+        }
+        parser.feed(static_cast<const char*>(data), br);
+    }
+    parser.finish();
 
-                    // Match key
-                    for (const auto& handler : key_handlers) {
-                        if (std::strcmp(key, handler.key) == 0) {
-                            handler.apply(*this, value);
-                            break;
-                        }
-                    }
-                }
-            }
+#if LOOTUNES_CONFIG_CACHE
+    // --- Rewrite compiled copy for next boot ---
 
-            // Prepare for next line
-            ptr = line;
-            line_pos = 0;
-        } else {
-            *ptr++ = c;
-            line_pos++;
-        }
+    if (has_compiled && pf_open_fileinfo(&compiled_file) == FR_OK) {
+        compiled.source_size = source.fsize;
+        compiled.source_date = source.fdate;
+        compiled.source_time = source.ftime;
+        compiled.config = *this;
+        FileRecord::seal(compiled);
+        FileRecord::write(0, compiled);
     }
+#endif
 
     return true;
 }
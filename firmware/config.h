@@ -29,9 +29,14 @@ public:
         Disabled      = 0x00,
         SaveTrack     = 0x01,
         SaveDirectory = 0x02,
-        SaveMode      = 0x04
+        SaveMode      = 0x04,
+        SavePosition  = 0x08,
+        PowerFail     = 0x10  // keep state in RAM, write it only when supply fails
     };
 
+    // Equaliser bands, sub-bands of 8 sub-band streams from lowest frequency
+    static constexpr int EQ_BANDS = 8;
+
     // Constructor
     Config();
 
@@ -45,8 +50,14 @@ public:
 
     UsbMode usb_mode;           // USB power mode
 
-    uint8_t fade_in;            // Fade-in step time in ms
-    uint8_t fade_out;           // Fade-out step time in ms
+    uint8_t fade_in;            // Fade-in time in 10 ms units
+    uint8_t fade_out;           // Fade-out time in 10 ms units
+
+    uint8_t volume;             // Master volume, percent of full amplitude
+
+    uint8_t mono_output;        // Both outputs play mono downmix (decoded once)
+
+    int8_t eq[EQ_BANDS];        // Equaliser gain per band in dB, all 0: off
 
     SaveState save_state;         // Bitmask for save options: track, directory, and mode
 
@@ -54,6 +65,8 @@ public:
 
     uint8_t instant_mode_change;
 
+    uint8_t hold_to_scan;       // Holding button scans within track instead of long press action
+
     inline bool saving_enabled(SaveState mode) const {
         return (static_cast<uint8_t>(save_state) & static_cast<uint8_t>(mode)) != 0;
     }
@@ -62,8 +75,10 @@ public:
         save_state = static_cast<SaveState>(static_cast<uint8_t>(save_state) | static_cast<uint8_t>(mode));
     }
 
-    // Load configuration from file
-    __attribute__((noinline)) bool load_from_file(const char* filename);
+    // Load configuration from file. With LOOTUNES_CONFIG_CACHE a compiled copy
+    // (existing file, FAT can't be extended) is loaded instead when it was written
+    // for the same file size and timestamp, otherwise it is rewritten after parsing.
+    __attribute__((noinline)) bool load_from_file(const char* filename, const char* compiled_name);
 
 private:
 };
@@ -12,18 +12,55 @@
 #include "config.h"
 #include "light_sensor.h"
 #include "playback_state.h"
+#include "power.h"
+#include "event_queue.h"
+#include "boot.h"
+#include "trace.h"
 
 extern "C" {
-    volatile uint8_t VolumeShift = 0;
+    #include "petitfat/source/diskio.h"
 }
 
+namespace Controller {
+
+// Work requested by interrupt handlers, done by main loop
+enum class EventType : uint8_t {
+    Button,
+    Light,
+};
+
+struct Event {
+    EventType type;
+    uint16_t value; // button id / sensor reading
+};
+
+namespace {
+    EventQueue<Event, 8> events;
+}
+
+} // namespace Controller
+
 // Global callback functions for external C interfaces
 void ButtonPressCallback(BTN::ID id) {
-    Controller::on_button_press(id);
+    Trace::record(Trace::Event::Button, static_cast<uint8_t>(id));
+    Controller::events.push({Controller::EventType::Button, static_cast<uint16_t>(id)});
 }
 
 void LightSensorCallback(uint16_t value) {
-    Controller::on_light_sensor(value);
+    Trace::record(Trace::Event::Light, static_cast<uint8_t>(value >> 4));
+    Controller::events.push({Controller::EventType::Light, value});
+}
+
+void PowerFailCallback() {
+    Controller::on_power_fail();
+}
+
+bool PlaybackEventsPending() {
+    return !Controller::events.empty() || Controller::fade_finished();
+}
+
+void PlaybackPollCallback() {
+    Controller::process_events();
 }
 
 namespace Controller {
@@ -42,55 +79,60 @@ void change_main_state(PlaybackState::Mode new_state);
 void change_playing_state(PState new_state, bool force = false);
 void set_thresholds_for_state();
 
+// Config fade times are per 1/10 of the fade (steps of the former 6 dB fade)
+constexpr uint32_t FADE_STEPS = 10;
+
 namespace {
-    // Playback state
     PState p_state = PState::NotPlaying;
 }
 
 void init() {
     AudioPlayer::init();
+}
 
-    // initialize timer used for fade in and out
-    __HAL_RCC_TIM16_CLK_ENABLE();
-    // 1ms time base
-    TIM16->PSC = (INPUT_FREQUENCY / 1000) - 1;
-    // enable update interrupt
-    TIM16->DIER |= TIM_DIER_UIE;
-    NVIC_EnableIRQ(TIM16_IRQn);
-    // don't start yet
-    TIM16->CR1 = 0;
+bool fade_finished() {
+    return (p_state == PState::FadeIn || p_state == PState::FadeOut) && AudioPlayer::fade_done();
 }
 
-void fade_handler() {
+void on_fade_done() {
     if (p_state == PState::FadeIn) {
-        if (VolumeShift > 0) {
-            VolumeShift = VolumeShift - 1;
-        }
-        else {
-            // done
-            TIM16->CR1 &= ~TIM_CR1_CEN; // stop timer
-            Controller::change_playing_state(Controller::PState::Playing, true);
-        }
+        change_playing_state(PState::Playing, true);
     }
-    else if (p_state == Controller::PState::FadeOut) {
-        if (VolumeShift < 10) {
-            VolumeShift = VolumeShift + 1;
-        }
-        else {
-            // done
-            TIM16->CR1 &= ~TIM_CR1_CEN; // stop timer
-            Controller::change_playing_state(Controller::PState::NotPlaying, true);
+    else {
+        change_playing_state(PState::NotPlaying, true);
+    }
+}
+
+void process_events() {
+    Event event;
+    while (events.pop(event)) {
+        switch (event.type) {
+            case EventType::Button:
+                on_button_press(static_cast<BTN::ID>(event.value));
+                break;
+            case EventType::Light:
+                on_light_sensor(event.value);
+                LIGHT::arm(); // thresholds are updated now
+                break;
         }
     }
+
+    // decoder ramps the level, fade ends with the ramp
+    if (fade_finished()) {
+        on_fade_done();
+    }
 }
 
-void arm_fade_timer(uint8_t period_ms) {
-    TIM16->CNT = 0;
-    TIM16->ARR = period_ms;
-    TIM16->CR1 |= TIM_CR1_CEN; // start timer
+void drop_events() {
+    Event event;
+    while (events.pop(event)) {
+    }
+    LIGHT::arm(); // dropped reading may have left callback disarmed
 }
 
 bool init_sd() {
+    // presses from before card init don't apply to state loaded below
+    drop_events();
     // re-initialize mute state after SD card init
     AudioPlayer::reset_mute();
     // reset playback state, needs to be loaded
@@ -100,6 +142,17 @@ bool init_sd() {
         return false;
     }
 
+    BTN::set_scan_mode(CFG.hold_to_scan != 0);
+    AudioPlayer::set_master_gain((CFG.volume < 100 ? CFG.volume : 100) * 0x8000u / 100);
+    AudioPlayer::set_equalizer(CFG.eq);
+
+    if (CFG.saving_enabled(Config::SaveState::PowerFail)) {
+        PVD::start();
+    }
+    else {
+        PVD::stop();
+    }
+
     PlaybackState& nv_state = FileNavigator::get_state();
 
     if (CFG.saving_enabled(Config::SaveState::SaveMode)) {
@@ -115,6 +168,7 @@ bool init_sd() {
         }
     }
 
+    Boot::mark(Boot::Phase::State);
     return true;
 }
 
@@ -164,6 +218,18 @@ void on_button_press(BTN::ID id)
         case BTN::ID::PREV:
             AudioPlayer::set_playback_command(PlaybackCommand::PrevTrack);
             break;
+        case BTN::ID::SCAN_FWD:
+            AudioPlayer::scan(true);
+            break;
+        case BTN::ID::SCAN_BACK:
+            AudioPlayer::scan(false);
+            break;
+        case BTN::ID::SCAN_END:
+            AudioPlayer::end_scan();
+            break;
+        case BTN::ID::SAVE_TRACE:
+            Trace::request_save(); // written by player like state, or before next track
+            break;
     }
 }
 
@@ -184,6 +250,27 @@ void on_light_sensor(uint16_t value)
     }
 }
 
+void on_power_fail()
+{
+    // shed load first to make the most of the hold-up time
+    AudioPlayer::halt();
+    LIGHT::stop();
+    GPIO::led_off();
+    GPIO::usb_power_off();
+
+    // main loop is never resumed, so its SD transfer can be dropped
+    disk_abort();
+    FileNavigator::handle_state_save();
+    while (disk_poll() == RES_NOTRDY) { // let the card finish programming
+    }
+
+    // wait for power to go away, start over if it was only a dip
+    while (PVD::supply_low()) {
+    }
+
+    NVIC_SystemReset();
+}
+
 void change_main_state(PlaybackState::Mode new_state)
 {
     PlaybackState& nv_state = FileNavigator::get_state();
@@ -207,6 +294,7 @@ void change_main_state(PlaybackState::Mode new_state)
     }
 
     nv_state.mode = new_state;
+    Trace::record(Trace::Event::Mode, static_cast<uint8_t>(new_state));
 }
 
 void change_playing_state(PState new_state, bool force)
@@ -237,7 +325,13 @@ void change_playing_state(PState new_state, bool force)
             GPIO::usb_power_off();
         }
         AudioPlayer::mute(); // this will create state-related mute lock
-        VolumeShift = 10; // prepare shift for potential fade in
+        AudioPlayer::fade(false, 0); // silent start for potential fade in
+
+        if (p_state != PState::Invalid && (CFG.saving_enabled(Config::SaveState::SavePosition)
+                || FileNavigator::is_state_dirty())) {
+            // remember where playback stopped / flush deferred track, saved by player while muted
+            FileNavigator::request_state_save();
+        }
     }
     else if (new_state == PState::FadeIn || new_state == PState::Playing)  {
         GPIO::led_on();
@@ -247,11 +341,10 @@ void change_playing_state(PState new_state, bool force)
         }
 
         if (new_state == PState::FadeIn) {
-            // Start fade-in timer
-            arm_fade_timer(CFG.fade_in);
+            AudioPlayer::fade(true, CFG.fade_in * FADE_STEPS);
         }
         else {
-            VolumeShift = 0; // instant on
+            AudioPlayer::fade(true, 0); // instant on
         }
 
         if (p_state == PState::NotPlaying) {
@@ -263,11 +356,11 @@ void change_playing_state(PState new_state, bool force)
     else if (new_state == PState::FadeOut) {
         // keep USB on during fade out, but not led
         GPIO::led_off();
-        // Start fade-out timer
-        arm_fade_timer(CFG.fade_out);
+        AudioPlayer::fade(false, CFG.fade_out * FADE_STEPS);
     }
 
     p_state = new_state;
+    Trace::record(Trace::Event::PlayState, static_cast<uint8_t>(new_state));
 }
 
 // Main Playback Loop
@@ -281,10 +374,16 @@ bool main() {
     if (!FileNavigator::restore_state()) {
         return false;
     }
+    Boot::mark(Boot::Phase::Restore);
 
     FILINFO* current_file = FileNavigator::get_current_file();
 
+    // resume restored track from saved position, other tracks start from beginning
+    uint32_t offset = CFG.saving_enabled(Config::SaveState::SavePosition)
+        ? FileNavigator::get_state().track_offset : 0;
+
     for (;;) {
+        process_events();
 
         if (current_file->fname[0] == 0) {
             break;
@@ -292,11 +391,13 @@ bool main() {
 
         PlaybackCommand command = PlaybackCommand::KeepPlaying;
 
-        if (!AudioPlayer::play_file(current_file, command)) {
+        if (!AudioPlayer::play_file(current_file, offset, command)) {
             // Error playing file, skip to next
             command = PlaybackCommand::NextTrack;
         }
 
+        offset = 0;
+
         bool next_directory = false;
 
         if (command == PlaybackCommand::PrevTrack) {
@@ -324,21 +425,22 @@ bool main() {
 
         // save state
         if (FileNavigator::is_state_save_requested()
-            || CFG.saving_enabled(Config::SaveState::SaveTrack)
-            || (CFG.saving_enabled(Config::SaveState::SaveDirectory) && next_directory)) {
+            || (CFG.saving_enabled(Config::SaveState::SaveDirectory) && next_directory
+                && !CFG.saving_enabled(Config::SaveState::PowerFail))) {
 
             FileNavigator::handle_state_save();
         }
+        else if (CFG.saving_enabled(Config::SaveState::SaveTrack)) {
+            // track-only change, coalesced with following ones
+            FileNavigator::defer_state_save();
+        }
+
+        if (Trace::save_requested()) {
+            FileNavigator::handle_trace_save();
+        }
     }
 
     return true;
 }
 
-} // namespace Controller
-
-void TIM16_IRQHandler() {
-    if (TIM16->SR & TIM_SR_UIF) {
-        TIM16->SR &= ~TIM_SR_UIF; // clear interrupt flag
-        Controller::fade_handler();
-    }
-}
\ No newline at end of file
+} // namespace Controller
\ No newline at end of file
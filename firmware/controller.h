@@ -12,6 +12,18 @@
 namespace Controller {
     void on_button_press(BTN::ID id);
     void on_light_sensor(uint16_t value);
+    void on_power_fail();
+
+    /**
+     * @brief Handle events posted by interrupt handlers (buttons, light sensor)
+     *        and fade end, called from main loop and by player while it waits for DMA
+     */
+    void process_events();
+
+    /**
+     * @brief Fade in / out is in progress and decoder got output level to its end
+     */
+    bool fade_finished();
 
     void init();
     bool init_sd();
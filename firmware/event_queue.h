@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Lock-free single producer / single consumer ring, used to pass events from
+ * interrupt handlers to the main loop. Producer only writes head, consumer only
+ * writes tail, so on a single core neither side needs to mask interrupts.
+ * Several interrupts may push as long as they share one NVIC priority and
+ * can't preempt each other.
+ */
+template <typename T, uint32_t N>
+class EventQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "queue size must be a power of two");
+
+public:
+    /**
+     * @brief Add item (producer side)
+     * @return false if queue is full, item is dropped
+     */
+    bool push(const T& item) {
+        const uint32_t h = head;
+        if (h - tail == N) {
+            return false;
+        }
+        items[h & (N - 1)] = item;
+        // item has to be in place before consumer can see it
+        __asm volatile("" ::: "memory");
+        head = h + 1;
+        return true;
+    }
+
+    /**
+     * @brief Take oldest item (consumer side)
+     * @return false if queue is empty
+     */
+    bool pop(T& item) {
+        const uint32_t t = tail;
+        if (head == t) {
+            return false;
+        }
+        item = items[t & (N - 1)];
+        __asm volatile("" ::: "memory");
+        tail = t + 1;
+        return true;
+    }
+
+    bool empty() const {
+        return head == tail;
+    }
+
+private:
+    T items[N];
+    volatile uint32_t head = 0;
+    volatile uint32_t tail = 0;
+};
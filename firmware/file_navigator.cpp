@@ -11,6 +11,9 @@
 #include "config.h"
 #include "feistel.h"
 #include "gpio.h"
+#include "boot.h"
+#include "card_profile.h"
+#include "trace.h"
 
 
 
@@ -19,6 +22,12 @@ namespace FileNavigator {
 
 constexpr const char* StateFileName = "STATE.BIN";
 constexpr const char* ConfigFileName = "CONFIG.INI";
+constexpr const char* CompiledConfigFileName = "CONFIG.BIN";
+constexpr const char* CardProfileFileName = "CARD.BIN";
+constexpr const char* TraceFileName = "TRACE.BIN";
+
+// Track-only changes written to state file at most every n tracks while playing
+constexpr uint32_t MAX_DEFERRED_SAVES = 8;
 
 namespace {
     FATFS fs;
@@ -28,6 +37,8 @@ namespace {
     uint32_t subdir_iter = -1;
     FILINFO current_file = {0};
     volatile bool save_state_requested = false;
+    volatile bool state_dirty = false;
+    uint32_t deferred_saves = 0;
 }
 
 uint32_t translate_track_number(uint32_t track) {
@@ -46,8 +57,13 @@ bool init() {
         return false;
     }
 
+    // read-ahead for this card, measured on its first mount (reading the FAT)
+    CardProfile::load(CardProfileFileName, fs.fatbase);
+    Boot::mark(Boot::Phase::Mount);
+
     // load config file
-    CFG.load_from_file(ConfigFileName);
+    CFG.load_from_file(ConfigFileName, CompiledConfigFileName);
+    Boot::mark(Boot::Phase::Config);
 
     // apply static usb modes, if selected
     if (CFG.usb_mode == Config::UsbMode::AlwaysOn) {
@@ -56,16 +72,28 @@ bool init() {
         GPIO::usb_power_off();
     }
 
-    // load playback state
+    // load playback state, defaults are kept if there is no valid record
+    nv_state.regenerate(CFG.seed);
     if (CFG.save_state == Config::SaveState::Disabled || !nv_state.load_from_file(StateFileName)) {
-        // failed to load state / state disabled, reset to defaults
-        nv_state.regenerate(CFG.seed);
+        // failed to open state file / state disabled
         CFG.save_state = Config::SaveState::Disabled; // disable saving state if loading failed
     }
 
     return true;
 }
 
+bool remount() {
+    const CLUST n_fatent = fs.n_fatent;
+    const DWORD fatbase = fs.fatbase;
+    const DWORD database = fs.database;
+
+    if (pf_mount(&fs) != FR_OK) {
+        return false;
+    }
+    // a different card, directories and file in RAM don't belong to it
+    return fs.n_fatent == n_fatent && fs.fatbase == fatbase && fs.database == database;
+}
+
 bool open_main_directory() {
     FRESULT res = pf_opendir(&main_dir, "/");
     return res == FR_OK;
@@ -195,13 +223,16 @@ bool next_track_in_dir(bool &next_dir) {
         }
     }
 
+    nv_state.track_offset = 0;
     return true;
 }
 
 bool next_track() {
     bool next_dir_requested = false;
     do {
-        next_track_in_dir(next_dir_requested);
+        if (!next_track_in_dir(next_dir_requested)) {
+            return false;
+        }
         if (next_dir_requested) {
             if (!next_dir()) {
                 return false;
@@ -227,6 +258,7 @@ bool prev_track() {
         return false;
     }
 
+    nv_state.track_offset = 0;
     return true;
 }
 
@@ -269,6 +301,7 @@ bool next_dir() {
 
     subdir_iter = -1;
     nv_state.current_track_index = -1;
+    nv_state.track_offset = 0;
     nv_state.regenerate_key(CFG.seed);
     return true;
 }
@@ -282,6 +315,10 @@ PlaybackState& get_state() {
 }
 
 void request_state_save() {
+    if (CFG.saving_enabled(Config::SaveState::PowerFail)) {
+        return; // written by power fail handler
+    }
+
     save_state_requested = true;
 }
 
@@ -289,10 +326,36 @@ bool is_state_save_requested() {
     return save_state_requested;
 }
 
+void defer_state_save() {
+    if (CFG.saving_enabled(Config::SaveState::PowerFail)) {
+        return; // written by power fail handler
+    }
+
+    if (++deferred_saves >= MAX_DEFERRED_SAVES) {
+        handle_state_save();
+        return;
+    }
+
+    state_dirty = true;
+}
+
+bool is_state_dirty() {
+    return state_dirty;
+}
+
 void handle_state_save() {
-    // Simple state save - only used outside of playback
+    // Runs from the main loop, from the scheduler during playback (write_during_playback
+    // in audio_player.cpp) and from the power fail interrupt, which can preempt the others
+    Trace::record(Trace::Event::StateSaveStart);
     nv_state.save_to_file(StateFileName);
     save_state_requested = false;
+    state_dirty = false;
+    deferred_saves = 0;
+    Trace::record(Trace::Event::StateSaveEnd);
+}
+
+void handle_trace_save() {
+    Trace::save(TraceFileName);
 }
 
 } // namespace FileNavigator
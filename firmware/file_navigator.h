@@ -19,6 +19,13 @@ namespace FileNavigator {
  */
 bool init();
 
+/**
+ * @brief Mount the volume again after the disk layer gave up on a read,
+ *        directories, current file and state are kept as they are
+ * @return true if mounted and it is still the same volume, false otherwise
+ */
+bool remount();
+
 /**
  * @brief Open the main directory
  * @return true if successful, false otherwise
@@ -79,9 +86,28 @@ void request_state_save();
  */
 bool is_state_save_requested();
 
+/**
+ * @brief Mark state as changed without saving it yet
+ *
+ * Used for track-only changes. Saved on next state save, when playback gets muted,
+ * or after several deferred changes.
+ */
+void defer_state_save();
+
+/**
+ * @brief Check if state has unsaved changes
+ * @return true if deferred save is pending
+ */
+bool is_state_dirty();
+
 /**
  * @brief Perform the state save operation
  */
 void handle_state_save();
 
+/**
+ * @brief Write frozen event trace to TRACE.BIN, recording resumes
+ */
+void handle_trace_save();
+
 } // namespace FileNavigator
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "file_record.h"
+#include "utility.h"
+
+#include <cstring>
+
+namespace FileRecord {
+
+namespace {
+    // CRC is the last field, it covers everything before it
+    constexpr uint16_t CRC_SIZE = sizeof(uint32_t);
+
+    uint32_t record_crc(const void* record, uint16_t size) {
+        return crc32(record, size - CRC_SIZE);
+    }
+}
+
+void seal(void* record, uint16_t size, uint32_t magic, uint16_t version) {
+    Header& header = *static_cast<Header*>(record);
+    header.magic = magic;
+    header.version = version;
+    header.size = size;
+    const uint32_t crc = record_crc(record, size);
+    std::memcpy(static_cast<uint8_t*>(record) + size - CRC_SIZE, &crc, CRC_SIZE);
+}
+
+bool valid(const void* record, uint16_t size, uint32_t magic, uint16_t version) {
+    const Header& header = *static_cast<const Header*>(record);
+    if (header.magic != magic || header.version != version || header.size != size) {
+        return false;
+    }
+
+    uint32_t crc;
+    std::memcpy(&crc, static_cast<const uint8_t*>(record) + size - CRC_SIZE, CRC_SIZE);
+    return crc == record_crc(record, size);
+}
+
+bool read(uint32_t offset, void* record, UINT size) {
+    UINT br;
+    return pf_lseek_cached(offset) == FR_OK && pf_read_cached(record, size, &br) == FR_OK && br == size;
+}
+
+bool write(uint32_t offset, const Part* parts, uint32_t count) {
+    if (pf_lseek_cached(offset) != FR_OK) {
+        return false;
+    }
+
+    UINT bw;
+    for (uint32_t i = 0; i < count; i++) {
+        if (parts[i].size && pf_write(parts[i].data, parts[i].size, &bw) != FR_OK) {
+            return false;
+        }
+    }
+
+    return pf_write(0, 0, &bw) == FR_OK; // finalize write operation
+}
+
+} // namespace FileRecord
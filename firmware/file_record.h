@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "petitfat/source/pff.h"
+
+/*
+ * Records kept in files on the card (state journal, compiled config, card
+ * profile). A record type starts with Header, ends with a CRC-32 of the rest
+ * and names itself with MAGIC and VERSION members. One torn by a power loss,
+ * written by another firmware version or never written fails valid() and is
+ * treated as missing.
+ *
+ * Files are never created or grown (Petit FatFs can't), writes go to a file
+ * already on the card and always start a sector: the disk layer pads the
+ * rest of it.
+ */
+namespace FileRecord {
+
+struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;      // whole record, layout changes without a version bump are caught
+};
+
+// Data written by one write(), empty parts are skipped
+struct Part {
+    const void* data;
+    UINT size;
+};
+
+/**
+ * @brief Fill header and CRC of a record
+ */
+void seal(void* record, uint16_t size, uint32_t magic, uint16_t version);
+
+/**
+ * @brief Header matches and CRC is correct
+ */
+bool valid(const void* record, uint16_t size, uint32_t magic, uint16_t version);
+
+/**
+ * @brief Read a record from the open file
+ * @param offset File offset
+ * @return false at end of file or on read error, content isn't checked
+ */
+bool read(uint32_t offset, void* record, UINT size);
+
+/**
+ * @brief Write parts one after another to the open file, finalized
+ * @param offset File offset, sector aligned
+ * @return true if all of it was written
+ */
+bool write(uint32_t offset, const Part* parts, uint32_t count);
+
+template <typename T>
+void seal(T& record) {
+    static_assert(offsetof(T, header) == 0 && offsetof(T, crc) == sizeof(T) - sizeof(uint32_t));
+    seal(&record, sizeof(T), T::MAGIC, T::VERSION);
+}
+
+template <typename T>
+bool valid(const T& record) {
+    return valid(&record, sizeof(T), T::MAGIC, T::VERSION);
+}
+
+template <typename T>
+bool read(uint32_t offset, T& record) {
+    return read(offset, &record, sizeof(T));
+}
+
+template <typename T>
+bool write(uint32_t offset, const T& record) {
+    const Part part = {&record, sizeof(T)};
+    return write(offset, &part, 1);
+}
+
+} // namespace FileRecord
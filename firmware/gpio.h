@@ -28,6 +28,9 @@ class GPIO {
     static inline void usb_power_off() {
         GPIOA->BSRR = GPIO_BSRR_BR7; // set PA7 low
     };
+    static inline bool usb_powered() {
+        return (GPIOA->ODR & GPIO_ODR_OD7) != 0;
+    };
     static inline void sd_nss_set() {
         GPIOA->BSRR = GPIO_BSRR_BR4; // set PA4 low
     };
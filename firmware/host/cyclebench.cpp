@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Cycle benchmark. Loads the firmware ELF built for the chip (LooTunes.out)
+ * into the Cortex-M0+ instruction set simulator and runs the decode hot
+ * path on recorded or generated SBC frames:
+ *   - sbc_decode, output compared with the host build of the decoder, in
+ *     stereo and with the mono subband downmix
+ *   - sd_read_sector, the SPI polling loop reading one 512 byte block from a
+ *     card model clocked at fPCLK / spi-div
+ * and reports cycles per frame / sector, split by function.
+ */
+
+#include "elf_file.h"
+#include "thumb_core.h"
+#include "sbc_tone.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+constexpr double CORE_MHZ = 48.0;
+constexpr double OUTPUT_HZ = 48e6 / (271 * 4); // TIM1 update rate, PWM sample clock
+
+constexpr uint32_t FLASH_SIZE = 32 * 1024;
+constexpr uint32_t RAM_SIZE = 16 * 1024;        // chip has 4K, bench buffers live above it
+constexpr uint32_t SCRATCH = ThumbCore::RAM_BASE + 0x1000;
+constexpr uint32_t STACK_TOP = ThumbCore::RAM_BASE + RAM_SIZE;
+
+// eq=6,0,0,0,0,0,-3,-3 as AudioPlayer::set_equalizer() sets it: 1 bit headroom, Q15 of 2
+constexpr sbc_eq BASS_BOOST = { 1, 1, { 24537, 16384, 16384, 11598 },
+    { 32690, 16384, 16384, 16384, 16384, 16384, 11598, 11598 } };
+
+constexpr uint32_t SPI1_DR = 0x4001300c;
+constexpr uint32_t SPI1_SR = 0x40013008;
+
+/*
+ * Peripheral registers read back what was written, except SPI1 which shifts
+ * bytes of a card response at fPCLK / divider, with 4 byte TX / RX FIFOs.
+ */
+class Peripherals : public ThumbCore::Bus {
+public:
+    unsigned byte_cycles = 16;
+    std::deque<uint8_t> response;       // bytes card sends, 0xff when empty
+    uint64_t overruns = 0;
+
+    uint32_t read(uint32_t address, unsigned size, uint64_t cycle) override {
+        if (address == SPI1_SR) {
+            update(cycle);
+            uint32_t sr = 0;
+            sr |= rx.empty() ? 0 : 1u << 0;                         // RXNE
+            sr |= tx_queued <= 2 ? 1u << 1 : 0;                      // TXE
+            sr |= shifting || tx_queued ? 1u << 7 : 0;               // BSY
+            sr |= std::min<uint32_t>((uint32_t)rx.size(), 3) << 9;   // FRLVL
+            sr |= std::min<uint32_t>(tx_queued, 3) << 11;            // FTLVL
+            return sr;
+        }
+        if (address == SPI1_DR) {
+            update(cycle);
+            if (rx.empty()) {
+                return 0;
+            }
+            const uint8_t value = rx.front();
+            rx.pop_front();
+            return value;
+        }
+
+        const uint32_t word = registers[address & ~3u];
+        return size == 4 ? word : (word >> (8 * (address & 3))) & (size == 2 ? 0xffff : 0xff);
+    }
+
+    void write(uint32_t address, uint32_t value, unsigned size, uint64_t cycle) override {
+        if (address == SPI1_DR) {
+            update(cycle);
+            if (!shifting) {
+                shifting = true;
+                shift_end = cycle + byte_cycles;
+            }
+            else if (tx_queued < 4) {
+                tx_queued++;
+            }
+            return;
+        }
+
+        uint32_t& word = registers[address & ~3u];
+        if (size == 4) {
+            word = value;
+        }
+        else {
+            const unsigned shift = 8 * (address & 3);
+            const uint32_t mask = (size == 2 ? 0xffffu : 0xffu) << shift;
+            word = (word & ~mask) | ((value << shift) & mask);
+        }
+    }
+
+    void reset_spi() {
+        shifting = false;
+        tx_queued = 0;
+        rx.clear();
+    }
+
+private:
+    std::map<uint32_t, uint32_t> registers;
+    bool shifting = false;
+    uint64_t shift_end = 0;
+    uint32_t tx_queued = 0;
+    std::deque<uint8_t> rx;
+
+    void update(uint64_t cycle) {
+        while (shifting && shift_end <= cycle) {
+            uint8_t value = 0xff;
+            if (!response.empty()) {
+                value = response.front();
+                response.pop_front();
+            }
+            if (rx.size() < 4) {
+                rx.push_back(value);
+            }
+            else {
+                overruns++;
+            }
+
+            if (tx_queued) {
+                tx_queued--;
+                shift_end += byte_cycles;
+            }
+            else {
+                shifting = false;
+            }
+        }
+    }
+};
+
+struct Options {
+    const char* elf_path = nullptr;
+    const char* input_path = nullptr;
+    uint32_t frames = 256;
+    uint32_t sectors = 64;
+    uint32_t token_wait = 1;            // 0xff bytes before data token
+    unsigned spi_div = 2;
+    unsigned top = 12;
+    ThumbCore::CycleModel model;
+};
+
+struct Range {
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+    uint64_t total = 0;
+    uint64_t count = 0;
+
+    void add(uint64_t value) {
+        min = std::min(min, value);
+        max = std::max(max, value);
+        total += value;
+        count++;
+    }
+
+    double average() const { return count ? (double)total / count : 0; }
+};
+
+std::vector<std::vector<uint8_t>> split_frames(const std::vector<uint8_t>& stream) {
+    std::vector<std::vector<uint8_t>> frames;
+    size_t offset = 0;
+    while (offset + SBC_PROBE_SIZE <= stream.size()) {
+        struct sbc_frame frame;
+        if (sbc_probe(stream.data() + offset, &frame) != 0) {
+            offset++; // resync like the player
+            continue;
+        }
+        const unsigned size = sbc_get_frame_size(&frame);
+        if (offset + size > stream.size()) {
+            break;
+        }
+        frames.emplace_back(stream.begin() + offset, stream.begin() + offset + size);
+        offset += size;
+    }
+    return frames;
+}
+
+// tone in every subband at falling amplitudes, exercises all bit allocations
+std::vector<std::vector<uint8_t>> tone_frames(uint32_t count) {
+    struct sbc_frame frame = {};
+    frame.freq = SBC_FREQ_44K1;
+    frame.mode = SBC_MODE_STEREO;
+    frame.bam = SBC_BAM_LOUDNESS;
+    frame.nblocks = 16;
+    frame.nsubbands = 8;
+    frame.bitpool = 53;
+
+    std::vector<std::vector<uint8_t>> frames;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t data[512];
+        const int subband = (int)(i % 8);
+        const int amplitude = 32767 >> ((i / 8) % 12);
+        // right channel quieter, so channel scales differ for the mono downmix
+        const unsigned size = sbc_tone_frame_stereo(&frame, subband, amplitude, amplitude >> (i % 4),
+            data, sizeof(data));
+        frames.emplace_back(data, data + size);
+    }
+    return frames;
+}
+
+class Profile {
+public:
+    Profile(const ThumbCore& core, const ElfFile& elf) : core(core), elf(elf), start(core.profile()) {
+    }
+
+    /**
+     * @brief Cycles per function since construction
+     */
+    std::vector<std::pair<std::string, uint64_t>> functions() const {
+        std::map<std::string, uint64_t> totals;
+        const std::vector<uint64_t>& now = core.profile();
+        for (size_t i = 0; i < now.size(); i++) {
+            const uint64_t cycles = now[i] - start[i];
+            if (!cycles) {
+                continue;
+            }
+            const ElfFile::Symbol* symbol = elf.function_at(ThumbCore::FLASH_BASE + (uint32_t)i * 2);
+            totals[symbol ? symbol->pretty : "?"] += cycles;
+        }
+
+        std::vector<std::pair<std::string, uint64_t>> sorted(totals.begin(), totals.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+        return sorted;
+    }
+
+private:
+    const ThumbCore& core;
+    const ElfFile& elf;
+    std::vector<uint64_t> start;
+};
+
+void print_profile(const Profile& profile, uint64_t calls, unsigned top) {
+    const auto functions = profile.functions();
+    uint64_t total = 0;
+    for (const auto& f : functions) {
+        total += f.second;
+    }
+
+    std::printf("  %-44s %12s %7s\n", "function", "cycles/call", "share");
+    for (size_t i = 0; i < functions.size() && i < top; i++) {
+        std::string name = functions[i].first;
+        if (name.size() > 44) {
+            name = name.substr(0, 41) + "...";
+        }
+        std::printf("  %-44s %12.1f %6.1f%%\n", name.c_str(),
+            (double)functions[i].second / calls, 100.0 * functions[i].second / total);
+    }
+}
+
+void print_range(const char* what, const Range& range) {
+    std::printf("%s cycles: min %llu, avg %.1f, max %llu (max %.1f us at %.0f MHz)\n", what,
+        (unsigned long long)range.min, range.average(), (unsigned long long)range.max,
+        range.max / CORE_MHZ, CORE_MHZ);
+}
+
+// decoder output saturates at 16 bits, >> 6 around the PWM midpoint
+bool clipped(int16_t sample) {
+    return sample <= 136 * 4 - 512 || sample >= 136 * 4 + 511;
+}
+
+/**
+ * Decode frames on the target and compare with the host decoder. Mono runs
+ * the subband downmix (no right channel buffer) and also compares it with a
+ * time-domain downmix of the stereo output. Cycles per frame go to range.
+ */
+bool bench_decode(ThumbCore& core, const ElfFile& elf, const Options& options,
+        const std::vector<std::vector<uint8_t>>& frames, bool mono, const sbc_eq& eq, Range& range) {
+    const char* name = mono ? "sbc_decode (mono downmix)" : eq.enabled ? "sbc_decode (equaliser)" : "sbc_decode";
+    const ElfFile::Symbol* decode = elf.find("sbc_decode");
+    if (!decode || !decode->function) {
+        std::printf("%s: not in ELF\n", name);
+        return false;
+    }
+
+    const uint32_t ctx = SCRATCH;
+    const uint32_t frame_desc = ctx + ((sizeof(sbc_t) + 7) & ~7u);
+    const uint32_t data = frame_desc + 64;
+    const uint32_t pcml = data + 512;
+    const uint32_t pcmr = mono ? 0 : pcml + SBC_MAX_SAMPLES * 2;
+    const uint32_t bands = pcml + 2 * SBC_MAX_SAMPLES * 2;
+
+    const std::vector<uint8_t> zero(sizeof(sbc_t), 0);
+    core.poke(ctx, zero.data(), (uint32_t)zero.size());
+    if (const ElfFile::Symbol* reset = elf.find("sbc_reset")) {
+        core.call(reset->address, { ctx }, STACK_TOP);
+    }
+
+    // decoder output goes straight to the PWM duty buffers, unity gain (no gain set)
+    if (const ElfFile::Symbol* set_eq = elf.find("sbc_set_eq"); set_eq && eq.enabled) {
+        core.poke(bands, &eq, sizeof(eq));
+        core.call(set_eq->address, { ctx, bands }, STACK_TOP);
+    }
+
+    sbc_t host, host_stereo;
+    sbc_reset(&host);
+    sbc_reset(&host_stereo);
+    sbc_set_eq(&host, &eq);
+    sbc_set_eq(&host_stereo, &eq);
+
+    Profile profile(core, elf);
+    uint32_t mismatches = 0;
+    uint32_t samples_per_frame = 0;
+    double downmix_max = 0;
+    double downmix_square = 0;
+    uint64_t downmix_samples = 0;
+    uint64_t downmix_clipped = 0;
+    std::vector<uint64_t> per_frame;
+
+    for (const std::vector<uint8_t>& frame : frames) {
+        core.poke(data, frame.data(), (uint32_t)frame.size());
+
+        const uint64_t before = core.cycles();
+        if (!core.call(decode->address, { ctx, data, (uint32_t)frame.size(), frame_desc, pcml, pcmr }, STACK_TOP)) {
+            std::printf("%s: %s\n", name, core.error().c_str());
+            return false;
+        }
+        range.add(core.cycles() - before);
+        per_frame.push_back(core.cycles() - before);
+
+        struct sbc_frame desc;
+        int16_t left[SBC_MAX_SAMPLES], right[SBC_MAX_SAMPLES];
+        const int host_result = sbc_decode(&host, frame.data(), (unsigned)frame.size(), &desc,
+            left, mono ? nullptr : right);
+        samples_per_frame = (uint32_t)(desc.nblocks * desc.nsubbands);
+
+        int16_t target_left[SBC_MAX_SAMPLES], target_right[SBC_MAX_SAMPLES];
+        core.peek(pcml, target_left, samples_per_frame * 2);
+        if (pcmr) {
+            core.peek(pcmr, target_right, samples_per_frame * 2);
+        }
+        if ((int)core.result() != host_result
+                || std::memcmp(left, target_left, samples_per_frame * 2) != 0
+                || (pcmr && desc.mode != SBC_MODE_MONO && std::memcmp(right, target_right, samples_per_frame * 2) != 0)) {
+            mismatches++;
+        }
+
+        if (mono && desc.mode != SBC_MODE_MONO) {
+            int16_t stereo_left[SBC_MAX_SAMPLES], stereo_right[SBC_MAX_SAMPLES];
+            sbc_decode(&host_stereo, frame.data(), (unsigned)frame.size(), &desc, stereo_left, stereo_right);
+            for (uint32_t i = 0; i < samples_per_frame; i++) {
+                // a channel clipped in stereo is within range in the mix
+                if (clipped(stereo_left[i]) || clipped(stereo_right[i])) {
+                    downmix_clipped++;
+                    continue;
+                }
+                const double error = left[i] - (stereo_left[i] + stereo_right[i]) / 2.0;
+                downmix_max = std::max(downmix_max, std::fabs(error));
+                downmix_square += error * error;
+                downmix_samples++;
+            }
+        }
+    }
+
+    const double budget = samples_per_frame / OUTPUT_HZ * CORE_MHZ * 1e6;
+    std::printf("%s: %zu frames, %u samples each, output %s host decoder (%u mismatched)\n",
+        name, frames.size(), samples_per_frame, mismatches ? "DIFFERS from" : "matches", mismatches);
+    print_range("  per frame", range);
+    std::printf("  %.1f%% of the %.0f cycles a frame lasts at the PWM rate\n", 100.0 * range.average() / budget, budget);
+    // silent and sparse frames take the short paths, the worst case sets the budget
+    std::sort(per_frame.begin(), per_frame.end());
+    if (!per_frame.empty()) {
+        std::printf("  distribution:");
+        for (unsigned percent : { 10, 50, 90, 99 }) {
+            std::printf(" p%u %llu", percent, (unsigned long long)per_frame[(per_frame.size() - 1) * percent / 100]);
+        }
+        std::printf(" max %llu\n", (unsigned long long)per_frame.back());
+    }
+    if (downmix_samples) {
+        // PWM steps, rounding of both decodes and of the sum
+        std::printf("  time-domain downmix (L + R) / 2 differs by %.1f at most, %.2f rms (PWM steps),"
+            " %llu samples clipped in stereo skipped\n", downmix_max, std::sqrt(downmix_square / downmix_samples),
+            (unsigned long long)downmix_clipped);
+    }
+    print_profile(profile, range.count, options.top);
+
+    return mismatches == 0;
+}
+
+bool bench_sector(ThumbCore& core, const ElfFile& elf, Peripherals& peripherals, const Options& options,
+        const std::vector<uint8_t>& source) {
+    const ElfFile::Symbol* read_sector = elf.find("sd_read_sector");
+    if (!read_sector || !read_sector->function) {
+        std::printf("sd_read_sector: not in ELF (inlined?)\n");
+        return false;
+    }
+
+    // CMD18 stream running, block after block
+    if (const ElfFile::Symbol* multi = elf.find("(anonymous namespace)::sdMultiTransfer")) {
+        const uint8_t one = 1;
+        core.poke(multi->address, &one, 1);
+    }
+    const ElfFile::Symbol* cache = elf.find("(anonymous namespace)::sectorCache");
+
+    Profile profile(core, elf);
+    Range range;
+    uint32_t mismatches = 0;
+
+    for (uint32_t i = 0; i < options.sectors; i++) {
+        uint8_t block[512];
+        for (uint32_t j = 0; j < sizeof(block); j++) {
+            const size_t offset = (size_t)i * sizeof(block) + j;
+            block[j] = source.empty() ? (uint8_t)(offset * 7) : source[offset % source.size()];
+        }
+
+        peripherals.reset_spi();
+        peripherals.response.assign(options.token_wait, 0xff);
+        peripherals.response.push_back(0xfe);
+        peripherals.response.insert(peripherals.response.end(), block, block + sizeof(block));
+        peripherals.response.push_back(0x12); // CRC
+        peripherals.response.push_back(0x34);
+
+        const uint64_t before = core.cycles();
+        if (!core.call(read_sector->address, {}, STACK_TOP)) {
+            std::printf("sd_read_sector: %s\n", core.error().c_str());
+            return false;
+        }
+        range.add(core.cycles() - before);
+
+        uint8_t received[512];
+        if (cache && core.peek(cache->address, received, sizeof(received))
+                && std::memcmp(received, block, sizeof(block)) != 0) {
+            mismatches++;
+        }
+    }
+
+    const uint64_t wire = (uint64_t)(options.token_wait + 1 + 512 + 2) * peripherals.byte_cycles;
+    std::printf("sd_read_sector: %u sectors, SPI at fPCLK/%u, %s (%u mismatched, %llu RX overruns)\n",
+        options.sectors, options.spi_div, cache ? "data checked" : "data not checked",
+        mismatches, (unsigned long long)peripherals.overruns);
+    print_range("  per sector", range);
+    std::printf("  wire time %llu cycles, loop overhead %.1f%%, %.0f kB/s\n",
+        (unsigned long long)wire, 100.0 * (range.average() - wire) / wire,
+        512.0 / (range.average() / (CORE_MHZ * 1e6)) / 1024.0);
+    print_profile(profile, range.count, options.top);
+
+    return mismatches == 0 && peripherals.overruns == 0;
+}
+
+void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s <LooTunes.out> [--input file.sbc] [--frames n] [--sectors n]\n"
+        "       [--flash-ws n] [--periph-ws n] [--mul-cycles n] [--spi-div n] [--token-wait n] [--top n]\n"
+        "  --input       recorded SBC stream (default: generated tones)\n"
+        "  --frames      frames decoded (default 256, all of input if 0)\n"
+        "  --sectors     blocks read by sd_read_sector (default 64)\n"
+        "  --flash-ws    flash wait states (default 1)\n"
+        "  --periph-ws   peripheral bus wait states (default 1)\n"
+        "  --mul-cycles  MULS cycles, 1 or 32 (default 1)\n"
+        "  --spi-div     SPI clock divider in fast mode (default 2)\n"
+        "  --token-wait  0xff bytes before data token (default 1)\n"
+        "  --top         functions listed (default 12)\n",
+        name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Options options;
+    options.elf_path = argv[1];
+    bool frames_given = false;
+
+    for (int i = 2; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--input") == 0 && has_value) {
+            options.input_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && has_value) {
+            options.frames = (uint32_t)std::atoi(argv[++i]);
+            frames_given = true;
+        }
+        else if (std::strcmp(argv[i], "--sectors") == 0 && has_value) {
+            options.sectors = (uint32_t)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--flash-ws") == 0 && has_value) {
+            options.model.flash_wait_states = (unsigned)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--periph-ws") == 0 && has_value) {
+            options.model.periph_wait_states = (unsigned)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--mul-cycles") == 0 && has_value) {
+            options.model.mul_cycles = (unsigned)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--spi-div") == 0 && has_value) {
+            options.spi_div = (unsigned)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--token-wait") == 0 && has_value) {
+            options.token_wait = (uint32_t)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--top") == 0 && has_value) {
+            options.top = (unsigned)std::atoi(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    ElfFile elf;
+    if (!elf.load(options.elf_path)) {
+        std::fprintf(stderr, "%s: %s\n", options.elf_path, elf.error().c_str());
+        return 1;
+    }
+
+    ThumbCore core(options.model, FLASH_SIZE, RAM_SIZE);
+    for (const ElfFile::Segment& segment : elf.segments()) {
+        // .data is copied from its load address by startup code, do it here
+        bool placed = core.poke(segment.paddr, segment.data.data(), (uint32_t)segment.data.size());
+        if (segment.vaddr != segment.paddr) {
+            placed = core.poke(segment.vaddr, segment.data.data(), (uint32_t)segment.data.size()) || placed;
+        }
+        if (!placed) {
+            std::fprintf(stderr, "segment at %08x doesn't fit flash / RAM\n", (unsigned)segment.vaddr);
+            return 1;
+        }
+    }
+
+    Peripherals peripherals;
+    peripherals.byte_cycles = 8 * options.spi_div;
+    core.set_bus(&peripherals);
+
+    std::vector<uint8_t> input;
+    std::vector<std::vector<uint8_t>> frames;
+    if (options.input_path) {
+        std::ifstream in(options.input_path, std::ios::binary);
+        if (!in) {
+            std::fprintf(stderr, "can't open %s\n", options.input_path);
+            return 1;
+        }
+        input.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        frames = split_frames(input);
+        if (frames_given && options.frames && frames.size() > options.frames) {
+            frames.resize(options.frames);
+        }
+    }
+    else {
+        frames = tone_frames(options.frames);
+    }
+
+    std::printf("%s\nmodel: flash_ws=%u periph_ws=%u mul_cycles=%u\n", options.elf_path,
+        options.model.flash_wait_states, options.model.periph_wait_states, options.model.mul_cycles);
+
+    bool ok = true;
+    if (!frames.empty()) {
+        Range stereo, mono, equalised;
+        ok = bench_decode(core, elf, options, frames, false, sbc_eq {}, stereo) && ok;
+        ok = bench_decode(core, elf, options, frames, true, sbc_eq {}, mono) && ok;
+        std::printf("mono downmix: %.1f%% of stereo decode cycles\n", 100.0 * mono.average() / stereo.average());
+        ok = bench_decode(core, elf, options, frames, false, BASS_BOOST, equalised) && ok;
+        std::printf("equaliser: %+.0f cycles per frame, %.1f%% of stereo decode cycles\n",
+            equalised.average() - stereo.average(), 100.0 * equalised.average() / stereo.average());
+    }
+    if (options.sectors) {
+        ok = bench_sector(core, elf, peripherals, options, input) && ok;
+    }
+
+    std::printf("total: %llu instructions, %llu cycles\n",
+        (unsigned long long)core.instructions(), (unsigned long long)core.cycles());
+
+    return ok ? 0 : 2;
+}
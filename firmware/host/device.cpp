@@ -0,0 +1,862 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "device.h"
+#include "mcu.h"
+#include "sd_card.h"
+#include "sd_spi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <sys/mman.h>
+#include <vector>
+
+namespace HostDevice {
+
+namespace {
+    constexpr double NEVER = std::numeric_limits<double>::infinity();
+
+    // written over every sample DMA has taken from RAM, decoder output never gets here
+    constexpr uint16_t POISON = 0x7FFF;
+
+    // SYSCFG_CFGR3 DMAx_MAP value of TIM1 update request
+    constexpr uint32_t DMA_MAP_TIM1_UP = 16;
+
+    constexpr uint32_t CRC_POLY = 0x04C11DB7;
+    constexpr uint32_t CRC_INIT = 0xFFFFFFFF;
+
+    // factory trimming values, UID, flash size (HAL reads HSI calibration here)
+    constexpr uintptr_t SYSTEM_MEMORY = 0x1FFF0000;
+    constexpr size_t SYSTEM_MEMORY_SIZE = 0x1000;
+    constexpr uint32_t FLASH_KB = 32;
+
+    constexpr uint32_t LED_PIN = 2;     // PB2
+    constexpr uint32_t USB_PIN = 7;     // PA7
+    constexpr uint32_t SD_CS_PIN = 4;   // PA4
+    constexpr uint32_t PVD_LINE = 16;
+
+    constexpr double LSI_HZ = 32768.0;
+
+    Options options;
+    HostPeripherals* regs = nullptr;    // model view
+    double now = 0;
+
+    SampleSink sample_sink = nullptr;
+    EventSink event_sink = nullptr;
+
+    uintptr_t ram_begin = 0;
+    uintptr_t ram_end = 0;
+
+    uint16_t light = 0xFFF;             // dark
+    bool supply_low = false;
+    bool led = false;
+    bool usb = false;
+
+    double adc_due = NEVER;
+    double adc_stop_due = NEVER;        // ADSTP waits for conversion in progress
+    double lptim_due = NEVER;           // ARR match of single mode run
+
+    struct Timer {
+        TIM_TypeDef* tim;
+        int irq;
+        bool running;
+        double origin;                  // time counter was at 0
+        bool cc1_done;
+        uint32_t repetition;
+    };
+
+    Timer timers[5];
+    Timer& tim1 = timers[0];
+
+    struct Channel {
+        DMA_Channel_TypeDef* regs;
+        uint32_t number;
+        bool active;
+        uint32_t reload;                // CNDTR at enable
+        uint32_t remaining;
+        uint32_t base;                  // memory address transfers are counted from
+        std::vector<uint16_t> stale;    // last value taken from each RAM slot
+    };
+
+    Channel channels[3];
+
+    constexpr uint32_t SPI_RX_FIFO = 4;
+    uint8_t spi_rx[SPI_RX_FIFO];
+    uint32_t spi_rx_count = 0;
+    double spi_transfer_us = 0;         // bytes clocked by the last access, charged after it
+
+    void event(const char* format, ...) {
+        if (!event_sink) {
+            return;
+        }
+
+        char text[160];
+        va_list args;
+        va_start(args, format);
+        std::vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        event_sink(now, text);
+    }
+
+    template <typename T>
+    bool within(size_t offset, const T& block, size_t& reg) {
+        const size_t base = (size_t)(reinterpret_cast<const uint8_t*>(&block) - reinterpret_cast<const uint8_t*>(regs));
+        if (offset < base || offset >= base + sizeof(T)) {
+            return false;
+        }
+        reg = offset - base;
+        return true;
+    }
+
+    bool is_ram(uint32_t address) {
+        return address >= ram_begin && address < ram_end;
+    }
+
+    uint32_t read_bus(uint32_t address, uint32_t size) {
+        uint32_t value = 0;
+        const ptrdiff_t offset = HostMcu::peripheral_offset(address);
+        const void* source = offset >= 0
+            ? reinterpret_cast<const uint8_t*>(regs) + offset
+            : reinterpret_cast<const void*>((uintptr_t)address);
+        std::memcpy(&value, source, size);
+        return value;
+    }
+
+    void write_bus(uint32_t address, uint32_t value, uint32_t size) {
+        const ptrdiff_t offset = HostMcu::peripheral_offset(address);
+        void* target = offset >= 0
+            ? reinterpret_cast<uint8_t*>(regs) + offset
+            : reinterpret_cast<void*>((uintptr_t)address);
+        std::memcpy(target, &value, size);
+    }
+
+    /* --- EXTI / GPIO --- */
+
+    int exti_irq(uint32_t line) {
+        if (line == PVD_LINE) {
+            return PVD_IRQn;
+        }
+        return line < 2 ? EXTI0_1_IRQn : line < 4 ? EXTI2_3_IRQn : EXTI4_15_IRQn;
+    }
+
+    void exti_edge(uint32_t line, bool rising) {
+        const uint32_t bit = 1u << line;
+        if (!((rising ? regs->EXTI_regs.RTSR : regs->EXTI_regs.FTSR) & bit)) {
+            return;
+        }
+
+        regs->EXTI_regs.PR |= bit;
+        if (regs->EXTI_regs.IMR & bit) {
+            HostMcu::raise(exti_irq(line));
+        }
+    }
+
+    void set_input(GPIO_TypeDef& gpio, uint32_t port, uint32_t pin, bool high) {
+        const uint32_t bit = 1u << pin;
+        if (((gpio.IDR & bit) != 0) == high) {
+            return;
+        }
+
+        gpio.IDR = high ? gpio.IDR | bit : gpio.IDR & ~bit;
+
+        const uint32_t select = (regs->EXTI_regs.EXTICR[pin / 4] >> (pin % 4 * 8)) & 3;
+        if (select == port) {
+            exti_edge(pin, high);
+        }
+    }
+
+    void update_outputs() {
+        const bool led_now = (regs->GPIOB_regs.ODR >> LED_PIN) & 1;
+        const bool usb_now = (regs->GPIOA_regs.ODR >> USB_PIN) & 1;
+
+        if (led_now != led) {
+            led = led_now;
+            event("led %s", led ? "on" : "off");
+        }
+        if (usb_now != usb) {
+            usb = usb_now;
+            event("usb power %s", usb ? "on" : "off");
+        }
+
+        HostSdSpi::select(!((regs->GPIOA_regs.ODR >> SD_CS_PIN) & 1));
+    }
+
+    void update_pvd() {
+        const bool output = (regs->PWR_regs.CR2 & PWR_CR2_PVDE) && supply_low;
+        if (output == ((regs->PWR_regs.SR & PWR_SR_PVDO) != 0)) {
+            return;
+        }
+
+        regs->PWR_regs.SR ^= PWR_SR_PVDO;
+        exti_edge(PVD_LINE, output);
+    }
+
+    /* --- ADC --- */
+
+    void schedule_adc() {
+        const ADC_TypeDef& adc = regs->ADC1_regs;
+        const bool running = (adc.CR & ADC_CR_ADEN) && (adc.CR & ADC_CR_ADSTART);
+        const uint32_t low = (adc.TR & ADC_TR_LT_Msk) >> ADC_TR_LT_Pos;
+        const uint32_t high = (adc.TR & ADC_TR_HT_Msk) >> ADC_TR_HT_Pos;
+
+        if (!running) {
+            adc_due = NEVER;
+        }
+        else if (!(adc.CFGR1 & ADC_CFGR1_CONT)) {
+            // single conversion, already scheduled when ADSTART was set
+            if (adc_due == NEVER) {
+                adc_due = now + options.adc_conversion_us;
+            }
+        }
+        else {
+            // conversions inside the window are invisible to firmware
+            adc_due = (adc.CFGR1 & ADC_CFGR1_AWDEN) && !(adc.ISR & ADC_ISR_AWD)
+                    && (light < low || light > high)
+                ? now + options.adc_conversion_us : NEVER;
+        }
+    }
+
+    void stop_adc() {
+        regs->ADC1_regs.CR &= ~(ADC_CR_ADSTP | ADC_CR_ADSTART);
+        adc_stop_due = NEVER;
+        schedule_adc();
+    }
+
+    void fire_adc() {
+        ADC_TypeDef& adc = regs->ADC1_regs;
+        const uint32_t low = (adc.TR & ADC_TR_LT_Msk) >> ADC_TR_LT_Pos;
+        const uint32_t high = (adc.TR & ADC_TR_HT_Msk) >> ADC_TR_HT_Pos;
+
+        adc.DR = light;
+        adc.ISR |= ADC_ISR_EOC | ADC_ISR_EOSEQ;
+        if ((adc.CFGR1 & ADC_CFGR1_AWDEN) && (light < low || light > high)) {
+            adc.ISR |= ADC_ISR_AWD;
+        }
+        if (!(adc.CFGR1 & ADC_CFGR1_CONT)) {
+            adc.CR &= ~ADC_CR_ADSTART;
+        }
+        if (adc.ISR & adc.IER) {
+            HostMcu::raise(ADC_COMP_IRQn);
+        }
+        adc_due = NEVER;
+    }
+
+    /* --- LPTIM --- */
+
+    void schedule_lptim() {
+        const LPTIM_TypeDef& lptim = regs->LPTIM_regs;
+        const bool lsi = (regs->RCC_regs.CCIPR & RCC_CCIPR_LPTIMSEL) == RCC_CCIPR_LPTIMSEL_0;
+        const double tick_us = (1u << ((lptim.CFGR & LPTIM_CFGR_PRESC) >> LPTIM_CFGR_PRESC_Pos))
+            * (lsi ? 1e6 / LSI_HZ : 1.0 / CORE_MHZ);
+
+        if (!(lptim.CR & LPTIM_CR_ENABLE)) {
+            lptim_due = NEVER;
+        }
+        else if (lptim.CR & LPTIM_CR_SNGSTRT) {
+            // counts from 0 up to ARR once, start bit reads back as 0
+            lptim_due = now + ((lptim.ARR & 0xFFFF) + 1) * tick_us;
+            regs->LPTIM_regs.CR &= ~LPTIM_CR_SNGSTRT;
+        }
+    }
+
+    void fire_lptim() {
+        LPTIM_TypeDef& lptim = regs->LPTIM_regs;
+        lptim.ISR |= LPTIM_ISR_ARRM;
+        if (lptim.IER & LPTIM_IER_ARRMIE) {
+            HostMcu::raise(LPTIM1_IRQn);
+        }
+        lptim_due = NEVER;
+    }
+
+    /* --- DMA --- */
+
+    void dma_flag(Channel& channel, uint32_t flag) {
+        const uint32_t shift = (channel.number - 1) * 4;
+        regs->DMA1_regs.ISR |= (flag | DMA_ISR_GIF1) << shift;
+
+        // TCIE / HTIE sit at the same positions as TCIF / HTIF
+        if (channel.regs->CCR & flag) {
+            HostMcu::raise(channel.number == 1 ? DMA1_Channel1_IRQn : DMA1_Channel2_3_IRQn);
+        }
+    }
+
+    void set_base(Channel& channel, uint32_t base) {
+        if (channel.number == 1 && is_ram(base) != is_ram(channel.base)) {
+            event("output: %s", is_ram(base) ? "decoded audio" : "silence");
+        }
+        channel.base = base;
+    }
+
+    void dma_enable(Channel& channel) {
+        channel.active = true;
+        channel.reload = channel.regs->CNDTR & 0xFFFF;
+        channel.remaining = channel.reload;
+        set_base(channel, channel.regs->CMAR);
+        channel.stale.assign(channel.reload, 0);
+    }
+
+    /**
+     * Single transfer, returns true if a RAM slot was taken before it was
+     * written again (decoder didn't keep up). Slot taken is returned in
+     * taken (0 if none), caller poisons it once all channels of the request
+     * are done, so channels sharing a buffer read the same sample.
+     */
+    bool dma_transfer(Channel& channel, uint32_t& taken) {
+        taken = 0;
+        if (!channel.active || channel.reload == 0) {
+            return false;
+        }
+
+        const uint32_t ccr = channel.regs->CCR;
+        const uint32_t msize = 1u << ((ccr >> DMA_CCR_MSIZE_Pos) & 3);
+        const uint32_t psize = 1u << ((ccr >> DMA_CCR_PSIZE_Pos) & 3);
+        const uint32_t index = channel.reload - channel.remaining;
+        const uint32_t memory = channel.base + (ccr & DMA_CCR_MINC ? index * msize : 0);
+        const uint32_t peripheral = channel.regs->CPAR + (ccr & DMA_CCR_PINC ? index * psize : 0);
+        bool underrun = false;
+
+        if (ccr & DMA_CCR_DIR) {
+            uint32_t value = read_bus(memory, msize);
+
+            if (msize == 2 && (ccr & DMA_CCR_CIRC) && is_ram(memory)) {
+                if (value == POISON) {
+                    underrun = true;
+                    value = channel.stale[index]; // hardware would play it again
+                }
+                else {
+                    channel.stale[index] = (uint16_t)value;
+                    taken = memory;
+                }
+            }
+
+            write_bus(peripheral, value, psize);
+        }
+        else {
+            write_bus(memory, read_bus(peripheral, psize), msize);
+        }
+
+        channel.remaining--;
+        if (channel.remaining == channel.reload / 2) {
+            dma_flag(channel, DMA_ISR_HTIF1);
+        }
+        if (channel.remaining == 0) {
+            dma_flag(channel, DMA_ISR_TCIF1);
+            if (ccr & DMA_CCR_CIRC) {
+                channel.remaining = channel.reload;
+                set_base(channel, channel.regs->CMAR);
+            }
+            else {
+                channel.active = false;
+            }
+        }
+
+        channel.regs->CNDTR = channel.remaining;
+        return underrun;
+    }
+
+    /* --- SPI1 --- */
+
+    // Byte transfers complete at the DR write, their time is charged right after the
+    // access; TX FIFO is always empty, BSY never set
+    void spi_status() {
+        SPI_TypeDef& spi = regs->SPI1_regs;
+        spi.SR = (spi.SR & SPI_SR_OVR) | SPI_SR_TXE
+            | (spi_rx_count ? SPI_SR_RXNE | std::min(spi_rx_count, 3u) << SPI_SR_FRLVL_Pos : 0);
+    }
+
+    void spi_transfer() {
+        SPI_TypeDef& spi = regs->SPI1_regs;
+        if (!(spi.CR1 & SPI_CR1_SPE)) {
+            event("spi: DR written while disabled");
+            return;
+        }
+
+        const uint8_t miso = HostSdSpi::exchange((uint8_t)spi.DR);
+        if (spi_rx_count < SPI_RX_FIFO) {
+            spi_rx[spi_rx_count++] = miso;
+        }
+        else {
+            spi.SR |= SPI_SR_OVR;
+        }
+
+        const uint32_t br = (spi.CR1 & SPI_CR1_BR_Msk) >> SPI_CR1_BR_Pos;
+        spi_transfer_us += 8.0 * (2u << br) / CORE_MHZ;
+        spi_status();
+    }
+
+    void spi_receive() {
+        SPI_TypeDef& spi = regs->SPI1_regs;
+        if (spi_rx_count) {
+            spi.DR = spi_rx[0];
+            std::copy(spi_rx + 1, spi_rx + spi_rx_count, spi_rx);
+            spi_rx_count--;
+        }
+        spi.SR &= ~SPI_SR_OVR;
+        spi_status();
+    }
+
+    /* --- Timers --- */
+
+    double tick_us(uint32_t psc) {
+        return (psc + 1) / CORE_MHZ;
+    }
+
+    uint32_t period(const Timer& timer) {
+        return timer.tim->ARR + 1;
+    }
+
+    uint32_t counter(const Timer& timer) {
+        if (!timer.running) {
+            return timer.tim->CNT;
+        }
+        const double ticks = std::floor((now - timer.origin) / tick_us(timer.tim->PSC) + 1e-9);
+        return (uint32_t)std::fmod(ticks, (double)period(timer));
+    }
+
+    void restart(Timer& timer, uint32_t count) {
+        timer.origin = now - count * tick_us(timer.tim->PSC);
+        timer.cc1_done = count > timer.tim->CCR1;
+    }
+
+    bool observable(const Timer& timer) {
+        return (timer.tim->DIER & (TIM_DIER_UIE | TIM_DIER_CC1IE | TIM_DIER_UDE))
+            || (timer.tim->CR1 & TIM_CR1_OPM);
+    }
+
+    double next_timer_event(const Timer& timer) {
+        if (!timer.running || !observable(timer)) {
+            return NEVER;
+        }
+
+        const double tick = tick_us(timer.tim->PSC);
+        const double update = timer.origin + period(timer) * tick;
+        if ((timer.tim->DIER & TIM_DIER_CC1IE) && !timer.cc1_done && timer.tim->CCR1 < period(timer)) {
+            return std::min(update, timer.origin + timer.tim->CCR1 * tick);
+        }
+        return update;
+    }
+
+    void timer_update(Timer& timer);
+
+    void fire_timer(Timer& timer) {
+        TIM_TypeDef& tim = *timer.tim;
+        const double tick = tick_us(tim.PSC);
+        const double update = timer.origin + period(timer) * tick;
+
+        if (!timer.cc1_done && (tim.DIER & TIM_DIER_CC1IE) && timer.origin + tim.CCR1 * tick < update) {
+            timer.cc1_done = true;
+            tim.SR |= TIM_SR_CC1IF;
+            HostMcu::raise(timer.irq);
+            return;
+        }
+
+        timer.origin = update;
+        timer.cc1_done = false;
+
+        if (timer.repetition > 0) {
+            timer.repetition--;
+            return;
+        }
+        timer.repetition = tim.RCR;
+
+        tim.SR |= TIM_SR_UIF;
+        if ((tim.DIER & TIM_DIER_UIE) && timer.irq >= 0) {
+            HostMcu::raise(timer.irq);
+        }
+
+        if (tim.CR1 & TIM_CR1_OPM) {
+            timer.running = false;
+            tim.CR1 &= ~TIM_CR1_CEN;
+            tim.CNT = 0;
+        }
+
+        if (&timer == &tim1) {
+            timer_update(timer);
+        }
+    }
+
+    /**
+     * TIM1 update: DMA requests of channels mapped to it, then PWM output
+     */
+    void timer_update(Timer& timer) {
+        TIM_TypeDef& tim = *timer.tim;
+        bool underrun = false;
+
+        if (tim.DIER & TIM_DIER_UDE) {
+            uint32_t taken[std::size(channels)];
+            for (Channel& channel : channels) {
+                uint32_t& slot = taken[&channel - channels];
+                slot = 0;
+                const uint32_t map = (regs->SYSCFG_regs.CFGR3 >> ((channel.number - 1) * 8)) & 0x1F;
+                if (map == DMA_MAP_TIM1_UP) {
+                    underrun |= dma_transfer(channel, slot);
+                }
+            }
+            for (uint32_t slot : taken) {
+                if (slot) {
+                    write_bus(slot, POISON, 2);
+                }
+            }
+        }
+
+        if (!sample_sink) {
+            return;
+        }
+
+        const bool output = (tim.BDTR & TIM_BDTR_MOE) && (tim.CR1 & TIM_CR1_CEN);
+        Sample sample;
+        sample.left = output && (tim.CCER & TIM_CCER_CC2E) ? (uint16_t)tim.CCR2 : 0;
+        sample.right = output && (tim.CCER & TIM_CCER_CC3E) ? (uint16_t)tim.CCR3 : 0;
+        sample.period = (uint16_t)period(timer);
+        sample.underrun = underrun;
+        sample.mute_pending = channels[0].active && channels[0].base != channels[0].regs->CMAR;
+        sample_sink(now, sample);
+    }
+
+    void timer_write(Timer& timer, size_t reg, uint32_t old) {
+        TIM_TypeDef& tim = *timer.tim;
+
+        if (reg == offsetof(TIM_TypeDef, CR1)) {
+            const bool enable = tim.CR1 & TIM_CR1_CEN;
+            if (enable && !timer.running) {
+                timer.running = true;
+                timer.repetition = tim.RCR;
+                restart(timer, tim.CNT);
+            }
+            else if (!enable && timer.running) {
+                tim.CNT = counter(timer);
+                timer.running = false;
+            }
+        }
+        else if (reg == offsetof(TIM_TypeDef, CNT)) {
+            if (timer.running) {
+                restart(timer, tim.CNT);
+            }
+        }
+        else if (reg == offsetof(TIM_TypeDef, PSC)) {
+            if (timer.running) {
+                const double ticks = (now - timer.origin) / tick_us(old);
+                timer.origin = now - ticks * tick_us(tim.PSC);
+            }
+        }
+        else if (reg == offsetof(TIM_TypeDef, EGR)) {
+            if (tim.EGR & TIM_EGR_UG) {
+                tim.CNT = 0;
+                timer.repetition = tim.RCR;
+                if (timer.running) {
+                    restart(timer, 0);
+                }
+            }
+            tim.EGR = 0;
+        }
+        else if (reg == offsetof(TIM_TypeDef, DIER) && timer.running) {
+            // counter wasn't followed while nothing could observe it
+            restart(timer, counter(timer));
+        }
+    }
+
+    /* --- Register access --- */
+
+    uint32_t crc32(uint32_t crc, uint32_t data) {
+        crc ^= data;
+        for (int bit = 0; bit < 32; bit++) {
+            crc = crc & 0x80000000u ? (crc << 1) ^ CRC_POLY : crc << 1;
+        }
+        return crc;
+    }
+
+    void apply_write(size_t offset, uint32_t old) {
+        size_t reg;
+
+        for (Timer& timer : timers) {
+            if (within(offset, *timer.tim, reg)) {
+                timer_write(timer, reg, old);
+                return;
+            }
+        }
+
+        for (Channel& channel : channels) {
+            if (within(offset, *channel.regs, reg)) {
+                if (reg == offsetof(DMA_Channel_TypeDef, CCR)) {
+                    const bool enable = channel.regs->CCR & DMA_CCR_EN;
+                    if (enable && !(old & DMA_CCR_EN)) {
+                        dma_enable(channel);
+                    }
+                    else if (!enable) {
+                        channel.active = false;
+                    }
+                }
+                else if (reg == offsetof(DMA_Channel_TypeDef, CMAR) && options.cmar_live && channel.active) {
+                    set_base(channel, channel.regs->CMAR);
+                }
+                return;
+            }
+        }
+
+        if (within(offset, regs->DMA1_regs, reg)) {
+            if (reg == offsetof(DMA_TypeDef, IFCR)) {
+                uint32_t clear = regs->DMA1_regs.IFCR;
+                for (uint32_t shift = 0; shift < 12; shift += 4) {
+                    if (clear & (DMA_IFCR_CGIF1 << shift)) {
+                        clear |= 0xFu << shift;
+                    }
+                }
+                regs->DMA1_regs.ISR &= ~clear;
+                regs->DMA1_regs.IFCR = 0;
+            }
+            return;
+        }
+
+        if (within(offset, regs->EXTI_regs, reg)) {
+            if (reg == offsetof(EXTI_TypeDef, PR)) {
+                regs->EXTI_regs.PR = old & ~regs->EXTI_regs.PR;
+            }
+            return;
+        }
+
+        if (within(offset, regs->ADC1_regs, reg)) {
+            ADC_TypeDef& adc = regs->ADC1_regs;
+            if (reg == offsetof(ADC_TypeDef, ISR)) {
+                adc.ISR = old & ~adc.ISR;
+            }
+            else if (reg == offsetof(ADC_TypeDef, CR)) {
+                // calibration completes at once, stop after the conversion in progress
+                adc.CR &= ~ADC_CR_ADCAL;
+                if ((adc.CR & ADC_CR_ADSTP) && adc_stop_due == NEVER) {
+                    adc_stop_due = now + options.adc_conversion_us;
+                }
+            }
+            schedule_adc();
+            return;
+        }
+
+        if (within(offset, regs->LPTIM_regs, reg)) {
+            LPTIM_TypeDef& lptim = regs->LPTIM_regs;
+            if (reg == offsetof(LPTIM_TypeDef, ICR)) {
+                lptim.ISR &= ~lptim.ICR;
+                lptim.ICR = 0;
+            }
+            else if (reg == offsetof(LPTIM_TypeDef, CR)) {
+                schedule_lptim();
+            }
+            return;
+        }
+
+        if (within(offset, regs->PWR_regs, reg)) {
+            update_pvd();
+            return;
+        }
+
+        if (within(offset, regs->SPI1_regs, reg)) {
+            if (reg == offsetof(SPI_TypeDef, DR)) {
+                spi_transfer();
+            }
+            else if (reg == offsetof(SPI_TypeDef, SR)) {
+                regs->SPI1_regs.SR = old; // read only
+            }
+            return;
+        }
+
+        if (within(offset, regs->CRC_regs, reg)) {
+            CRC_TypeDef& crc = regs->CRC_regs;
+            if (reg == offsetof(CRC_TypeDef, DR)) {
+                crc.DR = crc32(old, crc.DR);
+            }
+            else if (reg == offsetof(CRC_TypeDef, CR) && (crc.CR & CRC_CR_RESET)) {
+                crc.DR = CRC_INIT;
+                crc.CR &= ~CRC_CR_RESET;
+            }
+            return;
+        }
+
+        for (GPIO_TypeDef* gpio : { &regs->GPIOA_regs, &regs->GPIOB_regs, &regs->GPIOF_regs }) {
+            if (within(offset, *gpio, reg)) {
+                if (reg == offsetof(GPIO_TypeDef, BSRR)) {
+                    const uint32_t bsrr = gpio->BSRR;
+                    gpio->ODR = (gpio->ODR & ~(bsrr >> 16)) | (bsrr & 0xFFFF);
+                    gpio->BSRR = 0;
+                }
+                else if (reg == offsetof(GPIO_TypeDef, BRR)) {
+                    gpio->ODR &= ~gpio->BRR;
+                    gpio->BRR = 0;
+                }
+                update_outputs();
+                return;
+            }
+        }
+    }
+
+    void on_access(HostMcu::Access phase, size_t offset, bool write, uint32_t old) {
+        if (phase == HostMcu::Access::Before) {
+            size_t reg;
+            for (Timer& timer : timers) {
+                if (within(offset, *timer.tim, reg) && reg == offsetof(TIM_TypeDef, CNT)) {
+                    timer.tim->CNT = counter(timer);
+                }
+            }
+            if (!write && within(offset, regs->SPI1_regs, reg) && reg == offsetof(SPI_TypeDef, DR)) {
+                spi_receive();
+            }
+            return;
+        }
+
+        if (write) {
+            apply_write(offset, old);
+        }
+
+        // may take interrupts, firmware is between instructions here
+        const double us = options.bus_us + spi_transfer_us;
+        spi_transfer_us = 0;
+        HostSd::advance_us(us);
+    }
+
+    bool line_active(int irq) {
+        const uint32_t dma = regs->DMA1_regs.ISR;
+        const uint32_t exti = regs->EXTI_regs.PR & regs->EXTI_regs.IMR;
+
+        auto channel_active = [dma](const Channel& channel) {
+            const uint32_t shift = (channel.number - 1) * 4;
+            return ((dma >> shift) & channel.regs->CCR & (DMA_CCR_TCIE | DMA_CCR_HTIE | DMA_CCR_TEIE)) != 0;
+        };
+
+        switch (irq) {
+            case DMA1_Channel1_IRQn:
+                return channel_active(channels[0]);
+            case DMA1_Channel2_3_IRQn:
+                return channel_active(channels[1]) || channel_active(channels[2]);
+            case EXTI0_1_IRQn:
+                return exti & 0x3;
+            case EXTI2_3_IRQn:
+                return exti & 0xC;
+            case EXTI4_15_IRQn:
+                return exti & 0xFFF0;
+            case PVD_IRQn:
+                return exti & (1u << PVD_LINE);
+            case ADC_COMP_IRQn:
+                return regs->ADC1_regs.ISR & regs->ADC1_regs.IER;
+            case LPTIM1_IRQn:
+                return regs->LPTIM_regs.ISR & regs->LPTIM_regs.IER;
+        }
+
+        for (const Timer& timer : timers) {
+            if (timer.irq == irq) {
+                return timer.tim->SR & timer.tim->DIER & (TIM_SR_UIF | TIM_SR_CC1IF);
+            }
+        }
+        return false;
+    }
+}
+
+bool init(const Options& opts) {
+    options = opts;
+
+    if (!HostMcu::trap_peripheral_access(on_access)) {
+        return false;
+    }
+    regs = HostMcu::peripherals();
+    std::memset(regs, 0, sizeof(*regs));
+
+    void* system = mmap(reinterpret_cast<void*>(SYSTEM_MEMORY), SYSTEM_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (system == MAP_FAILED) {
+        return false;
+    }
+    *reinterpret_cast<uint16_t*>(FLASHSIZE_BASE) = FLASH_KB;
+
+    // reset values
+    for (TIM_TypeDef* tim : { &regs->TIM1_regs, &regs->TIM3_regs, &regs->TIM14_regs,
+            &regs->TIM16_regs, &regs->TIM17_regs }) {
+        tim->ARR = 0xFFFF;
+    }
+    regs->GPIOB_regs.IDR = (1u << 0) | (1u << 1); // buttons pulled up
+    regs->CRC_regs.DR = CRC_INIT;
+    spi_rx_count = 0;
+    spi_status();
+
+    timers[0] = { &regs->TIM1_regs, -1 };
+    timers[1] = { &regs->TIM3_regs, TIM3_IRQn };
+    timers[2] = { &regs->TIM14_regs, TIM14_IRQn };
+    timers[3] = { &regs->TIM16_regs, TIM16_IRQn };
+    timers[4] = { &regs->TIM17_regs, TIM17_IRQn };
+
+    channels[0] = { &regs->DMA1_Channel1_regs, 1 };
+    channels[1] = { &regs->DMA1_Channel2_regs, 2 };
+    channels[2] = { &regs->DMA1_Channel3_regs, 3 };
+
+    HostMcu::set_level_handler(line_active);
+    return true;
+}
+
+void advance(double now_us) {
+    for (;;) {
+        double when = std::min({ adc_due, adc_stop_due, lptim_due });
+        Timer* next = nullptr;
+        for (Timer& timer : timers) {
+            const double t = next_timer_event(timer);
+            if (t < when) {
+                when = t;
+                next = &timer;
+            }
+        }
+
+        if (when > now_us) {
+            break;
+        }
+
+        now = std::max(now, when);
+        if (next) {
+            fire_timer(*next);
+        }
+        else if (lptim_due <= std::min(adc_due, adc_stop_due)) {
+            fire_lptim();
+        }
+        else if (adc_stop_due <= adc_due) {
+            stop_adc();
+        }
+        else {
+            fire_adc();
+        }
+    }
+
+    now = std::max(now, now_us);
+    HostMcu::dispatch();
+}
+
+void set_button(Button button, bool pressed) {
+    const uint32_t pin = button == Button::PB0 ? 0 : 1;
+    set_input(regs->GPIOB_regs, 1, pin, !pressed);
+}
+
+void set_light(uint16_t value) {
+    light = value;
+    schedule_adc();
+}
+
+void set_supply_low(bool low) {
+    supply_low = low;
+    update_pvd();
+}
+
+void set_sample_sink(SampleSink sink) {
+    sample_sink = sink;
+}
+
+void set_event_sink(EventSink sink) {
+    event_sink = sink;
+}
+
+void set_ram(const void* begin, const void* end) {
+    ram_begin = reinterpret_cast<uintptr_t>(begin);
+    ram_end = reinterpret_cast<uintptr_t>(end);
+}
+
+} // namespace HostDevice
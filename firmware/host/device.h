@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Peripheral behaviour behind the host register block: timers, LPTIM single
+ * mode, DMA driven by TIM1 update, EXTI edges from button pins, ADC (single
+ * conversions, or continuous with analog watchdog), PVD, GPIO set/reset, CRC,
+ * SPI1 polled transfers to the simulated card (sd_spi.h) selected by PA4.
+ * Firmware register accesses are trapped (HostMcu::trap_peripheral_access),
+ * so spin loops on flags and write-1-to-clear registers behave like on the
+ * chip. Time is the HostSd clock.
+ */
+namespace HostDevice {
+
+constexpr double CORE_MHZ = 48.0;
+
+enum class Button {
+    PB0,    // short press: next track, long: previous track
+    PB1,    // short press: power (mode), long: next directory
+};
+
+struct Options {
+    bool cmar_live = false;         // CMAR write takes effect at once instead of at circular reload
+    double adc_conversion_us = 20.0;
+    double bus_us = 0.04;           // CPU time charged per register access
+};
+
+/**
+ * @brief One TIM1 update: PWM duty of both channels (0 when output is off)
+ */
+struct Sample {
+    uint16_t left;
+    uint16_t right;
+    uint16_t period;                // ARR + 1
+    bool underrun;                  // DMA read a sample the decoder hasn't written since last read
+    bool mute_pending;              // CMAR changed, DMA still reads the previous buffer
+};
+
+using SampleSink = void (*)(double time_us, const Sample& sample);
+using EventSink = void (*)(double time_us, const char* text);
+
+/**
+ * @brief Reset register values, start trapping register accesses
+ * @return false if peripherals can't be trapped
+ */
+bool init(const Options& options);
+
+/**
+ * @brief Run peripherals up to given time and take pending interrupts
+ */
+void advance(double now_us);
+
+void set_button(Button button, bool pressed);
+void set_light(uint16_t value);
+void set_supply_low(bool low);
+
+void set_sample_sink(SampleSink sink);
+void set_event_sink(EventSink sink);
+
+/**
+ * @brief Address range underrun detection watches, normally the .data / .bss of firmware
+ */
+void set_ram(const void* begin, const void* end);
+
+} // namespace HostDevice
@@ -0,0 +1,618 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Whole-device simulator. Runs the firmware main loop against the host
+ * peripheral model (device.cpp) on a simulated clock, its sd.cpp talks over
+ * the SPI1 model to the card on the image (sd_spi.cpp, sd_card.cpp).
+ * Renders PWM duty produced by TIM1 / DMA to a WAV file and reports every
+ * DMA underrun: a sample taken from pcml / pcmr that the decoder didn't
+ * write since DMA took it last time.
+ *
+ * CPU time is charged for SPI bytes at the clock set in SPI1 CR1, register
+ * accesses and every sbc_decode call (--decode-us), at the end of the
+ * interrupt masked section around it. Card latencies (access, stream gap,
+ * busy) are spent polling the card as the firmware does.
+ *
+ * Script lines are "<seconds> <command>" or "+<seconds> <command>" (relative
+ * to previous line), '#' starts a comment:
+ *   press <pb0|pb1> [bounce=<n>]      n contact bounces before settling
+ *   release <pb0|pb1> [bounce=<n>]
+ *   click <pb0|pb1> [<ms>]            press and release (default 80 ms)
+ *   hold <pb0|pb1> <seconds>
+ *   light <value>                      ADC reading, lower is brighter
+ *   supply <low|ok>                    PVD output
+ *   end                               stop simulation
+ */
+
+#include "device.h"
+#include "mcu.h"
+#include "sd_card.h"
+#include "file_navigator.h"
+#include "audio_player.h"
+#include "scheduler.h"
+#include "boot.h"
+#include "libsbc/include/sbc.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "petitfat/source/diskio.h"
+}
+
+// main() of main.cpp, renamed when linked (Makefile)
+extern "C" int firmware_main();
+
+void DMA1_Channel1_IRQHandler();
+void EXTI0_1_IRQHandler();
+void TIM3_IRQHandler();
+void LPTIM1_IRQHandler();
+void ADC_COMP_IRQHandler();
+void PVD_IRQHandler();
+
+// linker provided bounds of .data / .bss
+extern "C" char __data_start[];
+extern "C" char _end[];
+
+namespace {
+
+using HostDevice::Button;
+
+constexpr double BOUNCE_US = 300.0;
+
+struct Action {
+    double us;
+    enum Kind { Press, Release, Light, Supply } kind;
+    Button button;
+    int value;
+    std::string text;           // script line, logged with first action of the line
+};
+
+struct Underrun {
+    double start_us;
+    double end_us;
+    uint32_t samples;
+    bool after_mute;
+    std::string file;
+};
+
+std::vector<Action> actions;
+size_t next_action = 0;
+double end_us = 10e6;               // --seconds, or end of script
+double decode_us = 900.0;
+bool finished = false;
+
+FILE* wav = nullptr;
+uint32_t wav_rate = 0;
+uint64_t wav_frames = 0;
+uint64_t samples = 0;
+double last_sample_us = 0;
+
+std::vector<Underrun> underruns;
+bool underrun_open = false;
+uint64_t decode_sections = 0;
+uint64_t interrupts_taken = 0;
+double idle_us = 0;                 // spent in __WFI
+double stop_us = 0;                 // part of it in Stop mode
+bool decoded = false;               // sbc_decode ran since interrupts were masked
+
+// time spent in interrupt handlers, including handlers preempting them
+struct IsrStats {
+    const char* name;
+    int irq;
+    HostMcu::Vector handler;
+    uint32_t calls;
+    double total_us;
+    double max_us;
+    double max_latency_us;      // pending until taken
+};
+
+IsrStats isrs[] = {
+    { "DMA1_Channel1", DMA1_Channel1_IRQn, DMA1_Channel1_IRQHandler, 0, 0, 0, 0 },
+    { "EXTI0_1", EXTI0_1_IRQn, EXTI0_1_IRQHandler, 0, 0, 0, 0 },
+    { "TIM3", TIM3_IRQn, TIM3_IRQHandler, 0, 0, 0, 0 },
+    { "LPTIM1", LPTIM1_IRQn, LPTIM1_IRQHandler, 0, 0, 0, 0 },
+    { "ADC_COMP", ADC_COMP_IRQn, ADC_COMP_IRQHandler, 0, 0, 0, 0 },
+    { "PVD", PVD_IRQn, PVD_IRQHandler, 0, 0, 0, 0 },
+};
+
+template <size_t I>
+void timed_isr() {
+    IsrStats& isr = isrs[I];
+    isr.max_latency_us = std::max(isr.max_latency_us, HostMcu::entry_latency_us());
+    const double start = HostSd::now_us();
+    isr.handler();
+    const double us = HostSd::now_us() - start;
+    isr.calls++;
+    interrupts_taken++;
+    isr.total_us += us;
+    isr.max_us = std::max(isr.max_us, us);
+}
+
+template <size_t... I>
+void install_isrs(std::index_sequence<I...>) {
+    (HostMcu::set_vector(isrs[I].irq, timed_isr<I>), ...);
+}
+
+void log(double us, const char* text) {
+    std::printf("%12.6f  %s\n", us / 1e6, text);
+}
+
+bool parse_button(const std::string& name, Button& button) {
+    if (name == "pb0") {
+        button = Button::PB0;
+        return true;
+    }
+    if (name == "pb1") {
+        button = Button::PB1;
+        return true;
+    }
+    return false;
+}
+
+int parse_bounce(const std::vector<std::string>& args, size_t from) {
+    for (size_t i = from; i < args.size(); i++) {
+        if (args[i].rfind("bounce=", 0) == 0) {
+            return std::atoi(args[i].c_str() + 7);
+        }
+    }
+    return 0;
+}
+
+void add_edge(double us, Button button, bool pressed, int bounce, const std::string& text) {
+    // contact bounces: toggles before settling in the final state
+    for (int i = 0; i < 2 * bounce; i++) {
+        const bool state = (i % 2 == 0) == pressed;
+        actions.push_back({ us + i * BOUNCE_US, state ? Action::Press : Action::Release, button, 0, i ? "" : text });
+    }
+    actions.push_back({ us + 2 * bounce * BOUNCE_US, pressed ? Action::Press : Action::Release, button, 0,
+        bounce ? "" : text });
+}
+
+bool load_script(const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    std::string text;
+    double time = 0;
+    for (int number = 1; std::getline(in, text); number++) {
+        const size_t hash = text.find('#');
+        if (hash != std::string::npos) {
+            text.erase(hash);
+        }
+
+        std::istringstream stream(text);
+        std::vector<std::string> args;
+        for (std::string arg; stream >> arg; ) {
+            args.push_back(arg);
+        }
+        if (args.empty()) {
+            continue;
+        }
+
+        if (args.size() < 2) {
+            std::fprintf(stderr, "%s:%d: time and command expected\n", path, number);
+            return false;
+        }
+
+        const double seconds = std::atof(args[0].c_str() + (args[0][0] == '+'));
+        time = args[0][0] == '+' ? time + seconds : seconds;
+        const double us = time * 1e6;
+
+        const std::string& cmd = args[1];
+        std::string line = cmd;
+        for (size_t i = 2; i < args.size(); i++) {
+            line += " " + args[i];
+        }
+
+        Button button;
+        bool ok = true;
+
+        if ((cmd == "press" || cmd == "release") && args.size() >= 3 && parse_button(args[2], button)) {
+            add_edge(us, button, cmd == "press", parse_bounce(args, 3), line);
+        }
+        else if (cmd == "click" && args.size() >= 3 && parse_button(args[2], button)) {
+            const double ms = args.size() > 3 ? std::atof(args[3].c_str()) : 80.0;
+            add_edge(us, button, true, 0, line);
+            add_edge(us + ms * 1000.0, button, false, 0, "");
+        }
+        else if (cmd == "hold" && args.size() == 4 && parse_button(args[2], button)) {
+            add_edge(us, button, true, 0, line);
+            add_edge(us + std::atof(args[3].c_str()) * 1e6, button, false, 0, "");
+        }
+        else if (cmd == "light" && args.size() == 3) {
+            actions.push_back({ us, Action::Light, Button::PB0, (int)std::strtol(args[2].c_str(), nullptr, 0), line });
+        }
+        else if (cmd == "supply" && args.size() == 3 && (args[2] == "low" || args[2] == "ok")) {
+            actions.push_back({ us, Action::Supply, Button::PB0, args[2] == "low", line });
+        }
+        else if (cmd == "end" && args.size() == 2) {
+            end_us = us;
+        }
+        else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::fprintf(stderr, "%s:%d: bad command: %s\n", path, number, line.c_str());
+            return false;
+        }
+    }
+
+    std::stable_sort(actions.begin(), actions.end(),
+        [](const Action& a, const Action& b) { return a.us < b.us; });
+    return true;
+}
+
+void write_wav_header() {
+    const uint32_t data_bytes = (uint32_t)(wav_frames * 4);
+    const uint32_t byte_rate = wav_rate * 4;
+
+    uint8_t header[44];
+    auto put16 = [&header](int at, uint32_t v) { header[at] = v & 0xFF; header[at + 1] = (v >> 8) & 0xFF; };
+    auto put32 = [&](int at, uint32_t v) { put16(at, v & 0xFFFF); put16(at + 2, v >> 16); };
+
+    std::memcpy(header, "RIFF", 4);
+    put32(4, 36 + data_bytes);
+    std::memcpy(header + 8, "WAVEfmt ", 8);
+    put32(16, 16);
+    put16(20, 1);               // PCM
+    put16(22, 2);               // channels
+    put32(24, wav_rate);
+    put32(28, byte_rate);
+    put16(32, 4);               // block align
+    put16(34, 16);              // bits per sample
+    std::memcpy(header + 36, "data", 4);
+    put32(40, data_bytes);
+
+    std::fseek(wav, 0, SEEK_SET);
+    std::fwrite(header, 1, sizeof(header), wav);
+}
+
+int16_t to_pcm(uint16_t duty, uint16_t period) {
+    // 50 % duty is the output's midpoint, disabled output is held low
+    const double half = period / 2.0;
+    const double v = (duty - half) / half * 32767.0;
+    return (int16_t)std::clamp(v, -32768.0, 32767.0);
+}
+
+void close_underrun() {
+    if (!underrun_open) {
+        return;
+    }
+    underrun_open = false;
+
+    const Underrun& u = underruns.back();
+    char text[200];
+    std::snprintf(text, sizeof(text), "UNDERRUN %u samples (%.2f ms)%s in %s",
+        u.samples, (u.end_us - u.start_us) / 1000.0, u.after_mute ? " after mute" : "", u.file.c_str());
+    log(u.start_us, text);
+}
+
+void on_sample(double us, const HostDevice::Sample& sample) {
+    samples++;
+
+    // navigator moves to the next file before it's opened
+    static std::string track;
+    const FILINFO* file = FileNavigator::get_current_file();
+    if (file && track != file->fname) {
+        track = file->fname;
+        if (!(file->fattrib & AM_DIR)) {
+            log(us, ("track " + track).c_str());
+        }
+    }
+
+    if (sample.underrun) {
+        // samples of one run are consecutive TIM1 updates
+        if (!underrun_open) {
+            underruns.push_back({ us, us, 0, sample.mute_pending, track });
+            underrun_open = true;
+        }
+        underruns.back().samples++;
+        underruns.back().end_us = us;
+    }
+    else {
+        close_underrun();
+    }
+
+    if (wav) {
+        if (!wav_rate) {
+            wav_rate = (uint32_t)(HostDevice::CORE_MHZ * 1e6 / sample.period + 0.5);
+        }
+        const int16_t frame[2] = { to_pcm(sample.left, sample.period), to_pcm(sample.right, sample.period) };
+        std::fwrite(frame, sizeof(frame), 1, wav);
+        wav_frames++;
+    }
+    last_sample_us = us;
+}
+
+void on_event(double us, const char* text) {
+    log(us, text);
+}
+
+[[noreturn]] void finish(const char* reason) {
+    finished = true;
+    close_underrun();
+
+    const double now = HostSd::now_us();
+    char text[64];
+    std::snprintf(text, sizeof(text), "%s", reason);
+    log(now, text);
+
+    if (wav) {
+        write_wav_header();
+        std::fclose(wav);
+    }
+
+    uint64_t underrun_samples = 0;
+    uint32_t after_mute = 0;
+    for (const Underrun& u : underruns) {
+        underrun_samples += u.samples;
+        after_mute += u.after_mute;
+    }
+
+    const HostSd::Stats& sd = HostSd::stats();
+    std::printf("\nsimulated %.3f s, %llu output samples, %llu decoded frames (%.0f us each)\n",
+        now / 1e6, (unsigned long long)samples, (unsigned long long)decode_sections, decode_us);
+    std::printf("card: %llu sectors read, %llu written, %llu CMD18, %llu CMD13, %.1f ms busy wait\n",
+        (unsigned long long)sd.sectors_read, (unsigned long long)sd.sectors_written,
+        (unsigned long long)sd.cmd18, (unsigned long long)sd.cmd13, sd.busy_wait_us / 1000.0);
+    std::printf("card profile: %s read-ahead, CMD17 %u us, CMD18 %u us, gap %u us, CMD12 %u us, SPI fPCLK/%u\n",
+        disk_profile.stream ? "stream" : "single block", disk_profile.single_us, disk_profile.stream_us,
+        disk_profile.gap_us, disk_profile.stop_us, 2u << disk_profile.clock_div);
+    if (sd.failed_reads > 0) {
+        std::printf("recovery: %llu failed reads, %u retries, %u resyncs, %u reinits, %u remounts\n",
+            (unsigned long long)sd.failed_reads, (unsigned)disk_recovery.retries,
+            (unsigned)disk_recovery.resyncs, (unsigned)disk_recovery.reinits,
+            (unsigned)disk_recovery.remounts);
+    }
+    std::printf("underruns: %zu (%llu samples), %u of them after mute\n",
+        underruns.size(), (unsigned long long)underrun_samples, after_mute);
+    std::printf("idle (WFI): %.1f %%, Stop mode %.1f %%\n", now > 0 ? idle_us * 100.0 / now : 0.0,
+        now > 0 ? stop_us * 100.0 / now : 0.0);
+
+    std::printf("%-14s %8s %10s %10s %12s\n", "interrupt", "calls", "avg us", "max us", "max latency");
+    for (const IsrStats& isr : isrs) {
+        if (isr.calls) {
+            std::printf("%-14s %8u %10.2f %10.2f %12.2f\n", isr.name, isr.calls, isr.total_us / isr.calls,
+                isr.max_us, isr.max_latency_us);
+        }
+    }
+
+    // playback loop scheduler, times in output samples
+    static const char* const task_names[] = {"decode", "events", "storage", "state save"};
+    static_assert(std::size(task_names) == static_cast<size_t>(AudioPlayer::PlaybackTask::Count));
+    const Scheduler::Stats& sched = Scheduler::stats;
+    std::printf("deadlines: %u, %u missed, worst lateness %d samples\n",
+        sched.deadlines, sched.missed, sched.deadlines ? sched.worst_lateness : 0);
+    std::printf("%-14s %12s\n", "task", "worst run");
+    for (size_t i = 0; i < std::size(task_names); i++) {
+        std::printf("%-14s %12u\n", task_names[i], sched.worst[i]);
+    }
+
+    // boot phases from the retained profile, times since system clock setup
+    static const char* const phase_names[] = {"peripherals", "card", "mount", "config", "state", "restore",
+        "sound"};
+    static_assert(std::size(phase_names) == static_cast<size_t>(Boot::Phase::Count));
+    std::printf("%-14s %12s\n", "boot phase", "done at ms");
+    for (size_t i = 0; i < std::size(phase_names); i++) {
+        const uint16_t ticks = Boot::retained.current.ticks[i];
+        if (ticks == Boot::NOT_REACHED) {
+            std::printf("%-14s %12s\n", phase_names[i], "-");
+        }
+        else {
+            std::printf("%-14s %12.1f\n", phase_names[i], ticks * Boot::TICK_US / 1000.0);
+        }
+    }
+
+    std::fflush(stdout);
+    std::exit(underruns.empty() ? 0 : 3);
+}
+
+void on_time(double now) {
+    if (finished) {
+        return;
+    }
+
+    while (next_action < actions.size() && actions[next_action].us <= now) {
+        const Action action = actions[next_action++];
+        HostDevice::advance(action.us);
+
+        if (!action.text.empty()) {
+            log(action.us, ("script: " + action.text).c_str());
+        }
+
+        switch (action.kind) {
+            case Action::Press:
+            case Action::Release:
+                HostDevice::set_button(action.button, action.kind == Action::Press);
+                break;
+            case Action::Light:
+                HostDevice::set_light((uint16_t)action.value);
+                break;
+            case Action::Supply:
+                HostDevice::set_supply_low(action.value != 0);
+                break;
+        }
+    }
+
+    if (now >= end_us) {
+        HostDevice::advance(end_us);
+        finish("end of simulation");
+    }
+
+    HostDevice::advance(now);
+}
+
+void on_unmask() {
+    // interrupts are masked around sbc_decode, other masked sections (idle
+    // checks and the sleep after them, trace records) take no modelled time
+    if (!decoded) {
+        return;
+    }
+    decoded = false;
+    decode_sections++;
+    HostSd::advance_us(decode_us);
+}
+
+void on_idle() {
+    // sleep until an interrupt is taken (or pending while masked), give up after a second of silence
+    const uint64_t taken = interrupts_taken;
+    const double start = HostSd::now_us();
+    while (interrupts_taken == taken && !HostMcu::irq_waiting() && !finished
+            && HostSd::now_us() - start < 1e6) {
+        HostSd::advance_us(1.0);
+    }
+
+    const double us = HostSd::now_us() - start;
+    idle_us += us;
+    if (HostMcu::deep_sleep()) {
+        stop_us += us;
+    }
+}
+
+} // namespace
+
+// firmware calls of sbc_decode, linked with --wrap (Makefile)
+extern "C" int __real_sbc_decode(sbc_t* sbc, const void* data, unsigned size, sbc_frame* frame,
+    int16_t* pcml, int16_t* pcmr);
+
+extern "C" int __wrap_sbc_decode(sbc_t* sbc, const void* data, unsigned size, sbc_frame* frame,
+        int16_t* pcml, int16_t* pcmr) {
+    decoded = true;
+    return __real_sbc_decode(sbc, data, size, frame, pcml, pcmr);
+}
+
+namespace {
+
+void on_reset() {
+    finish("system reset");
+}
+
+void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s <image> [--script file] [--wav file] [--seconds s] [--light value]\n"
+        "          [--model key=value,...] [--decode-us us] [--dma-cmar reload|live]\n"
+        "  --script     button / light / supply events (see devsim.cpp)\n"
+        "  --wav        write PWM output as 16-bit stereo WAV\n"
+        "  --seconds    simulated time (default: script end or 10)\n"
+        "  --light      initial light sensor reading (default 0x400, lit)\n"
+        "  --model      card latency model overrides, e.g. access_us=500\n"
+        "  --decode-us  CPU time of one frame decode (default 900)\n"
+        "  --dma-cmar   CMAR written while channel runs is used after wrap (reload, default)\n"
+        "               or at once (live)\n",
+        name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* image_path = argv[1];
+    const char* wav_path = nullptr;
+    int light = 0x400;
+    double seconds = 0;
+    HostDevice::Options options;
+
+    for (int i = 2; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--script") == 0 && has_value) {
+            if (!load_script(argv[++i])) {
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--wav") == 0 && has_value) {
+            wav_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--seconds") == 0 && has_value) {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--light") == 0 && has_value) {
+            light = (int)std::strtol(argv[++i], nullptr, 0);
+        }
+        else if (std::strcmp(argv[i], "--model") == 0 && has_value) {
+            if (!HostSd::parse_model(argv[++i])) {
+                std::fprintf(stderr, "bad model: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--decode-us") == 0 && has_value) {
+            decode_us = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--dma-cmar") == 0 && has_value) {
+            ++i;
+            if (std::strcmp(argv[i], "live") != 0 && std::strcmp(argv[i], "reload") != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.cmar_live = std::strcmp(argv[i], "live") == 0;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (seconds > 0) {
+        end_us = seconds * 1e6;
+    }
+
+    // firmware saves state to the card
+    if (!HostSd::open(image_path, true)) {
+        std::fprintf(stderr, "can't open %s\n", image_path);
+        return 1;
+    }
+
+    if (wav_path) {
+        wav = std::fopen(wav_path, "wb");
+        if (!wav) {
+            std::fprintf(stderr, "can't write %s\n", wav_path);
+            return 1;
+        }
+        write_wav_header();
+    }
+
+    if (!HostDevice::init(options)) {
+        std::fprintf(stderr, "can't map peripheral registers\n");
+        return 1;
+    }
+
+    HostDevice::set_ram(__data_start, _end);
+    HostDevice::set_sample_sink(on_sample);
+    HostDevice::set_event_sink(on_event);
+    HostDevice::set_light((uint16_t)light);
+
+    install_isrs(std::make_index_sequence<std::size(isrs)>());
+    HostMcu::set_clock(HostSd::now_us);
+    HostMcu::set_unmask_handler(on_unmask);
+    HostMcu::set_idle_handler(on_idle);
+    HostMcu::set_reset_handler(on_reset);
+
+    HostSd::set_time_hook(on_time);
+
+    std::printf("%s\nmodel: ", image_path);
+    HostSd::print_model();
+
+    firmware_main();
+    finish("firmware returned");
+}
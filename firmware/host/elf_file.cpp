@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "elf_file.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+std::string demangle(const std::string& name) {
+    int status = 0;
+    char* text = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+    if (status != 0 || !text) {
+        return name;
+    }
+
+    std::string result = text;
+    std::free(text);
+    return result;
+}
+
+template <typename T>
+bool read_at(const std::vector<uint8_t>& file, uint64_t offset, T& value) {
+    if (offset + sizeof(T) > file.size()) {
+        return false;
+    }
+    std::memcpy(&value, file.data() + offset, sizeof(T));
+    return true;
+}
+
+} // namespace
+
+bool ElfFile::fail(const std::string& message) {
+    error_text = message;
+    return false;
+}
+
+bool ElfFile::load(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return fail(std::string("can't open ") + path);
+    }
+    const std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    Elf32_Ehdr header;
+    if (!read_at(file, 0, header) || std::memcmp(header.e_ident, ELFMAG, SELFMAG) != 0) {
+        return fail("not an ELF file");
+    }
+    if (header.e_ident[EI_CLASS] != ELFCLASS32 || header.e_ident[EI_DATA] != ELFDATA2LSB
+            || header.e_machine != EM_ARM) {
+        return fail("not a 32-bit little endian ARM ELF");
+    }
+
+    segment_list.clear();
+    for (unsigned i = 0; i < header.e_phnum; i++) {
+        Elf32_Phdr ph;
+        if (!read_at(file, header.e_phoff + (uint64_t)i * header.e_phentsize, ph)) {
+            return fail("truncated program header");
+        }
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0) {
+            continue;
+        }
+        if ((uint64_t)ph.p_offset + ph.p_filesz > file.size()) {
+            return fail("truncated segment");
+        }
+
+        Segment segment;
+        segment.vaddr = ph.p_vaddr;
+        segment.paddr = ph.p_paddr;
+        segment.mem_size = ph.p_memsz;
+        segment.data.assign(file.begin() + ph.p_offset, file.begin() + ph.p_offset + ph.p_filesz);
+        segment_list.push_back(std::move(segment));
+    }
+
+    symbol_list.clear();
+    for (unsigned i = 0; i < header.e_shnum; i++) {
+        Elf32_Shdr sh;
+        if (!read_at(file, header.e_shoff + (uint64_t)i * header.e_shentsize, sh)) {
+            return fail("truncated section header");
+        }
+        if (sh.sh_type != SHT_SYMTAB) {
+            continue;
+        }
+
+        Elf32_Shdr strings;
+        if (!read_at(file, header.e_shoff + (uint64_t)sh.sh_link * header.e_shentsize, strings)
+                || (uint64_t)strings.sh_offset + strings.sh_size > file.size()) {
+            return fail("bad string table");
+        }
+
+        for (uint32_t offset = 0; offset + sizeof(Elf32_Sym) <= sh.sh_size; offset += sizeof(Elf32_Sym)) {
+            Elf32_Sym sym;
+            if (!read_at(file, (uint64_t)sh.sh_offset + offset, sym)) {
+                return fail("truncated symbol table");
+            }
+
+            const unsigned type = ELF32_ST_TYPE(sym.st_info);
+            if ((type != STT_FUNC && type != STT_OBJECT) || sym.st_shndx == SHN_UNDEF
+                    || sym.st_name >= strings.sh_size) {
+                continue;
+            }
+
+            Symbol symbol;
+            symbol.name = reinterpret_cast<const char*>(file.data() + strings.sh_offset + sym.st_name);
+            symbol.pretty = demangle(symbol.name);
+            symbol.function = type == STT_FUNC;
+            symbol.address = symbol.function ? sym.st_value & ~1u : sym.st_value;
+            symbol.size = sym.st_size;
+            symbol_list.push_back(std::move(symbol));
+        }
+    }
+
+    if (segment_list.empty()) {
+        return fail("no loadable segments");
+    }
+
+    functions.clear();
+    for (const Symbol& symbol : symbol_list) {
+        if (symbol.function) {
+            functions.push_back(&symbol);
+        }
+    }
+    std::sort(functions.begin(), functions.end(), [](const Symbol* a, const Symbol* b) {
+        return a->address < b->address;
+    });
+
+    return true;
+}
+
+const ElfFile::Symbol* ElfFile::find(const std::string& name) const {
+    for (const Symbol& symbol : symbol_list) {
+        if (symbol.name == name || symbol.pretty == name) {
+            return &symbol;
+        }
+    }
+
+    for (const Symbol& symbol : symbol_list) {
+        if (symbol.pretty.size() > name.size() && symbol.pretty.compare(0, name.size(), name) == 0
+                && symbol.pretty[name.size()] == '(') {
+            return &symbol;
+        }
+    }
+
+    return nullptr;
+}
+
+const ElfFile::Symbol* ElfFile::function_at(uint32_t address) const {
+    auto it = std::upper_bound(functions.begin(), functions.end(), address, [](uint32_t a, const Symbol* s) {
+        return a < s->address;
+    });
+    if (it == functions.begin()) {
+        return nullptr;
+    }
+
+    const Symbol* symbol = *(it - 1);
+    // size 0: assembler labels without .size, assume function runs up to next symbol
+    return symbol->size == 0 || address < symbol->address + symbol->size ? symbol : nullptr;
+}
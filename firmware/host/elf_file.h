@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Reader for the firmware ELF (32-bit little endian ARM, LooTunes.out):
+ * loadable segments and the symbol table, enough to run firmware functions
+ * in the instruction set simulator.
+ */
+class ElfFile {
+public:
+    struct Segment {
+        uint32_t vaddr;                 // run address
+        uint32_t paddr;                 // load address (differs for .data)
+        uint32_t mem_size;              // bytes above data.size() are zero (.bss)
+        std::vector<uint8_t> data;
+    };
+
+    struct Symbol {
+        std::string name;               // as in the symbol table (mangled)
+        std::string pretty;             // demangled
+        uint32_t address;               // Thumb bit cleared
+        uint32_t size;
+        bool function;
+    };
+
+    /**
+     * @brief Read segments and symbols
+     * @return false (with error()) if file is not an ARM ELF
+     */
+    bool load(const char* path);
+
+    const std::string& error() const { return error_text; }
+    const std::vector<Segment>& segments() const { return segment_list; }
+    const std::vector<Symbol>& symbols() const { return symbol_list; }
+
+    /**
+     * @brief Find symbol by mangled name, demangled name, or demangled name without
+     *        parameter list ("sd_read_sector" matches "sd_read_sector()")
+     */
+    const Symbol* find(const std::string& name) const;
+
+    /**
+     * @brief Function containing address
+     */
+    const Symbol* function_at(uint32_t address) const;
+
+private:
+    std::string error_text;
+    std::vector<Segment> segment_list;
+    std::vector<Symbol> symbol_list;
+    std::vector<const Symbol*> functions;   // sorted by address
+
+    bool fail(const std::string& message);
+};
@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "fat_image.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    constexpr uint32_t SECTOR = 512;
+    constexpr uint32_t RESERVED_SECTORS = 32;
+    constexpr uint32_t NUM_FATS = 2;
+    constexpr uint32_t MIN_CLUSTERS = 65600;    // safely above FAT32 minimum (65525)
+    constexpr uint32_t END_OF_CHAIN = 0x0FFFFFFF;
+
+    constexpr uint8_t ATTR_DIR = 0x10;
+    constexpr uint8_t ATTR_ARCHIVE = 0x20;
+    constexpr uint8_t ATTR_LFN = 0x0F;
+
+    // 2025-01-01 12:00:00
+    constexpr uint16_t FAT_DATE = ((2025 - 1980) << 9) | (1 << 5) | 1;
+    constexpr uint16_t FAT_TIME = 12 << 11;
+
+    void st_word(uint8_t* p, uint16_t v) {
+        p[0] = v & 0xFF;
+        p[1] = v >> 8;
+    }
+
+    void st_dword(uint8_t* p, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (v >> (8 * i)) & 0xFF;
+        }
+    }
+
+    void make_entry(uint8_t entry[32], const std::string& name, uint8_t attr, uint32_t cluster, uint32_t size) {
+        std::memset(entry, 0, 32);
+        std::memcpy(entry, name.data(), 11);
+        entry[11] = attr;
+        st_word(entry + 14, FAT_TIME);
+        st_word(entry + 16, FAT_DATE);
+        st_word(entry + 18, FAT_DATE);
+        st_word(entry + 20, cluster >> 16);
+        st_word(entry + 22, FAT_TIME);
+        st_word(entry + 24, FAT_DATE);
+        st_word(entry + 26, cluster & 0xFFFF);
+        st_dword(entry + 28, size);
+    }
+
+    uint8_t lfn_checksum(const std::string& name) {
+        uint8_t sum = 0;
+        for (int i = 0; i < 11; i++) {
+            sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)name[i];
+        }
+        return sum;
+    }
+
+    bool pwrite_all(int fd, const void* data, size_t size, uint64_t offset) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        while (size) {
+            const ssize_t res = pwrite(fd, p, size, (off_t)offset);
+            if (res <= 0) {
+                return false;
+            }
+            p += res;
+            size -= res;
+            offset += res;
+        }
+        return true;
+    }
+}
+
+FatImage::FatImage(const Geometry& geo)
+    : geometry(geo)
+{
+    Node root;
+    root.dir = true;
+    nodes.push_back(root);
+}
+
+bool FatImage::ensure_formatted() {
+    if (formatted) {
+        return true;
+    }
+
+    if (geometry.cluster_bytes < SECTOR || geometry.cluster_bytes > 65536
+            || (geometry.cluster_bytes & (geometry.cluster_bytes - 1))) {
+        last_error = "cluster size must be power of two between 512 and 65536";
+        return false;
+    }
+
+    const uint32_t spc = geometry.cluster_bytes / SECTOR;
+
+    if (geometry.size_bytes) {
+        // fixed size: largest cluster count fitting the partition
+        const uint64_t total = geometry.size_bytes / SECTOR - geometry.partition_start;
+        uint32_t clusters = (uint32_t)((total - RESERVED_SECTORS) / spc);
+        for (int i = 0; i < 4; i++) {
+            const uint32_t fat = ((clusters + 2) * 4 + SECTOR - 1) / SECTOR;
+            clusters = (uint32_t)((total - RESERVED_SECTORS - NUM_FATS * fat - spc) / spc);
+        }
+
+        if (clusters < MIN_CLUSTERS) {
+            last_error = "image too small for FAT32 with this cluster size";
+            return false;
+        }
+
+        cluster_count = clusters;
+        used.assign(cluster_count + 2, false);
+    }
+    else {
+        used.assign(MIN_CLUSTERS + 2, false);
+    }
+
+    used[0] = used[1] = true;
+
+    // root directory
+    if (!allocate(1, 1, 0, nodes[0].clusters)) {
+        return false;
+    }
+
+    formatted = true;
+    return true;
+}
+
+bool FatImage::allocate(uint32_t count, uint32_t fragments, uint32_t gap, std::vector<uint32_t>& out) {
+    if (fragments == 0) {
+        fragments = 1;
+    }
+    if (fragments > count) {
+        fragments = count;
+    }
+
+    for (uint32_t run = 0; run < fragments; run++) {
+        const uint32_t run_length = count / fragments + (run < count % fragments ? 1 : 0);
+        uint32_t taken = 0;
+
+        while (taken < run_length) {
+            if (cursor >= used.size()) {
+                if (cluster_count) {
+                    last_error = "image full";
+                    return false;
+                }
+                used.resize(used.size() * 2, false); // auto size grows
+            }
+
+            if (!used[cursor]) {
+                used[cursor] = true;
+                out.push_back(cursor);
+                taken++;
+            }
+            cursor++;
+        }
+
+        if (run + 1 < fragments) {
+            cursor += gap; // leave hole, next run starts further
+        }
+    }
+
+    return true;
+}
+
+bool FatImage::make_83(const std::string& name, std::string& out) const {
+    std::string base = name;
+    std::string ext;
+    const auto dot = name.rfind('.');
+    if (dot != std::string::npos) {
+        base = name.substr(0, dot);
+        ext = name.substr(dot + 1);
+    }
+
+    if (base.empty() || base.size() > 8 || ext.size() > 3) {
+        last_error = "not a valid 8.3 name: " + name;
+        return false;
+    }
+
+    out.assign(11, ' ');
+    for (size_t i = 0; i < base.size(); i++) {
+        const char c = base[i];
+        if (c <= ' ' || std::strchr("\"*+,./:;<=>?[\\]|", c)) {
+            last_error = "invalid character in name: " + name;
+            return false;
+        }
+        out[i] = (char)std::toupper((unsigned char)c);
+    }
+    for (size_t i = 0; i < ext.size(); i++) {
+        out[8 + i] = (char)std::toupper((unsigned char)ext[i]);
+    }
+
+    if ((uint8_t)out[0] == 0xE5) {
+        out[0] = 0x05;
+    }
+
+    return true;
+}
+
+bool FatImage::find(const std::string& path, uint32_t& index) const {
+    index = 0;
+    size_t start = 0;
+
+    while (start < path.size()) {
+        while (start < path.size() && path[start] == '/') {
+            start++;
+        }
+        if (start >= path.size()) {
+            break;
+        }
+
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+
+        std::string name;
+        if (!make_83(path.substr(start, end - start), name)) {
+            return false;
+        }
+
+        const Node& dir = nodes[index];
+        const auto it = std::find_if(dir.children.begin(), dir.children.end(),
+            [&](uint32_t child) { return !nodes[child].deleted && nodes[child].name == name; });
+        if (it == dir.children.end()) {
+            return false;
+        }
+
+        index = *it;
+        start = end;
+    }
+
+    return true;
+}
+
+bool FatImage::append_entry(uint32_t dir, const uint8_t entry[32], uint32_t& offset) {
+    Node& node = nodes[dir];
+    offset = (uint32_t)node.entries.size();
+
+    if (offset + 32 > node.clusters.size() * geometry.cluster_bytes) {
+        if (!allocate(1, 1, 0, nodes[dir].clusters)) {
+            return false;
+        }
+    }
+
+    nodes[dir].entries.insert(nodes[dir].entries.end(), entry, entry + 32);
+    return true;
+}
+
+bool FatImage::add_node(const std::string& path, bool dir, const File* file) {
+    if (!ensure_formatted()) {
+        return false;
+    }
+
+    const auto slash = path.find_last_of('/');
+    const std::string parent_path = slash == std::string::npos ? "" : path.substr(0, slash);
+    const std::string leaf = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    uint32_t parent = 0;
+    if (!find(parent_path, parent) || !nodes[parent].dir) {
+        last_error = "no such directory: " + parent_path;
+        return false;
+    }
+
+    Node node;
+    node.dir = dir;
+    node.parent = parent;
+    if (!make_83(leaf, node.name)) {
+        return false;
+    }
+
+    uint32_t existing;
+    if (find(path, existing)) {
+        last_error = "already exists: " + path;
+        return false;
+    }
+
+    // long name entries are placed (and grow the directory) before the short entry
+    if (lfn_entries) {
+        const uint8_t sum = lfn_checksum(node.name);
+        for (uint32_t i = lfn_entries; i > 0; i--) {
+            uint8_t lfn[32];
+            std::memset(lfn, 0xFF, sizeof(lfn));
+            lfn[0] = (uint8_t)i | (i == lfn_entries ? 0x40 : 0);
+            lfn[11] = ATTR_LFN;
+            lfn[12] = 0;
+            lfn[13] = sum;
+            lfn[26] = lfn[27] = 0;
+            uint32_t offset;
+            if (!append_entry(parent, lfn, offset)) {
+                return false;
+            }
+        }
+    }
+
+    if (dir) {
+        if (!allocate(1, 1, 0, node.clusters)) {
+            return false;
+        }
+    }
+    else if (file) {
+        node.size = file->size;
+        node.data = file->data;
+        node.source = file->source;
+        const uint32_t count = (file->size + geometry.cluster_bytes - 1) / geometry.cluster_bytes;
+        if (count && !allocate(count, file->fragments, file->gap, node.clusters)) {
+            return false;
+        }
+    }
+
+    uint8_t entry[32];
+    make_entry(entry, node.name, dir ? ATTR_DIR : ATTR_ARCHIVE,
+        node.clusters.empty() ? 0 : node.clusters[0], dir ? 0 : node.size);
+
+    const uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back(node);
+
+    uint32_t offset;
+    if (!append_entry(parent, entry, offset)) {
+        return false;
+    }
+    nodes[index].entry_offset = offset;
+    nodes[parent].children.push_back(index);
+
+    if (dir) {
+        uint8_t dot[32];
+        make_entry(dot, ".          ", ATTR_DIR, nodes[index].clusters[0], 0);
+        nodes[index].entries.insert(nodes[index].entries.end(), dot, dot + 32);
+        make_entry(dot, "..         ", ATTR_DIR, parent == 0 ? 0 : nodes[parent].clusters[0], 0);
+        nodes[index].entries.insert(nodes[index].entries.end(), dot, dot + 32);
+    }
+
+    return true;
+}
+
+bool FatImage::mkdir(const std::string& path) {
+    return add_node(path, true, nullptr);
+}
+
+bool FatImage::add_file(const std::string& path, const File& file) {
+    return add_node(path, false, &file);
+}
+
+bool FatImage::reserve_dir(const std::string& path, uint32_t entries) {
+    if (!ensure_formatted()) {
+        return false;
+    }
+
+    uint32_t index;
+    if (!find(path, index) || !nodes[index].dir) {
+        last_error = "no such directory: " + path;
+        return false;
+    }
+
+    const uint32_t bytes = (entries + 2) * 32;
+    const uint32_t needed = (bytes + geometry.cluster_bytes - 1) / geometry.cluster_bytes;
+    if (needed > nodes[index].clusters.size()) {
+        return allocate(needed - (uint32_t)nodes[index].clusters.size(), 1, 0, nodes[index].clusters);
+    }
+
+    return true;
+}
+
+bool FatImage::remove(const std::string& path) {
+    uint32_t index;
+    if (!find(path, index) || index == 0) {
+        last_error = "no such entry: " + path;
+        return false;
+    }
+
+    Node& node = nodes[index];
+    if (node.dir && std::any_of(node.children.begin(), node.children.end(),
+            [this](uint32_t child) { return !nodes[child].deleted; })) {
+        last_error = "directory not empty: " + path;
+        return false;
+    }
+
+    node.deleted = true;
+    nodes[node.parent].entries[node.entry_offset] = 0xE5;
+    for (uint32_t cluster : node.clusters) {
+        used[cluster] = false;
+    }
+
+    return true;
+}
+
+void FatImage::chain(const std::vector<uint32_t>& clusters, std::vector<uint32_t>& fat) const {
+    for (size_t i = 0; i < clusters.size(); i++) {
+        fat[clusters[i]] = i + 1 < clusters.size() ? clusters[i + 1] : END_OF_CHAIN;
+    }
+}
+
+std::string FatImage::path_of(uint32_t index) const {
+    std::string path;
+    while (index != 0) {
+        std::string name = nodes[index].name.substr(0, 8);
+        name.erase(name.find_last_not_of(' ') + 1);
+        std::string ext = nodes[index].name.substr(8);
+        ext.erase(ext.find_last_not_of(' ') + 1);
+        path = "/" + name + (ext.empty() ? "" : "." + ext) + path;
+        index = nodes[index].parent;
+    }
+    return path.empty() ? "/" : path;
+}
+
+bool FatImage::copy_chain(int fd, const Node& node, uint64_t data_start) const {
+    const int in = ::open(node.source.c_str(), O_RDONLY);
+    if (in < 0) {
+        last_error = "can't open " + node.source;
+        return false;
+    }
+
+    // contiguous clusters go in one write, a run at a time
+    const uint32_t spc = geometry.cluster_bytes / SECTOR;
+    std::vector<uint8_t> buffer;
+    uint64_t offset = 0;
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < node.clusters.size() && offset < node.size; ) {
+        size_t run = 1;
+        while (i + run < node.clusters.size() && node.clusters[i + run] == node.clusters[i] + run
+                && run * geometry.cluster_bytes < (4u << 20)) {
+            run++;
+        }
+
+        const size_t count = std::min<uint64_t>(run * geometry.cluster_bytes, node.size - offset);
+        buffer.resize(count);
+        ok = ::pread(in, buffer.data(), count, (off_t)offset) == (ssize_t)count
+            && pwrite_all(fd, buffer.data(), count, (data_start + (uint64_t)(node.clusters[i] - 2) * spc) * SECTOR);
+
+        offset += count;
+        i += run;
+    }
+
+    ::close(in);
+    if (!ok) {
+        last_error = "can't copy " + node.source;
+    }
+    return ok;
+}
+
+std::vector<FatImage::FragmentInfo> FatImage::fragmentation() const {
+    std::vector<FragmentInfo> result;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        const Node& node = nodes[i];
+        if (node.deleted || node.clusters.empty()) {
+            continue;
+        }
+
+        uint32_t runs = 1;
+        for (size_t c = 1; c < node.clusters.size(); c++) {
+            if (node.clusters[c] != node.clusters[c - 1] + 1) {
+                runs++;
+            }
+        }
+
+        result.push_back({ path_of(i), (uint32_t)node.clusters.size(), runs, node.dir });
+    }
+    return result;
+}
+
+bool FatImage::write(const std::string& filename) const {
+    if (!formatted) {
+        last_error = "image is empty";
+        return false;
+    }
+
+    const uint32_t spc = geometry.cluster_bytes / SECTOR;
+
+    uint32_t clusters = cluster_count;
+    if (!clusters) {
+        // auto size: highest used cluster, at least FAT32 minimum
+        uint32_t highest = 2;
+        for (uint32_t c = 2; c < used.size(); c++) {
+            if (used[c]) {
+                highest = c;
+            }
+        }
+        clusters = std::max(highest - 1, MIN_CLUSTERS);
+    }
+
+    const uint32_t fat_size = ((clusters + 2) * 4 + SECTOR - 1) / SECTOR;
+
+    // align data area to cluster size (relative to card start)
+    uint32_t reserved = RESERVED_SECTORS;
+    while ((geometry.partition_start + reserved + NUM_FATS * fat_size) % spc) {
+        reserved++;
+    }
+
+    const uint64_t part_start = geometry.partition_start;
+    const uint64_t part_sectors = reserved + NUM_FATS * fat_size + (uint64_t)clusters * spc;
+    const uint64_t data_start = part_start + reserved + NUM_FATS * fat_size;
+
+    if (part_sectors > 0xFFFFFFFFull) {
+        last_error = "volume too large";
+        return false;
+    }
+
+    struct stat target;
+    const bool device = ::stat(filename.c_str(), &target) == 0 && S_ISBLK(target.st_mode);
+
+    const int fd = ::open(filename.c_str(), device ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        last_error = "can't create " + filename;
+        return false;
+    }
+
+    bool ok = device || ftruncate(fd, (off_t)((part_start + part_sectors) * SECTOR)) == 0;
+
+    // MBR with single FAT32 LBA partition
+    uint8_t sector[SECTOR] = {0};
+    uint8_t* entry = sector + 446;
+    entry[0] = 0x00;
+    entry[1] = 0xFE; entry[2] = 0xFF; entry[3] = 0xFF;
+    entry[4] = 0x0C;
+    entry[5] = 0xFE; entry[6] = 0xFF; entry[7] = 0xFF;
+    st_dword(entry + 8, (uint32_t)part_start);
+    st_dword(entry + 12, (uint32_t)part_sectors);
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    ok = ok && pwrite_all(fd, sector, SECTOR, 0);
+
+    // boot sector
+    std::memset(sector, 0, SECTOR);
+    sector[0] = 0xEB; sector[1] = 0x58; sector[2] = 0x90;
+    std::memcpy(sector + 3, "LOOTUNES", 8);
+    st_word(sector + 11, SECTOR);
+    sector[13] = (uint8_t)spc;
+    st_word(sector + 14, (uint16_t)reserved);
+    sector[16] = NUM_FATS;
+    sector[21] = 0xF8;
+    st_word(sector + 24, 63);
+    st_word(sector + 26, 255);
+    st_dword(sector + 28, (uint32_t)part_start);
+    st_dword(sector + 32, (uint32_t)part_sectors);
+    st_dword(sector + 36, fat_size);
+    st_dword(sector + 44, nodes[0].clusters[0]);
+    st_word(sector + 48, 1);
+    st_word(sector + 50, 6);
+    sector[64] = 0x80;
+    sector[66] = 0x29;
+    st_dword(sector + 67, 0x4C54554E);
+    std::memcpy(sector + 71, "LOOTUNES   ", 11);
+    std::memcpy(sector + 82, "FAT32   ", 8);
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    ok = ok && pwrite_all(fd, sector, SECTOR, part_start * SECTOR);
+    ok = ok && pwrite_all(fd, sector, SECTOR, (part_start + 6) * SECTOR);
+
+    // FAT
+    std::vector<uint32_t> fat(clusters + 2, 0);
+    fat[0] = 0x0FFFFFF8;
+    fat[1] = END_OF_CHAIN;
+    uint32_t free_clusters = clusters;
+    for (const Node& node : nodes) {
+        if (!node.deleted) {
+            chain(node.clusters, fat);
+            free_clusters -= (uint32_t)node.clusters.size();
+        }
+    }
+
+    // FS info
+    std::memset(sector, 0, SECTOR);
+    st_dword(sector, 0x41615252);
+    st_dword(sector + 484, 0x61417272);
+    st_dword(sector + 488, free_clusters);
+    st_dword(sector + 492, 0xFFFFFFFF);
+    st_dword(sector + 508, 0xAA550000);
+    ok = ok && pwrite_all(fd, sector, SECTOR, (part_start + 1) * SECTOR);
+    ok = ok && pwrite_all(fd, sector, SECTOR, (part_start + 7) * SECTOR);
+
+    std::vector<uint8_t> fat_bytes(fat.size() * 4);
+    for (size_t i = 0; i < fat.size(); i++) {
+        st_dword(&fat_bytes[i * 4], fat[i]);
+    }
+    for (uint32_t copy = 0; copy < NUM_FATS; copy++) {
+        ok = ok && pwrite_all(fd, fat_bytes.data(), fat_bytes.size(),
+            (part_start + reserved + copy * fat_size) * SECTOR);
+    }
+
+    // directory content and file data, cluster by cluster
+    auto write_chain = [&](const std::vector<uint32_t>& chain_clusters, const std::vector<uint8_t>& content) {
+        for (size_t i = 0; i < chain_clusters.size() && i * geometry.cluster_bytes < content.size(); i++) {
+            const size_t from = i * geometry.cluster_bytes;
+            const size_t count = std::min<size_t>(geometry.cluster_bytes, content.size() - from);
+            const uint64_t at = (data_start + (uint64_t)(chain_clusters[i] - 2) * spc) * SECTOR;
+            ok = ok && pwrite_all(fd, content.data() + from, count, at);
+        }
+    };
+
+    for (const Node& node : nodes) {
+        if (node.deleted) {
+            continue;
+        }
+
+        if (node.dir) {
+            // unused part of directory clusters must be zero (end of directory)
+            std::vector<uint8_t> content(node.clusters.size() * geometry.cluster_bytes, 0);
+            std::copy(node.entries.begin(), node.entries.end(), content.begin());
+            write_chain(node.clusters, content);
+        }
+        else if (node.data.empty() && !node.source.empty()) {
+            if (ok && !copy_chain(fd, node, data_start)) {
+                ::close(fd);
+                return false;
+            }
+        }
+        else {
+            write_chain(node.clusters, node.data);
+        }
+    }
+
+    // card keeps old content elsewhere, flush so it's complete when the tool exits
+    ok = ok && (!device || fsync(fd) == 0);
+
+    ::close(fd);
+
+    if (!ok) {
+        last_error = "write failed: " + filename;
+    }
+
+    return ok;
+}
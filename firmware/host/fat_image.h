@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Minimal FAT32 image writer for host tools. Builds a partitioned (MBR) card
+ * image with 8.3 directory entries. Clusters are handed out in the order
+ * entries are added, like a desktop OS copying files one by one, so
+ * directories grow interleaved with file data unless laid out otherwise.
+ */
+class FatImage {
+public:
+    struct Geometry {
+        uint64_t size_bytes = 0;        // 0: smallest valid FAT32 volume for content
+        uint32_t cluster_bytes = 32768;
+        uint32_t partition_start = 8192; // sectors, 4 MiB like SD card factory format
+    };
+
+    struct File {
+        std::vector<uint8_t> data;      // empty: data area left as zeros
+        std::string source;             // copied from this file by write() when data is empty
+        uint32_t size = 0;
+        uint32_t fragments = 1;         // number of cluster runs
+        uint32_t gap = 1;               // free clusters left between runs
+    };
+
+    explicit FatImage(const Geometry& geometry);
+
+    /**
+     * @brief Number of LFN entries placed before each following entry (0: none)
+     */
+    void set_lfn_entries(uint32_t count) { lfn_entries = count; }
+
+    bool mkdir(const std::string& path);
+    bool add_file(const std::string& path, const File& file);
+
+    /**
+     * @brief Delete entry: name byte set to 0xE5, clusters released, entry slot kept
+     */
+    bool remove(const std::string& path);
+
+    /**
+     * @brief Allocate directory clusters for expected number of entries before files are added
+     */
+    bool reserve_dir(const std::string& path, uint32_t entries);
+
+    /**
+     * @brief Format and write image file (sparse), or a card block device as
+     *        it is: only metadata and used clusters are written
+     */
+    bool write(const std::string& filename) const;
+
+    const std::string& error() const { return last_error; }
+
+    uint32_t cluster_bytes() const { return geometry.cluster_bytes; }
+    uint32_t total_clusters() const { return cluster_count; }
+
+    struct FragmentInfo {
+        std::string path;
+        uint32_t clusters;
+        uint32_t runs;
+        bool dir;
+    };
+
+    /**
+     * @brief Cluster runs of every file and directory
+     */
+    std::vector<FragmentInfo> fragmentation() const;
+
+private:
+    struct Node {
+        std::string name;               // 8.3 name, "NAME    EXT"
+        bool dir = false;
+        bool deleted = false;
+        uint32_t parent = 0;
+        uint32_t size = 0;
+        std::vector<uint32_t> clusters;
+        std::vector<uint8_t> entries;   // directory content
+        std::vector<uint32_t> children;
+        std::vector<uint8_t> data;
+        std::string source;
+        uint32_t entry_offset = 0;      // position of own entry in parent
+    };
+
+    bool ensure_formatted();
+    bool allocate(uint32_t count, uint32_t fragments, uint32_t gap, std::vector<uint32_t>& out);
+    bool append_entry(uint32_t dir, const uint8_t entry[32], uint32_t& offset);
+    bool add_node(const std::string& path, bool dir, const File* file);
+    bool find(const std::string& path, uint32_t& index) const;
+    bool make_83(const std::string& name, std::string& out) const;
+    void chain(const std::vector<uint32_t>& clusters, std::vector<uint32_t>& fat) const;
+    bool copy_chain(int fd, const Node& node, uint64_t data_start) const;
+    std::string path_of(uint32_t index) const;
+
+    Geometry geometry;
+    std::vector<Node> nodes;
+    std::vector<bool> used;             // cluster allocation map
+    uint32_t cursor = 2;                // next-fit allocation start
+    uint32_t cluster_count = 0;
+    uint32_t lfn_entries = 0;
+    bool formatted = false;
+    mutable std::string last_error;
+};
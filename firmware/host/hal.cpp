@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * HAL functions used by main.cpp, for the device simulator. Clocks are
+ * always at 48 MHz there, tick and delays follow the simulated clock.
+ */
+
+#include "sd_card.h"
+
+extern "C" {
+#include "py32f0xx.h"
+#include "py32f0xx_hal.h"
+}
+
+extern "C" {
+
+HAL_StatusTypeDef HAL_Init(void) {
+    return HAL_OK;
+}
+
+void HAL_IncTick(void) {
+}
+
+void HAL_SuspendTick(void) {
+}
+
+uint32_t HAL_GetTick(void) {
+    return (uint32_t)(HostSd::now_us() / 1000.0);
+}
+
+void HAL_Delay(uint32_t Delay) {
+    HostSd::advance_us(Delay * 1000.0);
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef*) {
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef*, uint32_t) {
+    return HAL_OK;
+}
+
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Host stand-in for CMSIS Cortex-M0+ core header. Picked up instead of
+ * CMSIS/Include/core_cm0plus.h when firmware sources are built for Linux.
+ * Core registers don't exist here, NVIC and interrupt masking calls are
+ * routed to the host MCU model (host/mcu.cpp).
+ */
+
+#ifndef __CORE_CM0PLUS_H_GENERIC
+#define __CORE_CM0PLUS_H_GENERIC
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+  #define   __I     volatile
+#else
+  #define   __I     volatile const
+#endif
+#define     __O     volatile
+#define     __IO    volatile
+#define     __IM    volatile const
+#define     __OM    volatile
+#define     __IOM   volatile
+
+#ifndef __STATIC_INLINE
+  #define __STATIC_INLINE static inline
+#endif
+#ifndef __ASM
+  #define __ASM __asm
+#endif
+#ifndef __WEAK
+  #define __WEAK __attribute__((weak))
+#endif
+#ifndef __ALIGNED
+  #define __ALIGNED(x) __attribute__((aligned(x)))
+#endif
+#ifndef __PACKED
+  #define __PACKED __attribute__((packed, aligned(1)))
+#endif
+
+#define __CORTEX_M (0x00U)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Host MCU model hooks */
+void host_irq_disable(void);
+void host_irq_enable(void);
+uint32_t host_irq_primask(void);
+void host_nvic_enable(int irq);
+void host_nvic_disable(int irq);
+void host_nvic_set_pending(int irq);
+void host_nvic_clear_pending(int irq);
+uint32_t host_nvic_is_pending(int irq);
+void host_nvic_set_priority(int irq, uint32_t priority);
+uint32_t host_nvic_priority(int irq);
+void host_system_reset(void);
+void host_idle(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+__STATIC_INLINE void __disable_irq(void) { host_irq_disable(); }
+__STATIC_INLINE void __enable_irq(void) { host_irq_enable(); }
+__STATIC_INLINE uint32_t __get_PRIMASK(void) { return host_irq_primask(); }
+__STATIC_INLINE void __set_PRIMASK(uint32_t primask) { if (primask) host_irq_disable(); else host_irq_enable(); }
+__STATIC_INLINE void __NOP(void) { }
+__STATIC_INLINE void __DSB(void) { }
+__STATIC_INLINE void __ISB(void) { }
+__STATIC_INLINE void __DMB(void) { }
+__STATIC_INLINE void __WFI(void) { host_idle(); }
+__STATIC_INLINE void __WFE(void) { host_idle(); }
+
+#define NVIC_EnableIRQ(irq)             host_nvic_enable((int)(irq))
+#define NVIC_DisableIRQ(irq)            host_nvic_disable((int)(irq))
+#define NVIC_SetPendingIRQ(irq)         host_nvic_set_pending((int)(irq))
+#define NVIC_ClearPendingIRQ(irq)       host_nvic_clear_pending((int)(irq))
+#define NVIC_GetPendingIRQ(irq)         host_nvic_is_pending((int)(irq))
+#define NVIC_SetPriority(irq, prio)     host_nvic_set_priority((int)(irq), (prio))
+#define NVIC_GetPriority(irq)           host_nvic_priority((int)(irq))
+#define NVIC_SystemReset()              host_system_reset()
+
+/* Bits referenced by HAL macros */
+#define SCB_SCR_SLEEPDEEP_Msk           (1UL << 2U)
+#define SCB_SCR_SLEEPONEXIT_Msk         (1UL << 1U)
+#define SCB_SCR_SEVONPEND_Msk           (1UL << 4U)
+#define SysTick_CTRL_TICKINT_Msk        (1UL << 1U)
+#define SysTick_CTRL_CLKSOURCE_Msk      (1UL << 2U)
+#define SysTick_CTRL_ENABLE_Msk         (1UL)
+
+typedef struct {
+    __IO uint32_t CPUID;
+    __IO uint32_t ICSR;
+    __IO uint32_t VTOR;
+    __IO uint32_t AIRCR;
+    __IO uint32_t SCR;
+    __IO uint32_t CCR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t LOAD;
+    __IO uint32_t VAL;
+    __IO uint32_t CALIB;
+} SysTick_Type;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern SCB_Type host_SCB;
+extern SysTick_Type host_SysTick;
+#ifdef __cplusplus
+}
+#endif
+
+#define SCB                             (&host_SCB)
+#define SysTick                         (&host_SysTick)
+
+#endif /* __CORE_CM0PLUS_H_GENERIC */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Host wrapper for the device header. Register layouts and bit definitions
+ * come from the real header, peripheral pointers are redirected to a plain
+ * structure owned by the host MCU model (host/mcu.cpp).
+ */
+
+#ifndef HOST_PY32F0XX_H
+#define HOST_PY32F0XX_H
+
+#include_next "py32f0xx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_PERIPHERALS(X) \
+    X(TIM_TypeDef, TIM1) \
+    X(TIM_TypeDef, TIM3) \
+    X(TIM_TypeDef, TIM14) \
+    X(TIM_TypeDef, TIM16) \
+    X(TIM_TypeDef, TIM17) \
+    X(LPTIM_TypeDef, LPTIM) \
+    X(SPI_TypeDef, SPI1) \
+    X(ADC_TypeDef, ADC1) \
+    X(ADC_Common_TypeDef, ADC) \
+    X(PWR_TypeDef, PWR) \
+    X(SYSCFG_TypeDef, SYSCFG) \
+    X(DMA_TypeDef, DMA1) \
+    X(DMA_Channel_TypeDef, DMA1_Channel1) \
+    X(DMA_Channel_TypeDef, DMA1_Channel2) \
+    X(DMA_Channel_TypeDef, DMA1_Channel3) \
+    X(RCC_TypeDef, RCC) \
+    X(EXTI_TypeDef, EXTI) \
+    X(FLASH_TypeDef, FLASH) \
+    X(CRC_TypeDef, CRC) \
+    X(GPIO_TypeDef, GPIOA) \
+    X(GPIO_TypeDef, GPIOB) \
+    X(GPIO_TypeDef, GPIOF)
+
+/*
+ * All peripherals in one block, so the simulator can map it at an address
+ * of its choice (host/mcu.h, HostMcu::trap_peripheral_access). Members are
+ * suffixed, peripheral names themselves are macros.
+ */
+typedef struct {
+#define HOST_PERIPHERAL_MEMBER(type, name) type name##_regs;
+HOST_PERIPHERALS(HOST_PERIPHERAL_MEMBER)
+#undef HOST_PERIPHERAL_MEMBER
+} HostPeripherals;
+
+extern HostPeripherals* host_peripherals;
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef TIM1
+#undef TIM3
+#undef TIM14
+#undef TIM16
+#undef TIM17
+#undef LPTIM
+#undef SPI1
+#undef ADC1
+#undef ADC
+#undef PWR
+#undef SYSCFG
+#undef DMA1
+#undef DMA1_Channel1
+#undef DMA1_Channel2
+#undef DMA1_Channel3
+#undef RCC
+#undef EXTI
+#undef FLASH
+#undef CRC
+#undef GPIOA
+#undef GPIOB
+#undef GPIOF
+
+#define TIM1            (&host_peripherals->TIM1_regs)
+#define TIM3            (&host_peripherals->TIM3_regs)
+#define TIM14           (&host_peripherals->TIM14_regs)
+#define TIM16           (&host_peripherals->TIM16_regs)
+#define TIM17           (&host_peripherals->TIM17_regs)
+#define LPTIM           (&host_peripherals->LPTIM_regs)
+#define SPI1            (&host_peripherals->SPI1_regs)
+#define ADC1            (&host_peripherals->ADC1_regs)
+#define ADC             (&host_peripherals->ADC_regs)
+#define PWR             (&host_peripherals->PWR_regs)
+#define SYSCFG          (&host_peripherals->SYSCFG_regs)
+#define DMA1            (&host_peripherals->DMA1_regs)
+#define DMA1_Channel1   (&host_peripherals->DMA1_Channel1_regs)
+#define DMA1_Channel2   (&host_peripherals->DMA1_Channel2_regs)
+#define DMA1_Channel3   (&host_peripherals->DMA1_Channel3_regs)
+#define RCC             (&host_peripherals->RCC_regs)
+#define EXTI            (&host_peripherals->EXTI_regs)
+#define FLASH           (&host_peripherals->FLASH_regs)
+#define CRC             (&host_peripherals->CRC_regs)
+#define GPIOA           (&host_peripherals->GPIOA_regs)
+#define GPIOB           (&host_peripherals->GPIOB_regs)
+#define GPIOF           (&host_peripherals->GPIOF_regs)
+
+#endif /* HOST_PY32F0XX_H */
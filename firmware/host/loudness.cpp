@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+constexpr double ABSOLUTE_GATE = -70;   // LUFS
+constexpr double RELATIVE_GATE = -10;   // LU below the mean of blocks over the absolute gate
+constexpr size_t BLOCK_SEGMENTS = 4;    // 400 ms block of 100 ms steps
+
+double to_lufs(double power) {
+    return -0.691 + 10 * std::log10(power);
+}
+
+double mean_above(const std::vector<double>& blocks, double gate) {
+    double sum = 0;
+    size_t count = 0;
+    for (double power : blocks) {
+        if (to_lufs(power) > gate) {
+            sum += power;
+            count++;
+        }
+    }
+    return count ? sum / count : 0;
+}
+
+} // namespace
+
+/*
+ * K-weighting filters of BS.1770 are given for 48 kHz, these are the analog
+ * prototypes they come from, bilinear transformed for the rate.
+ */
+LoudnessMeter::LoudnessMeter(int rate, int channels)
+    : nchannels(channels), weight(channels == 1 ? 2 : 1), segment_length((size_t)rate / 10) {
+    // high shelf, +4 dB above ~1.7 kHz: head diffraction
+    {
+        const double k = std::tan(M_PI * 1681.974450955533 / rate);
+        const double q = 0.7071752369554196;
+        const double vh = std::pow(10, 3.999843853973347 / 20);
+        const double vb = std::pow(vh, 0.4996667741545416);
+        const double a0 = 1 + k / q + k * k;
+        shelf = { (vh + vb * k / q + k * k) / a0, 2 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                  2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0 };
+    }
+
+    // second order high-pass at ~38 Hz (RLB weighting)
+    {
+        const double k = std::tan(M_PI * 38.13547087602444 / rate);
+        const double q = 0.5003270373238773;
+        const double a0 = 1 + k / q + k * k;
+        highpass = { 1, -2, 1, 2 * (k * k - 1) / a0, (1 - k / q + k * k) / a0 };
+    }
+}
+
+double LoudnessMeter::filter(int channel, double x) {
+    double* s = state[channel];
+
+    const double w1 = x - shelf.a1 * s[0] - shelf.a2 * s[1];
+    const double y1 = shelf.b0 * w1 + shelf.b1 * s[0] + shelf.b2 * s[1];
+    s[1] = s[0];
+    s[0] = w1;
+
+    const double w2 = y1 - highpass.a1 * s[2] - highpass.a2 * s[3];
+    const double y2 = highpass.b0 * w2 + highpass.b1 * s[2] + highpass.b2 * s[3];
+    s[3] = s[2];
+    s[2] = w2;
+
+    return y2;
+}
+
+void LoudnessMeter::add(const int16_t* pcm, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        for (int ch = 0; ch < nchannels; ch++) {
+            const int sample = pcm[i * nchannels + ch];
+            if (std::abs(sample) > max_sample) {
+                max_sample = std::abs(sample);
+            }
+
+            const double y = filter(ch, sample / 32768.0);
+            segment_sum += weight * y * y;
+        }
+
+        if (++segment_fill == segment_length) {
+            segments.push_back(segment_sum / segment_length);
+            segment_sum = 0;
+            segment_fill = 0;
+        }
+    }
+}
+
+double LoudnessMeter::integrated() const {
+    std::vector<double> blocks;
+    for (size_t i = 0; i + BLOCK_SEGMENTS <= segments.size(); i++) {
+        double sum = 0;
+        for (size_t j = 0; j < BLOCK_SEGMENTS; j++) {
+            sum += segments[i + j];
+        }
+        blocks.push_back(sum / BLOCK_SEGMENTS);
+    }
+
+    const double absolute = mean_above(blocks, ABSOLUTE_GATE);
+    if (absolute <= 0) {
+        return -HUGE_VAL;
+    }
+
+    const double relative = mean_above(blocks, std::max(ABSOLUTE_GATE, to_lufs(absolute) + RELATIVE_GATE));
+    return relative > 0 ? to_lufs(relative) : -HUGE_VAL;
+}
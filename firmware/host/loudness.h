@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Integrated loudness of a track after ITU-R BS.1770 / EBU R128: K-weighted
+ * mean square over 400 ms blocks every 100 ms, gated at -70 LUFS and then 10
+ * LU below the level of the blocks left. Mono is measured as the player
+ * outputs it, the same signal on both channels.
+ */
+class LoudnessMeter {
+public:
+    LoudnessMeter(int rate, int channels);
+
+    /**
+     * @brief Add interleaved 16-bit samples
+     */
+    void add(const int16_t* pcm, size_t count);
+
+    /**
+     * @brief Integrated loudness in LUFS, -HUGE_VAL when all blocks are gated
+     */
+    double integrated() const;
+
+    /**
+     * @brief Largest sample magnitude, 1.0 is full scale
+     */
+    double peak() const { return max_sample / 32768.0; }
+
+private:
+    struct Biquad {
+        double b0, b1, b2, a1, a2;
+    };
+
+    Biquad shelf;
+    Biquad highpass;
+    double state[2][4] = {};            // per channel: shelf then high-pass, direct form II
+
+    int nchannels;
+    double weight;                      // mono counts twice
+    size_t segment_length;              // samples of a 100 ms step
+    size_t segment_fill = 0;
+    double segment_sum = 0;
+
+    std::vector<double> segments;       // mean square of each step, blocks are 4 of them
+    int max_sample = 0;
+
+    double filter(int channel, double x);
+};
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "mcu.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace {
+    HostPeripherals default_peripherals;
+}
+
+extern "C" {
+HostPeripherals* host_peripherals = &default_peripherals;
+
+SCB_Type host_SCB;
+SysTick_Type host_SysTick;
+}
+
+namespace HostMcu {
+
+namespace {
+    constexpr int IRQ_COUNT = 32;
+    constexpr uint32_t NO_PRIORITY = 0x100;
+    constexpr unsigned long TRAP_FLAG = 0x100; // EFLAGS.TF
+
+    bool irq_masked = false;
+    uint32_t irq_enabled = 0;
+    uint32_t irq_pending = 0;
+    uint32_t irq_priority[IRQ_COUNT] = {0};
+    Vector vectors[IRQ_COUNT] = {nullptr};
+
+    // preempted handlers
+    int active_stack[IRQ_COUNT];
+    double active_latency[IRQ_COUNT];
+    int active_depth = 0;
+
+    Clock clock = nullptr;
+    double pending_since[IRQ_COUNT] = {0};
+
+    ResetHandler reset_handler = nullptr;
+    IdleHandler idle_handler = nullptr;
+    UnmaskHandler unmask_handler = nullptr;
+    LevelHandler level_handler = nullptr;
+
+    // register trapping
+    HostPeripherals* model_view = &default_peripherals;
+    uint8_t* trapped_view = nullptr;
+    size_t trapped_size = 0;
+    AccessHandler access_handler = nullptr;
+
+    struct PendingAccess {
+        size_t offset;
+        bool write;
+        uint32_t old;
+    };
+
+    // nested when interrupt handler is taken from access handler
+    PendingAccess pending_access[IRQ_COUNT + 1];
+    int pending_depth = 0;
+
+    void set_pending(int irq) {
+        if (!(irq_pending & (1u << irq)) && clock) {
+            pending_since[irq] = clock();
+        }
+        irq_pending |= 1u << irq;
+    }
+
+    // latency counts time spent behind other handlers only, not masked / disabled time
+    void restart_latency(uint32_t irqs) {
+        for (int irq = 0; irq < IRQ_COUNT && clock; irq++) {
+            if (irqs & (1u << irq)) {
+                pending_since[irq] = clock();
+            }
+        }
+    }
+
+    uint32_t current_priority() {
+        return active_depth ? irq_priority[active_stack[active_depth - 1]] : NO_PRIORITY;
+    }
+
+    int next_irq() {
+        const uint32_t ready = irq_pending & irq_enabled;
+        int best = -1;
+        for (int irq = 0; irq < IRQ_COUNT; irq++) {
+            if ((ready & (1u << irq)) && (best < 0 || irq_priority[irq] < irq_priority[best])) {
+                best = irq;
+            }
+        }
+
+        return best >= 0 && irq_priority[best] < current_priority() ? best : -1;
+    }
+
+    uint32_t read_model(size_t offset) {
+        uint32_t value;
+        std::memcpy(&value, reinterpret_cast<uint8_t*>(model_view) + (offset & ~size_t(3)), sizeof(value));
+        return value;
+    }
+
+    void on_segv(int sig, siginfo_t* info, void* context) {
+        uint8_t* address = static_cast<uint8_t*>(info->si_addr);
+        if (address < trapped_view || address >= trapped_view + trapped_size
+                || pending_depth > IRQ_COUNT) {
+            // genuine crash
+            std::signal(sig, SIG_DFL);
+            return;
+        }
+
+        ucontext_t* uc = static_cast<ucontext_t*>(context);
+        PendingAccess& access = pending_access[pending_depth++];
+        access.offset = (size_t)(address - trapped_view);
+        access.write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+        access.old = read_model(access.offset);
+
+        if (access_handler) {
+            access_handler(Access::Before, access.offset, access.write, access.old);
+            access.old = read_model(access.offset);
+        }
+
+        // let single instruction through
+        mprotect(trapped_view, trapped_size, PROT_READ | PROT_WRITE);
+        uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+    }
+
+    void on_trap(int sig, siginfo_t*, void* context) {
+        ucontext_t* uc = static_cast<ucontext_t*>(context);
+        if (pending_depth == 0 || !(uc->uc_mcontext.gregs[REG_EFL] & TRAP_FLAG)) {
+            std::signal(sig, SIG_DFL);
+            return;
+        }
+
+        uc->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+        mprotect(trapped_view, trapped_size, PROT_NONE);
+
+        const PendingAccess access = pending_access[--pending_depth];
+        if (access_handler) {
+            access_handler(Access::After, access.offset, access.write, access.old);
+        }
+    }
+}
+
+void set_reset_handler(ResetHandler handler) {
+    reset_handler = handler;
+}
+
+void set_idle_handler(IdleHandler handler) {
+    idle_handler = handler;
+}
+
+void set_unmask_handler(UnmaskHandler handler) {
+    unmask_handler = handler;
+}
+
+bool irq_is_masked() {
+    return irq_masked;
+}
+
+bool irq_waiting() {
+    return (irq_pending & irq_enabled) != 0;
+}
+
+bool deep_sleep() {
+    return (host_SCB.SCR & SCB_SCR_SLEEPDEEP_Msk) != 0;
+}
+
+bool irq_is_enabled(int irq) {
+    return (irq_enabled & (1u << irq)) != 0;
+}
+
+void set_vector(int irq, Vector handler) {
+    vectors[irq] = handler;
+}
+
+void set_level_handler(LevelHandler handler) {
+    level_handler = handler;
+}
+
+void raise(int irq) {
+    set_pending(irq);
+}
+
+void dispatch() {
+    while (!irq_masked) {
+        const int irq = next_irq();
+        if (irq < 0) {
+            return;
+        }
+
+        irq_pending &= ~(1u << irq);
+        active_latency[active_depth] = clock ? clock() - pending_since[irq] : 0;
+        active_stack[active_depth++] = irq;
+
+        if (vectors[irq]) {
+            vectors[irq]();
+        }
+
+        active_depth--;
+
+        if (level_handler && level_handler(irq)) {
+            set_pending(irq);
+        }
+    }
+}
+
+int active_irq() {
+    return active_depth ? active_stack[active_depth - 1] : -1;
+}
+
+void set_clock(Clock time_source) {
+    clock = time_source;
+}
+
+double entry_latency_us() {
+    return active_depth ? active_latency[active_depth - 1] : 0;
+}
+
+HostPeripherals* peripherals() {
+    return model_view;
+}
+
+ptrdiff_t peripheral_offset(uint32_t address) {
+    const uintptr_t base = reinterpret_cast<uintptr_t>(host_peripherals);
+    if ((uintptr_t)address < base || (uintptr_t)address >= base + sizeof(HostPeripherals)) {
+        return -1;
+    }
+
+    return (ptrdiff_t)(address - base);
+}
+
+bool trap_peripheral_access(AccessHandler handler) {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t size = (sizeof(HostPeripherals) + page - 1) / page * page;
+
+    const int fd = memfd_create("peripherals", 0);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+        return false;
+    }
+
+    void* model = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // firmware stores register addresses in 32-bit DMA registers
+    void* trapped = mmap(nullptr, size, PROT_NONE, MAP_SHARED | MAP_32BIT, fd, 0);
+    close(fd);
+
+    if (model == MAP_FAILED || trapped == MAP_FAILED) {
+        return false;
+    }
+
+    std::memcpy(model, host_peripherals, sizeof(HostPeripherals));
+    model_view = static_cast<HostPeripherals*>(model);
+    trapped_view = static_cast<uint8_t*>(trapped);
+    trapped_size = size;
+    access_handler = handler;
+    host_peripherals = static_cast<HostPeripherals*>(trapped);
+
+    struct sigaction action = {};
+    action.sa_flags = SA_SIGINFO | SA_NODEFER; // handlers may run firmware interrupts
+    sigemptyset(&action.sa_mask);
+
+    action.sa_sigaction = on_segv;
+    sigaction(SIGSEGV, &action, nullptr);
+    action.sa_sigaction = on_trap;
+    sigaction(SIGTRAP, &action, nullptr);
+
+    return true;
+}
+
+} // namespace HostMcu
+
+using namespace HostMcu;
+
+extern "C" {
+
+void host_irq_disable(void) {
+    irq_masked = true;
+}
+
+void host_irq_enable(void) {
+    if (irq_masked && unmask_handler) {
+        unmask_handler();
+    }
+
+    if (irq_masked) {
+        restart_latency(irq_pending);
+    }
+    irq_masked = false;
+    dispatch();
+}
+
+uint32_t host_irq_primask(void) {
+    return irq_masked ? 1 : 0;
+}
+
+void host_nvic_enable(int irq) {
+    if (irq >= 0) {
+        if (!(irq_enabled & (1u << irq))) {
+            restart_latency(irq_pending & (1u << irq));
+        }
+        irq_enabled |= 1u << irq;
+        dispatch();
+    }
+}
+
+void host_nvic_disable(int irq) {
+    if (irq >= 0) {
+        irq_enabled &= ~(1u << irq);
+    }
+}
+
+void host_nvic_set_pending(int irq) {
+    if (irq >= 0) {
+        set_pending(irq);
+        dispatch();
+    }
+}
+
+void host_nvic_clear_pending(int irq) {
+    if (irq >= 0) {
+        irq_pending &= ~(1u << irq);
+    }
+}
+
+uint32_t host_nvic_is_pending(int irq) {
+    return irq >= 0 ? (irq_pending >> irq) & 1u : 0;
+}
+
+void host_nvic_set_priority(int irq, uint32_t priority) {
+    if (irq >= 0) {
+        irq_priority[irq] = priority;
+    }
+}
+
+uint32_t host_nvic_priority(int irq) {
+    return irq >= 0 ? irq_priority[irq] : 0;
+}
+
+void host_system_reset(void) {
+    if (reset_handler) {
+        reset_handler();
+    }
+
+    std::fprintf(stderr, "system reset requested\n");
+    std::exit(2);
+}
+
+void host_idle(void) {
+    if (idle_handler) {
+        idle_handler();
+    }
+}
+
+}
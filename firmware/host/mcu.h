@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+extern "C" {
+#include "py32f0xx.h"
+}
+
+namespace HostMcu {
+
+using ResetHandler = void (*)();
+using IdleHandler = void (*)();
+using UnmaskHandler = void (*)();
+using Vector = void (*)();
+using LevelHandler = bool (*)(int irq);
+using Clock = double (*)();
+
+enum class Access {
+    Before, // instruction about to access register, reads see what's written here
+    After,  // instruction done, write side effects are applied here
+};
+
+/**
+ * @brief Register access handler
+ * @param offset Byte offset of accessed register in HostPeripherals
+ * @param write True for store (or read-modify-write) instruction
+ * @param old Register value before the access (After only)
+ */
+using AccessHandler = void (*)(Access phase, size_t offset, bool write, uint32_t old);
+
+/**
+ * @brief Called on NVIC_SystemReset, doesn't have to return
+ */
+void set_reset_handler(ResetHandler handler);
+
+/**
+ * @brief Called on __WFI / __WFE
+ */
+void set_idle_handler(IdleHandler handler);
+
+/**
+ * @brief Called on __enable_irq after interrupts were masked, before pending interrupts are taken
+ */
+void set_unmask_handler(UnmaskHandler handler);
+
+/**
+ * @brief Check if interrupts are masked with __disable_irq
+ */
+bool irq_is_masked();
+
+/**
+ * @brief Check if an enabled interrupt is pending, that ends __WFI even while masked
+ */
+bool irq_waiting();
+
+/**
+ * @brief Check if __WFI enters Stop mode (SLEEPDEEP set)
+ */
+bool deep_sleep();
+
+/**
+ * @brief Check if interrupt is enabled in NVIC
+ */
+bool irq_is_enabled(int irq);
+
+/**
+ * @brief Install interrupt handler taken by dispatch()
+ */
+void set_vector(int irq, Vector handler);
+
+/**
+ * @brief Query used after handler returns, interrupt is pending again if its line is still active
+ */
+void set_level_handler(LevelHandler handler);
+
+/**
+ * @brief Mark interrupt pending (peripheral side)
+ */
+void raise(int irq);
+
+/**
+ * @brief Take pending enabled interrupts allowed by PRIMASK and active priority
+ */
+void dispatch();
+
+/**
+ * @brief Currently executed interrupt, -1 in thread mode
+ */
+int active_irq();
+
+/**
+ * @brief Time source for interrupt latency, microseconds
+ */
+void set_clock(Clock clock);
+
+/**
+ * @brief How long the currently executed interrupt waited for other handlers before
+ *        it was taken (time it was masked by PRIMASK or disabled isn't counted)
+ */
+double entry_latency_us();
+
+/**
+ * @brief Register block seen by the model, never trapped
+ */
+HostPeripherals* peripherals();
+
+/**
+ * @brief Byte offset of firmware visible register address (as stored in DMA CPAR), or -1
+ */
+ptrdiff_t peripheral_offset(uint32_t address);
+
+/**
+ * @brief Map peripherals so every firmware access to them calls handler
+ *
+ * Register block is mapped twice from the same memory. Firmware view is
+ * protected, faulting instruction is single-stepped with the page unlocked
+ * and handler is called around it. Model view (peripherals()) stays
+ * accessible. Linux x86-64 only.
+ */
+bool trap_peripheral_access(AccessHandler handler);
+
+} // namespace HostMcu
+
+/**
+ * @brief Byte offset of register in HostPeripherals, e.g. HOST_REG(TIM3, CNT)
+ */
+#define HOST_REG(periph, reg) (offsetof(HostPeripherals, periph##_regs) + offsetof(decltype(HostPeripherals::periph##_regs), reg))
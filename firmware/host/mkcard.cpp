@@ -0,0 +1,632 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Card builder. Writes a FAT32 image, or a card block device, from a source
+ * tree laid out for the player:
+ *   - directories get their clusters first, sized for their entries, so
+ *     they never interleave with track data
+ *   - every file is one contiguous cluster run: the player caches it in a
+ *     single cluster range and CMD18 streams run across cluster boundaries
+ *   - entries are in name order, which is the order the player plays them
+ *   - long names are shortened to 8.3 (NAME~N.EXT), the player reads those
+ *   - cluster size is chosen for the library unless given: the largest one
+ *     (up to 32K) wasting at most 1% of the data in partially used clusters
+ *   - --state adds an empty STATE.BIN, the player can't create files and
+ *     keeps no playback state without it
+ *   - CONFIG.INI gets an empty CONFIG.BIN next to it, the player keeps the
+ *     parsed configuration there and reads it in one go on later boots
+ *   - an empty CARD.BIN is added, the player keeps read timing of the card
+ *     there instead of measuring it on every boot
+ *   - --trace adds an empty TRACE.BIN, the player saves its event trace to
+ *     it (see trace2json)
+ *
+ * --report reads an existing card or image instead and lists fragmented
+ * files, and those with more cluster runs than the player can cache (it
+ * doesn't open them, they are skipped).
+ */
+
+#include "fat_image.h"
+#include "petitfat/source/pffconf.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr uint32_t SECTOR = 512;
+constexpr uint32_t MIN_CLUSTERS = 65600;        // as FatImage, safely above FAT32 minimum
+constexpr double MAX_SLACK = 0.01;              // share of data lost to partial clusters
+constexpr uint32_t STATE_SLOTS = 8;             // PlaybackState journal, one record per sector
+constexpr uint32_t CACHED_RANGES = PF_CLUSTER_RANGES - 1;  // last one is the end mark
+
+struct Options {
+    const char* source = nullptr;
+    const char* target = nullptr;
+    uint64_t size = 0;                  // 0: device size, or smallest volume for an image
+    uint32_t cluster = 0;               // 0: chosen for the library
+    bool state = false;
+    bool trace = false;
+    bool card = false;                  // target may be a block device
+    bool report = false;
+};
+
+uint64_t parse_size(const std::string& value) {
+    char* end = nullptr;
+    uint64_t v = std::strtoull(value.c_str(), &end, 0);
+    switch (end && *end ? std::toupper((unsigned char)*end) : 0) {
+        case 'K': v <<= 10; break;
+        case 'M': v <<= 20; break;
+        case 'G': v <<= 30; break;
+    }
+    return v;
+}
+
+bool is_block_device(const char* path) {
+    struct stat st;
+    return ::stat(path, &st) == 0 && S_ISBLK(st.st_mode);
+}
+
+uint64_t device_size(const char* path) {
+    const int fd = ::open(path, O_RDONLY);
+    uint64_t size = 0;
+    if (fd >= 0) {
+        if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+            size = 0;
+        }
+        ::close(fd);
+    }
+    return size;
+}
+
+
+/*
+ * Source tree, entries of each directory in name order with their 8.3 names
+ */
+struct Entry {
+    fs::path source;
+    std::string name;                   // 8.3, "NAME.EXT"
+    bool dir = false;
+    uint64_t size = 0;
+    std::vector<Entry> children;
+};
+
+/**
+ * 8.3 name: the name itself when valid, otherwise up to 6 characters of it
+ * with ~N, unique in the directory. Extension is cut to 3 characters.
+ */
+std::string short_name(const std::string& name, std::set<std::string>& taken) {
+    std::string base = name;
+    std::string ext;
+    const auto dot = name.rfind('.');
+    if (dot != std::string::npos && dot > 0) {
+        base = name.substr(0, dot);
+        ext = name.substr(dot + 1);
+    }
+
+    auto clean = [](const std::string& part) {
+        std::string out;
+        for (const char c : part) {
+            if (c == ' ' || c == '.') {
+                continue;
+            }
+            const bool valid = (unsigned char)c > ' ' && (unsigned char)c < 0x7f
+                && !std::strchr("\"*+,/:;<=>?[\\]|", c);
+            out += valid ? (char)std::toupper((unsigned char)c) : '_';
+        }
+        return out;
+    };
+
+    const std::string clean_base = clean(base);
+    const std::string clean_ext = clean(ext).substr(0, 3);
+    const std::string suffix = clean_ext.empty() ? "" : "." + clean_ext;
+
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    const bool fits = !clean_base.empty() && clean_base.size() <= 8 && upper == clean_base + suffix;
+
+    if (fits && taken.insert(upper).second) {
+        return upper;
+    }
+
+    const std::string stem = clean_base.empty() ? "_" : clean_base;
+    for (uint32_t n = 1; ; n++) {
+        const std::string tail = "~" + std::to_string(n);
+        const std::string candidate = stem.substr(0, std::min<size_t>(stem.size(), 8 - tail.size())) + tail + suffix;
+        if (taken.insert(candidate).second) {
+            return candidate;
+        }
+    }
+}
+
+/**
+ * Name order ignoring case, numbers compare by value ("2" before "10")
+ */
+bool natural_less(const std::string& a, const std::string& b) {
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        if (std::isdigit((unsigned char)a[i]) && std::isdigit((unsigned char)b[j])) {
+            size_t end_a = i, end_b = j;
+            while (end_a < a.size() && std::isdigit((unsigned char)a[end_a])) end_a++;
+            while (end_b < b.size() && std::isdigit((unsigned char)b[end_b])) end_b++;
+
+            // leading zeros don't count, then the longer number is larger
+            std::string x = a.substr(i, end_a - i), y = b.substr(j, end_b - j);
+            x.erase(0, std::min(x.find_first_not_of('0'), x.size()));
+            y.erase(0, std::min(y.find_first_not_of('0'), y.size()));
+            if (x.size() != y.size()) {
+                return x.size() < y.size();
+            }
+            if (x != y) {
+                return x < y;
+            }
+            i = end_a;
+            j = end_b;
+            continue;
+        }
+
+        const int x = std::tolower((unsigned char)a[i]), y = std::tolower((unsigned char)b[j]);
+        if (x != y) {
+            return x < y;
+        }
+        i++;
+        j++;
+    }
+    return a.size() - i < b.size() - j;
+}
+
+bool scan(const fs::path& dir, Entry& into, uint32_t& files, uint64_t& bytes) {
+    std::vector<fs::directory_entry> items;
+    std::error_code error;
+    for (const fs::directory_entry& item : fs::directory_iterator(dir, error)) {
+        // hidden files of desktop systems stay behind
+        if (item.path().filename().string()[0] != '.' && (item.is_directory() || item.is_regular_file())) {
+            items.push_back(item);
+        }
+    }
+    if (error) {
+        std::fprintf(stderr, "%s: %s\n", dir.c_str(), error.message().c_str());
+        return false;
+    }
+
+    // the player plays entries in directory order
+    std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+        return natural_less(a.path().filename().string(), b.path().filename().string());
+    });
+
+    std::set<std::string> taken;
+    for (const fs::directory_entry& item : items) {
+        Entry entry;
+        entry.source = item.path();
+        entry.dir = item.is_directory();
+        entry.name = short_name(item.path().filename().string(), taken);
+
+        if (entry.dir) {
+            if (!scan(item.path(), entry, files, bytes)) {
+                return false;
+            }
+        }
+        else {
+            entry.size = item.file_size();
+            if (entry.size > UINT32_MAX) {
+                std::fprintf(stderr, "%s: over 4 GB, doesn't fit FAT32\n", item.path().c_str());
+                return false;
+            }
+            files++;
+            bytes += entry.size;
+        }
+        into.children.push_back(std::move(entry));
+    }
+    return true;
+}
+
+/**
+ * Bytes lost in the last clusters of files
+ */
+uint64_t slack(const Entry& dir, uint32_t cluster) {
+    uint64_t total = 0;
+    for (const Entry& entry : dir.children) {
+        total += entry.dir ? slack(entry, cluster) : (cluster - entry.size % cluster) % cluster;
+    }
+    return total;
+}
+
+/**
+ * Largest cluster (4K .. 32K) within the slack limit that still gives a
+ * FAT32 volume of the card size
+ */
+uint32_t choose_cluster(const Entry& root, uint64_t bytes, uint64_t card_size) {
+    for (uint32_t cluster = 32768; cluster > 4096; cluster /= 2) {
+        if (card_size && card_size / cluster < MIN_CLUSTERS + 1024) {
+            continue;
+        }
+        if (slack(root, cluster) <= bytes * MAX_SLACK) {
+            return cluster;
+        }
+    }
+    return 4096;
+}
+
+
+/*
+ * Layout: every directory first, each reserved for its entries, then the
+ * files, tree order. FatImage hands clusters out in order, so each file is
+ * one run right after the previous one.
+ */
+bool add_dirs(FatImage& image, const Entry& dir, const std::string& path) {
+    for (const Entry& entry : dir.children) {
+        if (entry.dir && !image.mkdir(path + "/" + entry.name)) {
+            return false;
+        }
+    }
+    for (const Entry& entry : dir.children) {
+        if (entry.dir && (!image.reserve_dir(path + "/" + entry.name, (uint32_t)entry.children.size())
+                || !add_dirs(image, entry, path + "/" + entry.name))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool add_files(FatImage& image, const Entry& dir, const std::string& path) {
+    for (const Entry& entry : dir.children) {
+        const std::string name = path + "/" + entry.name;
+        if (entry.dir) {
+            if (!add_files(image, entry, name)) {
+                return false;
+            }
+            continue;
+        }
+
+        FatImage::File file;
+        file.source = entry.source.string();
+        file.size = (uint32_t)entry.size;
+        if (!image.add_file(name, file)) {
+            return false;
+        }
+        if (strcasecmp(entry.name.c_str(), entry.source.filename().c_str()) != 0) {
+            std::printf("  %s -> %s\n", entry.source.c_str(), name.c_str());
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Existing FAT32 volume, whole card (MBR) or a partition image
+ */
+class CardReader {
+public:
+    ~CardReader() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool open(const char* path) {
+        fd = ::open(path, O_RDONLY);
+        uint8_t sector[SECTOR];
+        if (fd < 0 || !read(0, sector, SECTOR)) {
+            return fail("can't read");
+        }
+
+        // boot sector of the volume, or MBR pointing to it
+        uint64_t start = 0;
+        if (std::memcmp(sector + 82, "FAT32", 5) != 0) {
+            const uint8_t type = sector[446 + 4];
+            if (type != 0x0b && type != 0x0c) {
+                return fail("no FAT32 partition");
+            }
+            start = get32(sector + 446 + 8);
+            if (!read(start * SECTOR, sector, SECTOR) || std::memcmp(sector + 82, "FAT32", 5) != 0) {
+                return fail("no FAT32 boot sector");
+            }
+        }
+
+        if (get16(sector + 11) != SECTOR || !sector[13]) {
+            return fail("unsupported sector size");
+        }
+        cluster_bytes = sector[13] * SECTOR;
+        const uint64_t fat_start = start + get16(sector + 14);
+        const uint32_t fat_size = get32(sector + 36);
+        data_start = fat_start + (uint64_t)sector[16] * fat_size;
+        root = get32(sector + 44);
+
+        const uint64_t volume = get32(sector + 32);
+        cluster_count = (uint32_t)((volume - (data_start - start)) / sector[13]);
+
+        std::vector<uint8_t> bytes((size_t)fat_size * SECTOR);
+        if (!read(fat_start * SECTOR, bytes.data(), bytes.size())) {
+            return fail("can't read FAT");
+        }
+        fat.resize(std::min<size_t>(bytes.size() / 4, (size_t)cluster_count + 2));
+        for (size_t i = 0; i < fat.size(); i++) {
+            fat[i] = get32(&bytes[i * 4]) & 0x0fffffff;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Cluster runs of every file and directory under the root
+     */
+    std::vector<FatImage::FragmentInfo> fragmentation() {
+        std::vector<FatImage::FragmentInfo> result;
+        walk(root, "", result);
+        return result;
+    }
+
+    uint32_t cluster_size() const { return cluster_bytes; }
+    const std::string& error() const { return error_text; }
+
+private:
+    int fd = -1;
+    uint32_t cluster_bytes = 0;
+    uint32_t cluster_count = 0;
+    uint64_t data_start = 0;
+    uint32_t root = 0;
+    std::vector<uint32_t> fat;
+    std::string error_text;
+
+    static uint32_t get16(const uint8_t* p) { return p[0] | p[1] << 8; }
+    static uint32_t get32(const uint8_t* p) { return get16(p) | get16(p + 2) << 16; }
+
+    bool fail(const std::string& message) {
+        error_text = message;
+        return false;
+    }
+
+    bool read(uint64_t offset, void* data, size_t size) {
+        return ::pread(fd, data, size, (off_t)offset) == (ssize_t)size;
+    }
+
+    std::vector<uint32_t> chain(uint32_t cluster) const {
+        std::vector<uint32_t> clusters;
+        while (cluster >= 2 && cluster < fat.size() && clusters.size() < fat.size()) {
+            clusters.push_back(cluster);
+            cluster = fat[cluster];
+        }
+        return clusters;
+    }
+
+    static uint32_t runs(const std::vector<uint32_t>& clusters) {
+        uint32_t count = clusters.empty() ? 0 : 1;
+        for (size_t i = 1; i < clusters.size(); i++) {
+            count += clusters[i] != clusters[i - 1] + 1;
+        }
+        return count;
+    }
+
+    void walk(uint32_t dir, const std::string& path, std::vector<FatImage::FragmentInfo>& result) {
+        const std::vector<uint32_t> clusters = chain(dir);
+        result.push_back({ path.empty() ? "/" : path, (uint32_t)clusters.size(), runs(clusters), true });
+
+        std::vector<uint8_t> content(cluster_bytes);
+        for (const uint32_t cluster : clusters) {
+            if (!read((data_start + (uint64_t)(cluster - 2) * (cluster_bytes / SECTOR)) * SECTOR,
+                    content.data(), content.size())) {
+                return;
+            }
+
+            for (uint32_t offset = 0; offset < cluster_bytes; offset += 32) {
+                const uint8_t* entry = &content[offset];
+                if (entry[0] == 0) {
+                    return;                     // end of directory
+                }
+                if (entry[0] == 0xe5 || entry[11] == 0x0f || (entry[11] & 0x08) || entry[0] == '.') {
+                    continue;                   // deleted, long name, volume label, dot entries
+                }
+
+                std::string name(reinterpret_cast<const char*>(entry), 8);
+                name.erase(name.find_last_not_of(' ') + 1);
+                std::string ext(reinterpret_cast<const char*>(entry) + 8, 3);
+                ext.erase(ext.find_last_not_of(' ') + 1);
+                const std::string child = path + "/" + name + (ext.empty() ? "" : "." + ext);
+                const uint32_t first = get16(entry + 20) << 16 | get16(entry + 26);
+
+                if (entry[11] & 0x10) {
+                    walk(first, child, result);
+                }
+                else if (first) {
+                    const std::vector<uint32_t> file = chain(first);
+                    result.push_back({ child, (uint32_t)file.size(), runs(file), false });
+                }
+            }
+        }
+    }
+};
+
+void print_report(const char* target, const std::vector<FatImage::FragmentInfo>& entries, uint32_t cluster) {
+    uint32_t files = 0, fragmented = 0, uncached = 0, dirs_fragmented = 0;
+    for (const auto& info : entries) {
+        if (info.dir) {
+            dirs_fragmented += info.runs > 1;
+            continue;
+        }
+        files++;
+        if (info.runs > 1) {
+            fragmented++;
+            uncached += info.runs > CACHED_RANGES;
+            std::printf("  %-40s %7u clusters in %u runs%s\n", info.path.c_str(), info.clusters, info.runs,
+                info.runs > CACHED_RANGES ? ", skipped by the player" : "");
+        }
+    }
+    std::printf("%s: %u files, %u fragmented, %u over the %u cluster runs the player caches, "
+        "%u directories fragmented, cluster %u bytes\n",
+        target, files, fragmented, uncached, CACHED_RANGES, dirs_fragmented, cluster);
+}
+
+void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s <source dir> <image | device> [--size n[K|M|G]] [--cluster n[K]] [--state] [--trace] [--card]\n"
+        "       %s --report <image | device>\n"
+        "  --size     volume size (default: device size, smallest FAT32 volume for an image)\n"
+        "  --cluster  cluster size, 4K to 32K (default: largest wasting at most 1%% of data)\n"
+        "  --state    add empty STATE.BIN if the source has none, playback state is saved to it\n"
+        "  --trace    add empty TRACE.BIN if the source has none, event trace is saved to it\n"
+        "  --card     allow writing to a block device, everything on it is lost\n"
+        "  --report   list fragmented files of an existing card or image\n",
+        name, name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--size") == 0 && has_value) {
+            options.size = parse_size(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--cluster") == 0 && has_value) {
+            options.cluster = (uint32_t)parse_size(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--state") == 0) {
+            options.state = true;
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0) {
+            options.trace = true;
+        }
+        else if (std::strcmp(argv[i], "--card") == 0) {
+            options.card = true;
+        }
+        else if (std::strcmp(argv[i], "--report") == 0) {
+            options.report = true;
+        }
+        else if (argv[i][0] != '-' && !options.source) {
+            options.source = argv[i];
+        }
+        else if (argv[i][0] != '-' && !options.target) {
+            options.target = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // --- Report of an existing card ---
+
+    if (options.report) {
+        const char* target = options.source;
+        CardReader card;
+        if (!target || options.target) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!card.open(target)) {
+            std::fprintf(stderr, "%s: %s\n", target, card.error().c_str());
+            return 1;
+        }
+        print_report(target, card.fragmentation(), card.cluster_size());
+        return 0;
+    }
+
+    if (!options.source || !options.target) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (is_block_device(options.target)) {
+        if (!options.card) {
+            std::fprintf(stderr, "%s is a block device, --card writes to it\n", options.target);
+            return 1;
+        }
+        if (!options.size && !(options.size = device_size(options.target))) {
+            std::fprintf(stderr, "%s: can't get device size\n", options.target);
+            return 1;
+        }
+    }
+
+    // --- Source tree ---
+
+    Entry root;
+    uint32_t files = 0;
+    uint64_t bytes = 0;
+    if (!scan(options.source, root, files, bytes)) {
+        return 1;
+    }
+
+    const auto has = [&root](const char* name) {
+        return std::any_of(root.children.begin(), root.children.end(),
+            [name](const Entry& entry) { return entry.name == name; });
+    };
+    const bool add_state = options.state && !has("STATE.BIN");
+    const bool add_config = has("CONFIG.INI") && !has("CONFIG.BIN");
+    const bool add_profile = !has("CARD.BIN");
+    const bool add_trace = options.trace && !has("TRACE.BIN");
+
+    const uint32_t cluster = options.cluster ? options.cluster : choose_cluster(root, bytes, options.size);
+    std::printf("%u files, %.1f MB, cluster %u bytes (%.2f%% in partial clusters)\n",
+        files, bytes / 1048576.0, cluster, bytes ? 100.0 * slack(root, cluster) / bytes : 0.0);
+
+    // --- Layout and write ---
+
+    FatImage::Geometry geometry;
+    geometry.size_bytes = options.size;
+    geometry.cluster_bytes = cluster;
+    FatImage image(geometry);
+
+    bool ok = image.reserve_dir("", (uint32_t)root.children.size() + add_state + add_config + add_profile
+            + add_trace)
+        && add_dirs(image, root, "") && add_files(image, root, "");
+
+    // empty state file, zeros are no valid record in any slot
+    if (ok && add_state) {
+        FatImage::File state;
+        state.data.assign(STATE_SLOTS * SECTOR, 0);
+        state.size = STATE_SLOTS * SECTOR;
+        ok = image.add_file("/STATE.BIN", state);
+    }
+
+    // compiled configuration, written by the player after parsing CONFIG.INI
+    if (ok && add_config) {
+        FatImage::File config;
+        config.data.assign(SECTOR, 0);
+        config.size = SECTOR;
+        ok = image.add_file("/CONFIG.BIN", config);
+    }
+
+    // card profile, written by the player on first boot
+    if (ok && add_profile) {
+        FatImage::File profile;
+        profile.data.assign(SECTOR, 0);
+        profile.size = SECTOR;
+        ok = image.add_file("/CARD.BIN", profile);
+    }
+
+    // event trace, written by the player on request or after an underrun
+    if (ok && add_trace) {
+        FatImage::File trace;
+        trace.data.assign(SECTOR, 0);
+        trace.size = SECTOR;
+        ok = image.add_file("/TRACE.BIN", trace);
+    }
+
+    if (!ok || !image.write(options.target)) {
+        std::fprintf(stderr, "%s\n", image.error().c_str());
+        return 1;
+    }
+
+    print_report(options.target, image.fragmentation(), image.cluster_bytes());
+    return 0;
+}
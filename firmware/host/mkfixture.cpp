@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Builds FAT32 card images from fixture scripts (host/fixtures/ *.fix).
+ *
+ * Script commands, one per line, '#' starts a comment:
+ *   size <bytes>[K|M|G]        image size (default: smallest FAT32 volume for content)
+ *   cluster <bytes>[K]         cluster size (default 32K)
+ *   lfn <n>                    long name entries written before each next entry
+ *   mkdir <path>
+ *   file <path> [size=<n>] [frag=<runs>] [gap=<clusters>] [fill=<byte>] [src=<file>]
+ *   text <path> <content>      file with given content, "\n" is a line break
+ *   tone <path> <seconds> [subband=<k>] [amplitude=<n>] [bitpool=<n>] [frag=<runs>] [gap=<clusters>]
+ *                              playable SBC file (44.1 kHz stereo) with a tone in subband k
+ *   delete <path>              entry marked deleted, its clusters released
+ *   reserve <dir> <entries>    allocate directory clusters up front
+ *   repeat <var> <from> <to>   repeat lines up to matching "end", {var} or {var:width}
+ *   end                        in them is replaced by (zero padded) counter value
+ */
+
+#include "fat_image.h"
+#include "sbc_tone.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Line {
+    int number;
+    std::string text;
+};
+
+std::string base_dir;
+FatImage::Geometry geometry;
+FatImage* image = nullptr;
+uint32_t pending_lfn = 0;
+
+bool fail(const Line& line, const std::string& message) {
+    std::fprintf(stderr, "line %d: %s\n", line.number, message.c_str());
+    return false;
+}
+
+uint64_t parse_size(const std::string& value) {
+    char* end = nullptr;
+    uint64_t v = std::strtoull(value.c_str(), &end, 0);
+    switch (end && *end ? std::toupper((unsigned char)*end) : 0) {
+        case 'K': v <<= 10; break;
+        case 'M': v <<= 20; break;
+        case 'G': v <<= 30; break;
+    }
+    return v;
+}
+
+std::string substitute(const std::string& text, const std::map<std::string, uint32_t>& vars) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '{') {
+            out += text[i];
+            continue;
+        }
+
+        const size_t close = text.find('}', i);
+        if (close == std::string::npos) {
+            out += text.substr(i);
+            break;
+        }
+
+        std::string name = text.substr(i + 1, close - i - 1);
+        int width = 0;
+        const size_t colon = name.find(':');
+        if (colon != std::string::npos) {
+            width = std::atoi(name.c_str() + colon + 1);
+            name = name.substr(0, colon);
+        }
+
+        const auto it = vars.find(name);
+        if (it == vars.end()) {
+            out += text.substr(i, close - i + 1);
+        }
+        else {
+            char buffer[16];
+            std::snprintf(buffer, sizeof(buffer), "%0*u", width, it->second);
+            out += buffer;
+        }
+        i = close;
+    }
+    return out;
+}
+
+std::vector<std::string> split(const std::string& text) {
+    std::istringstream stream(text);
+    return std::vector<std::string>(std::istream_iterator<std::string>(stream), {});
+}
+
+bool ensure_image() {
+    if (!image) {
+        image = new FatImage(geometry);
+    }
+    image->set_lfn_entries(pending_lfn);
+    return true;
+}
+
+bool run_command(const Line& line) {
+    const auto args = split(line.text);
+    if (args.empty()) {
+        return true;
+    }
+
+    const std::string& cmd = args[0];
+
+    if (cmd == "size" || cmd == "cluster") {
+        if (image) {
+            return fail(line, cmd + " must precede entries");
+        }
+        if (args.size() != 2) {
+            return fail(line, "usage: " + cmd + " <bytes>");
+        }
+        if (cmd == "size") {
+            geometry.size_bytes = parse_size(args[1]);
+        }
+        else {
+            geometry.cluster_bytes = (uint32_t)parse_size(args[1]);
+        }
+        return true;
+    }
+
+    if (cmd == "lfn") {
+        if (args.size() != 2) {
+            return fail(line, "usage: lfn <count>");
+        }
+        pending_lfn = (uint32_t)std::atoi(args[1].c_str());
+        if (image) {
+            image->set_lfn_entries(pending_lfn);
+        }
+        return true;
+    }
+
+    ensure_image();
+
+    if (cmd == "mkdir" && args.size() == 2) {
+        return image->mkdir(args[1]) || fail(line, image->error());
+    }
+
+    if (cmd == "delete" && args.size() == 2) {
+        return image->remove(args[1]) || fail(line, image->error());
+    }
+
+    if (cmd == "reserve" && args.size() == 3) {
+        return image->reserve_dir(args[1], (uint32_t)std::atoi(args[2].c_str())) || fail(line, image->error());
+    }
+
+    if (cmd == "text" && args.size() >= 2) {
+        const size_t start = line.text.find(args[1]) + args[1].size();
+        std::string content = line.text.substr(start);
+        content.erase(0, content.find_first_not_of(" \t"));
+
+        FatImage::File file;
+        for (size_t i = 0; i < content.size(); i++) {
+            if (content[i] == '\\' && i + 1 < content.size() && content[i + 1] == 'n') {
+                file.data.push_back('\n');
+                i++;
+            }
+            else {
+                file.data.push_back((uint8_t)content[i]);
+            }
+        }
+        file.size = (uint32_t)file.data.size();
+        return image->add_file(args[1], file) || fail(line, image->error());
+    }
+
+    if (cmd == "tone" && args.size() >= 3) {
+        FatImage::File file;
+        int subband = 2;
+        int amplitude = 4096;
+
+        struct sbc_frame frame = {};
+        frame.freq = SBC_FREQ_44K1;
+        frame.mode = SBC_MODE_STEREO;
+        frame.bam = SBC_BAM_LOUDNESS;
+        frame.nblocks = 16;
+        frame.nsubbands = 8;
+        frame.bitpool = 53;
+
+        for (size_t i = 3; i < args.size(); i++) {
+            const size_t eq = args[i].find('=');
+            if (eq == std::string::npos) {
+                return fail(line, "bad option " + args[i]);
+            }
+            const std::string key = args[i].substr(0, eq);
+            const int value = std::atoi(args[i].c_str() + eq + 1);
+
+            if (key == "subband") {
+                subband = value;
+            }
+            else if (key == "amplitude") {
+                amplitude = value;
+            }
+            else if (key == "bitpool") {
+                frame.bitpool = value;
+            }
+            else if (key == "frag") {
+                file.fragments = (uint32_t)value;
+            }
+            else if (key == "gap") {
+                file.gap = (uint32_t)value;
+            }
+            else {
+                return fail(line, "unknown option " + key);
+            }
+        }
+
+        uint8_t data[512];
+        const unsigned frame_size = sbc_tone_frame(&frame, subband, amplitude, data, sizeof(data));
+        if (frame_size == 0) {
+            return fail(line, "bad tone parameters");
+        }
+
+        // frame content doesn't change, pattern period is 4 blocks
+        const double seconds = std::atof(args[2].c_str());
+        const uint32_t frames = (uint32_t)(seconds * sbc_get_freq_hz(frame.freq)
+            / (frame.nblocks * frame.nsubbands));
+        for (uint32_t i = 0; i < frames; i++) {
+            file.data.insert(file.data.end(), data, data + frame_size);
+        }
+        file.size = (uint32_t)file.data.size();
+
+        return image->add_file(args[1], file) || fail(line, image->error());
+    }
+
+    if (cmd == "file" && args.size() >= 2) {
+        FatImage::File file;
+        bool has_size = false;
+        int fill = -1;
+
+        for (size_t i = 2; i < args.size(); i++) {
+            const size_t eq = args[i].find('=');
+            if (eq == std::string::npos) {
+                return fail(line, "bad option " + args[i]);
+            }
+            const std::string key = args[i].substr(0, eq);
+            const std::string value = args[i].substr(eq + 1);
+
+            if (key == "size") {
+                file.size = (uint32_t)parse_size(value);
+                has_size = true;
+            }
+            else if (key == "frag") {
+                file.fragments = (uint32_t)std::atoi(value.c_str());
+            }
+            else if (key == "gap") {
+                file.gap = (uint32_t)std::atoi(value.c_str());
+            }
+            else if (key == "fill") {
+                fill = (int)std::strtol(value.c_str(), nullptr, 0);
+            }
+            else if (key == "src") {
+                const std::string path = value[0] == '/' ? value : base_dir + value;
+                std::ifstream in(path, std::ios::binary);
+                if (!in) {
+                    return fail(line, "can't read " + path);
+                }
+                file.data.assign(std::istreambuf_iterator<char>(in), {});
+                if (!has_size) {
+                    file.size = (uint32_t)file.data.size();
+                }
+            }
+            else {
+                return fail(line, "unknown option " + key);
+            }
+        }
+
+        if (fill >= 0) {
+            file.data.assign(file.size, (uint8_t)fill);
+        }
+        else if (!file.data.empty()) {
+            file.data.resize(file.size, 0);
+        }
+
+        return image->add_file(args[1], file) || fail(line, image->error());
+    }
+
+    return fail(line, "unknown command or wrong arguments: " + line.text);
+}
+
+bool run_block(const std::vector<Line>& lines, size_t begin, size_t end, std::map<std::string, uint32_t>& vars) {
+    for (size_t i = begin; i < end; i++) {
+        const Line line = { lines[i].number, substitute(lines[i].text, vars) };
+        const auto args = split(line.text);
+
+        if (args.empty() || args[0] != "repeat") {
+            if (!args.empty() && args[0] == "end") {
+                return fail(line, "end without repeat");
+            }
+            if (!run_command(line)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (args.size() != 4) {
+            return fail(line, "usage: repeat <var> <from> <to>");
+        }
+
+        // find matching end
+        size_t depth = 1;
+        size_t j = i + 1;
+        for (; j < end; j++) {
+            const auto inner = split(lines[j].text);
+            if (!inner.empty() && inner[0] == "repeat") {
+                depth++;
+            }
+            else if (!inner.empty() && inner[0] == "end" && --depth == 0) {
+                break;
+            }
+        }
+        if (j >= end) {
+            return fail(line, "repeat without end");
+        }
+
+        const uint32_t from = (uint32_t)std::atoi(args[2].c_str());
+        const uint32_t to = (uint32_t)std::atoi(args[3].c_str());
+        for (uint32_t v = from; v <= to; v++) {
+            vars[args[1]] = v;
+            if (!run_block(lines, i + 1, j, vars)) {
+                return false;
+            }
+        }
+        vars.erase(args[1]);
+        i = j;
+    }
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <script.fix> <image> [--report]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string script = argv[1];
+    const auto slash = script.find_last_of('/');
+    base_dir = slash == std::string::npos ? "" : script.substr(0, slash + 1);
+
+    std::ifstream in(script);
+    if (!in) {
+        std::fprintf(stderr, "can't open %s\n", script.c_str());
+        return 1;
+    }
+
+    std::vector<Line> lines;
+    std::string text;
+    for (int number = 1; std::getline(in, text); number++) {
+        const size_t hash = text.find('#');
+        if (hash != std::string::npos) {
+            text.erase(hash);
+        }
+        lines.push_back({ number, text });
+    }
+
+    std::map<std::string, uint32_t> vars;
+    if (!run_block(lines, 0, lines.size(), vars)) {
+        return 1;
+    }
+
+    ensure_image();
+    if (!image->write(argv[2])) {
+        std::fprintf(stderr, "%s\n", image->error().c_str());
+        return 1;
+    }
+
+    if (argc > 3 && std::strcmp(argv[3], "--report") == 0) {
+        uint32_t fragmented = 0;
+        uint32_t entries = 0;
+        for (const auto& info : image->fragmentation()) {
+            entries++;
+            if (info.runs > 1) {
+                fragmented++;
+                std::printf("  %-32s %6u clusters in %u runs\n", info.path.c_str(), info.clusters, info.runs);
+            }
+        }
+        std::printf("%s: %u allocated entries, %u fragmented, cluster %u bytes\n",
+            argv[2], entries, fragmented, image->cluster_bytes());
+    }
+
+    delete image;
+    return 0;
+}
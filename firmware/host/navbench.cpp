@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Navigation benchmark. Runs firmware FileNavigator, PlaybackState, Config
+ * and Petit FatFs on a card image and reports sectors read from the card and
+ * time spent in card operations according to the latency model.
+ */
+
+#include "sd_card.h"
+#include "file_navigator.h"
+#include "config.h"
+#include "playback_state.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "petitfat/source/pff.h"
+}
+
+namespace {
+
+struct OpStats {
+    const char* name;
+    uint32_t calls = 0;
+    uint32_t failures = 0;
+    uint64_t sectors = 0;
+    uint64_t max_sectors = 0;
+    uint64_t cmd17 = 0;
+    uint64_t cmd18 = 0;
+    uint64_t cmd12 = 0;
+    uint64_t hits = 0;
+    uint64_t written = 0;
+    double us = 0;
+    double max_us = 0;
+    uint64_t bytes = 0;     // payload read, for throughput
+};
+
+template <typename F>
+void measure(OpStats& op, F&& operation) {
+    const HostSd::Stats before = HostSd::stats();
+    const double start = HostSd::now_us();
+
+    if (!operation()) {
+        op.failures++;
+    }
+
+    const HostSd::Stats& after = HostSd::stats();
+    const double us = HostSd::now_us() - start;
+    const uint64_t sectors = after.sectors_read - before.sectors_read;
+
+    op.calls++;
+    op.sectors += sectors;
+    op.max_sectors = std::max(op.max_sectors, sectors);
+    op.cmd17 += after.cmd17 - before.cmd17;
+    op.cmd18 += after.cmd18 - before.cmd18;
+    op.cmd12 += after.cmd12 - before.cmd12;
+    op.hits += after.cache_hits - before.cache_hits;
+    op.written += after.sectors_written - before.sectors_written;
+    op.us += us;
+    op.max_us = std::max(op.max_us, us);
+}
+
+void print_header() {
+    std::printf("%-13s %5s %9s %7s %7s %7s %7s %8s %6s %10s %10s\n",
+        "operation", "calls", "sect/op", "max", "CMD17", "CMD18", "CMD12", "hits", "writes", "ms/op", "max ms");
+}
+
+void print(const OpStats& op) {
+    if (!op.calls) {
+        return;
+    }
+
+    std::printf("%-13s %5u %9.1f %7llu %7llu %7llu %7llu %8llu %6llu %10.3f %10.3f",
+        op.name, op.calls, (double)op.sectors / op.calls, (unsigned long long)op.max_sectors,
+        (unsigned long long)op.cmd17, (unsigned long long)op.cmd18, (unsigned long long)op.cmd12,
+        (unsigned long long)op.hits, (unsigned long long)op.written,
+        op.us / op.calls / 1000.0, op.max_us / 1000.0);
+
+    if (op.bytes) {
+        std::printf("  %.0f kB/s", op.bytes / 1024.0 / (op.us / 1e6));
+    }
+    if (op.failures) {
+        std::printf("  (%u failed)", op.failures);
+    }
+    std::printf("\n");
+}
+
+void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s <image> [--model key=value,...] [--ops n] [--read-kb n]\n"
+        "  --model    latency model overrides, e.g. access_us=500,spi_mhz=12\n"
+        "  --ops      calls of next_track / prev_track / next_dir (default 64)\n"
+        "  --read-kb  data read from current track in read_track (default 1024)\n",
+        name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* image_path = argv[1];
+    uint32_t ops = 64;
+    uint32_t read_kb = 1024;
+
+    for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            if (!HostSd::parse_model(argv[++i])) {
+                std::fprintf(stderr, "bad model: %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            ops = (uint32_t)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--read-kb") == 0 && i + 1 < argc) {
+            read_kb = (uint32_t)std::atoi(argv[++i]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!HostSd::open(image_path, true)) {
+        std::fprintf(stderr, "can't open %s\n", image_path);
+        return 1;
+    }
+
+    std::printf("%s\nmodel: ", image_path);
+    HostSd::print_model();
+    print_header();
+
+    OpStats boot = { "boot" };
+    measure(boot, [] {
+        return FileNavigator::init()
+            && FileNavigator::open_main_directory()
+            && FileNavigator::restore_state();
+    });
+    print(boot);
+
+    if (boot.failures) {
+        std::fprintf(stderr, "boot failed, no playable directory?\n");
+        return 1;
+    }
+
+    // restore_state is only exercised with directory and track saving on
+    CFG.enable_saving(Config::SaveState::SaveDirectory);
+    CFG.enable_saving(Config::SaveState::SaveTrack);
+
+    PlaybackState& state = FileNavigator::get_state();
+
+    OpStats next_track = { "next_track" };
+    for (uint32_t i = 0; i < ops; i++) {
+        measure(next_track, [] { return FileNavigator::next_track(); });
+    }
+    print(next_track);
+
+    OpStats prev_track = { "prev_track" };
+    for (uint32_t i = 0; i < ops; i++) {
+        measure(prev_track, [] { return FileNavigator::prev_track(); });
+    }
+    print(prev_track);
+
+    // remember a position in every visited directory (last track) for restore_state
+    std::vector<PlaybackState> positions;
+
+    OpStats next_dir = { "next_dir" };
+    for (uint32_t i = 0; i < ops; i++) {
+        measure(next_dir, [] { return FileNavigator::next_dir(); });
+
+        PlaybackState position = state;
+        position.current_track_index = position.tracks_in_current_dir - 1;
+        positions.push_back(position);
+    }
+    print(next_dir);
+
+    OpStats restore = { "restore_state" };
+    for (const PlaybackState& position : positions) {
+        state = position;
+        measure(restore, [] {
+            return FileNavigator::open_main_directory()
+                && FileNavigator::restore_state();
+        });
+
+        // restore falls back to first directory when state doesn't match
+        if (state.current_dir_index != position.current_dir_index
+                || state.current_track_index != position.current_track_index) {
+            restore.failures++;
+        }
+    }
+    print(restore);
+
+    OpStats save = { "save_state" };
+    measure(save, [] {
+        FileNavigator::handle_state_save();
+        return true;
+    });
+    print(save);
+
+    // file open builds cluster range cache from FAT, reading follows it
+    OpStats open_track = { "open_track" };
+    measure(open_track, [] {
+        return pf_open_fileinfo(FileNavigator::get_current_file()) == FR_OK;
+    });
+    print(open_track);
+
+    OpStats read_track = { "read_track" };
+    measure(read_track, [&read_track, read_kb] {
+        // typical SBC frame size, read like the player does
+        constexpr UINT FRAME = 119;
+        BYTE frame[FRAME];
+        UINT br = 0;
+        uint64_t total = 0;
+        do {
+            if (pf_read_cached(frame, FRAME, &br) != FR_OK) {
+                return false;
+            }
+            total += br;
+        } while (br == FRAME && total < read_kb * 1024ull);
+
+        read_track.bytes += total;
+        return true;
+    });
+    print(read_track);
+
+    const HostSd::Stats& totals = HostSd::stats();
+    std::printf("total: %llu sectors read, %llu written, %llu wasted CMD18, %.1f ms busy wait, %.1f ms modelled\n",
+        (unsigned long long)totals.sectors_read, (unsigned long long)totals.sectors_written,
+        (unsigned long long)totals.wasted_streams, totals.busy_wait_us / 1000.0, HostSd::now_us() / 1000.0);
+
+    HostSd::close();
+    return 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * SBC encoder for host tools. The codec is compiled in here to reuse its
+ * frame checks and bit allocation (compute_nbits is static), so frames are
+ * packed with exactly the allocation the player computes.
+ */
+
+#include "sbc_encoder.h"
+#include "libsbc/src/sbc.c"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * CRC-8 of the frame check, x^8 + x^4 + x^3 + x^2 + 1, MSB first
+ */
+static int crc8_bits(int crc, unsigned value, int nbits)
+{
+    for (int i = nbits - 1; i >= 0; i--) {
+        int bit = ((value >> i) & 1) ^ ((crc >> 7) & 1);
+        crc = (crc << 1) & 0xff;
+        if (bit)
+            crc ^= 0x1d;
+    }
+
+    return crc;
+}
+
+/**
+ * Smallest scale factor covering a magnitude, |sample| < 2^(scf + 1)
+ */
+static int scale_factor(double magnitude)
+{
+    int scf = 0;
+    while (scf < 15 && (2 << scf) <= magnitude)
+        scf++;
+
+    return scf;
+}
+
+unsigned sbc_pack_frame(const struct sbc_frame *frame,
+    const double (*sb_samples)[SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS],
+    void *data, unsigned size)
+{
+    if (frame->msbc || !check_frame(frame))
+        return 0;
+
+    unsigned frame_size = sbc_get_frame_size(frame);
+    if (size < frame_size)
+        return 0;
+
+    int nchannels = 1 + (frame->mode != SBC_MODE_MONO);
+    int nsubbands = frame->nsubbands;
+    int nblocks = frame->nblocks;
+
+    /* --- Scale factors, and coupling when it saves range ---
+     *
+     * A coupled sub-band carries (L + R) / 2 and (L - R) / 2, it's chosen
+     * when their scale factors sum below the ones of left and right. The
+     * last sub-band can't be coupled. */
+
+    double samples[2][SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS];
+    int scale_factors[2][SBC_MAX_SUBBANDS];
+    int nbits[2][SBC_MAX_SUBBANDS];
+    unsigned mjoint = 0;
+
+    for (int isb = 0; isb < nsubbands; isb++) {
+        double max[2] = { 0, 0 }, max_joint[2] = { 0, 0 };
+
+        for (int iblk = 0; iblk < nblocks; iblk++)
+            for (int ich = 0; ich < nchannels; ich++) {
+                double s = sb_samples[ich][iblk][isb];
+                samples[ich][iblk][isb] = s;
+                max[ich] = fmax(max[ich], fabs(s));
+            }
+
+        for (int ich = 0; ich < nchannels; ich++)
+            scale_factors[ich][isb] = scale_factor(max[ich]);
+
+        if (frame->mode != SBC_MODE_JOINT_STEREO || isb == nsubbands - 1)
+            continue;
+
+        for (int iblk = 0; iblk < nblocks; iblk++) {
+            double l = sb_samples[0][iblk][isb], r = sb_samples[1][iblk][isb];
+            max_joint[0] = fmax(max_joint[0], fabs(l + r) / 2);
+            max_joint[1] = fmax(max_joint[1], fabs(l - r) / 2);
+        }
+
+        int scf_mid = scale_factor(max_joint[0]);
+        int scf_side = scale_factor(max_joint[1]);
+
+        if (scf_mid + scf_side >= scale_factors[0][isb] + scale_factors[1][isb])
+            continue;
+
+        for (int iblk = 0; iblk < nblocks; iblk++) {
+            double l = samples[0][iblk][isb], r = samples[1][iblk][isb];
+            samples[0][iblk][isb] = (l + r) / 2;
+            samples[1][iblk][isb] = (l - r) / 2;
+        }
+
+        scale_factors[0][isb] = scf_mid;
+        scale_factors[1][isb] = scf_side;
+        mjoint |= 1 << isb;
+    }
+
+    compute_nbits(frame, scale_factors, nbits);
+    if (frame->mode == SBC_MODE_DUAL_CHANNEL)
+        compute_nbits(frame, scale_factors + 1, nbits + 1);
+
+    /* join[] is sent first sub-band first, on the most significant bit */
+
+    unsigned join = 0;
+    for (int isb = 0; isb < nsubbands; isb++)
+        join |= ((mjoint >> isb) & 1) << (nsubbands - 1 - isb);
+
+    /* --- Header, CRC is filled in afterwards --- */
+
+    memset(data, 0, frame_size);
+
+    sbc_bits_t bits;
+    sbc_setup_bits(&bits, SBC_BITS_WRITE, data, frame_size);
+
+    SBC_WITH_BITS(&bits);
+
+    SBC_PUT_BITS("syncword", 0x9c, 8);
+    SBC_PUT_BITS("sampling_frequency", frame->freq, 2);
+    SBC_PUT_BITS("blocks", (frame->nblocks >> 2) - 1, 2);
+    SBC_PUT_BITS("channel_mode", frame->mode, 2);
+    SBC_PUT_BITS("allocation_method", frame->bam, 1);
+    SBC_PUT_BITS("subbands", (frame->nsubbands >> 2) - 1, 1);
+    SBC_PUT_BITS("bitpool", frame->bitpool, 8);
+    SBC_PUT_BITS("crc_check", 0, 8);
+
+    if (frame->mode == SBC_MODE_JOINT_STEREO)
+        SBC_PUT_BITS("join[]", join, nsubbands);
+
+    for (int ich = 0; ich < nchannels; ich++)
+        for (int isb = 0; isb < nsubbands; isb++)
+            SBC_PUT_BITS("scale_factor", scale_factors[ich][isb], 4);
+
+    /* --- Samples, quantized as the decoder expects them ---
+     *
+     *   sample = ((sb_sample / 2^(scf + 1) + 1) (2^nbit - 1) - 1) / 2 */
+
+    for (int iblk = 0; iblk < nblocks; iblk++)
+        for (int ich = 0; ich < nchannels; ich++)
+            for (int isb = 0; isb < nsubbands; isb++) {
+                int nbit = nbits[ich][isb];
+                if (!nbit)
+                    continue;
+
+                double x = samples[ich][iblk][isb] / (2 << scale_factors[ich][isb]);
+                int levels = (1 << nbit) - 1;
+                int q = (int)((((x + 1) * levels) - 1) / 2 + 0.5);
+
+                SBC_PUT_BITS("audio_sample", q < 0 ? 0 : q > levels ? levels : q, nbit);
+            }
+
+    int padding_nbits = 8 - (sbc_tell_bits(&bits) % 8);
+    if (padding_nbits < 8)
+        SBC_PUT_BITS("padding_bits", 0, padding_nbits);
+
+    SBC_END_WITH_BITS();
+
+    sbc_flush_bits(&bits);
+
+    /* --- CRC over header fields after syncword, join[] and the scale factors --- */
+
+    const uint8_t *p = (const uint8_t *)data;
+    int crc = crc8_bits(0x0f, (p[1] << 8) | p[2], 16);
+
+    if (frame->mode == SBC_MODE_JOINT_STEREO)
+        crc = crc8_bits(crc, join, nsubbands);
+
+    for (int ich = 0; ich < nchannels; ich++)
+        for (int isb = 0; isb < nsubbands; isb++)
+            crc = crc8_bits(crc, scale_factors[ich][isb], 4);
+
+    ((uint8_t *)data)[3] = (uint8_t)crc;
+
+    return sbc_bits_error(&bits) ? 0 : frame_size;
+}
+
+
+/**
+ * Prototype filter of the specification, as the windows of the synthesis
+ * (Q13 of -M C[n]): C[n] = -proto_4[n] / 2^15, C[n] = -proto_8[n] / 2^16
+ */
+
+static const int16_t proto_4[40] = {
+         0,    -18,    -49,    -90,   -126,   -128,    -61,    100,
+      -358,   -670,   -946,  -1055,   -848,   -201,    944,   2544,
+     -4443,  -6389,  -8082,  -9235,  -9644,  -9235,  -8082,  -6389,
+      4443,   2544,    944,   -201,   -848,  -1055,   -946,   -670,
+       358,    100,    -61,   -128,   -126,    -90,    -49,    -18,
+};
+
+static const int16_t proto_8[80] = {
+         0,    -10,    -22,    -36,    -54,    -75,    -97,   -117,
+      -132,   -138,   -131,   -106,    -59,     12,    108,    229,
+      -371,   -526,   -685,   -835,   -960,  -1042,  -1063,  -1004,
+      -848,   -580,   -192,    322,    959,   1711,   2561,   3486,
+     -4456,  -5438,  -6395,  -7287,  -8078,  -8734,  -9224,  -9528,
+     -9631,  -9528,  -9224,  -8734,  -8078,  -7287,  -6395,  -5438,
+      4456,   3486,   2561,   1711,    959,    322,   -192,   -580,
+      -848,  -1004,  -1063,  -1042,   -960,   -835,   -685,   -526,
+       371,    229,    108,     12,    -59,   -106,   -131,   -138,
+      -132,   -117,    -97,    -75,    -54,    -36,    -22,    -10,
+};
+
+int sbc_encoder_reset(struct sbc_encoder *encoder, const struct sbc_frame *frame)
+{
+    if (frame->msbc || !check_frame(frame))
+        return -1;
+
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->frame = *frame;
+
+    int nsubbands = frame->nsubbands;
+
+    for (int k = 0; k < nsubbands; k++)
+        for (int i = 0; i < 2 * nsubbands; i++)
+            encoder->cosines[k][i] =
+                cos((k + 0.5) * (i - nsubbands / 2) * M_PI / nsubbands);
+
+    return 0;
+}
+
+unsigned sbc_encoder_encode(struct sbc_encoder *encoder, const int16_t *pcm,
+    void *data, unsigned size)
+{
+    const struct sbc_frame *frame = &encoder->frame;
+
+    int nchannels = 1 + (frame->mode != SBC_MODE_MONO);
+    int nsubbands = frame->nsubbands;
+
+    const int16_t *proto = nsubbands == 4 ? proto_4 : proto_8;
+    double scale = -1. / (nsubbands == 4 ? 1 << 15 : 1 << 16);
+
+    /* --- Analysis ---
+     *
+     *   X shifts by M, newest sample first: X[M-1-i] = pcm[i]
+     *   Y[i] = sum(j = 0..4) C[i + 2Mj] X[i + 2Mj]
+     *   S[k] = sum(i = 0..2M-1) cos((k + 1/2)(i - M/2) pi / M) Y[i] */
+
+    double sb_samples[2][SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS];
+
+    for (int iblk = 0; iblk < frame->nblocks; iblk++)
+        for (int ich = 0; ich < nchannels; ich++) {
+            double *x = encoder->x[ich];
+
+            memmove(x + nsubbands, x, 9 * nsubbands * sizeof(*x));
+            for (int i = 0; i < nsubbands; i++)
+                x[nsubbands - 1 - i] = pcm[(iblk * nsubbands + i) * nchannels + ich];
+
+            double y[2 * SBC_MAX_SUBBANDS];
+
+            for (int i = 0; i < 2 * nsubbands; i++) {
+                y[i] = 0;
+                for (int j = 0; j < 5; j++)
+                    y[i] += proto[i + 2*nsubbands*j] * x[i + 2*nsubbands*j];
+
+                y[i] *= scale;
+            }
+
+            for (int k = 0; k < nsubbands; k++) {
+                double s = 0;
+                for (int i = 0; i < 2 * nsubbands; i++)
+                    s += encoder->cosines[k][i] * y[i];
+
+                sb_samples[ich][iblk][k] = s;
+            }
+        }
+
+    return sbc_pack_frame(frame,
+        (const double (*)[SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS])sb_samples, data, size);
+}
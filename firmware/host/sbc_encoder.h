@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#ifndef HOST_SBC_ENCODER_H
+#define HOST_SBC_ENCODER_H
+
+#include "libsbc/include/sbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Encoder state, filter history of the analysis per channel
+ */
+struct sbc_encoder {
+    struct sbc_frame frame;
+    double x[2][10 * SBC_MAX_SUBBANDS];
+    double cosines[SBC_MAX_SUBBANDS][2 * SBC_MAX_SUBBANDS];
+};
+
+/**
+ * Pack a frame of sub-band samples: scale factors, joint stereo choice
+ * (joint stereo frames), bit allocation of the decoder, quantization and CRC
+ * frame           Frame description, mSBC is not supported
+ * sb_samples      Sub-band samples by channel, block and sub-band, on the
+ *                 scale of 16 bits PCM
+ * data, size      Output buffer and its size
+ * return          Frame size, 0 on error
+ */
+unsigned sbc_pack_frame(const struct sbc_frame *frame,
+    const double (*sb_samples)[SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS],
+    void *data, unsigned size);
+
+/**
+ * Reset the encoder for a stream
+ * encoder         Encoder state
+ * frame           Frame description of the stream
+ * return          0 on success, -1 when the frame description is not valid
+ */
+int sbc_encoder_reset(struct sbc_encoder *encoder, const struct sbc_frame *frame);
+
+/**
+ * Encode a frame
+ * encoder         Encoder state
+ * pcm             `nblocks * nsubbands` samples, interleaved by channel
+ * data, size      Output buffer and its size
+ * return          Frame size, 0 on error
+ */
+unsigned sbc_encoder_encode(struct sbc_encoder *encoder, const int16_t *pcm,
+    void *data, unsigned size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SBC_ENCODER_H */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Test stream generator for host tools, frames are packed by the encoder.
+ */
+
+#include "sbc_tone.h"
+#include "sbc_encoder.h"
+
+#include <stdint.h>
+
+unsigned sbc_tone_frame(const struct sbc_frame *frame, int subband, int amplitude,
+    void *data, unsigned size)
+{
+    return sbc_tone_frame_stereo(frame, subband, amplitude, amplitude, data, size);
+}
+
+unsigned sbc_tone_frame_stereo(const struct sbc_frame *frame, int subband,
+    int left_amplitude, int right_amplitude, void *data, unsigned size)
+{
+    if (subband < 0 || subband >= frame->nsubbands || frame->nsubbands > SBC_MAX_SUBBANDS
+            || frame->nblocks > SBC_MAX_BLOCKS)
+        return 0;
+
+    int nchannels = 1 + (frame->mode != SBC_MODE_MONO);
+
+    /* --- Tone in the middle of the sub-band, at least 1 so the
+     *     channel isn't silent --- */
+
+    static const int pattern[4] = { 1, 0, -1, 0 };
+
+    int amplitudes[2] = { left_amplitude, right_amplitude };
+    double sb_samples[2][SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS] = { 0 };
+
+    for (int ich = 0; ich < nchannels; ich++) {
+        int amplitude = amplitudes[ich];
+        if (amplitude < 1) amplitude = 1;
+        if (amplitude > INT16_MAX) amplitude = INT16_MAX;
+
+        for (int iblk = 0; iblk < frame->nblocks; iblk++)
+            sb_samples[ich][iblk][subband] = amplitude * pattern[iblk & 3];
+    }
+
+    return sbc_pack_frame(frame,
+        (const double (*)[SBC_MAX_BLOCKS][SBC_MAX_SUBBANDS])sb_samples, data, size);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#ifndef HOST_SBC_TONE_H
+#define HOST_SBC_TONE_H
+
+#include "libsbc/include/sbc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Build SBC frame with a single tone: subband `subband` of both channels
+ * carries samples A, 0, -A, 0, ... (tone in the middle of the subband),
+ * other subbands are silent. Bit allocation is the decoder's own, so the
+ * stream is valid for any bitpool accepted by the frame description.
+ * frame           Frame description
+ * subband         Subband carrying the tone
+ * amplitude       Subband sample amplitude, up to 32767
+ * data, size      Output buffer and its size
+ * return          Frame size, 0 on error
+ */
+unsigned sbc_tone_frame(const struct sbc_frame *frame, int subband, int amplitude,
+    void *data, unsigned size);
+
+/**
+ * Same tone with own amplitude per channel, right one is ignored in mono
+ */
+unsigned sbc_tone_frame_stereo(const struct sbc_frame *frame, int subband,
+    int left_amplitude, int right_amplitude, void *data, unsigned size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_SBC_TONE_H */
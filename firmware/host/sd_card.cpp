@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "sd_card.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <unistd.h>
+
+namespace HostSd {
+
+namespace {
+    int image_fd = -1;
+
+    LatencyModel latency;
+    Stats counters;
+    double clock_us = 0;
+    TimeHook time_hook = nullptr;
+
+    // CID of the simulated card
+    constexpr uint8_t host_cid[16] = { 'L', 'T', 'H', 'O', 'S', 'T', 'C', 'A', 'R', 'D', 1, 2, 3, 4, 5, 0 };
+
+    // fault model
+    uint64_t block_reads = 0;
+    uint32_t failing_reads = 0;     // reads left to fail of current fault
+
+    struct ModelKey {
+        const char* name;
+        double LatencyModel::*value;
+    };
+
+    constexpr ModelKey model_keys[] = {
+        { "spi_mhz", &LatencyModel::spi_mhz },
+        { "card_mhz", &LatencyModel::card_mhz },
+        { "cmd_us", &LatencyModel::cmd_us },
+        { "access_us", &LatencyModel::access_us },
+        { "stream_gap_us", &LatencyModel::stream_gap_us },
+        { "stop_us", &LatencyModel::stop_us },
+        { "write_busy_us", &LatencyModel::write_busy_us },
+        { "init_ms", &LatencyModel::init_ms },
+        { "poll_us", &LatencyModel::poll_us },
+        { "fail_every", &LatencyModel::fail_every },
+        { "fail_attempts", &LatencyModel::fail_attempts },
+    };
+}
+
+void advance_us(double us) {
+    clock_us += us;
+    if (time_hook) {
+        time_hook(clock_us);
+    }
+}
+
+double now_us() {
+    return clock_us;
+}
+
+void set_time_hook(TimeHook hook) {
+    time_hook = hook;
+}
+
+LatencyModel& model() {
+    return latency;
+}
+
+Stats& stats() {
+    return counters;
+}
+
+void reset_stats() {
+    counters = Stats();
+}
+
+bool open(const char* path, bool writable) {
+    close();
+    image_fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+    return image_fd >= 0;
+}
+
+void close() {
+    if (image_fd >= 0) {
+        ::close(image_fd);
+        image_fd = -1;
+    }
+}
+
+bool parse_model(const char* spec) {
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), "%s", spec);
+
+    for (char* item = std::strtok(buffer, ","); item; item = std::strtok(nullptr, ",")) {
+        char* eq = std::strchr(item, '=');
+        if (!eq) {
+            return false;
+        }
+        *eq = 0;
+
+        const auto key = std::find_if(std::begin(model_keys), std::end(model_keys),
+            [item](const ModelKey& k) { return std::strcmp(k.name, item) == 0; });
+        if (key == std::end(model_keys)) {
+            return false;
+        }
+
+        latency.*(key->value) = std::atof(eq + 1);
+    }
+
+    return true;
+}
+
+void print_model() {
+    for (const auto& key : model_keys) {
+        std::printf("%s=%g ", key.name, latency.*(key.value));
+    }
+    std::printf("\n");
+}
+
+bool present() {
+    return image_fd >= 0;
+}
+
+bool read_block(uint32_t sector, uint8_t* buffer) {
+    const ssize_t res = pread(image_fd, buffer, 512, (off_t)sector * 512);
+    if (res < 0) {
+        return false;
+    }
+
+    // reading past the end of image returns zeros, like unused card area
+    std::fill(buffer + res, buffer + 512, 0);
+    return true;
+}
+
+bool write_block(uint32_t sector, const uint8_t* buffer) {
+    return pwrite(image_fd, buffer, 512, (off_t)sector * 512) == 512;
+}
+
+bool read_fails() {
+    if (failing_reads == 0 && latency.fail_every >= 1
+            && ++block_reads % (uint64_t)latency.fail_every == 0) {
+        failing_reads = latency.fail_attempts >= 1 ? (uint32_t)latency.fail_attempts : 1;
+    }
+    if (failing_reads == 0) {
+        return false;
+    }
+
+    failing_reads--;
+    counters.failed_reads++;
+    return true;
+}
+
+const uint8_t* cid() {
+    return host_cid;
+}
+
+} // namespace HostSd
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Simulated SD card backed by a FAT image file: simulated clock, latency
+ * model, fault model and counters. Two front ends use it: sd_disk.cpp
+ * implements the Petit FatFs disk interface (diskio.h) on it directly,
+ * following sd.cpp (navbench, trace2json); sd_spi.cpp answers the SPI bus
+ * of the firmware's own sd.cpp, driven by the SPI1 register model
+ * (devsim).
+ */
+namespace HostSd {
+
+struct LatencyModel {
+    double spi_mhz = 24.0;          // SPI clock, fast mode (sd_disk.cpp, SPI1 CR1 sets it on the bus)
+    double card_mhz = 25.0;         // clock limit in CSD TRAN_SPEED, lower one slows SPI down
+    double cmd_us = 4.0;            // command overhead besides command bytes (sd_disk.cpp, R1 follows
+                                    // the command on the bus)
+    double access_us = 300.0;       // first data block after CMD17 / CMD18
+    double stream_gap_us = 30.0;    // between consecutive CMD18 blocks
+    double stop_us = 40.0;          // CMD12 including busy
+    double write_busy_us = 3000.0;  // programming after single block write
+    double init_ms = 80.0;          // card initialization (CMD0 .. ACMD41, slow SPI)
+    double poll_us = 0.75;          // disk_poll call with nothing to do (sd_disk.cpp, wait loop iteration)
+    double fail_every = 0;          // every n-th block read fails, 0 never
+    double fail_attempts = 1;       // reads in a row that fail then, 4 gets past the card init step
+};
+
+struct Stats {
+    uint64_t sectors_read = 0;      // blocks transferred from card
+    uint64_t sectors_written = 0;
+    uint64_t cache_hits = 0;        // reads served from sector cache (sd_disk.cpp)
+    uint64_t cmd17 = 0;
+    uint64_t cmd18 = 0;
+    uint64_t cmd12 = 0;
+    uint64_t cmd13 = 0;             // status checks after Stop mode
+    uint64_t wasted_streams = 0;    // CMD18 stopped before any block was read
+    uint64_t failed_reads = 0;      // block reads that got no data token (fault model)
+    double busy_wait_us = 0;        // waited for write programming
+};
+
+/**
+ * @brief Attach image file, sector 0 is the first sector of the card
+ * @return false if file can't be opened
+ */
+bool open(const char* path, bool writable);
+
+/**
+ * @brief Detach image file
+ */
+void close();
+
+/**
+ * @brief Parse comma separated list of model overrides, e.g. "access_us=500,spi_mhz=12"
+ * @return false on unknown key
+ */
+bool parse_model(const char* spec);
+
+/**
+ * @brief Print model parameters
+ */
+void print_model();
+
+LatencyModel& model();
+Stats& stats();
+void reset_stats();
+
+/**
+ * @brief Simulated time in microseconds
+ */
+double now_us();
+
+/**
+ * @brief Advance simulated time by work done outside of the card interface
+ */
+void advance_us(double us);
+
+/**
+ * @brief Called whenever simulated time advances (used by device simulator)
+ */
+using TimeHook = void (*)(double now_us);
+void set_time_hook(TimeHook hook);
+
+/**
+ * @brief Card has an image attached
+ */
+bool present();
+
+/**
+ * @brief Read one block of the image, past its end reads zeros
+ */
+bool read_block(uint32_t sector, uint8_t* buffer);
+
+/**
+ * @brief Write one block of the image
+ */
+bool write_block(uint32_t sector, const uint8_t* buffer);
+
+/**
+ * @brief Fault model: block read about to start gets no data token
+ */
+bool read_fails();
+
+/**
+ * @brief CID of the simulated card
+ */
+const uint8_t* cid();
+
+} // namespace HostSd
@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Host implementation of the Petit FatFs disk interface (diskio.h) on the
+ * simulated card. Sector cache, CMD17/CMD18 read-ahead and write busy
+ * handling follow sd.cpp, every card operation advances the simulated clock
+ * according to the latency model. Injected read errors exercise the
+ * recovery steps of sd.cpp. Card profile calibration reports the model's
+ * latencies and picks read-ahead the same way.
+ */
+
+#include "sd_card.h"
+#include "boot.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include "petitfat/source/diskio.h"
+}
+
+using namespace HostSd;
+
+// streaming read-ahead until the card is measured
+DPROFILE disk_profile = { {0}, 0, 1, 0, 0, 0, 0 };
+
+namespace {
+    // mirrors sd.cpp state
+    BYTE sectorCache[512];
+    DWORD sdCachedSector = NO_SECTOR;
+    DWORD sdRequestedSector = NO_SECTOR;
+    DWORD sdPrefetchSector = NO_SECTOR;
+    bool sdMultiTransfer = false;
+    bool sdWriteBusy = false;
+    bool sdSuspended = false;
+
+    // card timeline
+    double data_ready_us = 0;       // next block of requested read can be clocked out
+    double busy_until_us = 0;       // write programming finished
+    uint32_t stream_blocks = 0;     // blocks read since CMD18
+
+    // single block write in progress
+    BYTE writeBuffer[512];
+    DWORD writeSector = NO_SECTOR;
+    UINT sdWriteBytes = 0;
+}
+
+namespace {
+
+// SPI clock as sd.cpp sets it, fPCLK / 2 divided further for a slow card
+double spi_clock_mhz() {
+    return std::min(model().spi_mhz, 48.0 / (2 << disk_profile.clock_div));
+}
+
+void transfer_bytes(uint32_t count) {
+    advance_us(count * 8.0 / spi_clock_mhz());
+}
+
+void send_command(uint8_t cmd) {
+    Trace::record(Trace::Event::SdCommand, cmd);
+    advance_us(model().cmd_us);
+    transfer_bytes(8); // command frame, response
+}
+
+bool sd_write_done() {
+    if (sdWriteBusy && now_us() >= busy_until_us) {
+        sdWriteBusy = false;
+    }
+
+    return !sdWriteBusy;
+}
+
+void sd_wait_write_done() {
+    if (!sd_write_done()) {
+        stats().busy_wait_us += busy_until_us - now_us();
+        advance_us(busy_until_us - now_us());
+        sdWriteBusy = false;
+    }
+}
+
+void sd_request_sector(DWORD sector) {
+    sd_wait_write_done();
+    send_command(17);
+    stats().cmd17++;
+    data_ready_us = now_us() + model().access_us;
+    sdRequestedSector = sector;
+}
+
+void sd_start_sector_stream(DWORD sector) {
+    sd_wait_write_done();
+    send_command(18);
+    stats().cmd18++;
+    data_ready_us = now_us() + model().access_us;
+    sdRequestedSector = sector;
+    sdMultiTransfer = true;
+    stream_blocks = 0;
+}
+
+void sd_read_ahead(DWORD sector) {
+    if (disk_profile.stream) {
+        sd_start_sector_stream(sector);
+    }
+    else {
+        sd_request_sector(sector);
+    }
+}
+
+void sd_stop_sector_stream() {
+    send_command(12);
+    advance_us(model().stop_us);
+    stats().cmd12++;
+    if (stream_blocks == 0) {
+        stats().wasted_streams++;
+    }
+
+    sdRequestedSector = NO_SECTOR;
+    sdMultiTransfer = false;
+}
+
+// card is always still there, status check costs a command and its second byte
+void sd_awake() {
+    if (sdSuspended) {
+        sdSuspended = false;
+        send_command(13);
+        transfer_bytes(1);
+        stats().cmd13++;
+    }
+}
+
+bool sd_read_sector() {
+    Trace::record(Trace::Event::SdTokenWait);
+    if (now_us() < data_ready_us) {
+        advance_us(data_ready_us - now_us());
+    }
+
+    if (read_fails()) {
+        // no data token, read waits out the limit (100 ms at full clock)
+        advance_us(200000 * 8.0 / spi_clock_mhz());
+        Trace::record(Trace::Event::SdToken, 0xFF);
+        return false;
+    }
+    Trace::record(Trace::Event::SdToken, 0xFE);
+
+    read_block(sdRequestedSector, sectorCache);
+    transfer_bytes(512 + 2 + 1); // token, data, CRC
+    stats().sectors_read++;
+
+    if (sdMultiTransfer) {
+        sdRequestedSector++;
+        stream_blocks++;
+        data_ready_us = now_us() + model().stream_gap_us;
+    }
+    else {
+        sdRequestedSector = NO_SECTOR;
+    }
+    return true;
+}
+
+// single block can't be stopped, it's clocked out and dropped
+bool sd_drop_request() {
+    if (sdMultiTransfer) {
+        sd_stop_sector_stream();
+        return true;
+    }
+
+    Trace::record(Trace::Event::SdTokenWait);
+    if (now_us() < data_ready_us) {
+        advance_us(data_ready_us - now_us());
+    }
+    sdRequestedSector = NO_SECTOR;
+
+    if (read_fails()) {
+        advance_us(200000 * 8.0 / spi_clock_mhz());
+        Trace::record(Trace::Event::SdToken, 0xFF);
+        return false;
+    }
+    Trace::record(Trace::Event::SdToken, 0xFE);
+    transfer_bytes(512 + 2 + 1);
+    return true;
+}
+
+bool sd_fetch(DWORD sector, DWORD next_sector) {
+    bool have_sector = false;
+
+    if (sdCachedSector == sector) {
+        stats().cache_hits++;
+        have_sector = true;
+    }
+    else if (sector == sdRequestedSector) {
+        if (!sd_read_sector()) {
+            return false;
+        }
+        sdCachedSector = sector;
+        have_sector = true;
+    }
+
+    if (sdRequestedSector != NO_SECTOR
+            && (!have_sector || (sdMultiTransfer && next_sector != sdRequestedSector))) {
+        if (!sd_drop_request()) {
+            return false;
+        }
+    }
+
+    if (!have_sector) {
+        if (next_sector == sector + 1 && disk_profile.stream) {
+            sd_start_sector_stream(sector);
+        }
+        else {
+            sd_request_sector(sector);
+        }
+
+        if (!sd_read_sector()) {
+            return false;
+        }
+        sdCachedSector = sector;
+    }
+
+    return true;
+}
+
+// Steps of sd.cpp read error recovery
+enum class Recovery : uint8_t {
+    Retry,
+    Resync,
+    Reinit,
+    Count
+};
+
+} // namespace
+
+// tiers used, remounts are counted by the player
+DRECOVERY disk_recovery;
+
+extern "C" {
+
+DSTATUS disk_initialize (void)
+{
+    disk_recovery.failed = 0;
+    sdCachedSector = NO_SECTOR;
+    sdRequestedSector = NO_SECTOR;
+    sdPrefetchSector = NO_SECTOR;
+    sdMultiTransfer = false;
+    sdWriteBusy = false;
+    sdSuspended = false;
+    writeSector = NO_SECTOR;
+
+    advance_us(model().init_ms * 1000.0);
+    if (!present()) {
+        return STA_NOINIT;
+    }
+
+    if (!std::equal(cid(), cid() + 16, disk_profile.cid)) {
+        disk_profile = DPROFILE{};
+        disk_profile.stream = 1;
+        std::copy(cid(), cid() + 16, disk_profile.cid);
+    }
+    // fastest fPCLK / (2 << div) within the card's limit
+    disk_profile.clock_div = 0;
+    while (disk_profile.clock_div < 7 && 48.0 / (2 << disk_profile.clock_div) > model().card_mhz) {
+        disk_profile.clock_div++;
+    }
+
+    Boot::mark(Boot::Phase::Card);
+    return 0;
+}
+
+DRESULT disk_readp_ex (
+    BYTE* buff,
+    DWORD sector,
+    DWORD next_sector,
+    UINT offset,
+    UINT count
+)
+{
+    if (!present()) {
+        return RES_NOTRDY;
+    }
+
+    sd_awake();
+
+    if (next_sector == NO_SECTOR) {
+        next_sector = sector + 1; // heuristics
+    }
+
+    sdPrefetchSector = NO_SECTOR;
+
+    bool ok = sd_fetch(sector, next_sector);
+
+    // recovery ladder of sd.cpp, costs of each step
+    for (uint8_t step = 0; !ok && step < static_cast<uint8_t>(Recovery::Count); step++) {
+        sdCachedSector = NO_SECTOR;
+
+        switch (static_cast<Recovery>(step)) {
+            case Recovery::Retry:
+                disk_recovery.retries++;
+                if (sdMultiTransfer) {
+                    send_command(12);
+                    advance_us(model().stop_us);
+                    stats().cmd12++;
+                }
+                break;
+            case Recovery::Resync:
+                disk_recovery.resyncs++;
+                transfer_bytes(10 + 1); // idle clocks, DO released
+                break;
+            case Recovery::Reinit:
+                disk_recovery.reinits++;
+                advance_us(model().init_ms * 1000.0);
+                break;
+            case Recovery::Count:
+                break;
+        }
+
+        sdRequestedSector = NO_SECTOR;
+        sdMultiTransfer = false;
+        ok = sd_fetch(sector, next_sector);
+    }
+
+    if (!ok) {
+        disk_recovery.failed = 1;
+        return RES_ERROR;
+    }
+
+    if (buff) {
+        std::memcpy(buff, sectorCache + offset, count);
+    }
+
+    if (sdRequestedSector == NO_SECTOR && next_sector != NO_SECTOR) {
+        if (sdWriteBusy && !sd_write_done()) {
+            sdPrefetchSector = next_sector;
+        }
+        else {
+            sd_read_ahead(next_sector);
+        }
+    }
+
+    return RES_OK;
+}
+
+const BYTE* disk_cached_sector (void)
+{
+    return sectorCache;
+}
+
+DRESULT disk_poll (void)
+{
+    advance_us(model().poll_us);
+    sd_awake();
+
+    if (!sd_write_done()) {
+        return RES_NOTRDY;
+    }
+
+    if (sdPrefetchSector != NO_SECTOR) {
+        const DWORD sector = sdPrefetchSector;
+        sdPrefetchSector = NO_SECTOR;
+
+        if (sdRequestedSector == NO_SECTOR) {
+            sd_read_ahead(sector);
+        }
+    }
+
+    return RES_OK;
+}
+
+int disk_busy (void)
+{
+    return sdWriteBusy || sdPrefetchSector != NO_SECTOR;
+}
+
+void disk_prefetch (DWORD sector)
+{
+    if (sector == NO_SECTOR || sector == sdCachedSector || sector == sdRequestedSector) {
+        return;
+    }
+    sd_awake();
+
+    if (sdRequestedSector != NO_SECTOR && !sd_drop_request()) {
+        return;
+    }
+
+    sdPrefetchSector = sector;
+    disk_poll();
+}
+
+void disk_abort (void)
+{
+    if (writeSector != NO_SECTOR) {
+        // open block is padded with 0xFF and ended, the card programs it
+        std::memset(writeBuffer + sdWriteBytes, 0xFF, 512 - sdWriteBytes);
+        sdWriteBytes = 512;
+        disk_writep(nullptr, 0);
+    }
+    else if (sdMultiTransfer) {
+        sd_stop_sector_stream();
+    }
+    else if (sdRequestedSector != NO_SECTOR) {
+        sd_read_sector(); // data or error, block is discarded
+    }
+
+    sd_wait_write_done();
+
+    sdCachedSector = NO_SECTOR;
+    sdRequestedSector = NO_SECTOR;
+    sdPrefetchSector = NO_SECTOR;
+    sdMultiTransfer = false;
+    writeSector = NO_SECTOR;
+}
+
+void disk_suspend (void)
+{
+    if (sdRequestedSector != NO_SECTOR) {
+        sd_drop_request();
+    }
+
+    sdPrefetchSector = NO_SECTOR;
+    sdSuspended = true;
+}
+
+DRESULT disk_calibrate (DWORD sector)
+{
+    if (!present()) {
+        return RES_NOTRDY;
+    }
+
+    sd_awake();
+    if (sdRequestedSector != NO_SECTOR && !sd_drop_request()) {
+        return RES_ERROR;
+    }
+    sdPrefetchSector = NO_SECTOR;
+    sdCachedSector = NO_SECTOR;
+
+    // single block, then a stream of two blocks and its stop, as sd.cpp times them
+    sd_request_sector(sector);
+    if (!sd_read_sector()) {
+        return RES_ERROR;
+    }
+    sd_start_sector_stream(sector);
+    if (!sd_read_sector() || !sd_read_sector()) {
+        return RES_ERROR;
+    }
+    sd_stop_sector_stream();
+
+    const double byte_us = 8.0 / spi_clock_mhz();
+    disk_profile.single_us = (WORD)std::ceil(model().access_us + byte_us);
+    disk_profile.stream_us = (WORD)std::ceil(model().access_us + byte_us);
+    disk_profile.gap_us = (WORD)std::ceil(model().stream_gap_us + byte_us);
+    disk_profile.stop_us = (WORD)std::ceil(model().stop_us);
+
+    const WORD block_us = (WORD)std::ceil((512 + 2) * byte_us);
+    disk_profile.stream = disk_profile.stop_us <= disk_profile.single_us + block_us;
+
+    return RES_OK;
+}
+
+DRESULT disk_writep (
+    const BYTE* buff,
+    DWORD sc
+)
+{
+    if (!present()) {
+        return RES_NOTRDY;
+    }
+
+    if (sdRequestedSector != NO_SECTOR && !sd_drop_request()) {
+        return RES_ERROR;
+    }
+
+    sdPrefetchSector = NO_SECTOR;
+
+    if (!buff) {
+        if (sc) {
+            sd_awake();
+            sd_wait_write_done();
+            send_command(24);
+            transfer_bytes(1); // start token
+            writeSector = sc;
+            sdWriteBytes = 0;
+            std::memset(writeBuffer, 0, sizeof(writeBuffer));
+            return RES_OK;
+        }
+
+        if (writeSector == NO_SECTOR) {
+            return RES_ERROR;
+        }
+
+        transfer_bytes(512 - sdWriteBytes + 2 + 1); // padding, CRC, data response
+        if (!write_block(writeSector, writeBuffer)) {
+            return RES_ERROR;
+        }
+
+        if (sdCachedSector == writeSector) {
+            sdCachedSector = NO_SECTOR;
+        }
+
+        stats().sectors_written++;
+        writeSector = NO_SECTOR;
+        sdWriteBusy = true;
+        busy_until_us = now_us() + model().write_busy_us;
+        return RES_OK;
+    }
+
+    if (writeSector == NO_SECTOR || sdWriteBytes + (UINT)sc > 512) {
+        return RES_ERROR;
+    }
+
+    std::memcpy(writeBuffer + sdWriteBytes, buff, sc);
+    sdWriteBytes += (UINT)sc;
+    transfer_bytes((uint32_t)sc);
+
+    return RES_OK;
+}
+
+}
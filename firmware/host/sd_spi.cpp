@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "sd_spi.h"
+#include "sd_card.h"
+
+#include <algorithm>
+#include <deque>
+#include <initializer_list>
+#include <iterator>
+
+namespace HostSdSpi {
+
+namespace {
+    constexpr uint8_t IDLE = 0x01;              // R1 bits
+    constexpr uint8_t ILLEGAL = 0x04;
+    constexpr uint8_t DATA_TOKEN = 0xFE;
+    constexpr uint8_t DATA_ACCEPTED = 0xE5;
+    constexpr uint32_t OCR = 0xC0FF8000;        // powered up, CCS (block addressing), 2.7 - 3.6 V
+
+    // host polls busy again within this while it waits, gaps are work done in between
+    constexpr double BUSY_POLL_GAP_US = 50.0;
+
+    enum class Write : uint8_t {
+        None,
+        Token,      // CMD24 accepted, start token next
+        Data,       // block and CRC
+    };
+
+    bool selected = false;
+    std::deque<uint8_t> out;        // bytes the card sends next, DO is high when empty
+
+    uint8_t frame[6];
+    uint32_t frame_bytes = 0;
+
+    bool idle = true;               // CMD0 until ACMD41 completes initialization
+    bool app_command = false;       // CMD55 was last
+    double ready_us = 0;            // ACMD41 leaves idle state from here on
+
+    // block read
+    bool reading = false;
+    bool streaming = false;
+    bool block_sent = false;        // out holds a whole block, next one is timed when it's clocked out
+    uint32_t read_sector = 0;
+    double data_ready_us = 0;
+    uint32_t stream_blocks = 0;
+
+    // block write
+    Write writing = Write::None;
+    uint32_t write_sector = 0;
+    uint8_t write_block[512 + 2];   // data, CRC
+    uint32_t write_bytes = 0;
+
+    double busy_until_us = 0;       // DO held low, CMD12 or block programming
+    double last_busy_poll_us = -1;
+
+    void respond(std::initializer_list<uint8_t> bytes) {
+        out.clear();
+        out.push_back(0xFF); // NCR, response comes one byte after the command
+        out.insert(out.end(), bytes);
+    }
+
+    // CSD TRAN_SPEED of the fastest clock within the model's limit
+    uint8_t tran_speed() {
+        constexpr double unit_mhz[] = { 0.1, 1, 10, 100 };
+        constexpr uint8_t multiplier[] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };
+
+        uint8_t code = 0x08; // 100 kHz
+        double best = 0;
+        for (uint8_t unit = 0; unit < std::size(unit_mhz); unit++) {
+            for (uint8_t value = 1; value < std::size(multiplier); value++) {
+                const double mhz = unit_mhz[unit] * multiplier[value] / 10;
+                if (mhz <= HostSd::model().card_mhz + 1e-9 && mhz > best) {
+                    best = mhz;
+                    code = (uint8_t)(value << 3 | unit);
+                }
+            }
+        }
+        return code;
+    }
+
+    // CSD / CID go out like a data block
+    void send_register(const uint8_t* data) {
+        out.push_back(0xFF);
+        out.push_back(DATA_TOKEN);
+        out.insert(out.end(), data, data + 16);
+        out.push_back(0xFF); // CRC
+        out.push_back(0xFF);
+    }
+
+    void stop_read() {
+        reading = false;
+        streaming = false;
+        block_sent = false;
+    }
+
+    void start_read(uint32_t sector, bool stream, double start_us) {
+        reading = true;
+        streaming = stream;
+        block_sent = false;
+        read_sector = sector;
+        data_ready_us = start_us + HostSd::model().access_us;
+        stream_blocks = 0;
+    }
+
+    // block of the read in progress once the card has it, nothing (DO high) if the fault model drops it
+    void next_block() {
+        if (HostSd::now_us() < data_ready_us) {
+            return;
+        }
+
+        if (HostSd::read_fails()) {
+            stop_read(); // no token, host gives up and recovers
+            return;
+        }
+
+        uint8_t block[512];
+        HostSd::read_block(read_sector, block);
+        out.push_back(DATA_TOKEN);
+        out.insert(out.end(), std::begin(block), std::end(block));
+        out.push_back(0xFF); // CRC
+        out.push_back(0xFF);
+        HostSd::stats().sectors_read++;
+
+        if (streaming) {
+            read_sector++;
+            stream_blocks++;
+            block_sent = true;
+        }
+        else {
+            reading = false;
+        }
+    }
+
+    void command() {
+        const uint8_t cmd = frame[0] & 0x3F;
+        const uint32_t arg = (uint32_t)frame[1] << 24 | frame[2] << 16 | frame[3] << 8 | frame[4];
+        const bool app = app_command;
+        const uint8_t r1 = idle ? IDLE : 0x00;
+        HostSd::Stats& stats = HostSd::stats();
+        app_command = false;
+
+        // card still busy takes the command once it's done, sd.cpp doesn't wait for CMD12 busy
+        const double start_us = std::max(HostSd::now_us(), busy_until_us);
+        busy_until_us = 0;
+
+        // stop ends a block being sent as well
+        if (cmd == 12) {
+            stats.cmd12++;
+            if (streaming && stream_blocks == 0) {
+                stats.wasted_streams++;
+            }
+            stop_read();
+            out.clear();
+            out.push_back(0xFF); // stuff byte
+            out.push_back(r1);
+            busy_until_us = start_us + HostSd::model().stop_us;
+            return;
+        }
+
+        switch (cmd) {
+            case 0:
+                stop_read();
+                writing = Write::None;
+                idle = true;
+                ready_us = HostSd::now_us() + HostSd::model().init_ms * 1000.0;
+                respond({IDLE});
+                break;
+            case 8:
+                respond({r1, 0x00, 0x00, (uint8_t)(arg >> 8 & 0x0F), (uint8_t)arg});
+                break;
+            case 55:
+                app_command = true;
+                respond({r1});
+                break;
+            case 41:
+                if (!app) {
+                    respond({(uint8_t)(r1 | ILLEGAL)});
+                    break;
+                }
+                if (HostSd::now_us() >= ready_us) {
+                    idle = false;
+                }
+                respond({(uint8_t)(idle ? IDLE : 0x00)});
+                break;
+            case 58:
+                respond({r1, (uint8_t)((idle ? OCR & ~0x80000000u : OCR) >> 24), (uint8_t)(OCR >> 16),
+                    (uint8_t)(OCR >> 8), (uint8_t)OCR});
+                break;
+            case 9: {
+                uint8_t csd[16] = { 0x40, 0x0E, 0x00, tran_speed() }; // CSD version 2.0
+                respond({r1});
+                send_register(csd);
+                break;
+            }
+            case 10:
+                respond({r1});
+                send_register(HostSd::cid());
+                break;
+            case 13:
+                stats.cmd13++;
+                respond({r1, 0x00});
+                break;
+            case 17:
+            case 18:
+                if (idle) {
+                    respond({(uint8_t)(IDLE | ILLEGAL)});
+                    break;
+                }
+                (cmd == 17 ? stats.cmd17 : stats.cmd18)++;
+                respond({0x00});
+                start_read(arg, cmd == 18, start_us);
+                break;
+            case 24:
+                if (idle) {
+                    respond({(uint8_t)(IDLE | ILLEGAL)});
+                    break;
+                }
+                respond({0x00});
+                stop_read();
+                writing = Write::Token;
+                write_sector = arg;
+                write_bytes = 0;
+                break;
+            default:
+                respond({(uint8_t)(r1 | ILLEGAL)});
+                break;
+        }
+    }
+
+    // bytes of a CMD24 block, false if the byte isn't part of it
+    bool receive_write(uint8_t mosi) {
+        if (writing == Write::Token && mosi == DATA_TOKEN) {
+            writing = Write::Data;
+            return true;
+        }
+        if (writing != Write::Data) {
+            return false;
+        }
+
+        write_block[write_bytes++] = mosi;
+        if (write_bytes == sizeof(write_block)) {
+            writing = Write::None;
+            HostSd::write_block(write_sector, write_block);
+            HostSd::stats().sectors_written++;
+            out.clear();
+            out.push_back(DATA_ACCEPTED);
+            busy_until_us = HostSd::now_us() + HostSd::model().write_busy_us;
+        }
+        return true;
+    }
+
+    void receive(uint8_t mosi) {
+        if (receive_write(mosi)) {
+            return;
+        }
+
+        if (frame_bytes == 0 && (mosi & 0xC0) != 0x40) {
+            return; // idle bus, start and transmission bits start a command
+        }
+
+        frame[frame_bytes++] = mosi;
+        if (frame_bytes == sizeof(frame)) {
+            frame_bytes = 0;
+            command();
+        }
+    }
+
+    uint8_t send() {
+        if (out.empty() && reading) {
+            next_block();
+        }
+
+        if (!out.empty()) {
+            const uint8_t byte = out.front();
+            out.pop_front();
+            if (out.empty() && block_sent) {
+                block_sent = false;
+                data_ready_us = HostSd::now_us() + HostSd::model().stream_gap_us;
+            }
+            return byte;
+        }
+
+        const double now = HostSd::now_us();
+        if (now < busy_until_us) {
+            if (last_busy_poll_us >= 0 && now - last_busy_poll_us < BUSY_POLL_GAP_US) {
+                HostSd::stats().busy_wait_us += now - last_busy_poll_us;
+            }
+            last_busy_poll_us = now;
+            return 0x00;
+        }
+
+        last_busy_poll_us = -1;
+        return 0xFF;
+    }
+}
+
+void select(bool active) {
+    if (active != selected) {
+        selected = active;
+        frame_bytes = 0; // command cut by deselect is dropped
+    }
+}
+
+uint8_t exchange(uint8_t mosi) {
+    if (!selected || !HostSd::present()) {
+        return 0xFF;
+    }
+
+    // card answers with what it had ready before this byte
+    const uint8_t miso = send();
+    receive(mosi);
+    return miso;
+}
+
+} // namespace HostSdSpi
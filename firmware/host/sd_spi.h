@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * SPI mode bus side of the simulated card (sd_card.h), clocked byte by byte
+ * by the SPI1 register model (device.cpp) so the firmware's own sd.cpp runs
+ * against it. Commands used by sd.cpp are answered: CMD0, CMD8, CMD55 /
+ * ACMD41, CMD58, CMD9 / CMD10, CMD13, CMD17 / CMD18 / CMD12 and CMD24 with
+ * its data block. Data token waits, stream gaps, CMD12 busy, write busy and
+ * card init take the latency model's times, injected read faults leave out
+ * the data token. CRC is never checked (CMD59 isn't sent).
+ */
+namespace HostSdSpi {
+
+/**
+ * @brief Chip select, true while CS is driven low
+ */
+void select(bool selected);
+
+/**
+ * @brief One byte clocked on the bus at the current simulated time
+ * @param mosi Byte sent by the host
+ * @return Byte the card drives on DO, 0xFF while deselected
+ */
+uint8_t exchange(uint8_t mosi);
+
+} // namespace HostSdSpi
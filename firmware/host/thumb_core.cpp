@@ -0,0 +1,683 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "thumb_core.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t RETURN_ADDRESS = 0xfffffffe;    // LR of a call(), never mapped
+constexpr uint32_t PERIPH_BASE = 0x40000000;
+constexpr uint32_t PERIPH_END = 0x60000000;
+
+constexpr unsigned SP = 13;
+constexpr unsigned LR = 14;
+constexpr unsigned PC = 15;
+
+uint32_t bits(uint32_t value, unsigned high, unsigned low) {
+    return (value >> low) & ((2u << (high - low)) - 1);
+}
+
+int32_t sign_extend(uint32_t value, unsigned width) {
+    const uint32_t sign = 1u << (width - 1);
+    return (int32_t)((value ^ sign) - sign);
+}
+
+unsigned popcount(uint32_t value) {
+    return (unsigned)__builtin_popcount(value);
+}
+
+} // namespace
+
+ThumbCore::ThumbCore(const CycleModel& cycle_model, uint32_t flash_size, uint32_t ram_size)
+    : model(cycle_model),
+      flash{FLASH_BASE, std::vector<uint8_t>(flash_size, 0xff), cycle_model.flash_wait_states},
+      ram{RAM_BASE, std::vector<uint8_t>(ram_size, 0), 0},
+      pc_cycles(flash_size / 2, 0) {
+}
+
+ThumbCore::Region* ThumbCore::region(uint32_t address, uint32_t size) {
+    for (Region* reg : { &flash, &ram }) {
+        if (address >= reg->base && (uint64_t)address + size <= (uint64_t)reg->base + reg->bytes.size()) {
+            return reg;
+        }
+    }
+    return nullptr;
+}
+
+const ThumbCore::Region* ThumbCore::region(uint32_t address, uint32_t size) const {
+    return const_cast<ThumbCore*>(this)->region(address, size);
+}
+
+unsigned ThumbCore::wait_states(uint32_t address) const {
+    if (address >= PERIPH_BASE && address < PERIPH_END) {
+        return model.periph_wait_states;
+    }
+    const Region* reg = region(address, 1);
+    return reg ? reg->wait_states : 0;
+}
+
+bool ThumbCore::poke(uint32_t address, const void* data, uint32_t size) {
+    Region* reg = region(address, size);
+    if (!reg) {
+        return false;
+    }
+    std::memcpy(reg->bytes.data() + (address - reg->base), data, size);
+    return true;
+}
+
+bool ThumbCore::peek(uint32_t address, void* data, uint32_t size) const {
+    const Region* reg = region(address, size);
+    if (!reg) {
+        return false;
+    }
+    std::memcpy(data, reg->bytes.data() + (address - reg->base), size);
+    return true;
+}
+
+void ThumbCore::fault(const char* format, ...) {
+    if (faulted) {
+        return;
+    }
+
+    char text[160];
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    char where[32];
+    std::snprintf(where, sizeof(where), " at pc %08x", (unsigned)instruction);
+    error_text = std::string(text) + where;
+    faulted = true;
+}
+
+uint16_t ThumbCore::fetch(uint32_t address) {
+    const uint32_t word = address & ~3u;
+    if (word != fetch_word) {
+        if (word == fetch_word + 4) {
+            // prefetched while previous word executed
+            if (next_word_ready > cycle) {
+                cycle = next_word_ready;
+            }
+        }
+        else {
+            cycle += wait_states(word);
+        }
+        fetch_word = word;
+        next_word_ready = cycle + 1 + wait_states(word + 4);
+    }
+
+    const Region* reg = region(address, 2);
+    if (!reg || (address & 1)) {
+        fault("instruction fetch from %08x", (unsigned)address);
+        return 0;
+    }
+
+    uint16_t value;
+    std::memcpy(&value, reg->bytes.data() + (address - reg->base), sizeof(value));
+    return value;
+}
+
+void ThumbCore::jump(uint32_t target) {
+    // pipeline refill is part of the branch timing, memory wait states are not
+    fetch_word = target & ~3u;
+    cycle += wait_states(fetch_word);
+    next_word_ready = cycle + 1 + wait_states(fetch_word + 4);
+}
+
+void ThumbCore::data_access(uint32_t address) {
+    const unsigned ws = wait_states(address);
+    if (next_word_ready > cycle) {
+        next_word_ready += ws;
+    }
+    cycle += ws;
+}
+
+uint32_t ThumbCore::load(uint32_t address, unsigned size) {
+    if (address & (size - 1)) {
+        fault("unaligned %u byte load from %08x", size, (unsigned)address);
+        return 0;
+    }
+
+    data_access(address);
+
+    if (address >= PERIPH_BASE && address < PERIPH_END) {
+        return bus ? bus->read(address, size, cycle + 1) : 0;
+    }
+
+    const Region* reg = region(address, size);
+    if (!reg) {
+        fault("load from unmapped %08x", (unsigned)address);
+        return 0;
+    }
+
+    uint32_t value = 0;
+    std::memcpy(&value, reg->bytes.data() + (address - reg->base), size);
+    return value;
+}
+
+void ThumbCore::store(uint32_t address, uint32_t value, unsigned size) {
+    if (address & (size - 1)) {
+        fault("unaligned %u byte store to %08x", size, (unsigned)address);
+        return;
+    }
+
+    data_access(address);
+
+    if (address >= PERIPH_BASE && address < PERIPH_END) {
+        if (bus) {
+            bus->write(address, value, size, cycle + 1);
+        }
+        return;
+    }
+
+    Region* reg = region(address, size);
+    if (!reg || reg == &flash) {
+        fault("store to %s %08x", reg ? "flash" : "unmapped", (unsigned)address);
+        return;
+    }
+
+    std::memcpy(reg->bytes.data() + (address - reg->base), &value, size);
+}
+
+uint32_t ThumbCore::add_with_carry(uint32_t x, uint32_t y, bool carry_in, bool set_flags) {
+    const uint64_t unsigned_sum = (uint64_t)x + y + carry_in;
+    const int64_t signed_sum = (int64_t)(int32_t)x + (int32_t)y + carry_in;
+    const uint32_t result = (uint32_t)unsigned_sum;
+
+    if (set_flags) {
+        set_nz(result);
+        c = (unsigned_sum >> 32) != 0;
+        v = (int64_t)(int32_t)result != signed_sum;
+    }
+    return result;
+}
+
+void ThumbCore::set_nz(uint32_t value) {
+    n = (value >> 31) != 0;
+    z = value == 0;
+}
+
+bool ThumbCore::condition(unsigned cond) const {
+    switch (cond) {
+        case 0x0: return z;
+        case 0x1: return !z;
+        case 0x2: return c;
+        case 0x3: return !c;
+        case 0x4: return n;
+        case 0x5: return !n;
+        case 0x6: return v;
+        case 0x7: return !v;
+        case 0x8: return c && !z;
+        case 0x9: return !c || z;
+        case 0xa: return n == v;
+        case 0xb: return n != v;
+        case 0xc: return !z && n == v;
+        case 0xd: return z || n != v;
+        default: return true;
+    }
+}
+
+bool ThumbCore::call(uint32_t function, const std::vector<uint32_t>& args, uint32_t stack_top,
+        uint64_t instruction_limit) {
+    faulted = false;
+    error_text.clear();
+
+    uint32_t sp = stack_top & ~7u;
+    if (args.size() > 4) {
+        sp -= (uint32_t)((args.size() - 4) * 4);
+        sp &= ~7u;
+        for (size_t i = 4; i < args.size(); i++) {
+            if (!poke(sp + (uint32_t)(i - 4) * 4, &args[i], 4)) {
+                fault("stack %08x not in RAM", (unsigned)sp);
+                return false;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        r[i] = i < args.size() ? args[i] : 0;
+    }
+    r[SP] = sp;
+    r[LR] = RETURN_ADDRESS | 1;
+    r[PC] = function & ~1u;
+    instruction = r[PC];
+    fetch_word = 0xffffffff; // first fetch is not sequential
+
+    for (uint64_t i = 0; i < instruction_limit; i++) {
+        if (r[PC] == RETURN_ADDRESS) {
+            return true;
+        }
+        if (!step()) {
+            return false;
+        }
+    }
+
+    fault("instruction limit reached");
+    return false;
+}
+
+bool ThumbCore::step() {
+    const uint32_t pc = r[PC];
+    const uint64_t start = cycle;
+    instruction = pc;
+
+    const uint16_t op = fetch(pc);
+    if (faulted) {
+        return false;
+    }
+
+    uint32_t next = pc + 2;
+    bool branch = false;
+    unsigned cost = 1;
+
+    r[PC] = pc + 4; // PC reads as instruction address + 4
+
+    auto shift_c = [this](uint32_t value, unsigned type, unsigned amount) -> uint32_t {
+        // type: 0 LSL, 1 LSR, 2 ASR, 3 ROR; amount 0 leaves value and carry alone
+        if (amount == 0) {
+            return value;
+        }
+        switch (type) {
+            case 0:
+                c = amount <= 32 && ((value >> (32 - amount)) & 1);
+                return amount < 32 ? value << amount : 0;
+            case 1:
+                c = amount <= 32 && ((value >> (amount - 1)) & 1);
+                return amount < 32 ? value >> amount : 0;
+            case 2:
+                if (amount >= 32) {
+                    c = (value >> 31) != 0;
+                    return c ? 0xffffffff : 0;
+                }
+                c = ((value >> (amount - 1)) & 1) != 0;
+                return (uint32_t)((int32_t)value >> amount);
+            default: {
+                const unsigned rot = amount & 31;
+                const uint32_t result = rot ? (value >> rot) | (value << (32 - rot)) : value;
+                c = (result >> 31) != 0;
+                return result;
+            }
+        }
+    };
+
+    const unsigned rd = bits(op, 2, 0);
+    const unsigned rn = bits(op, 5, 3);
+    const unsigned rm = bits(op, 8, 6);
+
+    switch (op >> 11) {
+        case 0x00: case 0x01: case 0x02: {     // LSLS / LSRS / ASRS immediate
+            const unsigned type = bits(op, 12, 11);
+            unsigned amount = bits(op, 10, 6);
+            if (type != 0 && amount == 0) {
+                amount = 32;
+            }
+            r[rd] = shift_c(r[rn], type, amount);
+            set_nz(r[rd]);
+            break;
+        }
+
+        case 0x03: {                            // ADDS / SUBS register or 3-bit immediate
+            const uint32_t operand = (op & 0x400) ? bits(op, 8, 6) : r[rm];
+            r[rd] = (op & 0x200) ? add_with_carry(r[rn], ~operand, true, true)
+                                 : add_with_carry(r[rn], operand, false, true);
+            break;
+        }
+
+        case 0x04: case 0x05: case 0x06: case 0x07: {  // MOVS / CMP / ADDS / SUBS 8-bit immediate
+            const unsigned reg = bits(op, 10, 8);
+            const uint32_t imm = bits(op, 7, 0);
+            switch (bits(op, 12, 11)) {
+                case 0: r[reg] = imm; set_nz(imm); break;
+                case 1: add_with_carry(r[reg], ~imm, true, true); break;
+                case 2: r[reg] = add_with_carry(r[reg], imm, false, true); break;
+                case 3: r[reg] = add_with_carry(r[reg], ~imm, true, true); break;
+            }
+            break;
+        }
+
+        case 0x08: {
+            if ((op & 0x400) == 0) {            // data processing
+                const unsigned rs = bits(op, 5, 3);
+                const uint32_t a = r[rd];
+                const uint32_t b = r[rs];
+                switch (bits(op, 9, 6)) {
+                    case 0x0: r[rd] = a & b; set_nz(r[rd]); break;                          // ANDS
+                    case 0x1: r[rd] = a ^ b; set_nz(r[rd]); break;                          // EORS
+                    case 0x2: r[rd] = shift_c(a, 0, b & 0xff); set_nz(r[rd]); break;        // LSLS
+                    case 0x3: r[rd] = shift_c(a, 1, b & 0xff); set_nz(r[rd]); break;        // LSRS
+                    case 0x4: r[rd] = shift_c(a, 2, b & 0xff); set_nz(r[rd]); break;        // ASRS
+                    case 0x5: r[rd] = add_with_carry(a, b, c, true); break;                 // ADCS
+                    case 0x6: r[rd] = add_with_carry(a, ~b, c, true); break;                // SBCS
+                    case 0x7: r[rd] = shift_c(a, 3, b & 0xff); set_nz(r[rd]); break;        // RORS
+                    case 0x8: set_nz(a & b); break;                                         // TST
+                    case 0x9: r[rd] = add_with_carry(~b, 0, true, true); break;             // RSBS #0
+                    case 0xa: add_with_carry(a, ~b, true, true); break;                     // CMP
+                    case 0xb: add_with_carry(a, b, false, true); break;                     // CMN
+                    case 0xc: r[rd] = a | b; set_nz(r[rd]); break;                          // ORRS
+                    case 0xd: r[rd] = a * b; set_nz(r[rd]); cost = model.mul_cycles; break; // MULS
+                    case 0xe: r[rd] = a & ~b; set_nz(r[rd]); break;                         // BICS
+                    case 0xf: r[rd] = ~b; set_nz(r[rd]); break;                             // MVNS
+                }
+                break;
+            }
+
+            // special data processing and branch exchange, high registers
+            const unsigned dn = bits(op, 2, 0) | (bits(op, 7, 7) << 3);
+            const unsigned m = bits(op, 6, 3);
+            switch (bits(op, 9, 8)) {
+                case 0:                         // ADD
+                    if (dn == PC) {
+                        next = (r[PC] + r[m]) & ~1u;
+                        branch = true;
+                        cost = 2;
+                    }
+                    else {
+                        r[dn] = r[dn] + r[m];
+                    }
+                    break;
+                case 1:                         // CMP
+                    add_with_carry(r[dn], ~r[m], true, true);
+                    break;
+                case 2:                         // MOV
+                    if (dn == PC) {
+                        next = r[m] & ~1u;
+                        branch = true;
+                        cost = 2;
+                    }
+                    else {
+                        r[dn] = r[m];
+                    }
+                    break;
+                case 3: {                       // BX / BLX
+                    const uint32_t target = r[m];
+                    if (!(target & 1)) {
+                        fault("interworking branch to ARM state (%08x)", (unsigned)target);
+                        return false;
+                    }
+                    if (op & 0x80) {
+                        r[LR] = next | 1;
+                    }
+                    next = target & ~1u;
+                    branch = true;
+                    cost = 2;
+                    break;
+                }
+            }
+            break;
+        }
+
+        case 0x09: {                            // LDR literal
+            const uint32_t address = (r[PC] & ~3u) + bits(op, 7, 0) * 4;
+            r[bits(op, 10, 8)] = load(address, 4);
+            cost = 2;
+            break;
+        }
+
+        case 0x0a: case 0x0b: {                 // load / store register offset
+            const uint32_t address = r[rn] + r[rm];
+            cost = 2;
+            switch (bits(op, 11, 9)) {
+                case 0: store(address, r[rd], 4); break;                                        // STR
+                case 1: store(address, r[rd] & 0xffff, 2); break;                               // STRH
+                case 2: store(address, r[rd] & 0xff, 1); break;                                 // STRB
+                case 3: r[rd] = (uint32_t)sign_extend(load(address, 1), 8); break;              // LDRSB
+                case 4: r[rd] = load(address, 4); break;                                        // LDR
+                case 5: r[rd] = load(address, 2); break;                                        // LDRH
+                case 6: r[rd] = load(address, 1); break;                                        // LDRB
+                case 7: r[rd] = (uint32_t)sign_extend(load(address, 2), 16); break;             // LDRSH
+            }
+            break;
+        }
+
+        case 0x0c: case 0x0d: case 0x0e: case 0x0f: {  // STR / LDR / STRB / LDRB immediate
+            const bool byte = (op & 0x1000) != 0;
+            const uint32_t address = r[rn] + bits(op, 10, 6) * (byte ? 1 : 4);
+            if (op & 0x800) {
+                r[rd] = load(address, byte ? 1 : 4);
+            }
+            else {
+                store(address, byte ? r[rd] & 0xff : r[rd], byte ? 1 : 4);
+            }
+            cost = 2;
+            break;
+        }
+
+        case 0x10: case 0x11: {                 // STRH / LDRH immediate
+            const uint32_t address = r[rn] + bits(op, 10, 6) * 2;
+            if (op & 0x800) {
+                r[rd] = load(address, 2);
+            }
+            else {
+                store(address, r[rd] & 0xffff, 2);
+            }
+            cost = 2;
+            break;
+        }
+
+        case 0x12: case 0x13: {                 // STR / LDR SP relative
+            const unsigned reg = bits(op, 10, 8);
+            const uint32_t address = r[SP] + bits(op, 7, 0) * 4;
+            if (op & 0x800) {
+                r[reg] = load(address, 4);
+            }
+            else {
+                store(address, r[reg], 4);
+            }
+            cost = 2;
+            break;
+        }
+
+        case 0x14:                              // ADR
+            r[bits(op, 10, 8)] = (r[PC] & ~3u) + bits(op, 7, 0) * 4;
+            break;
+
+        case 0x15:                              // ADD Rd, SP, #imm
+            r[bits(op, 10, 8)] = r[SP] + bits(op, 7, 0) * 4;
+            break;
+
+        case 0x16: case 0x17: {                 // miscellaneous
+            if ((op & 0xff00) == 0xb000) {      // ADD / SUB SP, SP, #imm
+                const uint32_t imm = bits(op, 6, 0) * 4;
+                r[SP] = (op & 0x80) ? r[SP] - imm : r[SP] + imm;
+            }
+            else if ((op & 0xff00) == 0xb200) { // SXTH / SXTB / UXTH / UXTB
+                const uint32_t value = r[rn];
+                switch (bits(op, 7, 6)) {
+                    case 0: r[rd] = (uint32_t)sign_extend(value & 0xffff, 16); break;
+                    case 1: r[rd] = (uint32_t)sign_extend(value & 0xff, 8); break;
+                    case 2: r[rd] = value & 0xffff; break;
+                    case 3: r[rd] = value & 0xff; break;
+                }
+            }
+            else if ((op & 0xfe00) == 0xb400) { // PUSH
+                const uint32_t list = bits(op, 7, 0) | (bits(op, 8, 8) << LR);
+                uint32_t address = r[SP] - 4 * popcount(list);
+                r[SP] = address;
+                for (unsigned i = 0; i < 16; i++) {
+                    if (list & (1u << i)) {
+                        store(address, r[i], 4);
+                        address += 4;
+                    }
+                }
+                cost = 1 + popcount(list);
+            }
+            else if ((op & 0xffef) == 0xb662) { // CPSIE / CPSID i
+                primask = (op & 0x10) != 0;
+            }
+            else if ((op & 0xff00) == 0xba00 && bits(op, 7, 6) != 2) {  // REV / REV16 / REVSH
+                const uint32_t value = r[rn];
+                switch (bits(op, 7, 6)) {
+                    case 0: r[rd] = __builtin_bswap32(value); break;
+                    case 1: r[rd] = ((value & 0x00ff00ff) << 8) | ((value & 0xff00ff00) >> 8); break;
+                    case 3: r[rd] = (uint32_t)sign_extend(((value & 0xff) << 8) | ((value >> 8) & 0xff), 16); break;
+                }
+            }
+            else if ((op & 0xfe00) == 0xbc00) { // POP
+                const uint32_t list = bits(op, 7, 0) | (bits(op, 8, 8) << PC);
+                uint32_t address = r[SP];
+                for (unsigned i = 0; i < 16; i++) {
+                    if (list & (1u << i)) {
+                        const uint32_t value = load(address, 4);
+                        address += 4;
+                        if (i == PC) {
+                            if (!(value & 1)) {
+                                fault("POP to ARM state address %08x", (unsigned)value);
+                                return false;
+                            }
+                            next = value & ~1u;
+                            branch = true;
+                        }
+                        else {
+                            r[i] = value;
+                        }
+                    }
+                }
+                r[SP] = address;
+                cost = (branch ? 3 : 1) + popcount(list);
+            }
+            else if ((op & 0xff00) == 0xbe00) { // BKPT
+                fault("BKPT #%u", bits(op, 7, 0));
+                return false;
+            }
+            else if ((op & 0xff0f) == 0xbf00) { // NOP / YIELD / WFE / WFI / SEV
+                cost = (bits(op, 7, 4) == 2 || bits(op, 7, 4) == 3) ? 2 : 1;
+            }
+            else {
+                fault("undefined instruction %04x", op);
+                return false;
+            }
+            break;
+        }
+
+        case 0x18: case 0x19: {                 // STM / LDM
+            const unsigned base = bits(op, 10, 8);
+            const uint32_t list = bits(op, 7, 0);
+            if (list == 0) {
+                fault("LDM/STM with empty register list");
+                return false;
+            }
+            uint32_t address = r[base];
+            const bool is_load = (op & 0x800) != 0;
+            for (unsigned i = 0; i < 8; i++) {
+                if (list & (1u << i)) {
+                    if (is_load) {
+                        r[i] = load(address, 4);
+                    }
+                    else {
+                        store(address, r[i], 4);
+                    }
+                    address += 4;
+                }
+            }
+            if (!is_load || !(list & (1u << base))) {
+                r[base] = address;
+            }
+            cost = 1 + popcount(list);
+            break;
+        }
+
+        case 0x1a: case 0x1b: {                 // B<cond>, UDF, SVC
+            const unsigned cond = bits(op, 11, 8);
+            if (cond >= 0xe) {
+                fault(cond == 0xe ? "UDF #%u" : "SVC #%u", bits(op, 7, 0));
+                return false;
+            }
+            if (condition(cond)) {
+                next = r[PC] + (uint32_t)(sign_extend(bits(op, 7, 0), 8) * 2);
+                branch = true;
+                cost = 2;
+            }
+            break;
+        }
+
+        case 0x1c:                              // B
+            next = r[PC] + (uint32_t)(sign_extend(bits(op, 10, 0), 11) * 2);
+            branch = true;
+            cost = 2;
+            break;
+
+        default: {                              // 32-bit instructions
+            const uint16_t op2 = fetch(pc + 2);
+            if (faulted) {
+                return false;
+            }
+            next = pc + 4;
+
+            if ((op & 0xf800) == 0xf000 && (op2 & 0xd000) == 0xd000) {  // BL
+                const uint32_t s = bits(op, 10, 10);
+                const uint32_t i1 = !(bits(op2, 13, 13) ^ s);
+                const uint32_t i2 = !(bits(op2, 11, 11) ^ s);
+                const uint32_t imm = (s << 24) | (i1 << 23) | (i2 << 22) | (bits(op, 9, 0) << 12) | (bits(op2, 10, 0) << 1);
+                r[LR] = next | 1;
+                next = next + (uint32_t)sign_extend(imm, 25);
+                branch = true;
+                cost = 3;
+            }
+            else if ((op & 0xfff0) == 0xf380 && (op2 & 0xff00) == 0x8800) {   // MSR
+                const unsigned sysm = bits(op2, 7, 0);
+                const uint32_t value = r[bits(op, 3, 0)];
+                if (sysm <= 3) {
+                    n = (value >> 31) & 1; z = (value >> 30) & 1; c = (value >> 29) & 1; v = (value >> 28) & 1;
+                }
+                else if (sysm == 8 || sysm == 9) {
+                    r[SP] = value & ~3u;
+                }
+                else if (sysm == 16) {
+                    primask = value & 1;
+                }
+                cost = 3;
+            }
+            else if (op == 0xf3ef && (op2 & 0xf000) == 0x8000) {           // MRS
+                const unsigned sysm = bits(op2, 7, 0);
+                uint32_t value = 0;
+                if (sysm <= 7) {
+                    value = ((uint32_t)n << 31) | ((uint32_t)z << 30) | ((uint32_t)c << 29) | ((uint32_t)v << 28);
+                }
+                else if (sysm == 8 || sysm == 9) {
+                    value = r[SP];
+                }
+                else if (sysm == 16) {
+                    value = primask;
+                }
+                r[bits(op2, 11, 8)] = value;
+                cost = 3;
+            }
+            else if (op == 0xf3bf && (op2 & 0xff00) == 0x8f00) {           // DSB / DMB / ISB
+                cost = 3;
+            }
+            else {
+                fault("undefined instruction %04x %04x", op, op2);
+                return false;
+            }
+            break;
+        }
+    }
+
+    if (faulted) {
+        r[PC] = pc;
+        return false;
+    }
+
+    cycle += cost;
+    if (branch) {
+        jump(next);
+    }
+    r[PC] = next;
+    retired++;
+
+    const uint32_t index = (pc - FLASH_BASE) / 2;
+    if (index < pc_cycles.size()) {
+        pc_cycles[index] += cycle - start;
+    }
+
+    return true;
+}
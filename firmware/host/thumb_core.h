@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * ARMv6-M (Thumb-1) instruction set simulator with a Cortex-M0+ cycle model,
+ * for measuring firmware hot paths on the host. No exceptions or interrupts:
+ * functions are called directly and run until they return.
+ *
+ * Cycle model:
+ *  - instruction timings of the Cortex-M0+ TRM (1 cycle ALU, 2 cycles load /
+ *    store, 1+N LDM/STM/PUSH/POP, 3+N POP {pc}, taken branch 2, BL 3)
+ *  - multiplier: 1 cycle (fast) or 32 (small), chip dependent
+ *  - instructions are fetched as 32-bit words over the single AHB port; a
+ *    word fetch from memory with wait states takes 1 + ws cycles. The next
+ *    sequential word is fetched while the current one executes, a jump
+ *    restarts fetching and pays the target word's wait states in full
+ *  - data accesses pay the wait states of their region (flash literals and
+ *    tables, APB peripherals) and hold off an instruction fetch in flight
+ */
+class ThumbCore {
+public:
+    struct CycleModel {
+        unsigned flash_wait_states = 1;     // 48 MHz needs one flash wait state
+        unsigned periph_wait_states = 1;    // AHB to APB bridge
+        unsigned mul_cycles = 1;
+    };
+
+    /**
+     * @brief Peripheral region (0x40000000 .. 0x5fffffff) access, cycle is the
+     *        count when the access happens
+     */
+    class Bus {
+    public:
+        virtual ~Bus() = default;
+        virtual uint32_t read(uint32_t address, unsigned size, uint64_t cycle) = 0;
+        virtual void write(uint32_t address, uint32_t value, unsigned size, uint64_t cycle) = 0;
+    };
+
+    static constexpr uint32_t FLASH_BASE = 0x08000000;
+    static constexpr uint32_t RAM_BASE = 0x20000000;
+
+    ThumbCore(const CycleModel& model, uint32_t flash_size, uint32_t ram_size);
+
+    void set_bus(Bus* peripherals) { bus = peripherals; }
+
+    /**
+     * @brief Copy bytes into flash or RAM (no timing)
+     * @return false if range isn't mapped
+     */
+    bool poke(uint32_t address, const void* data, uint32_t size);
+    bool peek(uint32_t address, void* data, uint32_t size) const;
+
+    /**
+     * @brief Call function with up to 4 arguments in registers, rest on stack
+     * @return false on fault or when instruction limit is hit, see error()
+     */
+    bool call(uint32_t function, const std::vector<uint32_t>& args, uint32_t stack_top,
+        uint64_t instruction_limit = 100000000);
+
+    uint32_t result() const { return r[0]; }
+    uint64_t cycles() const { return cycle; }
+    uint64_t instructions() const { return retired; }
+    const std::string& error() const { return error_text; }
+
+    /**
+     * @brief Cycles spent per flash halfword (index: (pc - FLASH_BASE) / 2),
+     *        including fetch stalls, accumulated over all calls
+     */
+    const std::vector<uint64_t>& profile() const { return pc_cycles; }
+
+private:
+    struct Region {
+        uint32_t base;
+        std::vector<uint8_t> bytes;
+        unsigned wait_states;
+    };
+
+    CycleModel model;
+    Region flash;
+    Region ram;
+    Bus* bus = nullptr;
+
+    uint32_t r[16] = {0};
+    bool n = false, z = false, c = false, v = false;
+    bool primask = false;
+
+    uint64_t cycle = 0;
+    uint64_t retired = 0;
+    std::vector<uint64_t> pc_cycles;
+
+    // instruction fetch
+    uint32_t fetch_word = 0xffffffff;   // word the executing instruction came from
+    uint64_t next_word_ready = 0;       // cycle sequentially next word arrives
+
+    uint32_t instruction = 0;           // address of instruction being executed
+    bool faulted = false;
+    std::string error_text;
+
+    Region* region(uint32_t address, uint32_t size);
+    const Region* region(uint32_t address, uint32_t size) const;
+    unsigned wait_states(uint32_t address) const;
+
+    uint16_t fetch(uint32_t address);
+    void jump(uint32_t target);
+
+    uint32_t load(uint32_t address, unsigned size);
+    void store(uint32_t address, uint32_t value, unsigned size);
+    void data_access(uint32_t address);
+
+    uint32_t add_with_carry(uint32_t x, uint32_t y, bool carry_in, bool set_flags);
+    void set_nz(uint32_t value);
+    bool condition(unsigned cond) const;
+
+    void fault(const char* format, ...);
+    bool step();
+};
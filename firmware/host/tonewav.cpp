@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Writes a 1 kHz sine as a 16-bit 44.1 kHz WAV file, transcoder input of
+ * the loudness check (make loudness).
+ */
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t SAMPLE_RATE = 44100;
+constexpr double FREQUENCY = 1000;
+
+void put16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(value & 0xff);
+    out.push_back(value >> 8);
+}
+
+void put32(std::vector<uint8_t>& out, uint32_t value) {
+    put16(out, value & 0xffff);
+    put16(out, value >> 16);
+}
+
+void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s <output.wav> <seconds> <peak dBFS> [--mono]\n"
+        "  --mono  one channel (default two, same signal)\n",
+        name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 4 || argc > 5 || (argc == 5 && std::strcmp(argv[4], "--mono") != 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const double seconds = std::atof(argv[2]);
+    const double peak = std::pow(10, std::atof(argv[3]) / 20) * 32767;
+    const uint16_t channels = argc == 5 ? 1 : 2;
+    if (seconds <= 0 || peak > 32767) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const uint32_t frames = (uint32_t)(seconds * SAMPLE_RATE);
+    const uint32_t data_size = frames * channels * 2;
+
+    std::vector<uint8_t> out;
+    out.insert(out.end(), {'R', 'I', 'F', 'F'});
+    put32(out, 36 + data_size);
+    out.insert(out.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put32(out, 16);
+    put16(out, 1); // PCM
+    put16(out, channels);
+    put32(out, SAMPLE_RATE);
+    put32(out, SAMPLE_RATE * channels * 2);
+    put16(out, channels * 2);
+    put16(out, 16);
+    out.insert(out.end(), {'d', 'a', 't', 'a'});
+    put32(out, data_size);
+
+    for (uint32_t i = 0; i < frames; i++) {
+        const int16_t sample = (int16_t)std::lround(peak * std::sin(2 * M_PI * FREQUENCY * i / SAMPLE_RATE));
+        for (uint16_t c = 0; c < channels; c++) {
+            put16(out, (uint16_t)sample);
+        }
+    }
+
+    FILE* file = std::fopen(argv[1], "wb");
+    if (!file || std::fwrite(out.data(), 1, out.size(), file) != out.size()) {
+        std::fprintf(stderr, "can't write %s\n", argv[1]);
+        return 1;
+    }
+    std::fclose(file);
+    return 0;
+}
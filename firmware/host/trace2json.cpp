@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Event trace converter. Reads TRACE.BIN written by the player (trace.h),
+ * on its own or from a card image, and writes it in Chrome trace event
+ * format, opened by Perfetto (ui.perfetto.dev) or chrome://tracing.
+ *
+ * Tracks: "cpu" has decode, state saves and Stop mode as slices, "sd" card
+ * commands and data token waits, "dma" audio buffer halves, "controller"
+ * buttons, light readings and state changes. Underruns are marked across
+ * all of them. Time starts at the oldest record.
+ */
+
+#include "sd_card.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "petitfat/source/pff.h"
+}
+
+namespace {
+
+using Trace::Event;
+
+constexpr uint32_t COUNTER_RANGE = 0x10000;
+
+enum Track : int {
+    Cpu = 1,
+    Sd,
+    Dma,
+    Controller,
+};
+
+const char* const track_names[] = {"", "cpu", "sd", "dma", "controller"};
+
+// BTN::ID
+const char* const button_names[] = {"power", "next dir", "next", "prev", "scan fwd", "scan back", "scan end",
+    "save trace"};
+// PlaybackState::Mode
+const char* const mode_names[] = {"sensor", "forced on", "forced off"};
+// PState of controller.cpp
+const char* const state_names[] = {"invalid", "not playing", "fade out", "fade in", "playing"};
+
+template <size_t N>
+std::string name_of(const char* const (&names)[N], uint8_t value) {
+    return value < N ? names[value] : std::to_string(value);
+}
+
+struct Dump {
+    Trace::Header header;
+    std::vector<Trace::Record> records;
+};
+
+bool parse(const std::vector<uint8_t>& data, Dump& dump) {
+    if (data.size() < sizeof(Trace::Header)) {
+        return false;
+    }
+    std::memcpy(&dump.header, data.data(), sizeof(Trace::Header));
+    if (dump.header.magic != Trace::HEADER_MAGIC || dump.header.version != Trace::HEADER_VERSION) {
+        return false;
+    }
+
+    const size_t count = std::min<size_t>(dump.header.records,
+        (data.size() - sizeof(Trace::Header)) / sizeof(Trace::Record));
+    dump.records.resize(count);
+    std::memcpy(dump.records.data(), data.data() + sizeof(Trace::Header), count * sizeof(Trace::Record));
+    return true;
+}
+
+bool read_file(const char* path, std::vector<uint8_t>& data) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    data.resize(512);
+    data.resize(std::fread(data.data(), 1, data.size(), file));
+    std::fclose(file);
+    return true;
+}
+
+// TRACE.BIN in the root directory of a card image, read by Petit FatFs
+bool read_from_image(const char* path, std::vector<uint8_t>& data) {
+    FATFS fs;
+    UINT br;
+    data.resize(512);
+    const bool ok = HostSd::open(path, false) && pf_mount(&fs) == FR_OK && pf_open("TRACE.BIN") == FR_OK
+        && pf_read(data.data(), (UINT)data.size(), &br) == FR_OK;
+    HostSd::close();
+    data.resize(ok ? br : 0);
+    return ok;
+}
+
+class Writer {
+public:
+    explicit Writer(FILE* out) : out(out) {
+        std::fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        std::fprintf(out, "  {\"ph\": \"M\", \"pid\": 1, \"name\": \"process_name\", \"args\": {\"name\": \"LooTunes\"}}");
+        for (int track = Cpu; track <= Controller; track++) {
+            std::fprintf(out, ",\n  {\"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"name\": \"thread_name\", "
+                "\"args\": {\"name\": \"%s\"}}", track, track_names[track]);
+            std::fprintf(out, ",\n  {\"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"name\": \"thread_sort_index\", "
+                "\"args\": {\"sort_index\": %d}}", track, track);
+        }
+    }
+
+    ~Writer() {
+        std::fprintf(out, "\n]}\n");
+    }
+
+    // phase B / E (slice), i (instant); args is a JSON object body or empty
+    void event(char phase, Track track, uint64_t us, const std::string& name, const std::string& args = "",
+            bool global = false) {
+        std::fprintf(out, ",\n  {\"ph\": \"%c\", \"pid\": 1, \"tid\": %d, \"ts\": %llu, \"name\": \"%s\"",
+            phase, track, (unsigned long long)us, name.c_str());
+        if (phase == 'i') {
+            std::fprintf(out, ", \"s\": \"%c\"", global ? 'g' : 't');
+        }
+        if (!args.empty()) {
+            std::fprintf(out, ", \"args\": {%s}", args.c_str());
+        }
+        std::fprintf(out, "}");
+    }
+
+private:
+    FILE* out;
+};
+
+// Slice of begin / end event pair, end without its begin (cut off by the ring) is dropped
+struct Slice {
+    Track track;
+    const char* name;
+    bool open = false;
+
+    void begin(Writer& writer, uint64_t us, const std::string& args = "") {
+        if (open) {
+            writer.event('E', track, us, name); // end missed, e.g. decode ended by an error
+        }
+        writer.event('B', track, us, name, args);
+        open = true;
+    }
+
+    void end(Writer& writer, uint64_t us, const std::string& args = "") {
+        if (open) {
+            writer.event('E', track, us, name, args);
+            open = false;
+        }
+    }
+};
+
+void convert(const Dump& dump, FILE* out) {
+    Writer writer(out);
+
+    Slice decode = {Cpu, "decode"};
+    Slice state_save = {Cpu, "state save"};
+    Slice stop = {Cpu, "stop mode"};
+    Slice token_wait = {Sd, "token wait"};
+
+    uint64_t us = 0;
+    uint16_t previous = 0;
+    bool stopped_stream = false; // CMD12 was the last command, CMD18 after it restarts the stream
+
+    for (size_t i = 0; i < dump.records.size(); i++) {
+        const Trace::Record& record = dump.records[i];
+        if (i > 0) {
+            // at least one more wrap if counter is past the previous value again
+            const bool wrapped = record.event & Trace::WRAPPED;
+            us += (uint16_t)(record.time - previous)
+                + (wrapped && record.time >= previous ? COUNTER_RANGE : 0);
+        }
+        previous = record.time;
+
+        const uint8_t arg = record.arg;
+        switch (static_cast<Event>(record.event & ~Trace::WRAPPED)) {
+            case Event::DmaHalf:
+                writer.event('i', Dma, us, "half");
+                break;
+            case Event::DmaComplete:
+                writer.event('i', Dma, us, "complete");
+                break;
+            case Event::DecodeStart:
+                decode.begin(writer, us, "\"position\": " + std::to_string(arg));
+                break;
+            case Event::DecodeEnd:
+                decode.end(writer, us);
+                break;
+            case Event::SdCommand: {
+                const bool restart = stopped_stream && arg == 18;
+                writer.event('i', Sd, us, "CMD" + std::to_string(arg) + (restart ? " restart" : ""));
+                stopped_stream = arg == 12;
+                break;
+            }
+            case Event::SdTokenWait:
+                token_wait.begin(writer, us);
+                break;
+            case Event::SdToken: {
+                char token[8];
+                std::snprintf(token, sizeof(token), "%02X", arg);
+                token_wait.end(writer, us, std::string("\"token\": \"") + token + "\"");
+                stopped_stream = false;
+                break;
+            }
+            case Event::StateSaveStart:
+                state_save.begin(writer, us);
+                break;
+            case Event::StateSaveEnd:
+                state_save.end(writer, us);
+                break;
+            case Event::Button:
+                writer.event('i', Controller, us, "button " + name_of(button_names, arg));
+                break;
+            case Event::Light:
+                writer.event('i', Controller, us, "light", "\"reading\": " + std::to_string(arg * 16));
+                break;
+            case Event::Mode:
+                writer.event('i', Controller, us, "mode " + name_of(mode_names, arg));
+                break;
+            case Event::PlayState:
+                writer.event('i', Controller, us, name_of(state_names, arg));
+                break;
+            case Event::StopEnter:
+                stop.begin(writer, us);
+                break;
+            case Event::StopExit:
+                stop.end(writer, us);
+                break;
+            case Event::Underrun:
+                writer.event('i', Cpu, us, "underrun", "\"late_samples\": " + std::to_string(arg), true);
+                break;
+            default:
+                writer.event('i', Cpu, us, "event " + std::to_string(record.event & ~Trace::WRAPPED),
+                    "\"arg\": " + std::to_string(arg));
+                break;
+        }
+    }
+
+    // slices still open at the end of the ring
+    for (Slice* slice : {&decode, &state_save, &stop, &token_wait}) {
+        slice->end(writer, us);
+    }
+}
+
+void usage(const char* name) {
+    std::fprintf(stderr,
+        "usage: %s <TRACE.BIN | image> [output.json]\n"
+        "  trace file copied from the card, or a card image to read it from\n"
+        "  output defaults to stdout\n",
+        name);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* input = argv[1];
+    std::vector<uint8_t> data;
+    Dump dump;
+    if (!read_file(input, data)) {
+        std::fprintf(stderr, "can't read %s\n", input);
+        return 1;
+    }
+    if (!parse(data, dump) && !(read_from_image(input, data) && parse(data, dump))) {
+        std::fprintf(stderr, "%s: no trace, TRACE.BIN is empty or missing\n", input);
+        return 1;
+    }
+    if (dump.header.event_count != static_cast<uint8_t>(Event::Count)) {
+        std::fprintf(stderr, "%s: written by firmware with %u events, this one has %u\n", input,
+            dump.header.event_count, static_cast<unsigned>(Event::Count));
+    }
+
+    FILE* out = argc == 3 ? std::fopen(argv[2], "w") : stdout;
+    if (!out) {
+        std::fprintf(stderr, "can't write %s\n", argv[2]);
+        return 1;
+    }
+
+    convert(dump, out);
+    if (out != stdout) {
+        std::fclose(out);
+    }
+
+    std::fprintf(stderr, "%s: %zu records, saved %s\n", input, dump.records.size(),
+        dump.header.reason == Trace::Reason::Underrun ? "after underrun" : "on request");
+    return 0;
+}
@@ -0,0 +1,1050 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Batch transcoder preparing a card: converts every audio file under the
+ * input directory to a stream the player reads (.LTS by default, raw .SBC
+ * on request), mirroring the directory tree in the output directory.
+ *   - input formats are pluggable readers giving 16-bit PCM: WAV is parsed
+ *     here, FLAC is decoded by the `flac` command and MP3 / Ogg / AAC by
+ *     `ffmpeg` through a pipe
+ *   - files are converted on a work-stealing thread pool, one job per file
+ *   - outputs are written to a temporary name and renamed when complete, a
+ *     file whose output is newer is skipped, so reruns only convert new or
+ *     changed files
+ *   - with the firmware ELF, the bitpool is the highest one whose worst case
+ *     decode fits a share of the frame time on the chip, measured by running
+ *     sbc_decode in the instruction set simulator
+ *   - tracks are normalised to a loudness target: a first pass measures the
+ *     integrated loudness, attenuation goes to the .LTS header gain the
+ *     player folds into its output scaling, a quiet track is amplified
+ *     before encoding as far as its peak allows
+ */
+
+#include "elf_file.h"
+#include "thumb_core.h"
+#include "sbc_encoder.h"
+#include "libsbc/include/lts.h"
+#include "loudness.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr double CORE_HZ = 48e6;
+
+constexpr uint32_t FLASH_SIZE = 32 * 1024;
+constexpr uint32_t RAM_SIZE = 16 * 1024;        // chip has 4K, bench buffers live above it
+constexpr uint32_t SCRATCH = ThumbCore::RAM_BASE + 0x1000;
+constexpr uint32_t STACK_TOP = ThumbCore::RAM_BASE + RAM_SIZE;
+
+constexpr int DEFAULT_BITPOOL = 53;             // 328 kbps joint stereo at 44.1 kHz
+constexpr unsigned PROBE_FRAMES = 24;           // noise frames decoded per bitpool
+constexpr double DEFAULT_LOUDNESS = -18;        // LUFS, ReplayGain 2.0 reference level
+
+struct Options {
+    fs::path input_dir;
+    fs::path output_dir;
+    unsigned jobs = 0;                  // 0: all cores
+    int bitpool = 0;                    // 0: default, or chosen against budget
+    int subbands = 8;
+    int blocks = 16;
+    const char* mode = "joint";
+    const char* elf_path = nullptr;
+    double budget = 50;                 // % of frame time decode may take
+    int rewind_s = 0;
+    double loudness = DEFAULT_LOUDNESS;
+    double tolerance = 0;               // dB, --measure only
+    bool normalize = true;
+    bool raw = false;
+    bool force = false;
+    ThumbCore::CycleModel model;
+};
+
+
+/*
+ * Input: 16-bit interleaved PCM of one or two channels.
+ */
+class AudioReader {
+public:
+    virtual ~AudioReader() = default;
+
+    /**
+     * @brief Open file and read its format
+     * @return false with error() set
+     */
+    virtual bool open(const fs::path& path) = 0;
+
+    /**
+     * @brief Read up to count frames of interleaved samples
+     * @return frames read, 0 at end of stream
+     */
+    virtual size_t read(int16_t* pcm, size_t count) = 0;
+
+    /**
+     * @brief Close after the last read
+     * @return false with error() set if the stream ended early
+     */
+    virtual bool close() = 0;
+
+    int sample_rate() const { return rate; }
+    int channels() const { return nchannels; }
+    const std::string& error() const { return error_text; }
+
+protected:
+    int rate = 0;
+    int nchannels = 0;
+    std::string error_text;
+
+    bool fail(const std::string& message) {
+        error_text = message;
+        return false;
+    }
+};
+
+/*
+ * WAV, integer PCM of 8 to 32 bits or 32-bit float, plain or extensible
+ * format. Chunks are walked without seeking so it also reads from pipes.
+ */
+class WavReader : public AudioReader {
+public:
+    ~WavReader() override {
+        WavReader::close();
+    }
+
+    bool open(const fs::path& path) override {
+        fp = std::fopen(path.c_str(), "rb");
+        if (!fp) {
+            return fail(std::strerror(errno));
+        }
+        return parse();
+    }
+
+    size_t read(int16_t* pcm, size_t count) override {
+        const size_t frame_size = (size_t)sample_size * nchannels;
+        if (remaining < count * frame_size) {
+            count = remaining / frame_size;
+        }
+
+        buffer.resize(count * frame_size);
+        const size_t frames = std::fread(buffer.data(), frame_size, count, fp);
+        remaining -= frames * frame_size;
+
+        const uint8_t* p = buffer.data();
+        for (size_t i = 0; i < frames * nchannels; i++, p += sample_size) {
+            pcm[i] = convert(p);
+        }
+        return frames;
+    }
+
+    bool close() override {
+        if (fp) {
+            std::fclose(fp);
+            fp = nullptr;
+        }
+        return remaining == 0 || remaining == SIZE_MAX || fail("truncated");
+    }
+
+protected:
+    FILE* fp = nullptr;
+
+    bool parse() {
+        uint8_t riff[12];
+        if (std::fread(riff, sizeof(riff), 1, fp) != 1
+                || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0) {
+            return fail("not a WAV file");
+        }
+
+        bool has_format = false;
+        for (;;) {
+            uint8_t chunk[8];
+            if (std::fread(chunk, sizeof(chunk), 1, fp) != 1) {
+                return fail("no data chunk");
+            }
+            const uint32_t size = get32(chunk + 4);
+
+            if (std::memcmp(chunk, "data", 4) == 0) {
+                if (!has_format) {
+                    return fail("data before format");
+                }
+                // streamed WAV (pipes) leaves the size unset
+                remaining = size && size != UINT32_MAX ? size : SIZE_MAX;
+                return true;
+            }
+
+            std::vector<uint8_t> body(size + (size & 1));
+            if (!body.empty() && std::fread(body.data(), body.size(), 1, fp) != 1) {
+                return fail("truncated chunk");
+            }
+
+            if (std::memcmp(chunk, "fmt ", 4) == 0) {
+                if (size < 16) {
+                    return fail("bad format chunk");
+                }
+                unsigned tag = get16(&body[0]);
+                nchannels = get16(&body[2]);
+                rate = (int)get32(&body[4]);
+                if (tag == 0xfffe && size >= 26) {
+                    tag = get16(&body[24]);     // sub-format GUID starts with the tag
+                }
+
+                if (nchannels < 1 || nchannels > 2) {
+                    return fail(std::to_string(nchannels) + " channels");
+                }
+
+                // container size, 24 valid bits may come in 32
+                sample_size = get16(&body[12]) / nchannels;
+                is_float = tag == 3;
+                if (!((tag == 1 && sample_size >= 1 && sample_size <= 4) || (is_float && sample_size == 4))) {
+                    return fail("unsupported sample format");
+                }
+                has_format = true;
+            }
+        }
+    }
+
+private:
+    int sample_size = 0;
+    bool is_float = false;
+    size_t remaining = 0;
+    std::vector<uint8_t> buffer;
+
+    static unsigned get16(const uint8_t* p) { return p[0] | p[1] << 8; }
+    static uint32_t get32(const uint8_t* p) { return get16(p) | (uint32_t)get16(p + 2) << 16; }
+
+    int16_t convert(const uint8_t* p) const {
+        if (is_float) {
+            float value;
+            std::memcpy(&value, p, sizeof(value));
+            return (int16_t)std::clamp(std::lround(value * 32768.0f), -32768L, 32767L);
+        }
+        if (sample_size == 1) {
+            return (int16_t)((p[0] - 128) << 8);     // 8 bits are unsigned
+        }
+        // upper 16 bits of the little endian sample
+        return (int16_t)(p[sample_size - 2] | p[sample_size - 1] << 8);
+    }
+};
+
+/*
+ * Any format a decoder command turns into WAV on its stdout, read through a
+ * pipe. "{}" in the command stands for the file name.
+ */
+class PipeReader : public WavReader {
+public:
+    explicit PipeReader(std::vector<std::string> command) : command(std::move(command)) {
+    }
+
+    ~PipeReader() override {
+        PipeReader::close();
+    }
+
+    bool close() override {
+        bool ok = WavReader::close();
+        if (pid > 0) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            pid = -1;
+            ok = ok && ((WIFEXITED(status) && WEXITSTATUS(status) == 0) || fail(command[0] + " failed"));
+        }
+        return ok;
+    }
+
+    bool open(const fs::path& path) override {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            return fail(std::strerror(errno));
+        }
+
+        // the child gets the write end as stdout, other workers' pipes stay closed in it
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+        std::vector<std::string> args = command;
+        std::replace(args.begin(), args.end(), std::string("{}"), path.string());
+        std::vector<char*> argv;
+        for (std::string& arg : args) {
+            argv.push_back(arg.data());
+        }
+        argv.push_back(nullptr);
+
+        const int status = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+
+        posix_spawn_file_actions_destroy(&actions);
+        ::close(fds[1]);
+
+        if (status != 0) {
+            ::close(fds[0]);
+            pid = -1;
+            return fail(command[0] + ": " + std::strerror(status));
+        }
+
+        fp = fdopen(fds[0], "rb");
+        return parse();
+    }
+
+private:
+    std::vector<std::string> command;
+    pid_t pid = -1;
+};
+
+/*
+ * Readers by file extension (lower case). FLAC goes through the reference
+ * decoder, lossy formats through ffmpeg, downmixed to 16-bit stereo.
+ */
+const std::vector<std::string> FLAC_COMMAND = { "flac", "-d", "-c", "-s", "--", "{}" };
+const std::vector<std::string> FFMPEG_COMMAND = { "ffmpeg", "-v", "error", "-nostdin", "-i", "{}",
+    "-map_metadata", "-1", "-ac", "2", "-f", "wav", "-c:a", "pcm_s16le", "-" };
+
+const std::map<std::string, std::function<std::unique_ptr<AudioReader>()>> READERS = {
+    { ".wav", [] { return std::make_unique<WavReader>(); } },
+    { ".flac", [] { return std::make_unique<PipeReader>(FLAC_COMMAND); } },
+    { ".mp3", [] { return std::make_unique<PipeReader>(FFMPEG_COMMAND); } },
+    { ".ogg", [] { return std::make_unique<PipeReader>(FFMPEG_COMMAND); } },
+    { ".m4a", [] { return std::make_unique<PipeReader>(FFMPEG_COMMAND); } },
+};
+
+std::string lower_extension(const fs::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension;
+}
+
+
+/*
+ * Output stream, frames are appended as they are encoded. .LTS packs them
+ * into sectors like ltspack, header is written last once they are counted.
+ */
+class StreamWriter {
+public:
+    ~StreamWriter() {
+        if (fp) {
+            std::fclose(fp);
+        }
+    }
+
+    bool open(const fs::path& path, bool lts_stream) {
+        lts = lts_stream;
+        fp = std::fopen(path.c_str(), "wb");
+        return fp && (!lts || std::fseek(fp, LTS_HEADER_SIZE, SEEK_SET) == 0);
+    }
+
+    bool write(const uint8_t* frame, unsigned size) {
+        if (!frame_count) {
+            std::memcpy(sbc_header, frame, SBC_HEADER_SIZE);
+            frame_size = size;
+        }
+        frame_count++;
+
+        if (!lts) {
+            return std::fwrite(frame, size, 1, fp) == 1;
+        }
+
+        std::memcpy(sector + fill, frame, size);
+        fill += size;
+        if (fill + size > LTS_SECTOR_SIZE) {
+            std::memset(sector + fill, 0, LTS_SECTOR_SIZE - fill);
+            fill = 0;
+            return std::fwrite(sector, LTS_SECTOR_SIZE, 1, fp) == 1;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Flush last sector and write the header, file is closed
+     */
+    bool finish(int rewind_s, uint16_t gain) {
+        bool ok = true;
+        if (lts) {
+            // last sector isn't padded, the file ends with the last frame
+            ok = !fill || std::fwrite(sector, fill, 1, fp) == 1;
+
+            uint8_t header[LTS_HEADER_SIZE] = {};
+            std::memcpy(header + 0, LTS_MAGIC, 4);
+            header[4] = LTS_VERSION;
+            header[5] = (uint8_t)(frame_size ? LTS_SECTOR_SIZE / frame_size : 0);
+            put16(header + 6, frame_size);
+            std::memcpy(header + 8, sbc_header, SBC_HEADER_SIZE);
+            put16(header + 12, frame_count & 0xffff);
+            put16(header + 14, frame_count >> 16);
+            put16(header + 16, gain);
+            put16(header + 18, (unsigned)rewind_s);
+
+            ok = ok && std::fseek(fp, 0, SEEK_SET) == 0 && std::fwrite(header, sizeof(header), 1, fp) == 1;
+        }
+
+        ok = std::fclose(fp) == 0 && ok;
+        fp = nullptr;
+        return ok;
+    }
+
+    uint32_t frames() const { return frame_count; }
+
+private:
+    FILE* fp = nullptr;
+    bool lts = false;
+    uint8_t sbc_header[SBC_HEADER_SIZE] = {};
+    unsigned frame_size = 0;
+    uint32_t frame_count = 0;
+    uint8_t sector[LTS_SECTOR_SIZE];
+    unsigned fill = 0;
+
+    static void put16(uint8_t* p, unsigned v) {
+        p[0] = v & 0xff;
+        p[1] = (v >> 8) & 0xff;
+    }
+};
+
+
+/*
+ * Decode cost on the chip. The firmware ELF runs in the simulator, frames
+ * of full scale noise (every sub-band allocated, the costliest case for a
+ * bitpool) are decoded and the slowest one counts. Results are kept per
+ * frame parameters, the simulator is shared by all workers.
+ */
+class CycleBudget {
+public:
+    explicit CycleBudget(const ThumbCore::CycleModel& model) : core(model, FLASH_SIZE, RAM_SIZE) {
+    }
+
+    bool load(const char* path) {
+        if (!elf.load(path)) {
+            error_text = elf.error();
+            return false;
+        }
+
+        for (const ElfFile::Segment& segment : elf.segments()) {
+            // .data is copied from its load address by startup code, do it here
+            bool placed = core.poke(segment.paddr, segment.data.data(), (uint32_t)segment.data.size());
+            if (segment.vaddr != segment.paddr) {
+                placed = core.poke(segment.vaddr, segment.data.data(), (uint32_t)segment.data.size()) || placed;
+            }
+            if (!placed) {
+                error_text = "segment doesn't fit flash / RAM";
+                return false;
+            }
+        }
+
+        decode = elf.find("sbc_decode");
+        reset = elf.find("sbc_reset");
+        if (!decode || !decode->function || !reset) {
+            error_text = "sbc_decode not in ELF";
+            return false;
+        }
+        return true;
+    }
+
+    const std::string& error() const { return error_text; }
+
+    /**
+     * @brief Highest bitpool whose slowest frame decodes within share of the
+     *        frame time, 0 if even the lowest one doesn't
+     */
+    int bitpool(sbc_frame frame, double share) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        const auto key = std::make_tuple((int)frame.freq, (int)frame.mode, frame.nsubbands, frame.nblocks, share);
+        if (const auto found = chosen.find(key); found != chosen.end()) {
+            return found->second;
+        }
+
+        const double frame_cycles = frame.nblocks * frame.nsubbands * CORE_HZ / sbc_get_freq_hz(frame.freq);
+        const uint64_t limit = (uint64_t)(frame_cycles * share / 100);
+
+        // cycles grow with the bitpool, search the highest valid one in budget
+        sbc_encoder encoder;
+        int low = 2, high = 250;
+        for (frame.bitpool = high; high > low && sbc_encoder_reset(&encoder, &frame) != 0; frame.bitpool = --high) {
+        }
+
+        int best = 0;
+        while (low <= high) {
+            frame.bitpool = (low + high) / 2;
+            const uint64_t cycles = worst_frame(frame);
+            if (cycles && cycles <= limit) {
+                best = frame.bitpool;
+                low = frame.bitpool + 1;
+            }
+            else {
+                high = frame.bitpool - 1;
+            }
+        }
+
+        if (best) {
+            frame.bitpool = best;
+            std::printf("bitpool %d for %d Hz %s, %d subbands, %d blocks: %.1f%% of frame time on the chip\n",
+                best, sbc_get_freq_hz(frame.freq), frame.mode == SBC_MODE_MONO ? "mono" : "stereo",
+                frame.nsubbands, frame.nblocks, 100.0 * worst_frame(frame) / frame_cycles);
+        }
+        chosen[key] = best;
+        return best;
+    }
+
+private:
+    ThumbCore core;
+    ElfFile elf;
+    const ElfFile::Symbol* decode = nullptr;
+    const ElfFile::Symbol* reset = nullptr;
+    std::string error_text;
+    std::mutex mutex;
+    std::map<std::tuple<int, int, int, int, double>, int> chosen;
+
+    uint64_t worst_frame(const sbc_frame& frame) {
+        const uint32_t ctx = SCRATCH;
+        const uint32_t frame_desc = ctx + ((sizeof(sbc_t) + 7) & ~7u);
+        const uint32_t data = frame_desc + 64;
+        const uint32_t pcml = data + 512;
+        const uint32_t pcmr = frame.mode == SBC_MODE_MONO ? 0 : pcml + SBC_MAX_SAMPLES * 2;
+
+        const std::vector<uint8_t> zero(sizeof(sbc_t), 0);
+        core.poke(ctx, zero.data(), (uint32_t)zero.size());
+        if (!core.call(reset->address, { ctx }, STACK_TOP)) {
+            return 0;
+        }
+
+        sbc_encoder encoder;
+        sbc_encoder_reset(&encoder, &frame);
+
+        std::mt19937 random(1);
+        std::uniform_int_distribution<int> noise(-32768, 32767);
+        int16_t pcm[2 * SBC_MAX_SAMPLES];
+
+        uint64_t worst = 0;
+        for (unsigned i = 0; i < PROBE_FRAMES; i++) {
+            for (int16_t& sample : pcm) {
+                sample = (int16_t)noise(random);
+            }
+
+            uint8_t frame_data[512];
+            const unsigned size = sbc_encoder_encode(&encoder, pcm, frame_data, sizeof(frame_data));
+            if (!size) {
+                return 0;
+            }
+            core.poke(data, frame_data, size);
+
+            const uint64_t before = core.cycles();
+            if (!core.call(decode->address, { ctx, data, size, frame_desc, pcml, pcmr }, STACK_TOP)) {
+                return 0;
+            }
+            // filter history settles after the first frames
+            if (i >= 2) {
+                worst = std::max(worst, core.cycles() - before);
+            }
+        }
+        return worst;
+    }
+};
+
+
+/*
+ * Thread pool with a deque of jobs per worker: a worker takes jobs from the
+ * back of its own deque and, once it runs dry, steals from the front of the
+ * others. All jobs are known up front, a worker finding every deque empty
+ * is done.
+ */
+class WorkPool {
+public:
+    using Job = std::function<void()>;
+
+    explicit WorkPool(unsigned threads) : queues(std::max(threads, 1u)) {
+    }
+
+    /**
+     * @brief Run jobs dealt round robin in given order, returns when all are done
+     */
+    void run(std::vector<Job> jobs) {
+        for (size_t i = 0; i < jobs.size(); i++) {
+            queues[i % queues.size()].jobs.push_back(std::move(jobs[i]));
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned worker = 0; worker < queues.size(); worker++) {
+            workers.emplace_back([this, worker] {
+                Job job;
+                while (take(worker, job)) {
+                    job();
+                }
+            });
+        }
+        for (std::thread& thread : workers) {
+            thread.join();
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+    std::vector<Queue> queues;
+
+    bool take(unsigned worker, Job& job) {
+        {
+            Queue& own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty()) {
+                job = std::move(own.jobs.back());
+                own.jobs.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < queues.size(); i++) {
+            Queue& victim = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+struct Totals {
+    std::atomic<unsigned> converted{0};
+    std::atomic<unsigned> skipped{0};
+    std::atomic<unsigned> failed{0};
+    std::atomic<uint64_t> audio_ms{0};
+};
+
+std::mutex print_mutex;
+
+bool frequency(int rate, sbc_freq& freq) {
+    switch (rate) {
+        case 16000: freq = SBC_FREQ_16K; return true;
+        case 32000: freq = SBC_FREQ_32K; return true;
+        case 44100: freq = SBC_FREQ_44K1; return true;
+        case 48000: freq = SBC_FREQ_48K; return true;
+        default: return false;
+    }
+}
+
+/**
+ * Read a frame of samples as the encoder takes them: stereo input downmixed
+ * for mono streams, end of the stream padded with silence
+ * @return frames read from the input, 0 at its end
+ */
+size_t read_frame(AudioReader& reader, const sbc_frame& frame, std::vector<int16_t>& in, int16_t* pcm) {
+    const size_t samples = (size_t)frame.nblocks * frame.nsubbands;
+    const int input_channels = reader.channels();
+    in.resize(samples * input_channels);
+
+    const size_t count = reader.read(in.data(), samples);
+    std::fill(in.begin() + count * input_channels, in.end(), 0);
+
+    if (frame.mode == SBC_MODE_MONO && input_channels == 2) {
+        for (size_t i = 0; i < samples; i++) {
+            pcm[i] = (int16_t)((in[2 * i] + in[2 * i + 1]) / 2);
+        }
+    }
+    else {
+        std::copy(in.begin(), in.end(), pcm);
+    }
+    return count;
+}
+
+/**
+ * Gain bringing a track to the loudness target, split in the part applied
+ * to samples before encoding (amplification up to the peak, or all of it for
+ * raw streams which have no header) and the Q15 header gain (attenuation)
+ * @return gain to the target, 0 when the track is silent
+ */
+double track_gain(const Options& options, const LoudnessMeter& meter, double& pcm_scale, uint16_t& header_gain) {
+    const double loudness = meter.integrated();
+    if (!std::isfinite(loudness) || meter.peak() <= 0) {
+        return 0;
+    }
+
+    const double gain = std::pow(10, (options.loudness - loudness) / 20);
+    const double headroom = 1 / meter.peak();
+
+    if (options.raw) {
+        pcm_scale = std::min(gain, headroom);
+    }
+    else {
+        pcm_scale = std::clamp(gain, 1.0, std::max(headroom, 1.0));
+        header_gain = (uint16_t)std::clamp(std::lround(gain / pcm_scale * LTS_GAIN_UNITY), 1L, (long)LTS_GAIN_UNITY);
+    }
+    return gain;
+}
+
+/**
+ * Convert one file, written to a temporary name and renamed when complete
+ * @return error text, empty on success
+ */
+std::string convert(const Options& options, CycleBudget* budget, const fs::path& input,
+        const fs::path& output, std::string& summary, uint64_t& duration_ms) {
+    auto reader = READERS.at(lower_extension(input))();
+    if (!reader->open(input)) {
+        return reader->error();
+    }
+
+    sbc_frame frame = {};
+    if (!frequency(reader->sample_rate(), frame.freq)) {
+        return std::to_string(reader->sample_rate()) + " Hz is not an SBC rate, resample first";
+    }
+
+    const bool mono = reader->channels() == 1 || std::strcmp(options.mode, "mono") == 0;
+    frame.mode = mono ? SBC_MODE_MONO
+        : std::strcmp(options.mode, "stereo") == 0 ? SBC_MODE_STEREO : SBC_MODE_JOINT_STEREO;
+    frame.bam = SBC_BAM_LOUDNESS;
+    frame.nsubbands = options.subbands;
+    frame.nblocks = options.blocks;
+    frame.bitpool = options.bitpool ? options.bitpool : DEFAULT_BITPOOL;
+
+    if (budget && !options.bitpool && !(frame.bitpool = budget->bitpool(frame, options.budget))) {
+        return "no bitpool fits the cycle budget";
+    }
+
+    sbc_encoder encoder;
+    if (sbc_encoder_reset(&encoder, &frame) != 0) {
+        return "invalid SBC parameters (bitpool " + std::to_string(frame.bitpool) + ")";
+    }
+
+    std::vector<int16_t> in;
+    int16_t pcm[2 * SBC_MAX_SAMPLES];
+    const size_t samples = (size_t)frame.nblocks * frame.nsubbands;
+    const int channels = frame.mode == SBC_MODE_MONO ? 1 : 2;
+
+    // --- Loudness pass, the input is decoded again for encoding ---
+
+    double pcm_scale = 1;
+    uint16_t header_gain = 0;
+    double loudness = -HUGE_VAL;
+    double gain = 0;
+
+    if (options.normalize) {
+        LoudnessMeter meter(reader->sample_rate(), channels);
+        while (const size_t count = read_frame(*reader, frame, in, pcm)) {
+            meter.add(pcm, count);
+        }
+        if (!reader->close()) {
+            return reader->error();
+        }
+
+        if ((gain = track_gain(options, meter, pcm_scale, header_gain))) {
+            loudness = meter.integrated();
+        }
+
+        reader = READERS.at(lower_extension(input))();
+        if (!reader->open(input)) {
+            return reader->error();
+        }
+    }
+
+    std::error_code error;
+    fs::create_directories(output.parent_path(), error);
+    const fs::path partial = output.string() + ".part";
+
+    StreamWriter writer;
+    if (!writer.open(partial, !options.raw)) {
+        return partial.string() + ": " + std::strerror(errno);
+    }
+
+    // --- Frames, last one padded with silence ---
+
+    uint64_t frames_in = 0;
+
+    while (const size_t count = read_frame(*reader, frame, in, pcm)) {
+        frames_in += count;
+
+        if (pcm_scale != 1) {
+            for (size_t i = 0; i < samples * channels; i++) {
+                pcm[i] = (int16_t)std::clamp(std::lround(pcm[i] * pcm_scale), -32768L, 32767L);
+            }
+        }
+
+        uint8_t data[512];
+        const unsigned size = sbc_encoder_encode(&encoder, pcm, data, sizeof(data));
+        if (!size || !writer.write(data, size)) {
+            writer.finish(0, 0);
+            fs::remove(partial, error);
+            return "write failed";
+        }
+    }
+
+    if (!reader->close()) {
+        writer.finish(0, 0);
+        fs::remove(partial, error);
+        return reader->error();
+    }
+    if (!writer.finish(options.rewind_s, header_gain)) {
+        fs::remove(partial, error);
+        return "write failed";
+    }
+
+    fs::rename(partial, output, error);
+    if (error) {
+        return error.message();
+    }
+
+    duration_ms = frames_in * 1000 / reader->sample_rate();
+    char text[160];
+    int length = std::snprintf(text, sizeof(text), "%.1f s, bitpool %d, %u kbps", duration_ms / 1000.0,
+        frame.bitpool, sbc_get_frame_bitrate(&frame) / 1000);
+    if (gain) {
+        // short of the target when the peak limits amplification
+        const double applied = pcm_scale * (header_gain ? header_gain : LTS_GAIN_UNITY) / LTS_GAIN_UNITY;
+        std::snprintf(text + length, sizeof(text) - length, ", %.1f LUFS, gain %+.1f dB%s", loudness,
+            20 * std::log10(applied), applied < gain * 0.99 ? " (peak limited)" : "");
+    }
+    summary = text;
+    return "";
+}
+
+/**
+ * Print integrated loudness and peak of WAV files, e.g. devsim output to
+ * check the player's level against the target; with a tolerance, a file
+ * further than it from the target fails
+ */
+int measure(const std::vector<const char*>& paths, const Options& options) {
+    int status = 0;
+    for (const char* path : paths) {
+        WavReader reader;
+        if (!reader.open(path)) {
+            std::printf("%s: %s\n", path, reader.error().c_str());
+            status = 1;
+            continue;
+        }
+
+        LoudnessMeter meter(reader.sample_rate(), reader.channels());
+        int16_t pcm[2 * 1024];
+        while (const size_t count = reader.read(pcm, 1024)) {
+            meter.add(pcm, count);
+        }
+        reader.close();
+
+        const double loudness = meter.integrated();
+        const bool off_target = options.tolerance > 0 && !(std::fabs(loudness - options.loudness) <= options.tolerance);
+        std::printf("%s: %.1f LUFS, peak %.1f dBFS%s\n", path, loudness, 20 * std::log10(meter.peak()),
+            off_target ? ", off target" : "");
+        if (off_target) {
+            status = 1;
+        }
+    }
+    return status;
+}
+
+void usage(const char* name) {
+    std::string extensions;
+    for (const auto& reader : READERS) {
+        extensions += " " + reader.first;
+    }
+
+    std::fprintf(stderr,
+        "usage: %s <input dir> <output dir> [--jobs n] [--bitpool n] [--subbands 4|8] [--blocks n]\n"
+        "       [--mode joint|stereo|mono] [--elf LooTunes.out] [--budget percent] [--rewind s]\n"
+        "       [--loudness LUFS|off] [--sbc] [--force]\n"
+        "       %s --measure <file.wav>... [--loudness LUFS --tolerance dB]\n"
+        "  --jobs      worker threads (default: all cores)\n"
+        "  --bitpool   SBC bitpool (default %d, or the highest within budget with --elf)\n"
+        "  --subbands  4 or 8 (default 8)\n"
+        "  --blocks    4, 8, 12 or 16 (default 16)\n"
+        "  --mode      channel mode of stereo input (default joint)\n"
+        "  --elf       firmware ELF the decode cycles are measured on\n"
+        "  --budget    share of frame time decoding may take, %% (default 50)\n"
+        "  --rewind    seconds resumed playback goes back (.LTS header)\n"
+        "  --loudness  integrated loudness tracks are normalised to (default %.0f LUFS)\n"
+        "  --sbc       write raw .SBC streams instead of .LTS\n"
+        "  --force     convert files whose output is up to date too\n"
+        "  --measure   print loudness and peak of WAV files (e.g. devsim --wav output)\n"
+        "  --tolerance with --measure, fail if a file is further from --loudness\n"
+        "input:%s\n",
+        name, name, DEFAULT_BITPOOL, DEFAULT_LOUDNESS, extensions.c_str());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    std::vector<const char*> positional;
+    bool measuring = false;
+
+    for (int i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--jobs") == 0 && has_value) {
+            options.jobs = (unsigned)std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--bitpool") == 0 && has_value) {
+            options.bitpool = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--subbands") == 0 && has_value) {
+            options.subbands = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--blocks") == 0 && has_value) {
+            options.blocks = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--mode") == 0 && has_value) {
+            options.mode = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--elf") == 0 && has_value) {
+            options.elf_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--budget") == 0 && has_value) {
+            options.budget = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--rewind") == 0 && has_value) {
+            options.rewind_s = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--loudness") == 0 && has_value) {
+            i++;
+            options.normalize = std::strcmp(argv[i], "off") != 0;
+            options.loudness = std::atof(argv[i]);
+        }
+        else if (std::strcmp(argv[i], "--tolerance") == 0 && has_value) {
+            options.tolerance = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--measure") == 0) {
+            measuring = true;
+        }
+        else if (std::strcmp(argv[i], "--sbc") == 0) {
+            options.raw = true;
+        }
+        else if (std::strcmp(argv[i], "--force") == 0) {
+            options.force = true;
+        }
+        else if (argv[i][0] != '-') {
+            positional.push_back(argv[i]);
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (measuring) {
+        if (positional.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+        return measure(positional, options);
+    }
+
+    const bool mode_valid = std::strcmp(options.mode, "joint") == 0 || std::strcmp(options.mode, "stereo") == 0
+        || std::strcmp(options.mode, "mono") == 0;
+    if (positional.size() != 2 || !mode_valid || (options.subbands != 4 && options.subbands != 8)
+            || options.blocks < 4 || options.blocks > 16 || options.blocks % 4
+            || options.rewind_s < 0 || options.rewind_s > UINT16_MAX || options.budget <= 0
+            || (options.normalize && (options.loudness >= 0 || options.loudness < -70))) {
+        usage(argv[0]);
+        return 1;
+    }
+    options.input_dir = positional[0];
+    options.output_dir = positional[1];
+
+    std::unique_ptr<CycleBudget> budget;
+    if (options.elf_path) {
+        budget = std::make_unique<CycleBudget>(options.model);
+        if (!budget->load(options.elf_path)) {
+            std::fprintf(stderr, "%s: %s\n", options.elf_path, budget->error().c_str());
+            return 1;
+        }
+    }
+
+    // --- Files to convert, up to date outputs are skipped ---
+
+    struct File {
+        fs::path input;
+        fs::path output;
+        uintmax_t size;
+    };
+    std::vector<File> files;
+    Totals totals;
+
+    std::error_code error;
+    for (auto it = fs::recursive_directory_iterator(options.input_dir, error);
+            !error && it != fs::recursive_directory_iterator(); it.increment(error)) {
+        if (!it->is_regular_file() || !READERS.count(lower_extension(it->path()))) {
+            continue;
+        }
+
+        fs::path output = options.output_dir / fs::relative(it->path(), options.input_dir);
+        output.replace_extension(options.raw ? ".SBC" : ".LTS");
+
+        std::error_code missing;
+        const auto output_time = fs::last_write_time(output, missing);
+        if (!options.force && !missing && output_time >= it->last_write_time()) {
+            totals.skipped++;
+            continue;
+        }
+        files.push_back({ it->path(), output, it->file_size() });
+    }
+    if (error) {
+        std::fprintf(stderr, "%s: %s\n", options.input_dir.c_str(), error.message().c_str());
+        return 1;
+    }
+
+    // owners take from the back: each worker starts on its largest files
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.size < b.size; });
+
+    const unsigned threads = options.jobs ? options.jobs : std::max(std::thread::hardware_concurrency(), 1u);
+    std::printf("%zu files to convert (%u up to date) on %u threads\n",
+        files.size(), totals.skipped.load(), threads);
+
+    std::vector<WorkPool::Job> jobs;
+    std::atomic<unsigned> done{0};
+    for (const File& file : files) {
+        jobs.push_back([&, file] {
+            std::string summary;
+            uint64_t duration_ms = 0;
+            const std::string failure = convert(options, budget.get(), file.input, file.output, summary, duration_ms);
+
+            std::lock_guard<std::mutex> lock(print_mutex);
+            const unsigned index = ++done;
+            if (failure.empty()) {
+                totals.converted++;
+                totals.audio_ms += duration_ms;
+                std::printf("[%u/%zu] %s: %s\n", index, files.size(), file.output.c_str(), summary.c_str());
+            }
+            else {
+                totals.failed++;
+                std::printf("[%u/%zu] %s: FAILED, %s\n", index, files.size(), file.input.c_str(), failure.c_str());
+            }
+            std::fflush(stdout);
+        });
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    WorkPool(threads).run(std::move(jobs));
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%u converted, %u up to date, %u failed in %.1f s (%.0fx real time)\n",
+        totals.converted.load(), totals.skipped.load(), totals.failed.load(), elapsed,
+        elapsed > 0 ? totals.audio_ms / 1000.0 / elapsed : 0.0);
+
+    return totals.failed ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * NVIC priorities, Cortex-M0+ has 4 levels and lower value preempts higher.
+ */
+namespace IrqPriority {
+    // power fail handling must preempt everything else
+    constexpr uint32_t POWER_FAIL = 0;
+    // audio DMA half / transfer complete, never delayed by other handlers
+    constexpr uint32_t AUDIO = 1;
+    // buttons and light sensor: handlers only post controller events,
+    // shared level keeps them from preempting each other (single queue producer)
+    constexpr uint32_t EVENTS = 2;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/**
+ * LooTunes stream (.LTS), SBC frames laid out for the player
+ *
+ * The first sector holds the header, frames follow from LTS_HEADER_SIZE.
+ * Each 512 bytes sector carries `frames_per_sector` frames and is padded
+ * after them, so no frame crosses a sector boundary and the player decodes
+ * frames in place from its sector buffer. All frames are coded with the
+ * parameters of `sbc_header`, nothing is probed while playing.
+ *
+ * Multi-bytes fields are little endian.
+ */
+
+#ifndef __LTS_H
+#define __LTS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+#define LTS_MAGIC         "LTS1"
+#define LTS_VERSION       ( 1)
+
+#define LTS_SECTOR_SIZE   (512)
+#define LTS_HEADER_SIZE   LTS_SECTOR_SIZE
+
+#define LTS_GAIN_UNITY    (0x8000)
+
+
+/**
+ * Stream header, rest of the header sector is zero
+ */
+
+struct lts_header
+{
+    char magic[4];              /* LTS_MAGIC, not terminated */
+    uint8_t version;            /* LTS_VERSION */
+    uint8_t frames_per_sector;
+    uint16_t frame_size;        /* bytes of a frame, without padding */
+
+    uint8_t sbc_header[4];      /* header of the frames (codec parameters) */
+    uint32_t frame_count;
+
+    uint16_t gain;              /* track gain, Q15 up to LTS_GAIN_UNITY, 0 when not set */
+    uint16_t rewind_s;          /* seconds resumed playback goes back, 0: none */
+    uint32_t reserved[3];
+};
+
+/**
+ * Offset of a frame in the stream
+ * header          Stream header
+ * index           Frame index, `frame_count` gives the end of the stream
+ * return          Byte offset in the file
+ */
+static inline uint32_t lts_frame_offset(const struct lts_header *header, uint32_t index)
+{
+    return LTS_HEADER_SIZE + (index / header->frames_per_sector) * LTS_SECTOR_SIZE
+        + (index % header->frames_per_sector) * header->frame_size;
+}
+
+/**
+ * Frame at an offset of the stream
+ * header          Stream header
+ * offset          Byte offset in the file, inside a frame or its padding
+ * return          Index of the frame, next one in padding
+ */
+static inline uint32_t lts_frame_index(const struct lts_header *header, uint32_t offset)
+{
+    if (offset < LTS_HEADER_SIZE)
+        return 0;
+
+    offset -= LTS_HEADER_SIZE;
+    return (offset / LTS_SECTOR_SIZE) * header->frames_per_sector
+        + (offset % LTS_SECTOR_SIZE) / header->frame_size;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LTS_H */
@@ -123,19 +123,61 @@ struct sbc_frame
 struct sbc_dstate
 {
     int idx;
+    int nzero;  /* consecutive all-zero blocks, up to the 10 of history */
     int16_t alignas(sizeof(int)) v[2][SBC_MAX_SUBBANDS][10];
 };
 
+struct sbc_gain;
+struct sbc_eq;
+
 typedef struct sbc
 {
     int nchannels;
     int nblocks, nsubbands;
 
+    struct sbc_gain *gain;
+    const struct sbc_eq *eq;
+
     struct sbc_dstate dstates[2];
 
 } sbc_t;
 
 
+/**
+ * Output gain, applied by the synthesis
+ * Level and target are Q15 in the upper half-word (SBC_GAIN_UNITY at most),
+ * the lower half-word keeps the fraction of ramps. Each block moves level
+ * linearly towards target, by at most rate per sample. Rate is limited to
+ * SBC_GAIN_RATE_MAX, full range within two blocks.
+ */
+
+struct sbc_gain
+{
+    uint32_t level;
+    uint32_t target;
+    uint32_t rate;
+};
+
+#define SBC_GAIN_UNITY      (0x8000u << 16)
+#define SBC_GAIN_RATE_MAX   (SBC_GAIN_UNITY / (2 * SBC_MAX_SUBBANDS))
+
+
+/**
+ * Sub-band equaliser, applied to the dequantized samples
+ * Gains are Q15 fractions of 2^headroom (0x8000 is 2^headroom), by
+ * sub-band of 4 and 8 sub-bands frames. The samples scale drops by
+ * headroom, so boosted sub-bands keep within 16 bits.
+ */
+
+struct sbc_eq
+{
+    int enabled;
+    int headroom;
+    uint16_t gain4[4];
+    uint16_t gain8[8];
+};
+
+
 /**
  * Return the sampling frequency in Hz
  * freq            The frequency enum value
@@ -163,6 +205,20 @@ unsigned sbc_get_frame_bitrate(const struct sbc_frame *frame);
  */
 void sbc_reset(sbc_t *sbc);
 
+/**
+ * Set output gain of the context, kept by the caller
+ * sbc             Decoding context
+ * gain            Output gain, advanced by sbc_decode(), NULL for unity
+ */
+void sbc_set_gain(sbc_t *sbc, struct sbc_gain *gain);
+
+/**
+ * Set sub-band equaliser of the context, kept by the caller
+ * sbc             Decoding context
+ * eq              Equaliser, NULL for none
+ */
+void sbc_set_eq(sbc_t *sbc, const struct sbc_eq *eq);
+
 /**
  * Probe the data and return frame description
  * data            Data pointer with at least ̀`SBC_PROBE_SIZE` bytes
@@ -181,6 +237,7 @@ int sbc_probe(const void *data, struct sbc_frame *frame);
  * return          0 on success, -1 otherwise
  *
  * `data` can be NULL to enable PLC emulation
+ * `pcmr` can be NULL to get stereo frames downmixed to mono in `pcml`
  */
 int sbc_decode(sbc_t *sbc,
     const void *data, unsigned size, struct sbc_frame *frame,
@@ -36,10 +36,10 @@
  */
 
 void sbc_synthesize_4(struct sbc_dstate *state,
-    const int16_t *in, int scale, int16_t *out);
+    const int16_t *in, int scale, int16_t *out, uint32_t gain, uint32_t end);
 
 void sbc_synthesize_8(struct sbc_dstate *state,
-    const int16_t *in, int scale, int16_t *out);
+    const int16_t *in, int scale, int16_t *out, uint32_t gain, uint32_t end);
 
 #ifndef SBC_ASM
 #define ASM(fn) (fn##_c)
@@ -296,6 +296,22 @@ void sbc_reset(struct sbc *sbc)
     *sbc = (struct sbc){ };
 }
 
+/**
+ * Set output gain
+ */
+void sbc_set_gain(struct sbc *sbc, struct sbc_gain *gain)
+{
+    sbc->gain = gain;
+}
+
+/**
+ * Set sub-band equaliser
+ */
+void sbc_set_eq(struct sbc *sbc, const struct sbc_eq *eq)
+{
+    sbc->eq = eq;
+}
+
 
 /* ----------------------------------------------------------------------------
  *  Decoding
@@ -372,9 +388,11 @@ static __attribute__((always_inline)) inline bool decode_header(sbc_bits_t *bits
  * frame           Frame description
  * sb_samples      Return the sub-band samples, by channels
  * sb_scale        Return the sample scaler, by track (indep. channels)
+ * downmix         Return mono (L + R) / 2 of stereo frames as channel 0
+ * output_eq       Sub-band gains applied when enabled, NULL for none
  */
 static __attribute__((always_inline)) inline void decode_frame(sbc_bits_t *bits, const struct sbc_frame *frame,
-    int16_t (*sb_samples)[SBC_MAX_SAMPLES], int *sb_scale)
+    int16_t (*sb_samples)[SBC_MAX_SAMPLES], int *sb_scale, int downmix, const struct sbc_eq *output_eq)
 {
     static const int range_scale[] = {
         0xFFFFFFF, 0x5555556, 0x2492492, 0x1111111,
@@ -458,10 +476,29 @@ static __attribute__((always_inline)) inline void decode_frame(sbc_bits_t *bits,
         sb_scale[0] = sb_scale[1] =
             sb_scale[0] < sb_scale[1] ? sb_scale[0] : sb_scale[1];
 
+    /* Channel without bits (silence, low bitpool) is all zero, and
+     * there is nothing to read for it */
+
+    int silent[2] = { 1, 1 };
+
+    const uint16_t *eq = !output_eq || !output_eq->enabled ? NULL :
+        nsubbands == 4 ? output_eq->gain4 : output_eq->gain8;
+
+    for (int ich = 0; ich < nchannels; ich++) {
+        for (int isb = 0; isb < nsubbands; isb++)
+            silent[ich] &= !nbits[ich][isb];
+
+        if (silent[ich])
+            memset(sb_samples[ich], 0, frame->nblocks * nsubbands * sizeof(int16_t));
+    }
+
     for (int iblk = 0; iblk < frame->nblocks; iblk++)
         for (int ich = 0; ich < nchannels; ich++) {
             int16_t *p_sb_samples = sb_samples[ich] + iblk*nsubbands;
 
+            if (silent[ich])
+                continue;
+
             for (int isb = 0; isb < nsubbands; isb++) {
                 int nbit = nbits[ich][isb];
                 int scf = scale_factors[ich][isb];
@@ -471,11 +508,48 @@ static __attribute__((always_inline)) inline void decode_frame(sbc_bits_t *bits,
                 int s = SBC_GET_BITS("audio_sample", nbit);
                 s = ((s << 1) | 1) * range_scale[nbit-1];
 
-                *(p_sb_samples++) =
-                    (s - (1 << 28)) >> (28 - ((scf + 1) + sb_scale[ich]));
+                s = (s - (1 << 28)) >> (28 - ((scf + 1) + sb_scale[ich]));
+                if (eq) s = (s * eq[isb]) >> 15;
+
+                *(p_sb_samples++) = s;
             }
         }
 
+    /* Equalised samples are on 2^headroom coarser scale */
+
+    if (eq) {
+        sb_scale[0] -= output_eq->headroom;
+        sb_scale[1] -= output_eq->headroom;
+    }
+
+    /* --- Downmix to mono ---
+     *
+     * Synthesis is linear, so (L + R) / 2 of the sub-band samples gives the
+     * mono output with one synthesis. Coupled sub-bands carry it as channel
+     * 0 samples already, others are summed on the scale of the coarser
+     * channel. */
+
+    if (downmix && nchannels == 2) {
+        int scale = sb_scale[0] < sb_scale[1] ? sb_scale[0] : sb_scale[1];
+        int shr0 = sb_scale[0] - scale, shr1 = sb_scale[1] - scale;
+
+        for (int isb = 0; isb < nsubbands; isb++) {
+
+            if ((mjoint >> isb) & 1)
+                continue;
+
+            for (int iblk = 0; iblk < frame->nblocks; iblk++) {
+                int16_t *s0 = &sb_samples[0][iblk*nsubbands + isb];
+                int16_t s1 = sb_samples[1][iblk*nsubbands + isb];
+
+                *s0 = ((*s0 >> shr0) + (s1 >> shr1)) >> 1;
+            }
+        }
+
+        sb_scale[0] = scale;
+        mjoint = 0; /* nothing to uncouple */
+    }
+
     /* --- Uncoupling "Joint-Stereo" ---
      *
      * The `Left/Right` samples are coded as :
@@ -629,23 +703,20 @@ static __attribute__((always_inline)) inline void dct8(const int16_t *in, int sc
     ( (v) > (272*4) ? (272*4) : (v))
 
 
-extern volatile uint8_t VolumeShift;
-
 /**
  * Apply window on reconstructed samples
  * in, n           Reconstructed samples and number of subbands
  * window          Window coefficients
  * offset          Offset of coefficients for each samples
  * out             Output adress of PCM samples
- * pitch           Number of PCM samples between two consecutive
+ * gain, step      Gain of first sample (struct sbc_gain level) and its
+ *                 increment per sample
  */
 static __attribute__((always_inline)) inline void apply_window(const int16_t (*in)[10], int n,
-    const int16_t (*window)[2*10], int offset, int16_t *out)
+    const int16_t (*window)[2*10], int offset, int16_t *out, uint32_t gain, int32_t step)
 {
     const int16_t *u = (const int16_t *)in;
 
-    const uint8_t shift = VolumeShift; // make sure it's only read once
-
     for (int i = 0; i < n; i++) {
         const int16_t *w = window[i] + offset;
         int s;
@@ -656,20 +727,90 @@ static __attribute__((always_inline)) inline void apply_window(const int16_t (*i
         s += *(u++) * *(w++);  s += *(u++) * *(w++);
         s += *(u++) * *(w++);  s += *(u++) * *(w++);
 
-        *out = SAMPLE_SAT((SBC_SAT16((s + (1 << 12)) >> 13) >> 6 >> shift) + (136*4));  out += 1;
+        /* Q15 gain, folded into the >> 6 to PWM range */
+        s = SBC_SAT16((s + (1 << 12)) >> 13) * (int)(gain >> 16);
+        *out = SAMPLE_SAT((s >> (15 + 6)) + (136*4));  out += 1;
+        gain += step;
     }
 }
 
+/**
+ * Check sub-band samples of a block
+ * in, n           Sub-band samples and number of subbands
+ * return          True when all are zero
+ */
+static __attribute__((always_inline)) inline int zero_block(const int16_t *in, int n)
+{
+    int x = in[0] | in[1] | in[2] | in[3];
+
+    if (n == 8)
+        x |= in[4] | in[5] | in[6] | in[7];
+
+    return x == 0;
+}
+
+/**
+ * Store the DCT of an all-zero block, what dct4 / dct8 give without the
+ * multiplications
+ * out0, out1      Output of 1st and 2nd half samples
+ * idx, n          Index of transformed samples and number of subbands
+ */
+static __attribute__((always_inline)) inline void zero_dct(
+    int16_t (*out0)[10], int16_t (*out1)[10], int idx, int n)
+{
+    for (int i = 0; i < n; i++)
+        out0[i][idx] = out1[i][idx] = 0;
+}
+
+/**
+ * Transform and window a block, or take the fast paths
+ * An all-zero block skips the DCT. Once the whole 10 blocks history is
+ * zero, the window gives the PWM midpoint at any gain, so it is skipped
+ * too. Both paths are bit-exact with the full one.
+ * state           Previous transformed samples of the channel
+ * in, n           Sub-band samples and number of subbands
+ * scale           Scale factor of samples
+ * out             Output adress of PCM samples
+ * gain, end       Gain at first sample and after the block
+ * window          Windowing coefficients
+ */
+static __attribute__((always_inline)) inline void synthesize_block(struct sbc_dstate *state,
+    const int16_t *in, int n, int scale, int16_t *out, uint32_t gain, uint32_t end,
+    const int16_t (*window)[2*10])
+{
+    int dct_idx = state->idx ? 10 - state->idx : 0, odd = dct_idx & 1;
+
+    if (zero_block(in, n)) {
+        zero_dct(state->v[odd], state->v[!odd], dct_idx, n);
+        state->nzero = state->nzero < 10 ? state->nzero + 1 : 10;
+    } else {
+        if (n == 4)
+            dct4(in, scale, state->v[odd], state->v[!odd], dct_idx);
+        else
+            dct8(in, scale, state->v[odd], state->v[!odd], dct_idx);
+        state->nzero = 0;
+    }
+
+    if (state->nzero < 10)
+        apply_window(state->v[odd], n, window, state->idx, out,
+            gain, (int32_t)(end - gain) >> (n == 4 ? 2 : 3));
+    else
+        for (int i = 0; i < n; i++)
+            out[i] = 136*4;
+
+    state->idx = state->idx < 9 ? state->idx + 1 : 0;
+}
+
 /**
  * Synthesize samples of a 4 subbands block
  * state           Previous transformed samples of the channel
  * in              Sub-band samples
  * scale           Scale factor of samples
  * out             Output adress of PCM samples
- * pitch           Number of samples between two consecutive
+ * gain, end       Gain at first sample and after the block
  */
 static __attribute__((always_inline)) inline void sbc_synthesize_4_c(struct sbc_dstate *state,
-    const int16_t *in, int scale, int16_t *out)
+    const int16_t *in, int scale, int16_t *out, uint32_t gain, uint32_t end)
 {
     /* --- Windowing coefficients (fixed 2.13) ---
      *
@@ -692,12 +833,7 @@ static __attribute__((always_inline)) inline void sbc_synthesize_4_c(struct sbc_
 
     /* --- IDCT and windowing --- */
 
-    int dct_idx = state->idx ? 10 - state->idx : 0, odd = dct_idx & 1;
-
-    dct4(in, scale, state->v[odd], state->v[!odd], dct_idx);
-    apply_window(state->v[odd], 4, window, state->idx, out);
-
-    state->idx = state->idx < 9 ? state->idx + 1 : 0;
+    synthesize_block(state, in, 4, scale, out, gain, end, window);
 }
 
 /**
@@ -706,10 +842,10 @@ static __attribute__((always_inline)) inline void sbc_synthesize_4_c(struct sbc_
  * sb_samples      Sub-band samples
  * sb_scale        Scale factor of samples (-2 to 14)
  * out             Output adress of PCM samples
- * pitch           Number of PCM samples between two consecutive
+ * gain, end       Gain at first sample and after the block
  */
 static __attribute__((always_inline)) inline void sbc_synthesize_8_c(struct sbc_dstate *state,
-    const int16_t *in, int scale, int16_t *out)
+    const int16_t *in, int scale, int16_t *out, uint32_t gain, uint32_t end)
 {
     /* --- Windowing coefficients (fixed 2.13) ---
      *
@@ -744,12 +880,24 @@ static __attribute__((always_inline)) inline void sbc_synthesize_8_c(struct sbc_
 
     /* --- IDCT and windowing --- */
 
-    int dct_idx = state->idx ? 10 - state->idx : 0, odd = dct_idx & 1;
+    synthesize_block(state, in, 8, scale, out, gain, end, window);
+}
 
-    dct8(in, scale, state->v[odd], state->v[!odd], dct_idx);
-    apply_window(state->v[odd], 8, window, state->idx, out);
+/**
+ * Gain after a block of n samples
+ * output_gain     Target and rate of the ramp
+ * gain            Gain at first sample of the block
+ * n               Number of samples, rate limits the change
+ */
+static inline uint32_t gain_after(const struct sbc_gain *output_gain, uint32_t gain, int n)
+{
+    const uint32_t target = output_gain->target;
+    const uint32_t max_step = output_gain->rate * n;
 
-    state->idx = state->idx < 9 ? state->idx + 1 : 0;
+    if (gain < target)
+        return target - gain > max_step ? gain + max_step : target;
+
+    return gain - target > max_step ? gain - max_step : target;
 }
 
 /**
@@ -760,22 +908,30 @@ static __attribute__((always_inline)) inline void sbc_synthesize_8_c(struct sbc_
  * in              Sub-band input samples
  * scale           Scale factor of samples
  * out             Output adress of PCM samples
- * pitch           Number of PCM samples between two consecutive
+ * output_gain     Target and rate of the ramp
+ * gain            Gain at first sample
+ * return          Gain after the last sample
  */
-static __attribute__((always_inline)) inline void synthesize(
+static __attribute__((always_inline)) inline uint32_t synthesize(
     struct sbc_dstate *state, int nblocks, int nsubbands,
-    const int16_t *in, int scale, int16_t *out)
+    const int16_t *in, int scale, int16_t *out,
+    const struct sbc_gain *output_gain, uint32_t gain)
 {
     for (int iblk = 0; iblk < nblocks; iblk++) {
 
+        const uint32_t end = gain_after(output_gain, gain, nsubbands);
+
         if (nsubbands == 4)
-            ASM(sbc_synthesize_4)(state, in, scale, out);
+            ASM(sbc_synthesize_4)(state, in, scale, out, gain, end);
         else
-            ASM(sbc_synthesize_8)(state, in, scale, out);
+            ASM(sbc_synthesize_8)(state, in, scale, out, gain, end);
 
+        gain = end;
         in += nsubbands;
         out += nsubbands;
     }
+
+    return gain;
 }
 
 /**
@@ -830,7 +986,7 @@ int sbc_decode(struct sbc *sbc,
             (void *)((uintptr_t)data + SBC_HEADER_SIZE),
             sbc_get_frame_size(frame) - SBC_HEADER_SIZE);
         
-        decode_frame(&bits, frame, sb_samples, sb_scale);
+        decode_frame(&bits, frame, sb_samples, sb_scale, !pcmr, sbc->eq);
 
         sbc->nchannels = 1 + (frame->mode != SBC_MODE_MONO);
         sbc->nblocks = frame->nblocks;
@@ -846,12 +1002,22 @@ int sbc_decode(struct sbc *sbc,
         }
     }
 
-    synthesize(&sbc->dstates[0], sbc->nblocks, sbc->nsubbands,
-        sb_samples[0], sb_scale[0], pcml);
+    /* both channels get the same gain ramp */
+
+    static const struct sbc_gain unity = {
+        SBC_GAIN_UNITY, SBC_GAIN_UNITY, SBC_GAIN_RATE_MAX };
+    const struct sbc_gain *output_gain = sbc->gain ? sbc->gain : &unity;
+    const uint32_t gain = output_gain->level;
 
-    if (frame->mode != SBC_MODE_MONO)
+    const uint32_t end = synthesize(&sbc->dstates[0], sbc->nblocks, sbc->nsubbands,
+        sb_samples[0], sb_scale[0], pcml, output_gain, gain);
+
+    if (frame->mode != SBC_MODE_MONO && pcmr)
         synthesize(&sbc->dstates[1], sbc->nblocks, sbc->nsubbands,
-            sb_samples[1], sb_scale[1], pcmr);
+            sb_samples[1], sb_scale[1], pcmr, output_gain, gain);
+
+    if (sbc->gain)
+        sbc->gain->level = end;
 
 
     return 0;
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+/*
+ * Packs an SBC bitstream into a LooTunes stream (.LTS, see lts.h): header
+ * sector, then frames padded so none crosses a sector boundary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include <sbc.h>
+#include <lts.h>
+
+
+/**
+ * Error handling
+ */
+
+static void error(int status, const char *format, ...)
+{
+    va_list args;
+
+    fflush(stdout);
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fprintf(stderr, status ? ": %s\n" : "\n", strerror(status));
+    exit(status);
+}
+
+
+/**
+ * Parameters
+ */
+
+struct parameters {
+    const char *fname_in;
+    const char *fname_out;
+    double gain_db;
+    int has_gain;
+    int rewind_s;
+};
+
+static struct parameters parse_args(int argc, char *argv[])
+{
+    static const char *usage =
+        "Usage: %s [options] [sbc_file] [lts_file]\n"
+        "\n"
+        "sbc_file\t"  "Input bitstream file, stdin if omitted\n"
+        "lts_file\t"  "Output stream file, stdout if omitted\n"
+        "\n"
+        "Options:\n"
+        "\t-h\t"     "Display help\n"
+        "\t-g\t"     "Track gain in dB (0 or less)\n"
+        "\t-r\t"     "Seconds resumed playback goes back\n"
+        "\n";
+
+    struct parameters p = { };
+
+    for (int iarg = 1; iarg < argc; ) {
+        const char *arg = argv[iarg++];
+
+        if (arg[0] == '-' && arg[1] != '\0') {
+            if (arg[2] != '\0')
+                error(EINVAL, "Option %s", arg);
+
+            char opt = arg[1];
+            const char *optarg = NULL;
+
+            switch (opt) {
+                case 'g': case 'r':
+                    if (iarg >= argc)
+                        error(EINVAL, "Argument %s", arg);
+                    optarg = argv[iarg++];
+            }
+
+            switch (opt) {
+                case 'h': fprintf(stderr, usage, argv[0]); exit(0);
+                case 'g': p.gain_db = atof(optarg); p.has_gain = 1; break;
+                case 'r': p.rewind_s = atoi(optarg); break;
+                default:
+                    error(EINVAL, "Option %s", arg);
+            }
+
+        } else {
+
+            if (!p.fname_in)
+                p.fname_in = arg;
+            else if (!p.fname_out)
+                p.fname_out = arg;
+            else
+                error(EINVAL, "Argument %s", arg);
+        }
+    }
+
+    if (p.gain_db > 0)
+        error(EINVAL, "Gain %g dB", p.gain_db);
+
+    if (p.rewind_s < 0 || p.rewind_s > UINT16_MAX)
+        error(EINVAL, "Rewind %d s", p.rewind_s);
+
+    return p;
+}
+
+
+/**
+ * Store 16 / 32 bits little endian
+ */
+
+static void put16(uint8_t *p, unsigned v)
+{
+    p[0] = v & 0xff; p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v & 0xffff); put16(p + 2, v >> 16);
+}
+
+
+/**
+ * Entry point
+ */
+int main(int argc, char *argv[])
+{
+    /* --- Read parameters --- */
+
+    struct parameters p = parse_args(argc, argv);
+    FILE *fp_in = stdin, *fp_out = stdout;
+
+    if (p.fname_in && (fp_in = fopen(p.fname_in, "rb")) == NULL)
+        error(errno, "%s", p.fname_in);
+
+    if (p.fname_out && (fp_out = fopen(p.fname_out, "wb")) == NULL)
+        error(errno, "%s", p.fname_out);
+
+    /* --- Check the stream --- */
+
+    uint8_t data[2*SBC_MAX_SAMPLES*sizeof(int16_t)];
+    struct sbc_frame frame;
+
+    if (fread(data, SBC_PROBE_SIZE, 1, fp_in) < 1
+            || sbc_probe(data, &frame) < 0)
+        error(EINVAL, "SBC input file format");
+
+    const uint8_t sbc_header[SBC_HEADER_SIZE] = {
+        data[0], data[1], data[2], data[3] };
+
+    unsigned frame_size = sbc_get_frame_size(&frame);
+    unsigned frames_per_sector = LTS_SECTOR_SIZE / frame_size;
+
+    /* --- Frames, header goes first once they are counted --- */
+
+    uint8_t sector[LTS_SECTOR_SIZE] = { };
+
+    if (fseek(fp_out, LTS_HEADER_SIZE, SEEK_SET) != 0)
+        error(errno, "Output must be seekable");
+
+    uint32_t nframes = 0;
+    unsigned fill = 0;
+
+    for (int i = 0; i == 0 || (fread(data, SBC_PROBE_SIZE, 1, fp_in) >= 1); i++) {
+
+        /* codec parameters can't change within the stream (sync,
+         * configuration and bitpool bytes, the last one is CRC) */
+
+        if (memcmp(data, sbc_header, 3) != 0)
+            error(EINVAL, "Frame %u: parameters change", nframes);
+
+        if (fread(data + SBC_PROBE_SIZE, frame_size - SBC_PROBE_SIZE, 1, fp_in) < 1)
+            break;
+
+        memcpy(sector + fill, data, frame_size);
+        fill += frame_size;
+        nframes++;
+
+        if (fill + frame_size > LTS_SECTOR_SIZE) {
+            memset(sector + fill, 0, LTS_SECTOR_SIZE - fill);
+            fwrite(sector, LTS_SECTOR_SIZE, 1, fp_out);
+            fill = 0;
+        }
+    }
+
+    /* last sector isn't padded, the file ends with the last frame */
+
+    if (fill)
+        fwrite(sector, fill, 1, fp_out);
+
+    /* --- Header --- */
+
+    uint8_t header[LTS_HEADER_SIZE] = { };
+    long gain = p.has_gain ? lround(0x8000 * pow(10, p.gain_db / 20)) : 0;
+
+    if (p.has_gain && gain < 1)
+        gain = 1;
+
+    memcpy(header + 0, LTS_MAGIC, 4);
+    header[4] = LTS_VERSION;
+    header[5] = frames_per_sector;
+    put16(header + 6, frame_size);
+    memcpy(header + 8, sbc_header, SBC_HEADER_SIZE);
+    put32(header + 12, nframes);
+    put16(header + 16, gain);
+    put16(header + 18, p.rewind_s);
+
+    rewind(fp_out);
+    if (fwrite(header, sizeof(header), 1, fp_out) < 1)
+        error(errno, "%s", p.fname_out ? p.fname_out : "stdout");
+
+    fprintf(stderr, "%u frames of %u bytes, %u per sector (%.1f%% padding)\n",
+        nframes, frame_size, frames_per_sector,
+        100.0 * (LTS_SECTOR_SIZE - frames_per_sector * frame_size) / LTS_SECTOR_SIZE);
+
+    /* --- Cleanup --- */
+
+    if (fp_in != stdin)
+        fclose(fp_in);
+
+    if (fp_out != stdout)
+        fclose(fp_out);
+}
@@ -37,5 +37,14 @@ dsbc_ldlibs += m
 $(eval $(call add-bin,dsbc))
 
 
+ltspack_src += \
+    $(TOOLS_DIR)/ltspack.c
+
+ltspack_lib += libsbc
+ltspack_ldlibs += m
+
+$(eval $(call add-bin,ltspack))
+
+
 .PHONY: tools
-tools: esbc dsbc
+tools: esbc dsbc ltspack
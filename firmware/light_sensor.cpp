@@ -6,9 +6,66 @@
 */
 
 #include "light_sensor.h"
+#include "irq_priority.h"
+
+namespace {
+    // LSI / 128 = 256 Hz LPTIM clock
+    constexpr uint32_t LPTIM_PRESCALER = 7;
+    constexpr uint32_t LPTIM_HZ = LSI_VALUE >> LPTIM_PRESCALER;
+
+    // averaging window covers one second, power of two
+    constexpr uint32_t AVERAGE_SAMPLES = 4;
+    static_assert((AVERAGE_SAMPLES & (AVERAGE_SAMPLES - 1)) == 0);
+
+    // filtered value has to be outside window this many samples in a row (hysteresis in time,
+    // thresholds themselves give the one in level)
+    constexpr uint32_t CONFIRM_SAMPLES = 2;
+
+    uint16_t raw[3];                        // last readings, for median
+    uint16_t medians[AVERAGE_SAMPLES];
+    uint32_t median_sum = 0;
+    uint32_t sample_count = 0;
+    uint32_t outside_count = 0;
+
+    volatile uint32_t window = 0xFFFu << 16; // high << 16 | low, one write as interrupt reads it
+    volatile bool armed = true;
+    bool booted = false; // started since reset
+
+    uint16_t median3(uint16_t a, uint16_t b, uint16_t c) {
+        if (a > b) {
+            const uint16_t t = a;
+            a = b;
+            b = t;
+        }
+        // a <= b
+        return c < a ? a : (c > b ? b : c);
+    }
+
+    uint16_t filter(uint16_t value) {
+        if (sample_count == 0) {
+            // first reading after start fills the history, so decision doesn't wait for it
+            raw[0] = raw[1] = raw[2] = value;
+            for (uint16_t& m : medians) {
+                m = value;
+            }
+            median_sum = value * AVERAGE_SAMPLES;
+        }
+
+        raw[sample_count % 3] = value;
+        const uint16_t median = median3(raw[0], raw[1], raw[2]);
+
+        uint16_t& oldest = medians[sample_count & (AVERAGE_SAMPLES - 1)];
+        median_sum += median - oldest;
+        oldest = median;
+        sample_count++;
+
+        return median_sum / AVERAGE_SAMPLES;
+    }
+}
 
 void LIGHT::init() {
     __HAL_RCC_ADC_CLK_ENABLE();
+    __HAL_RCC_LPTIM_CLK_ENABLE();
 
     stop();
 
@@ -18,19 +75,24 @@ void LIGHT::init() {
     // wait for calibration to complete
     while (ADC1->CR & ADC_CR_ADCAL);
 
-
+    NVIC_SetPriority(ADC_COMP_IRQn, IrqPriority::EVENTS);
     NVIC_EnableIRQ(ADC_COMP_IRQn);
 
-    // analog watchdog on ADC1, channel 5 (PA5)
-    ADC1->CFGR1 = ADC_CFGR1_CONT | ADC_CFGR1_OVRMOD | ADC_CFGR1_AWDEN | ADC_CFGR1_AWDSGL | ADC_CFGR1_AWDCH_0 | ADC_CFGR1_AWDCH_2;
+    // single conversion on software start
+    ADC1->CFGR1 = ADC_CFGR1_OVRMOD;
 
     ADC1->SMPR = ADC_SMPR_SMP_2 | ADC_SMPR_SMP_1 | ADC_SMPR_SMP_0; // set sampling time to 239.5 cycles (ADC_SMPR_SMP_2 | ADC_SMPR_SMP_1 | ADC_SMPR_SMP_0)
 
-    ADC1->IER = ADC_IER_AWDIE; // enable ADC interrupt for analog watchdog
+    ADC1->IER = ADC_IER_EOCIE; // interrupt at end of conversion
+
+    // sampling timer, configuration registers are written while it's disabled
+    __HAL_RCC_LPTIM_CONFIG(RCC_LPTIMCLKSOURCE_LSI);
+    LPTIM->CFGR = LPTIM_PRESCALER << LPTIM_CFGR_PRESC_Pos;
+    LPTIM->IER = LPTIM_IER_ARRMIE;
+    EXTI->IMR |= EXTI_IMR_IM29; // LPTIM wakes the core from Stop mode
 
-    set_thresholds(0x000, 0xFFF); // set initial thresholds for analog watchdog
-    // start ADC conversion
-    ADC1->CR |= ADC_CR_ADSTART;
+    NVIC_SetPriority(LPTIM1_IRQn, IrqPriority::EVENTS);
+    NVIC_EnableIRQ(LPTIM1_IRQn);
 }
 
 void LIGHT::start() {
@@ -42,13 +104,24 @@ void LIGHT::start() {
     ADC1->CR |= ADC_CR_ADEN; // enable ADC
 
     while (!(ADC1->CR & ADC_CR_ADEN));
-    
-    // wait for ADC to stabilize
-    //HAL_Delay(1); // allow some time for the ADC to stabilize after enabling
-    ADC1->CR |= ADC_CR_ADSTART; // start ADC conversion
+
+    sample_count = 0;
+    // nothing to debounce against at boot, first reading decides so sound doesn't wait a
+    // period; starts after a forced mode are confirmed as usual
+    outside_count = booted ? 0 : CONFIRM_SAMPLES - 1;
+    booted = true;
+
+    // LPTIM only has single mode here, interrupt handler starts every next period
+    LPTIM->CR = LPTIM_CR_ENABLE;
+    LPTIM->ARR = LPTIM_HZ / SAMPLE_HZ - 1;
+    LPTIM->CR = LPTIM_CR_ENABLE | LPTIM_CR_SNGSTRT;
+
+    ADC1->CR |= ADC_CR_ADSTART; // first reading right away
 }
 
 void LIGHT::stop() {
+    LPTIM->CR = 0;
+
     if ((ADC1->CR & ADC_CR_ADEN) != 0) {
 
         if (ADC1->CR & ADC_CR_ADSTART) {
@@ -64,30 +137,41 @@ void LIGHT::stop() {
 }
 
 void LIGHT::set_thresholds(uint16_t low, uint16_t high) {
-    // check if thresholds currently set are the same
-    if ((ADC1->TR & (ADC_TR_HT_Msk | ADC_TR_LT_Msk)) == ((high << ADC_TR_HT_Pos) | (low << ADC_TR_LT_Pos))) {
-        return; // thresholds are already set, no need to change
-    }
+    window = (static_cast<uint32_t>(high) << 16) | low;
+    outside_count = 0;
+}
 
-    bool started = (ADC1->CR & ADC_CR_ADSTART) != 0;
-    
-    if (started) {
-        stop();
-    }
+void LIGHT::arm() {
+    armed = true;
+}
 
-    ADC1->TR = (high << ADC_TR_HT_Pos) | (low << ADC_TR_LT_Pos);
-    if (started) { // restore ADC state
-        start();
+bool LIGHT::busy() {
+    return (ADC1->CR & ADC_CR_ADSTART) != 0;
+}
+
+// sampling period elapsed
+void LPTIM1_IRQHandler(void) {
+    if (LPTIM->ISR & LPTIM_ISR_ARRM) {
+        LPTIM->ICR = LPTIM_ICR_ARRMCF;
+        LPTIM->CR = LPTIM_CR_ENABLE | LPTIM_CR_SNGSTRT;
+        ADC1->CR |= ADC_CR_ADSTART; // one conversion, ends in ADC interrupt
     }
 }
 
 // interrupt
 void ADC_COMP_IRQHandler(void) {
-    if (ADC1->ISR & ADC_ISR_AWD) {
-        // Analog watchdog triggered
-        const uint32_t adc_value = ADC1->DR; // read the ADC data register
-        // callback is supposed to change thresholds so interrupt won't trigger immediately again
-        LightSensorCallback(adc_value);
-        ADC1->ISR |= ADC_ISR_AWD; // Clear the AWD flag
+    if (ADC1->ISR & ADC_ISR_EOC) {
+        const uint16_t value = filter(ADC1->DR);
+        ADC1->ISR = ADC_ISR_EOC | ADC_ISR_EOSEQ | ADC_ISR_OVR;
+
+        const uint32_t thresholds = window;
+        const bool outside = value < (thresholds & 0xFFFF) || value > (thresholds >> 16);
+        outside_count = outside ? outside_count + 1 : 0;
+
+        if (armed && outside_count >= CONFIRM_SAMPLES) {
+            // callback handler moves thresholds and re-arms
+            armed = false;
+            LightSensorCallback(value);
+        }
     }
 }
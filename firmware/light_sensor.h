@@ -14,13 +14,37 @@ extern "C" {
 #include "py32f0xx_hal.h"
 }
 
+/*
+ * Light sensor on PA5. LPTIM (LSI clock, keeps running in Stop mode) starts
+ * one ADC conversion a few times per second. Readings go through a median of
+ * three (spikes) and a moving average (mains flicker), the filtered value is
+ * compared against the threshold window in software.
+ */
 class LIGHT {
     public:
+    static constexpr uint32_t SAMPLE_HZ = 4;
+
     static void init();
+
+    /**
+     * @brief Set window, callback fires when filtered reading stays below low or above high
+     */
     static void set_thresholds(uint16_t low, uint16_t high);
     static void start();
     static void stop();
-    
+
+    /**
+     * @brief Enable callback, it's disabled by the interrupt handler after each
+     *        call until thresholds are updated
+     */
+    static void arm();
+
+    /**
+     * @brief Conversion in progress, ADC clock has to keep running (no Stop mode)
+     */
+    static bool busy();
+
 };
 
+// called from interrupt, no further calls until LIGHT::arm()
 void LightSensorCallback(uint16_t value);
@@ -16,6 +16,9 @@ extern "C" {
 #include "controller.h"
 #include "light_sensor.h"
 #include "random.h"
+#include "power.h"
+#include "boot.h"
+#include "trace.h"
 
 void SysTick_Handler(void) { HAL_IncTick(); }
 
@@ -69,12 +72,16 @@ int main() {
   HAL_SuspendTick();
   RAND::init();
   SystemClock_Config();
+  Boot::start();
+  Trace::init();
 
   GPIO::init();
   BTN::init();
   SPI::init();
   LIGHT::init();
+  PVD::init();
   Controller::init();
+  Boot::mark(Boot::Phase::Peripherals);
   
   while(1) {
   if (!Controller::main()) { // false = error caused by file system / sd card
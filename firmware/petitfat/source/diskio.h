@@ -25,6 +25,31 @@ typedef enum {
 } DRESULT;
 
 
+/* Read error recovery, steps taken since power on */
+typedef struct {
+	DWORD	retries;	/* transfer stopped, sector requested again */
+	DWORD	resyncs;	/* bus clocked idle with card deselected */
+	DWORD	reinits;	/* card initialized again, mount kept */
+	DWORD	remounts;	/* volume mounted again after all of the above failed */
+	BYTE	failed;		/* last read failed after all steps, cleared by disk_initialize */
+} DRECOVERY;
+
+extern DRECOVERY disk_recovery;
+
+/* Read timing of the card and the read-ahead picked from it */
+typedef struct {
+	BYTE	cid[16];	/* card identification register, profile belongs to this card */
+	BYTE	clock_div;	/* SPI clock fPCLK / (2 << clock_div), from CSD TRAN_SPEED */
+	BYTE	stream;		/* read ahead with CMD18 stream (1) or CMD17 single block (0) */
+	WORD	single_us;	/* CMD17 to data token, 0 until measured */
+	WORD	stream_us;	/* CMD18 to first data token */
+	WORD	gap_us;		/* between blocks of a stream */
+	WORD	stop_us;	/* CMD12 until the card releases DO */
+} DPROFILE;
+
+extern DPROFILE disk_profile;
+
+
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
@@ -32,11 +57,18 @@ typedef enum {
 
 DSTATUS disk_initialize (void);
 DRESULT disk_readp_ex (BYTE* buff, DWORD sector, DWORD next_sector, UINT offset, UINT count);
+const BYTE* disk_cached_sector (void);
 static inline DRESULT disk_readp (BYTE* buff, DWORD sector, UINT offset, UINT count) {
 	return disk_readp_ex(buff, sector, NO_SECTOR, offset, count);
 }
 
 DRESULT disk_writep (const BYTE* buff, DWORD sc);
+DRESULT disk_poll (void);
+int disk_busy (void);
+void disk_prefetch (DWORD sector);
+void disk_abort (void);
+void disk_suspend (void);
+DRESULT disk_calibrate (DWORD sector);	/* Firmware built with LOOTUNES_CARD_PROFILE only */
 
 #define STA_NOINIT		0x01	/* Drive not initialized */
 #define STA_NODISK		0x02	/* No medium in the drive */
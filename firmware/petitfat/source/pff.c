@@ -884,19 +884,6 @@ FRESULT pf_mount (
 	return FR_OK;
 }
 
-FRESULT pf_save_state(FATFS* fs)
-{
-	if (!FatFs) return FR_NOT_ENABLED;
-	memcpy(fs, FatFs, sizeof(FATFS));
-	return FR_OK;
-}
-
-FRESULT pf_restore_state(FATFS* fs)
-{
-	memcpy(FatFs, fs, sizeof(FATFS));
-	return FR_OK;
-}
-
 FRESULT pf_build_cluster_cache (
 	CLUST cluster,	/* Start cluster number */
 	DWORD fsize	/* File size */
@@ -908,6 +895,7 @@ FRESULT pf_build_cluster_cache (
 	if (cluster <= 1) ABORT(FR_DISK_ERR);
 
 	fs->fcurr_range = fs->fcrange;	/* Reset current cluster range */
+	fs->frange_pos = 0;
 
 	CRANGE *range = fs->fcrange;
 	range->cluster = cluster; /* Set start cluster */
@@ -920,6 +908,9 @@ FRESULT pf_build_cluster_cache (
 		if (range->cluster + range->remaining == cluster) { /* Same cluster? */
 			range->remaining++;
 		} else { /* New cluster */
+			if (range == &fs->fcrange[PF_CLUSTER_RANGES - 2]) { /* Last entry is the end mark */
+				ABORT(FR_FRAGMENTED);	/* Too fragmented, rest of the file isn't reachable */
+			}
 			range++;
 			range->cluster = cluster; /* Set new cluster */
 			range->remaining = 1;
@@ -960,7 +951,7 @@ FRESULT pf_open (
 
 	fs->org_clust = get_clust(dir);		/* File start cluster */
 	fs->fsize = ld_dword(dir+DIR_FileSize);	/* File size */
-	pf_build_cluster_cache(fs->org_clust, fs->fsize);
+	if (pf_build_cluster_cache(fs->org_clust, fs->fsize) == FR_FRAGMENTED) return FR_FRAGMENTED;
 	fs->fptr = 0;						/* File pointer */
 	fs->flag = FA_OPENED;
 
@@ -978,6 +969,7 @@ FRESULT pf_open_fileinfo(FILINFO *fno)
 
 	FATFS *fs = FatFs;
 
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system (remount may have failed) */
 	res = dir_read(&dj, dir);	/* Get current directory item */
 	if (res != FR_OK) return res;
 
@@ -985,7 +977,7 @@ FRESULT pf_open_fileinfo(FILINFO *fno)
 
 	fs->org_clust = get_clust(dir);		/* File start cluster */
 	fs->fsize = ld_dword(dir+DIR_FileSize);	/* File size */
-	pf_build_cluster_cache(fs->org_clust, fs->fsize);
+	if (pf_build_cluster_cache(fs->org_clust, fs->fsize) == FR_FRAGMENTED) return FR_FRAGMENTED;
 	fs->fptr = 0;						/* File pointer */
 	fs->flag = FA_OPENED;
 
@@ -993,6 +985,79 @@ FRESULT pf_open_fileinfo(FILINFO *fno)
 }
 
 
+
+/*-----------------------------------------------------------------------*/
+/* Keep the Open File while Another One is Used                          */
+/* Only a short cluster cache is kept, a longer one is built again from  */
+/* the FAT when the file is restored.                                    */
+/*-----------------------------------------------------------------------*/
+
+FRESULT pf_save_file (
+	FSTATE* st		/* Open file state */
+)
+{
+	BYTE n;
+	FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
+
+	st->fptr = fs->fptr;
+	st->fsize = fs->fsize;
+	st->org_clust = fs->org_clust;
+	st->curr_clust = fs->curr_clust;
+	st->next_clust = fs->next_clust;
+	st->dsect = fs->dsect;
+	st->next_sect = fs->next_sect;
+	st->frange_pos = fs->frange_pos;
+	st->frange = (BYTE)(fs->fcurr_range - fs->fcrange);
+
+	st->nranges = 0;
+	for (n = 0; n < PF_SAVED_RANGES; n++) {
+		st->fcrange[n] = fs->fcrange[n];
+		if (!fs->fcrange[n].cluster) {		/* End mark, whole cache fits */
+			st->nranges = n + 1;
+			break;
+		}
+	}
+
+	return FR_OK;
+}
+
+FRESULT pf_restore_file (
+	const FSTATE* st	/* State saved by pf_save_file */
+)
+{
+	FRESULT res;
+	FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	fs->flag = 0;
+	if (st->nranges) {
+		memcpy(fs->fcrange, st->fcrange, st->nranges * sizeof(CRANGE));
+	} else {
+		res = pf_build_cluster_cache(st->org_clust, st->fsize);	/* Same ranges as before */
+		if (res != FR_OK) return res;
+	}
+
+	fs->fptr = st->fptr;
+	fs->fsize = st->fsize;
+	fs->org_clust = st->org_clust;
+	fs->curr_clust = st->curr_clust;
+	fs->next_clust = st->next_clust;
+	fs->dsect = st->dsect;
+	fs->next_sect = st->next_sect;
+	fs->frange_pos = st->frange_pos;
+	fs->fcurr_range = &fs->fcrange[st->frange];
+	fs->flag = FA_OPENED;
+
+	return FR_OK;
+}
+
+
 /*-----------------------------------------------------------------------*/
 /* Read File                                                             */
 /*-----------------------------------------------------------------------*/
@@ -1052,22 +1117,39 @@ CLUST pf_next_cached_cluster(CLUST *next_clst)
 	FATFS *fs = FatFs;
 	CRANGE *range = fs->fcurr_range;
 
-	if (range->remaining) {
-		range->remaining--;
-		*next_clst = (range->remaining > 0) ? (range->cluster + 1) : ((range + 1)->cluster);
-		return range->cluster++;
+	/* Ranges are kept intact so the file pointer can be moved back and forth */
+	if (fs->frange_pos >= range->remaining) {
+		range++;
+		if (!range->cluster) {
+			*next_clst = 0;
+			return 0;
+		}
+		fs->fcurr_range = range;
+		fs->frange_pos = 0;
 	}
 
-	range++;
-	if (!range->cluster) {
-		*next_clst = 0;
-		return 0;
-	}
+	CLUST clst = range->cluster + fs->frange_pos++;
+	*next_clst = (fs->frange_pos < range->remaining) ? (clst + 1) : ((range + 1)->cluster);
+	return clst;
+}
 
-	fs->fcurr_range = range;
-	range->remaining--;
-	*next_clst = (range->remaining > 0) ? (range->cluster + 1) : ((range + 1)->cluster);
-	return range->cluster++;
+static void set_next_sect (
+	BYTE cs		/* Sector offset of fs->dsect in the current cluster */
+)
+{
+	FATFS *fs = FatFs;
+
+	if (fs->fptr + 512 < fs->fsize) { // next sector should exist
+		if (cs + 1 < fs->csize) { // next sector is in the same cluster
+			fs->next_sect = fs->dsect + 1;
+		} else if (fs->next_clust) { // next sector is in the next cluster
+			fs->next_sect = clust2sect(fs->next_clust);
+		} else { // no next sector
+			fs->next_sect = NO_SECTOR;
+		}
+	} else {
+		fs->next_sect = NO_SECTOR;
+	}
 }
 
 FRESULT pf_read_cached (
@@ -1104,19 +1186,7 @@ FRESULT pf_read_cached (
 			fs->dsect = sect + cs;
 
 			// get next sector for read-ahead
-
-			if (fs->fptr + 512 < fs->fsize) { // next sector should exist
-				if (cs + 1 < fs->csize) { // next sector is in the same cluster
-					fs->next_sect = fs->dsect + 1;
-				} else if (fs->next_clust) { // next sector is in the next cluster
-					fs->next_sect = clust2sect(fs->next_clust);
-				} else { // no next sector
-					fs->next_sect = NO_SECTOR;
-				}
-			} else {
-				fs->next_sect = NO_SECTOR;
-			}
-
+			set_next_sect(cs);
 		}
 		rcnt = 512 - (UINT)fs->fptr % 512;			/* Get partial sector data from sector buffer */
 		if (rcnt > btr) rcnt = btr;
@@ -1129,6 +1199,83 @@ FRESULT pf_read_cached (
 
 	return FR_OK;
 }
+
+/*-----------------------------------------------------------------------*/
+/* Read Data in place using cluster cache                                */
+/* Data is not copied, *ptr points into the sector buffer of the disk    */
+/* layer and stays valid until next disk access. Reading stops at the    */
+/* end of current sector.                                                */
+/*-----------------------------------------------------------------------*/
+
+FRESULT pf_read_direct (
+	const void** ptr,	/* Pointer to the data pointer */
+	UINT btr,		/* Number of bytes to read */
+	UINT* br		/* Pointer to number of bytes read */
+)
+{
+	UINT ofs;
+	FATFS *fs = FatFs;
+
+
+	*br = 0;
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+
+	ofs = (UINT)fs->fptr % 512;
+	if (btr > 512 - ofs) btr = 512 - ofs;		/* Truncate btr at the sector boundary */
+	*ptr = disk_cached_sector() + ofs;
+
+	return pf_read_cached(0, btr, br);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Seek File Read Pointer using cluster cache                            */
+/* Target cluster is found by walking the cached cluster ranges, so no   */
+/* FAT sector has to be read.                                            */
+/*-----------------------------------------------------------------------*/
+
+FRESULT pf_lseek_cached (
+	DWORD ofs		/* File pointer from top of file */
+)
+{
+	DWORD bcs, ci;
+	CLUST clst;
+	BYTE cs;
+	CRANGE *range;
+	FATFS *fs = FatFs;
+
+
+	if (!fs) return FR_NOT_ENABLED;		/* Check file system */
+	if (!(fs->flag & FA_OPENED)) return FR_NOT_OPENED;	/* Check if opened */
+
+	if (ofs > fs->fsize) ofs = fs->fsize;	/* Clip offset with the file size */
+
+	bcs = (DWORD)fs->csize * 512;		/* Cluster size (byte) */
+	ci = ofs / bcs;						/* Cluster index in the file */
+
+	for (range = fs->fcrange; range->cluster && ci >= range->remaining; range++) {
+		ci -= range->remaining;
+	}
+
+	fs->fptr = ofs;
+	if (!range->cluster) {				/* Beyond the last cached cluster */
+		if (ofs < fs->fsize) ABORT(FR_DISK_ERR);
+		return FR_OK;					/* End of file, nothing to read anymore */
+	}
+
+	fs->fcurr_range = range;
+	fs->frange_pos = ci;
+
+	if (ofs % bcs) {					/* Inside of the cluster, pf_read_cached won't fetch it */
+		clst = pf_next_cached_cluster(&fs->next_clust);
+		if (clst <= 1) ABORT(FR_DISK_ERR);
+		fs->curr_clust = clst;
+		cs = (BYTE)(ofs / 512 & (fs->csize - 1));
+		fs->dsect = clust2sect(clst) + cs;
+		set_next_sect(cs);
+	}
+
+	return FR_OK;
+}
 #endif
 
 
@@ -1172,11 +1319,7 @@ FRESULT pf_write (
 		if ((UINT)fs->fptr % 512 == 0) {			/* On the sector boundary? */
 			cs = (BYTE)(fs->fptr / 512 & (fs->csize - 1));	/* Sector offset in the cluster */
 			if (!cs) {								/* On the cluster boundary? */
-				if (fs->fptr == 0) {				/* On the top of the file? */
-					clst = fs->org_clust;
-				} else {
-					clst = get_fat(fs->curr_clust);
-				}
+				clst = pf_next_cached_cluster(&fs->next_clust);	/* Follow cluster cache, same as pf_read_cached/pf_lseek_cached */
 				if (clst <= 1) ABORT(FR_DISK_ERR);
 				fs->curr_clust = clst;				/* Update current cluster */
 			}
@@ -1393,6 +1536,7 @@ UINT pf_countindir (
 
 FRESULT pf_prevdir(DIR *dj)
 {
+	if (!FatFs) return FR_NOT_ENABLED;
 	if (dj->index == 0) return FR_NO_FILE;  // Already at the beginning of the directory
 
 	WORD current_file_index = dj->index - 1; // undo dir_next already called in pf_readdir
@@ -56,8 +56,8 @@ typedef unsigned long	DWORD;	/* 32-bit unsigned integer */
 #endif
 
 typedef struct {
-	CLUST cluster;   /* Starting / current cluster */
-	DWORD remaining; /* Remaining cluster count in this range */
+	CLUST cluster;   /* Starting cluster */
+	DWORD remaining; /* Cluster count in this range */
 } CRANGE;
 
 /* File system object structure */
@@ -81,10 +81,29 @@ typedef struct {
 	DWORD	next_sect;	/* File next data sector */
 	CRANGE  fcrange[PF_CLUSTER_RANGES]; /* Cluster range of the current file */
 	CRANGE* fcurr_range; /* Current cluster range of the file */
+	DWORD	frange_pos;	/* Clusters consumed from the current cluster range */
 } FATFS;
 
 
 
+/* Open file kept while another one is used (pf_save_file) */
+
+typedef struct {
+	DWORD	fptr;		/* File R/W pointer */
+	DWORD	fsize;		/* File size */
+	CLUST	org_clust;	/* File start cluster */
+	CLUST	curr_clust;	/* File current cluster */
+	CLUST   next_clust;	/* File next cluster */
+	DWORD	dsect;		/* File current data sector */
+	DWORD	next_sect;	/* File next data sector */
+	DWORD	frange_pos;	/* Clusters consumed from the current cluster range */
+	BYTE	frange;		/* Index of the current cluster range */
+	BYTE	nranges;	/* Ranges in fcrange, 0: cache is built again */
+	CRANGE	fcrange[PF_SAVED_RANGES];	/* Short cluster cache with its end mark */
+} FSTATE;
+
+
+
 /* Directory object structure */
 
 typedef struct {
@@ -120,7 +139,8 @@ typedef enum {
 	FR_NO_FILE,			/* 3 */
 	FR_NOT_OPENED,		/* 4 */
 	FR_NOT_ENABLED,		/* 5 */
-	FR_NO_FILESYSTEM	/* 6 */
+	FR_NO_FILESYSTEM,	/* 6 */
+	FR_FRAGMENTED		/* 7: more cluster runs than PF_CLUSTER_RANGES, file can't be read */
 } FRESULT;
 
 
@@ -133,16 +153,18 @@ FRESULT pf_open (const char* path);							/* Open a file */
 FRESULT pf_open_fileinfo (FILINFO* dj);				     	/* Open a file from fileinfo structure */
 FRESULT pf_read (void* buff, UINT btr, UINT* br);			/* Read data from the open file */
 FRESULT pf_read_cached (void* buff, UINT btr, UINT* br);	/* Read data from the open file using cluster cache */
+FRESULT pf_read_direct (const void** ptr, UINT btr, UINT* br);	/* Read data within a sector in place, using cluster cache */
 FRESULT pf_write (const void* buff, UINT btw, UINT* bw);	/* Write data to the open file */
 FRESULT pf_lseek (DWORD ofs);								/* Move file pointer of the open file */
+FRESULT pf_lseek_cached (DWORD ofs);						/* Move file pointer of the open file using cluster cache */
 FRESULT pf_opendir (DIR* dj, const char* path);				/* Open a directory */
 FRESULT pf_readdir (DIR* dj, FILINFO* fno);					/* Read a directory item from the open directory */
 FRESULT pf_readdir_n_element(DIR* dj, UINT n, FILINFO* fno);/* Read a specific directory item from the open directory */
 FRESULT pf_prevdir(DIR* dj);                                /* Move directory index to the previous item */
 UINT pf_countindir (DIR *dj); 							    /* Count files in the directory */
 
-FRESULT pf_save_state(FATFS* fs);                        /* Save current file system state */
-FRESULT pf_restore_state(FATFS* fs);                     /* Restore file system state */
+FRESULT pf_save_file (FSTATE* st);                         /* Keep the open file while another one is used */
+FRESULT pf_restore_file (const FSTATE* st);                /* Reopen the kept file where it was */
 
 /*--------------------------------------------------------------*/
 /* Flags and offset address                                     */
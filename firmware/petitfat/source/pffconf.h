@@ -19,6 +19,7 @@
 #define PF_FS_FAT32		1	/* FAT32 */
 
 #define PF_CLUSTER_RANGES 20 /* Size of cached cluster ranges for opened file */
+#define PF_SAVED_RANGES 3 /* Cluster ranges (end mark included) pf_save_file keeps, longer caches are read again from the FAT */
 
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
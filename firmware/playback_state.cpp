@@ -6,9 +6,31 @@
 */
 
 #include "playback_state.h"
-#include "petitfat/source/pff.h"
+#include "file_record.h"
 #include "random.h"
 
+namespace {
+    // State file is a journal of records, one per sector. Each save goes to the next
+    // sector, so a torn write only damages one record and card wear is spread.
+    constexpr uint32_t SLOT_SIZE = 512;
+    constexpr uint32_t MAX_SLOTS = 8;
+
+    struct Record {
+        static constexpr uint32_t MAGIC = 0x5453544c; // "LTST"
+        static constexpr uint16_t VERSION = 1;
+
+        FileRecord::Header header;
+        uint32_t sequence;
+        uint32_t current_dir_index;
+        uint32_t current_track_index;
+        uint32_t rand_key;
+        uint32_t tracks_in_current_dir;
+        uint32_t mode;
+        uint32_t track_offset;
+        uint32_t crc;
+    };
+}
+
 bool PlaybackState::load_from_file(const char* filename) {
     // Open file
     FRESULT res = pf_open(filename);
@@ -16,32 +38,63 @@ bool PlaybackState::load_from_file(const char* filename) {
         return false;
     }
 
-    // read all members from binary file
-    UINT br;
-    pf_read(&current_dir_index, sizeof(current_dir_index), &br);
-    pf_read(&current_track_index, sizeof(current_track_index), &br);
-    pf_read(&rand_key, sizeof(rand_key), &br);
-    pf_read(&tracks_in_current_dir, sizeof(tracks_in_current_dir), &br);
-    pf_read(&mode, sizeof(mode), &br);
-    return true;
+    // scan all slots, the newest valid record wins
+    bool found = false;
+    slots = 0;
+
+    for (uint32_t slot = 0; slot < MAX_SLOTS; slot++) {
+        Record record;
+        if (!FileRecord::read(slot * SLOT_SIZE, record)) {
+            break; // end of file
+        }
+
+        slots++;
+
+        if (!FileRecord::valid(record)) {
+            continue; // empty or damaged slot
+        }
+
+        if (found && static_cast<int32_t>(record.sequence - sequence) <= 0) {
+            continue; // older record
+        }
+
+        found = true;
+        sequence = record.sequence;
+        current_dir_index = record.current_dir_index;
+        current_track_index = record.current_track_index;
+        rand_key = record.rand_key;
+        tracks_in_current_dir = record.tracks_in_current_dir;
+        mode = static_cast<Mode>(record.mode);
+        track_offset = record.track_offset;
+    }
+
+    // file without any valid record is still usable, caller keeps defaults
+    return slots > 0;
 }
 
 bool PlaybackState::save_to_file(const char* filename) {
     // Open file
     FRESULT res = pf_open(filename);
-    if (res != FR_OK) {
+    if (res != FR_OK || slots == 0) {
         return false;
     }
 
-    // write all members to binary file
-    UINT br;
-    pf_write(&current_dir_index, sizeof(current_dir_index), &br);
-    pf_write(&current_track_index, sizeof(current_track_index), &br);
-    pf_write(&rand_key, sizeof(rand_key), &br);
-    pf_write(&tracks_in_current_dir, sizeof(tracks_in_current_dir), &br);
-    pf_write(&mode, sizeof(mode), &br);
-    pf_write(0, 0, &br); // finalize write operation
+    Record record;
+    record.sequence = sequence + 1;
+    record.current_dir_index = current_dir_index;
+    record.current_track_index = current_track_index;
+    record.rand_key = rand_key;
+    record.tracks_in_current_dir = tracks_in_current_dir;
+    record.mode = static_cast<uint32_t>(mode);
+    record.track_offset = track_offset;
+    FileRecord::seal(record);
+
+    // write record to the next slot
+    if (!FileRecord::write((record.sequence % slots) * SLOT_SIZE, record)) {
+        return false;
+    }
 
+    sequence = record.sequence;
     return true;
 }
 
@@ -49,6 +102,7 @@ void PlaybackState::regenerate(uint32_t seed) {
     current_dir_index = -1;
     current_track_index = -1;
     tracks_in_current_dir = 0;
+    track_offset = 0;
     regenerate_key(seed);
 }
 
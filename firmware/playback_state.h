@@ -22,6 +22,12 @@ struct PlaybackState {
         LastElement // marker for calculation
     } mode;
 
+    uint32_t track_offset; // byte offset of the first frame to play in current track
+
+    // state file journal bookkeeping, not saved
+    uint32_t sequence; // sequence number of the newest record
+    uint32_t slots; // number of record slots in state file
+
     bool load_from_file(const char* filename);
     bool save_to_file(const char* filename);
     void regenerate(uint32_t seed);
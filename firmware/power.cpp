@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "power.h"
+#include "irq_priority.h"
+
+void SystemClock_Config(void); // main.cpp
+
+void PVD::init() {
+    __HAL_RCC_PWR_CLK_ENABLE();
+
+    stop();
+
+    // 3.0V threshold leaves some margin before SD card minimum (2.7V),
+    // filter ignores short dips caused by load spikes
+    PWR->CR2 = PWR_PVDLEVEL_6 | PWR_PVD_FILTER_16CLOCK;
+
+    // PVD output goes high when supply falls below threshold (EXTI line 16 rising edge)
+    EXTI->RTSR |= EXTI_RTSR_RT16;
+    EXTI->FTSR &= ~EXTI_FTSR_FT16;
+
+    NVIC_SetPriority(PVD_IRQn, IrqPriority::POWER_FAIL);
+}
+
+void PVD::start() {
+    if (PWR->CR2 & PWR_CR2_PVDE) {
+        return;
+    }
+
+    PWR->CR2 |= PWR_CR2_PVDE;
+
+    // give detector time to settle before listening to it (systick is suspended)
+    for (volatile uint32_t i = 0; i < 1000; i++) {
+    }
+
+    EXTI->PR = EXTI_PR_PR16;
+    EXTI->IMR |= EXTI_IMR_IM16;
+    NVIC_ClearPendingIRQ(PVD_IRQn);
+    NVIC_EnableIRQ(PVD_IRQn);
+}
+
+void PVD::stop() {
+    NVIC_DisableIRQ(PVD_IRQn);
+    EXTI->IMR &= ~EXTI_IMR_IM16;
+    PWR->CR2 &= ~PWR_CR2_PVDE;
+}
+
+void PVD_IRQHandler() {
+    if (EXTI->PR & EXTI_PR_PR16) {
+        EXTI->PR = EXTI_PR_PR16; // clear interrupt flag
+
+        // filtered output still has to be low, otherwise it was a glitch
+        if (PVD::supply_low()) {
+            PowerFailCallback();
+        }
+    }
+}
+
+void STOP::enter() {
+    PWR->CR1 |= PWR_CR1_LPR; // low power regulator in Stop mode
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    __WFI();
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+    // woken up running from HSI
+    SystemClock_Config();
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+extern "C" {
+#include "py32f0xx.h"
+#include "py32f0xx_hal.h"
+}
+
+class PVD {
+    public:
+    static void init();
+    static void start();
+    static void stop();
+
+    static inline bool supply_low() {
+        return (PWR->SR & PWR_SR_PVDO) != 0;
+    }
+};
+
+/*
+ * Stop mode: PLL, HSI and all timers but LPTIM are off, SRAM, registers and
+ * pins keep their state. EXTI lines wake it up: buttons, LPTIM of the light
+ * sensor, PVD.
+ */
+class STOP {
+    public:
+    /**
+     * @brief Sleep until an interrupt is pending, system clock is back at 48 MHz on return.
+     *        Called with interrupts disabled, so the handler runs at full clock once they're enabled
+     */
+    static void enter();
+};
+
+void PowerFailCallback();
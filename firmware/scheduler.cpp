@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "scheduler.h"
+
+namespace Scheduler {
+
+Stats stats = {{0}, {0}, INT32_MIN, 0, 0};
+
+namespace {
+    // recent worst case loses this part of its excess per shorter run or postponed start
+    constexpr uint32_t DECAY_SHIFT = 3;
+
+    void decay(Time& recent, Time took) {
+        recent = took >= recent ? took : recent - ((recent - took + (1u << DECAY_SHIFT) - 1) >> DECAY_SHIFT);
+    }
+}
+
+Time budget(const Task* tasks, uint32_t index) {
+    return stats.recent[index] > tasks[index].estimate ? stats.recent[index] : tasks[index].estimate;
+}
+
+bool run(const Task* tasks, uint32_t count, Time (*now)(), Time (*latest_start)()) {
+    bool ran = false;
+    for (uint32_t i = 0; i < count; i++) {
+        const Task& task = tasks[i];
+        if (!task.pending()) {
+            continue;
+        }
+
+        const Time start = now();
+        if (task.optional && static_cast<int32_t>(latest_start() - (start + budget(tasks, i))) < 0) {
+            decay(stats.recent[i], 0); // slow run long ago shouldn't block it for good
+            continue; // would delay deadline task, try again after it
+        }
+
+        task.run();
+        ran = true;
+
+        const Time took = now() - start;
+        if (took > stats.worst[i]) {
+            stats.worst[i] = took;
+        }
+        decay(stats.recent[i], took);
+    }
+
+    return ran;
+}
+
+void deadline_done(int32_t lateness) {
+    stats.deadlines++;
+    if (lateness > 0) {
+        stats.missed++;
+    }
+    if (lateness > stats.worst_lateness) {
+        stats.worst_lateness = lateness;
+    }
+}
+
+} // namespace Scheduler
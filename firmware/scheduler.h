@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ * 
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Cooperative run-to-completion scheduler of the playback loop.
+ *
+ * Time is counted in output samples (audio DMA position), so deadlines are
+ * points where the DMA enters a buffer half. Every round runs pending tasks in
+ * table order. Optional tasks are only started if their recent worst-case run
+ * time still fits before the latest start of the next deadline task, other
+ * tasks always run. That worst case decays, with each shorter run and each
+ * postponed start, so a single slow run (card error recovery) doesn't keep a
+ * task postponed for good. Pending checks must be cheap, caller may sleep when
+ * a round runs nothing.
+ */
+namespace Scheduler {
+
+using Time = uint32_t; // output samples, wraps around, compare differences only
+
+constexpr uint32_t MAX_TASKS = 4;
+
+struct Task {
+    bool (*pending)();
+    void (*run)();
+    Time estimate;      // worst-case run time assumed, unless a longer one was measured recently
+    bool optional;      // may be postponed to a longer slack
+};
+
+struct Stats {
+    Time worst[MAX_TASKS];  // longest measured run of each task
+    Time recent[MAX_TASKS]; // decaying maximum of runs, what budget() uses
+    int32_t worst_lateness; // deadline task completion, negative if always early
+    uint32_t deadlines;
+    uint32_t missed;
+};
+
+extern Stats stats;
+
+/**
+ * @brief Run one round over task table
+ * @param now Output clock
+ * @param latest_start Last moment optional tasks may occupy, evaluated before each one
+ * @return false if no task was run
+ */
+bool run(const Task* tasks, uint32_t count, Time (*now)(), Time (*latest_start)());
+
+/**
+ * @brief Record completion of deadline work
+ * @param lateness Completion time minus deadline (negative when early)
+ */
+void deadline_done(int32_t lateness);
+
+/**
+ * @brief Time a task is going to need, measured or estimated
+ */
+Time budget(const Task* tasks, uint32_t index);
+
+} // namespace Scheduler
@@ -7,8 +7,12 @@
 
 #include "sd.h"
 #include "spi.h"
+#include "boot.h"
+#include "trace.h"
+#include "build_options.h"
 
 #include <algorithm>
+#include <iterator>
 
 extern "C" {
     #include "petitfat/source/diskio.h"
@@ -20,8 +24,37 @@ namespace {
     DWORD sdRequestedSector = NO_SECTOR;
     bool sdMultiTransfer = false;
     bool extendedCapacity = false;
+    bool sdWriteBusy = false; // card is programming last written block
+    DWORD sdPrefetchSector = NO_SECTOR; // read-ahead postponed until write completes
+    bool sdSuspended = false; // card status unknown after Stop mode, checked on next access
+    bool sdWriteOpen = false; // CMD24 block started, not all of it sent yet
+    UINT sdWriteBytes = 0; // bytes of the open block sent
+
+    constexpr uint32_t WRITE_BUSY_POLL_LIMIT = 2'000'000u;
+    constexpr uint32_t TOKEN_POLL_LIMIT = 200'000u; // over 100 ms read access limit at full clock
+    constexpr uint32_t SPI_KERNEL_KHZ = INPUT_FREQUENCY / 1000; // fPCLK, APB clock isn't divided
+
+    // ACMD41 attempts, at least 18 bytes each at the identification clock: over the 1 s
+    // the card may take to leave idle state
+    constexpr uint32_t ACMD41_RETRIES = 3000u;
+
+    uint32_t sdTokenWait = 0; // bytes polled for the last data token, calibration times with it
+
+    // Steps of read error recovery, sector is read again after each
+    enum class Recovery : uint8_t {
+        Retry,      // stop transfer (CMD12), request the sector again
+        Resync,     // deselect, clock the bus idle, wait for card to release DO
+        Reinit,     // card init, mount and open files stay as they are
+        Count
+    };
 }
 
+// tiers used, remounts are counted by the player
+DRECOVERY disk_recovery;
+
+// streaming read-ahead until the card is measured
+DPROFILE disk_profile = { {0}, 0, 1, 0, 0, 0, 0 };
+
 
 /*-----------------------------------------------------------------------*/
 /* Initialize Disk Drive                                                 */
@@ -29,7 +62,8 @@ namespace {
 DSTATUS disk_initialize (void)
 {
 	if (SD::init()) {
-        SPI::speed_mode(true); // fast SPI
+        Boot::mark(Boot::Phase::Card);
+        disk_recovery.failed = 0;
         return RES_OK;
     }
 
@@ -44,11 +78,81 @@ void make_empty_traffic() {
 }
 
 
+/*-----------------------------------------------------------------------*/
+/* Write Busy Polling                                                    */
+/*-----------------------------------------------------------------------*/
+
+// Check once if card finished programming, CS is released between polls
+bool sd_write_done() {
+    if (!sdWriteBusy) {
+        return true;
+    }
+
+    SPI::begin();
+    SD::cs_set();
+    // card drives DO low (0x00) until the programming completes
+    const bool ready = SPI::raw_byte_read() != 0x00;
+    SD::cs_reset();
+    make_empty_traffic();
+    SPI::end();
+
+    if (ready) {
+        sdWriteBusy = false;
+    }
+
+    return ready;
+}
+
+DRESULT sd_wait_write_done() {
+    uint32_t guard = 0;
+    while (!sd_write_done()) {
+        if (++guard > WRITE_BUSY_POLL_LIMIT) { // crude timeout guard
+            sdWriteBusy = false;
+            return RES_ERROR;
+        }
+    }
+
+    return RES_OK;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Card Check After Stop Mode                                            */
+/*-----------------------------------------------------------------------*/
+
+// Card keeps its state over Stop mode unless it was swapped or lost power,
+// SEND_STATUS tells, card init brings it back with the mount still valid
+DRESULT sd_resume() {
+    sdSuspended = false;
+
+    SPI::begin();
+    SD::cs_set();
+    const uint8_t response = SD::send_command(13, 0, 0x01); // CMD13, R2 response
+    const uint8_t status = SPI::raw_byte_read();
+    SD::cs_reset();
+    make_empty_traffic();
+    SPI::end();
+
+    if (response == 0x00 && status == 0x00) {
+        return RES_OK;
+    }
+
+    return disk_initialize() == RES_OK ? RES_OK : RES_ERROR;
+}
+
+bool sd_awake() {
+    return !sdSuspended || sd_resume() == RES_OK;
+}
+
+
 /*-----------------------------------------------------------------------*/
 /* Read Partial Sector                                                   */
 /*-----------------------------------------------------------------------*/
 
 DRESULT sd_request_sector(DWORD sector) {
+    if (sd_wait_write_done() != RES_OK) {
+        return RES_ERROR;
+    }
+
     SPI::begin();
     SD::cs_set();
     
@@ -68,6 +172,10 @@ DRESULT sd_request_sector(DWORD sector) {
 }
 
 DRESULT sd_start_sector_stream(DWORD starting_sector) {
+    if (sd_wait_write_done() != RES_OK) {
+        return RES_ERROR;
+    }
+
     SPI::begin();
     SD::cs_set();
     
@@ -104,12 +212,23 @@ DRESULT sd_stop_sector_stream() {
     return RES_OK;
 }
 
-void sd_read_sector() {
-    // Wait for data token (0xFE)
+// Data token (0xFE) starting a block, error token or 0xFF when the card doesn't answer
+uint8_t sd_wait_token() {
     uint8_t token;
+    sdTokenWait = 0;
+    Trace::record(Trace::Event::SdTokenWait);
     do {
         token = SPI::raw_byte_read();
-    } while (token == 0xFF);
+    } while (token == 0xFF && ++sdTokenWait < TOKEN_POLL_LIMIT);
+
+    Trace::record(Trace::Event::SdToken, token);
+    return token;
+}
+
+DRESULT sd_read_sector() {
+    if (sd_wait_token() != 0xFE) {
+        return RES_ERROR; // transfer is dropped by recovery
+    }
 
     // Read the entire sector into the cache
     SPI::raw_read(sectorCache, sizeof(sectorCache));
@@ -128,20 +247,38 @@ void sd_read_sector() {
         SPI::end();
         sdRequestedSector = NO_SECTOR;
     }
+
+    return RES_OK;
 }
 
-DRESULT disk_readp_ex (
-    BYTE* buff,		/* Pointer to the destination object */
-    DWORD sector,	/* Sector number (LBA) */
-    DWORD next_sector, /* Next sector number (LBA) for pre-fetching */
-    UINT offset,	/* Offset in the sector */
-    UINT count		/* Byte count (bit15:destination) */
-)
-{
-    if (next_sector == NO_SECTOR) {
-        next_sector = sector + 1; // heuristics
+// Request sector ahead of its read, streamed or single block as the card profile says
+DRESULT sd_read_ahead(DWORD sector) {
+    return disk_profile.stream ? sd_start_sector_stream(sector) : sd_request_sector(sector);
+}
+
+// End open transfer, a single block read can't be stopped: it's clocked out and
+// dropped, cache keeps the sector being read
+DRESULT sd_drop_request() {
+    if (sdMultiTransfer) {
+        return sd_stop_sector_stream();
     }
 
+    const bool received = sd_wait_token() == 0xFE;
+    if (received) {
+        for (uint32_t i = 0; i < sizeof(sectorCache) + 2; i++) { // data, CRC
+            SPI::raw_byte_read();
+        }
+    }
+
+    SD::cs_reset();
+    make_empty_traffic();
+    SPI::end();
+    sdRequestedSector = NO_SECTOR;
+    return received ? RES_OK : RES_ERROR;
+}
+
+// Get sector into cache, transfer left open is ended if next_sector isn't its next block
+DRESULT sd_fetch(DWORD sector, DWORD next_sector) {
     DRESULT res = RES_ERROR;
 
     if (sdCachedSector == sector) {
@@ -149,14 +286,18 @@ DRESULT disk_readp_ex (
     }
     else if (sector == sdRequestedSector) {
         // already requested sector from sd card, wait and read it
-        sd_read_sector();
+        res = sd_read_sector();
+        if (res != RES_OK) {
+            return res;
+        }
         sdCachedSector = sector;
-        res = RES_OK;
     }
 
-    if (sdRequestedSector != NO_SECTOR && next_sector != sdRequestedSector) {
-        // requested sector earlier but now we will need different one, stop transfer
-        if (sd_stop_sector_stream() != RES_OK) {
+    // requested sector earlier but now we will need different one, stop transfer; single
+    // block costs nothing while it waits, it's only dropped once the bus is needed
+    if (sdRequestedSector != NO_SECTOR
+            && (res != RES_OK || (sdMultiTransfer && next_sector != sdRequestedSector))) {
+        if (sd_drop_request() != RES_OK) {
             return RES_ERROR;
         }
     }
@@ -164,7 +305,7 @@ DRESULT disk_readp_ex (
     if (res != RES_OK) { // we don't have sector data yet
 
         // need to request the sector now and wait for it
-        if (next_sector == sector + 1) { // transfer needed
+        if (next_sector == sector + 1 && disk_profile.stream) { // transfer needed
             // request multi-sector read if we are going to read the next sector soon
             res = sd_start_sector_stream(sector);
         }
@@ -173,33 +314,334 @@ DRESULT disk_readp_ex (
         }
 
         if (res == RES_OK) {
-            sd_read_sector();
+            res = sd_read_sector();
+        }
+        if (res == RES_OK) {
             sdCachedSector = sector;
         }
-        else {
-            return res;
+    }
+
+    return res;
+}
+
+// false if the card is gone, retrying the read is pointless then
+bool sd_recover(Recovery step) {
+    // cache may hold part of the failed block
+    sdCachedSector = NO_SECTOR;
+    bool ready = true;
+
+    switch (step) {
+        case Recovery::Retry:
+            disk_recovery.retries++;
+            if (sdMultiTransfer) {
+                SD::send_command(12, 0, 0x01); // CMD12, failure shows on the retry
+            }
+            SD::cs_reset();
+            make_empty_traffic();
+            SPI::end();
+            break;
+
+        case Recovery::Resync: {
+            disk_recovery.resyncs++;
+            SPI::begin();
+            SPI::raw_write(nullptr, 0); // complete byte in flight, drop received data
+            SD::cs_reset();
+            for (int i = 0; i < 10; i++) { // 80 clocks with the card deselected
+                SPI::raw_byte_read();
+            }
+
+            // card may still be sending or busy, it's done once DO stays high
+            SD::cs_set();
+            uint32_t guard = 0;
+            while (SPI::raw_byte_read() != 0xFF && ++guard < WRITE_BUSY_POLL_LIMIT) {
+            }
+            SD::cs_reset();
+            make_empty_traffic();
+            SPI::end();
+            break;
         }
+
+        case Recovery::Reinit:
+            disk_recovery.reinits++;
+            ready = SD::init(); // bounded, a card that doesn't come back fails it
+            break;
+
+        case Recovery::Count:
+            break;
     }
 
-    // correct sector is in cache
-    std::copy(sectorCache + offset, sectorCache + offset + count, buff);
+    sdRequestedSector = NO_SECTOR;
+    sdMultiTransfer = false;
+    return ready;
+}
+
+DRESULT disk_readp_ex (
+    BYTE* buff,		/* Pointer to the destination object */
+    DWORD sector,	/* Sector number (LBA) */
+    DWORD next_sector, /* Next sector number (LBA) for pre-fetching */
+    UINT offset,	/* Offset in the sector */
+    UINT count		/* Byte count (bit15:destination) */
+)
+{
+    if (!sd_awake()) {
+        return RES_ERROR;
+    }
+
+    if (next_sector == NO_SECTOR) {
+        next_sector = sector + 1; // heuristics
+    }
+
+    sdPrefetchSector = NO_SECTOR; // superseded by this read
+
+    DRESULT res = sd_fetch(sector, next_sector);
+
+    // recovery ladder, each step disturbs more than the one before
+    for (uint8_t step = 0; res != RES_OK && step < static_cast<uint8_t>(Recovery::Count); step++) {
+        if (!sd_recover(static_cast<Recovery>(step))) {
+            break;
+        }
+        res = sd_fetch(sector, next_sector);
+    }
+
+    if (res != RES_OK) {
+        disk_recovery.failed = 1; // up to the player to mount again
+        return res;
+    }
+
+    // correct sector is in cache, null buffer only skips (pf_read_direct reads in place)
+    if (buff) {
+        std::copy(sectorCache + offset, sectorCache + offset + count, buff);
+    }
 
     // at this point we have the correct sector, but we might want to pre-fetch the next one
     if (sdRequestedSector == NO_SECTOR && next_sector != NO_SECTOR) {
-        sd_start_sector_stream(next_sector);
+        if (sdWriteBusy) {
+            // don't wait for the card here, disk_poll will start the read
+            sdPrefetchSector = next_sector;
+        }
+        else {
+            sd_read_ahead(next_sector);
+        }
     }
 
     return res;
 }
 
+const BYTE* disk_cached_sector (void)
+{
+    return sectorCache;
+}
+
 /*-----------------------------------------------------------------------*/
-/* Write Partial Sector                                                  */
+/* Poll pending write, then start postponed read-ahead                   */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_poll (void)
+{
+    if (!sd_awake()) {
+        return RES_ERROR;
+    }
+
+    if (!sd_write_done()) {
+        return RES_NOTRDY;
+    }
+
+    if (sdPrefetchSector != NO_SECTOR) {
+        const DWORD sector = sdPrefetchSector;
+        sdPrefetchSector = NO_SECTOR;
+
+        if (sdRequestedSector == NO_SECTOR) {
+            return sd_read_ahead(sector);
+        }
+    }
+
+    return RES_OK;
+}
+
+void disk_prefetch (
+    DWORD sector	/* Sector number (LBA) expected to be read next */
+)
+{
+    if (sector == NO_SECTOR || sector == sdCachedSector || sector == sdRequestedSector || !sd_awake()) {
+        return;
+    }
+
+    if (sdRequestedSector != NO_SECTOR && sd_drop_request() != RES_OK) {
+        return;
+    }
+
+    sdPrefetchSector = sector;
+    disk_poll();
+}
+
+/*-----------------------------------------------------------------------*/
+/* Check if disk_poll has work: write in progress or read-ahead waiting  */
+/*-----------------------------------------------------------------------*/
+
+int disk_busy (void)
+{
+    return sdWriteBusy || sdPrefetchSector != NO_SECTOR;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Abandon interrupted transfer, used from power fail interrupt          */
+/*-----------------------------------------------------------------------*/
+
+void disk_abort (void)
+{
+    SPI::begin();
+    SPI::raw_write(nullptr, 0); // complete byte in flight, drop received data
+    SD::cs_set();
+
+    if (sdWriteOpen) {
+        // interrupted in the middle of a CMD24 block, the card takes no command until it
+        // has all of it: pad it, end it with a CRC that doesn't match and take the data
+        // response. Card checks CRC only when enabled (CMD59, never sent), so the padded
+        // block may be programmed; state, config and card records have a CRC, a torn one is
+        // ignored on load.
+        // Count misses bytes of a raw_write that was interrupted, the extra 0xFF the card
+        // gets after the block are idle bus to it.
+        for (; sdWriteBytes < 512; sdWriteBytes++) {
+            SPI::raw_byte_read(); // sends 0xFF
+        }
+        uint8_t crc[2] = {0x00, 0x00};
+        SPI::raw_write(crc, 2);
+        uint32_t guard = 0;
+        while (SPI::raw_byte_read() == 0xFF && ++guard < TOKEN_POLL_LIMIT) {
+        }
+        sdWriteOpen = false;
+    }
+    else if (sdMultiTransfer) {
+        SD::send_command(12, 0, 0x01); // CMD12 stops block being sent as well
+    }
+    else if (sdRequestedSector != NO_SECTOR) {
+        // single block read can't be stopped, clock out rest of it
+        uint32_t guard = 0;
+        while (SPI::raw_byte_read() == 0xFF && ++guard < WRITE_BUSY_POLL_LIMIT) {
+        }
+        SPI::raw_read(sectorCache, sizeof(sectorCache));
+        SPI::raw_byte_read();
+        SPI::raw_byte_read();
+    }
+
+    // wait until card releases DO (busy after CMD12 or block programming)
+    uint32_t guard = 0;
+    while (SPI::raw_byte_read() != 0xFF && ++guard < WRITE_BUSY_POLL_LIMIT) {
+    }
+
+    SD::cs_reset();
+    make_empty_traffic();
+    SPI::end();
+
+    sdCachedSector = NO_SECTOR;
+    sdRequestedSector = NO_SECTOR;
+    sdPrefetchSector = NO_SECTOR;
+    sdMultiTransfer = false;
+    sdWriteBusy = false;
+}
+
+/*-----------------------------------------------------------------------*/
+/* End read-ahead before Stop mode, no write may be in progress          */
+/*-----------------------------------------------------------------------*/
+
+void disk_suspend (void)
+{
+    if (sdRequestedSector != NO_SECTOR) {
+        sd_drop_request();
+    }
+
+    sdPrefetchSector = NO_SECTOR;
+    sdSuspended = true;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Time the read paths of the card, pick read-ahead from them            */
 /*-----------------------------------------------------------------------*/
 
+#if LOOTUNES_CARD_PROFILE
+
 namespace {
-    UINT sdWriteBytes = 0;
+    // bytes clocked while waiting to microseconds at the fast clock, rounded up; 32-bit
+    // math, count is cut where even the fastest clock gives over 0xFFFF us
+    WORD bytes_to_us(uint32_t bytes) {
+        const uint32_t spi_khz = SPI_KERNEL_KHZ / (2u << disk_profile.clock_div);
+        const uint32_t us = (std::min<uint32_t>(bytes, 0x40000u) * 8000 + spi_khz - 1) / spi_khz;
+        return us < 0xFFFF ? us : 0xFFFF;
+    }
+}
+
+DRESULT disk_calibrate (
+    DWORD sector	/* Sector to read, any one on the card */
+)
+{
+    if (!sd_awake() || (sdRequestedSector != NO_SECTOR && sd_drop_request() != RES_OK)) {
+        return RES_ERROR;
+    }
+    sdPrefetchSector = NO_SECTOR;
+    sdCachedSector = NO_SECTOR; // cache holds the blocks read here
+
+    // CMD12 of a stopped stream leaves the card busy, single block is timed after it
+    SPI::begin();
+    SD::cs_set();
+    uint32_t busy = 0;
+    while (SPI::raw_byte_read() != 0xFF && ++busy < WRITE_BUSY_POLL_LIMIT) {
+        // card holds DO low while busy
+    }
+    SD::cs_reset();
+    make_empty_traffic();
+    SPI::end();
+
+    // single block
+    if (sd_request_sector(sector) != RES_OK || sd_read_sector() != RES_OK) {
+        return RES_ERROR;
+    }
+    const uint32_t single = sdTokenWait;
+
+    // stream, two blocks and the stop
+    if (sd_start_sector_stream(sector) != RES_OK || sd_read_sector() != RES_OK) {
+        return RES_ERROR;
+    }
+    const uint32_t stream = sdTokenWait;
+    if (sd_read_sector() != RES_OK) {
+        return RES_ERROR;
+    }
+    const uint32_t gap = sdTokenWait;
+
+    const uint8_t response = SD::send_command(12, 0, 0x01); // CMD12 to stop transmission
+    uint32_t stop = 0;
+    while (SPI::raw_byte_read() != 0xFF && ++stop < WRITE_BUSY_POLL_LIMIT) {
+        // card holds DO low while busy
+    }
+    SD::cs_reset();
+    make_empty_traffic();
+    SPI::end();
+    sdRequestedSector = NO_SECTOR;
+    sdMultiTransfer = false;
+
+    if (response != 0x00) {
+        return RES_ERROR;
+    }
+
+    // token byte included, so measured times are never 0
+    disk_profile.single_us = bytes_to_us(single + 1);
+    disk_profile.stream_us = bytes_to_us(stream + 1);
+    disk_profile.gap_us = bytes_to_us(gap + 1);
+    disk_profile.stop_us = bytes_to_us(stop);
+
+    // read-ahead the decoder doesn't take costs stopping the stream, or the rest of
+    // a single block (it can't be stopped); stream unless stopping is the slower one
+    const WORD block_us = bytes_to_us(512 + 2);
+    disk_profile.stream = disk_profile.stop_us <= disk_profile.single_us + block_us;
+
+    return RES_OK;
 }
 
+#endif
+
+/*-----------------------------------------------------------------------*/
+/* Write Partial Sector                                                  */
+/*-----------------------------------------------------------------------*/
+
 DRESULT disk_writep (
     const BYTE* buff,       /* Pointer to the data to be written, NULL:Initiate/Finalize write operation */
     DWORD sc                /* Sector number (LBA) when buff==NULL and sc>0; or number of bytes to send when buff!=NULL */
@@ -207,14 +649,21 @@ DRESULT disk_writep (
 {
     // if read is pending stop it
     if (sdRequestedSector != NO_SECTOR) {
-        if (sd_stop_sector_stream() != RES_OK) {
+        if (sd_drop_request() != RES_OK) {
             return RES_ERROR;
         }
     }
 
+    sdPrefetchSector = NO_SECTOR;
+
     // Initiate write (buff == NULL, sc > 0): Send CMD24 and the data-start token (0xFE)
     if (!buff) {
         if (sc) {
+            // previous block must be programmed before next command
+            if (!sd_awake() || sd_wait_write_done() != RES_OK) {
+                return RES_ERROR;
+            }
+
             // Start single-block write
             SPI::begin();
             SD::cs_set();
@@ -234,6 +683,7 @@ DRESULT disk_writep (
             SPI::raw_write(&token, 1);
 
             sdWriteBytes = 0;
+            sdWriteOpen = true;
             return RES_OK;
         } else {
             // Finalize write (buff == NULL, sc == 0): send CRC, check data-response, wait busy release
@@ -246,12 +696,16 @@ DRESULT disk_writep (
             // Send dummy CRC
             uint8_t crc[2] = {0xFF, 0xFF};
             SPI::raw_write(crc, 2);
+            sdWriteOpen = false;
 
             // Get first non-0xFF data-response byte
             uint8_t resp;
-            do { resp = SPI::raw_byte_read(); } while (resp == 0xFF);
+            uint32_t guard = 0;
+            do {
+                resp = SPI::raw_byte_read();
+            } while (resp == 0xFF && ++guard < TOKEN_POLL_LIMIT);
 
-            // Data accepted = 0bxxx00101 (mask low 5 bits == 0x05)
+            // Data accepted = 0bxxx00101 (mask low 5 bits == 0x05), no response (0xFF) fails too
             if ((resp & 0x1F) != 0x05) {
                 SD::cs_reset();
                 make_empty_traffic();
@@ -259,17 +713,9 @@ DRESULT disk_writep (
                 return RES_ERROR;
             }
 
-            // Busy wait: card drives DO low (0x00) until the programming completes
-            // Add a simple timeout if desired
-            uint32_t guard = 0;
-            while (SPI::raw_byte_read() == 0x00) {
-                if (++guard > 10'000'000u) { // crude timeout guard
-                    SD::cs_reset();
-                    make_empty_traffic();
-                    SPI::end();
-                    return RES_ERROR;
-                }
-            }
+            // Don't wait for programming to complete, card keeps busy with CS released.
+            // It is polled by disk_poll or before next command is issued.
+            sdWriteBusy = true;
 
             // Release bus
             SD::cs_reset();
@@ -302,7 +748,45 @@ void SD::cs_reset() {
     GPIOA->BSRR = GPIO_BSRR_BS4; // Set NSS high
 }
 
+namespace {
+    // CSD / CID, sent like a 16 byte data block
+    bool read_register(uint8_t cmd, uint8_t (&reg)[16]) {
+        SD::cs_set();
+        const bool ok = SD::send_command(cmd, 0, 0x01) == 0x00 && sd_wait_token() == 0xFE;
+        if (ok) {
+            SPI::raw_read(reg, sizeof(reg));
+            SPI::raw_byte_read(); // CRC
+            SPI::raw_byte_read();
+        }
+        SD::cs_reset();
+        make_empty_traffic();
+        return ok;
+    }
+
+    // Fast clock divider within CSD TRAN_SPEED: 25 MHz default speed cards get
+    // fPCLK/2, slower ones the next divider that fits
+    uint8_t clock_divider(uint8_t tran_speed) {
+        constexpr uint32_t unit_khz[] = { 100, 1000, 10000, 100000 };
+        constexpr uint8_t multiplier[] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };
+
+        const uint8_t unit = tran_speed & 0x07;
+        const uint8_t value = multiplier[(tran_speed >> 3) & 0x0F];
+        if (unit >= std::size(unit_khz) || value == 0) {
+            return 0; // reserved, keep the full clock
+        }
+
+        const uint32_t max_khz = unit_khz[unit] * value / 10;
+        uint8_t div = 0;
+        while (div < 7 && SPI_KERNEL_KHZ / (2u << div) > max_khz) {
+            div++;
+        }
+        return div;
+    }
+}
+
 uint8_t SD::send_command(uint8_t cmd, uint32_t arg, uint8_t crc) {
+    Trace::record(Trace::Event::SdCommand, cmd);
+
     uint8_t command[6];
     command[0] = cmd | 0x40; // Add the start bit (0b01xxxxxx)
     command[1] = (arg >> 24) & 0xFF;
@@ -332,7 +816,11 @@ uint8_t SD::send_command(uint8_t cmd, uint32_t arg, uint8_t crc) {
 bool SD::init() {
     sdCachedSector = NO_SECTOR;
     sdRequestedSector = NO_SECTOR;
+    sdPrefetchSector = NO_SECTOR;
+    sdWriteBusy = false;
+    sdWriteOpen = false;
     sdMultiTransfer = false;
+    sdSuspended = false;
     extendedCapacity = false;
     uint8_t hcs = 0x01;
 
@@ -391,7 +879,12 @@ bool SD::init() {
     }
 
     // Step 4: Send ACMD41 repeatedly until the card exits idle state
+    uint32_t attempts = 0;
     do {
+        if (++attempts > ACMD41_RETRIES) {
+            return false; // card stays idle, dead or not a card
+        }
+
         make_empty_traffic();
 
         // Send CMD55 (APP_CMD) before ACMD41
@@ -406,6 +899,25 @@ bool SD::init() {
         cs_reset();
     } while (response != 0x00);
 
+    // card identification and speed, still at the slow clock as the card may not take full one
+    uint8_t cid[16];
+    uint8_t csd[16];
+    const bool identified = read_register(10, cid) && read_register(9, csd);
+    if (!identified || !std::equal(cid, cid + sizeof(cid), disk_profile.cid)) {
+        // another card, its read timing is loaded or measured once mounted
+        disk_profile = DPROFILE{};
+        disk_profile.stream = 1;
+        if (identified) {
+            std::copy(cid, cid + sizeof(cid), disk_profile.cid);
+        }
+    }
+    if (identified) {
+        disk_profile.clock_div = clock_divider(csd[3]);
+    }
+
+    // card left identification mode, the rest runs at full clock
+    SPI::set_fast_rate(disk_profile.clock_div);
+    SPI::speed_mode(true);
     make_empty_traffic();
 
     // Step 5: Send CMD58 (READ_OCR) to read OCR register
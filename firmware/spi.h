@@ -66,9 +66,17 @@ public:
     static void speed_mode(bool fast) {
         SPI1->CR1 &= ~SPI_CR1_BR_Msk; // clear baud rate
         if (!fast) {
-            // slow = fPCLK/256
-            SPI1->CR1 |= SPI_CR1_BR_2 | SPI_CR1_BR_1 | SPI_CR1_BR_0;
+            // slow = fPCLK/128, 375 kHz: card identification allows up to 400 kHz
+            SPI1->CR1 |= SPI_CR1_BR_2 | SPI_CR1_BR_1;
         }
+        else {
+            SPI1->CR1 |= fast_rate << SPI_CR1_BR_Pos;
+        }
+    }
+
+    // fast mode clock fPCLK / (2 << rate), 0 unless the card's CSD allows less
+    static void set_fast_rate(uint8_t rate) {
+        fast_rate = rate;
     }
 
     static void begin() {
@@ -82,11 +90,11 @@ public:
     static void dma_map() {
         SYSCFG->CFGR3 &= ~SYSCFG_CFGR3_DMA1_MAP_Msk; // unmap dma channel 1
         SYSCFG->CFGR3 |= SYSCFG_CFGR3_DMA1_MAP_0; // map channel 1 dma to spi tx signalling
-        DMA1_Channel1->CPAR = (uint32_t)&SPI1->DR; // connect dma to tx fifo
+        DMA1_Channel1->CPAR = (uint32_t)(uintptr_t)&SPI1->DR; // connect dma to tx fifo
 
         //SYSCFG->CFGR3 &= ~SYSCFG_CFGR3_DMA2_MAP_Msk; // unmap dma channel 2
         //SYSCFG->CFGR3 |= SYSCFG_CFGR3_DMA2_MAP_1; // map channel 2 dma to spi rx signalling
-        //DMA1_Channel2->CPAR = (uint32_t)&SPI1->DR; // connect dma to rx fifo
+        //DMA1_Channel2->CPAR = (uint32_t)(uintptr_t)&SPI1->DR; // connect dma to rx fifo
     }
 
     static void dma_begin() {
@@ -166,14 +174,14 @@ public:
         // channel 2 - fake rx
         DMA1_Channel2->CCR = 0;
         DMA1_Channel2->CNDTR = len;
-        DMA1_Channel2->CMAR = reinterpret_cast<uint32_t>(&DMADummy); // receive to dummy mem
+        DMA1_Channel2->CMAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&DMADummy)); // receive to dummy mem
 
         DMA1_Channel2->CCR = DMA_CCR_EN; // from periph, memory do not increment, transfer enabled
 
         // channel 1 - tx
         DMA1_Channel1->CCR = 0;
         DMA1_Channel1->CNDTR = len;
-        DMA1_Channel1->CMAR = reinterpret_cast<uint32_t>(memory);
+        DMA1_Channel1->CMAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(memory));
         DMA1_Channel1->CCR = DMA_CCR_DIR | DMA_CCR_EN | DMA_CCR_MINC; // from memory, memory increment, transfer enabled
 
         spi_wait_dma_end();
@@ -191,14 +199,14 @@ public:
         // channel 2 - rx
         DMA1_Channel2->CCR = 0;
         DMA1_Channel2->CNDTR = len;
-        DMA1_Channel2->CMAR = reinterpret_cast<uint32_t>(input); // receive to real memory
+        DMA1_Channel2->CMAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(input)); // receive to real memory
 
         DMA1_Channel2->CCR = DMA_CCR_EN | DMA_CCR_MINC; // from periph, memory increment, transfer enabled
 
         // channel 1 - placeholder tx
         DMA1_Channel1->CCR = 0;
         DMA1_Channel1->CNDTR = len;
-        DMA1_Channel1->CMAR = reinterpret_cast<uint32_t>(&DMADummy);
+        DMA1_Channel1->CMAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&DMADummy));
         DMA1_Channel1->CCR = DMA_CCR_DIR | DMA_CCR_EN; // from memory, memory not increment, transfer enabled
 
         spi_wait_dma_end();
@@ -217,14 +225,14 @@ public:
         /*
         DMA1_Channel2->CCR = 0;
         DMA1_Channel2->CNDTR = len;
-        DMA1_Channel2->CMAR = reinterpret_cast<uint32_t>(input); // receive to real memory
+        DMA1_Channel2->CMAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(input)); // receive to real memory
 
         DMA1_Channel2->CCR = DMA_CCR_EN; // from periph, memory NOT increment (don't care), transfer enabled
 */
         // channel 1 - placeholder tx
         DMA1_Channel1->CCR = 0;
         DMA1_Channel1->CNDTR = len;
-        DMA1_Channel1->CMAR = reinterpret_cast<uint32_t>(&DMADummy);
+        DMA1_Channel1->CMAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&DMADummy));
         DMA1_Channel1->CCR = DMA_CCR_DIR | DMA_CCR_EN; // from memory, memory not increment, transfer enabled
 
         spi_wait_dma_end();
@@ -236,6 +244,8 @@ public:
     }
 
 private:
+    static inline uint8_t fast_rate = 0;
+
     static void spi_wait_dma_end() {
         //while ((DMA1->ISR & (DMA_ISR_TCIF1 | DMA_ISR_TCIF2)) != (DMA_ISR_TCIF1 | DMA_ISR_TCIF2)) {
         //}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#include "trace.h"
+
+#if LOOTUNES_TRACE
+
+#include "file_record.h"
+
+#include <iterator>
+
+extern "C" {
+#include "py32f0xx.h"
+#include "py32f0xx_hal.h"
+}
+
+namespace Trace {
+
+namespace {
+    Record ring[RECORDS];
+    uint32_t head = 0;          // next record written
+    bool full = false;          // ring wrapped, oldest record is at head
+    uint32_t post_trigger = 0;  // records still taken after the underrun
+    bool underrun_armed = true;
+    volatile bool frozen = false;
+    Reason reason = Reason::Request;
+}
+
+void init() {
+    __HAL_RCC_TIM17_CLK_ENABLE();
+    TIM17->CR1 = 0;
+    TIM17->PSC = INPUT_FREQUENCY / 1000000 - 1;
+    TIM17->ARR = 0xffff;
+    TIM17->EGR = TIM_EGR_UG; // load prescaler
+    TIM17->SR = 0;           // UG flags an update too, UIF means wrapped from here on
+    TIM17->CR1 = TIM_CR1_CEN;
+}
+
+void record(Event event, uint8_t arg) {
+    // called by interrupt handlers too, and with interrupts already masked (decode)
+    const uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (!frozen) {
+        uint8_t id = static_cast<uint8_t>(event);
+        if (TIM17->SR & TIM_SR_UIF) {
+            TIM17->SR = 0;
+            id |= WRAPPED;
+        }
+        ring[head] = {static_cast<uint16_t>(TIM17->CNT), id, arg};
+
+        if (++head == RECORDS) {
+            head = 0;
+            full = true;
+        }
+        if (post_trigger && --post_trigger == 0) {
+            frozen = true;
+        }
+    }
+
+    __set_PRIMASK(primask);
+}
+
+void underrun(int32_t lateness) {
+    record(Event::Underrun, static_cast<uint8_t>(lateness > 0xff ? 0xff : lateness));
+
+    // later ones are likely a consequence of the first, it's not overwritten
+    if (underrun_armed) {
+        underrun_armed = false;
+        reason = Reason::Underrun;
+        post_trigger = RECORDS / 4;
+    }
+}
+
+void request_save() {
+    __disable_irq();
+    post_trigger = 0;
+    reason = Reason::Request;
+    frozen = true;
+    __enable_irq();
+}
+
+bool save_requested() {
+    return frozen;
+}
+
+bool save(const char* filename) {
+    bool written = false;
+
+    if (pf_open(filename) == FR_OK) {
+        const uint32_t oldest = full ? RECORDS - head : 0; // records from head to the end
+        const Header header = {
+            HEADER_MAGIC, HEADER_VERSION, static_cast<uint16_t>(oldest + head), reason,
+            static_cast<uint8_t>(Event::Count), 0
+        };
+
+        // oldest first, ring is split at head
+        const FileRecord::Part parts[] = {
+            {&header, sizeof(header)},
+            {&ring[head], static_cast<UINT>(oldest * sizeof(Record))},
+            {ring, static_cast<UINT>(head * sizeof(Record))},
+        };
+        written = FileRecord::write(0, parts, std::size(parts));
+    }
+
+    frozen = false;
+    return written;
+}
+
+} // namespace Trace
+
+#endif // LOOTUNES_TRACE
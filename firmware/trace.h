@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025 Przemysław Romaniak
+ *
+ * This source code is licensed under the MIT License.
+ * See the LICENSE file in the root directory for details.
+*/
+
+#pragma once
+
+#include "build_options.h"
+
+#include <cstdint>
+
+/*
+ * Event trace: ring of the last RECORDS events in RAM, each one stamped by
+ * TIM17 counting microseconds. On request (both buttons held) or after the
+ * first underrun since boot it's frozen and written to a file on the card,
+ * host/trace2json turns the file into a Chrome / Perfetto timeline.
+ *
+ * The counter is 16-bit, a record only tells if it wrapped since the
+ * previous one, so gaps over 65 ms (Stop mode, where it doesn't count
+ * either) show shorter than they were. DMA interrupts every buffer half keep
+ * gaps short while playing.
+ */
+namespace Trace {
+
+// RAM left by the player with the stack reserve, about 5 buffer halves of playback
+constexpr uint32_t RECORDS = 24;
+
+// event byte of a record, counter wrapped since the previous record
+constexpr uint8_t WRAPPED = 0x80;
+
+enum class Event : uint8_t {
+    DmaHalf,        // audio DMA entered second buffer half
+    DmaComplete,    // audio DMA wrapped to first half
+    DecodeStart,    // arg: output buffer position
+    DecodeEnd,
+    SdCommand,      // arg: command index
+    SdTokenWait,    // waiting for data token of a block
+    SdToken,        // arg: token, 0xFF when card didn't answer
+    StateSaveStart,
+    StateSaveEnd,
+    Button,         // arg: BTN::ID
+    Light,          // arg: reading / 16
+    Mode,           // arg: PlaybackState::Mode
+    PlayState,      // arg: controller playing state
+    StopEnter,
+    StopExit,
+    Underrun,       // arg: lateness in samples, 255 for more
+    Count
+};
+
+enum class Reason : uint8_t {
+    Request,        // button combination
+    Underrun,
+};
+
+struct Record {
+    uint16_t time;  // us, TIM17 counter
+    uint8_t event;  // Event, WRAPPED flag
+    uint8_t arg;
+};
+
+// Start of the file, records follow oldest first
+struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t records;
+    Reason reason;
+    uint8_t event_count;   // Event::Count of the firmware that wrote it
+    uint16_t reserved;
+};
+
+constexpr uint32_t HEADER_MAGIC = 0x45435254; // "TRCE"
+constexpr uint16_t HEADER_VERSION = 1;
+
+#if LOOTUNES_TRACE
+
+/**
+ * @brief Start the timestamp counter, recording starts with it
+ */
+void init();
+
+/**
+ * @brief Add an event, interrupt safe, ignored while trace waits to be saved
+ */
+void record(Event event, uint8_t arg = 0);
+
+/**
+ * @brief Deadline missed: recorded, first one since boot freezes the trace a
+ *        quarter of the ring later (what followed is kept too) to be saved
+ * @param lateness Samples played before the buffer half was complete
+ */
+void underrun(int32_t lateness);
+
+/**
+ * @brief Freeze the trace to be saved
+ */
+void request_save();
+
+/**
+ * @brief Trace is frozen, waiting for save()
+ */
+bool save_requested();
+
+/**
+ * @brief Write frozen trace to the file and resume recording
+ * @param filename File on the card, nothing is written without it (no file creation)
+ * @return true if written
+ */
+bool save(const char* filename);
+
+#else
+
+// left out of the build (LOOTUNES_TRACE), calls compile to nothing
+inline void init() {}
+inline void record(Event, uint8_t = 0) {}
+inline void underrun(int32_t) {}
+inline void request_save() {}
+inline bool save_requested() { return false; }
+inline bool save(const char*) { return false; }
+
+#endif
+
+} // namespace Trace
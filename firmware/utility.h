@@ -8,6 +8,20 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
+
+// bitwise CRC-32 (IEEE), table would cost 1 kB of flash
+inline uint32_t crc32(const void* data, uint32_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xffffffff;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
 
 template <typename T, std::size_t N, T Value>
 constexpr auto make_filled_array() {
@@ -16,12 +30,23 @@ constexpr auto make_filled_array() {
     return arr;
 }
 
+// Read error (disk layer recovery failed, see disk_recovery) reads nothing, like end of file
 inline __attribute__((always_inline)) UINT freadwrap(void* buff, UINT size) {
     UINT br;
     FRESULT res = pf_read_cached(buff, size, &br);
     if (res != FR_OK) {
-        // Handle read error
-        while(1) { };
+        return 0;
+    }
+
+    return br;
+}
+
+// Read within a sector without copying, see pf_read_direct
+inline __attribute__((always_inline)) UINT freaddirect(const void** ptr, UINT size) {
+    UINT br;
+    FRESULT res = pf_read_direct(ptr, size, &br);
+    if (res != FR_OK) {
+        return 0;
     }
 
     return br;